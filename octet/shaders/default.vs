@@ -4,9 +4,15 @@
 //
 
 // matrices
+// these change every draw, so glUniform is cheaper than updating an octet_draw block.
 uniform mat4 modelToProjection;
 uniform mat4 modelToCamera;
 
+// instanced draws set this and pass world to projection/camera matrices above.
+// each instance then brings its own model to world matrix.
+uniform bool instanced;
+attribute mat4 instanceToWorld;
+
 // attributes from vertex buffer
 attribute vec4 pos;
 attribute vec2 uv;
@@ -21,9 +27,15 @@ varying vec3 model_pos_;
 varying vec3 camera_pos_;
 
 void main() {
-  gl_Position = modelToProjection * pos;
-  vec3 tnormal = (modelToCamera * vec4(normal, 0.0)).xyz;
-  vec3 tpos = (modelToCamera * pos).xyz;
+  vec4 ipos = pos;
+  vec4 inormal = vec4(normal, 0.0);
+  if (instanced) {
+    ipos = instanceToWorld * pos;
+    inormal = instanceToWorld * inormal;
+  }
+  gl_Position = modelToProjection * ipos;
+  vec3 tnormal = (modelToCamera * inormal).xyz;
+  vec3 tpos = (modelToCamera * ipos).xyz;
   normal_ = tnormal;
   uv_ = uv;
   color_ = color;
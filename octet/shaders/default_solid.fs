@@ -4,9 +4,20 @@
 //
 
 // constant parameters
-uniform vec4 lighting[17];
-uniform int num_lights;
-uniform vec4 diffuse;
+#ifdef OCTET_UNIFORM_BLOCKS
+  layout(std140) uniform octet_frame {
+    vec4 lighting[17];
+    int num_lights;
+  };
+
+  layout(std140) uniform octet_material {
+    vec4 diffuse;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+  uniform vec4 diffuse;
+#endif
 
 // inputs
 varying vec2 uv_;
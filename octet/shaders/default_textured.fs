@@ -4,8 +4,16 @@
 //
 
 // constant parameters
-uniform vec4 lighting[17];
-uniform int num_lights;
+#ifdef OCTET_UNIFORM_BLOCKS
+  layout(std140) uniform octet_frame {
+    vec4 lighting[17];
+    int num_lights;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+#endif
+
 uniform sampler2D diffuse_sampler;
 
 // inputs
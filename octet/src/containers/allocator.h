@@ -6,7 +6,7 @@
 //
 // game-style memory allocator
 //
-// this is a placeholder for a game-style memory allocator
+// the default allocator sits on top of malloc and free.
 // using malloc and free is frowned upon in grown-up circles.
 //
 // these functions are poor for the following reasons:
@@ -14,6 +14,10 @@
 // 1) free() has to compute the size of the block to free
 // 2) these functions use heavy weight locks to guard the heap.
 // 3) implementations are quite variable
+//
+// so we also have pool_allocator (thread local size classes for small objects),
+// frame_allocator (a linear arena reset every frame) and tagged_allocator<>
+// which accounts for memory by subsystem. See pool_allocator.h and arena_allocator.h
 
 // this is a dummy class used to customise the placement new and delete
 struct dynarray_dummy_t {};
@@ -49,10 +53,33 @@ void operator delete(void *ptr, void *place, dynarray_dummy_t x) {}
 
 
 namespace octet { namespace containers {
-  class allocator {
-    // singleton state, a bit like an old-world global variable
+  /// Tags used to account for memory by subsystem.
+  ///
+  /// Each tagged_allocator<tag> reports its live and peak bytes to allocator_stats.
+  enum allocator_tag {
+    alloc_tag_default,    // anything using the plain allocator
+    alloc_tag_containers, // container storage chosen explicitly by the user
+    alloc_tag_resources,  // resource objects: scene nodes, mesh instances, materials...
+    alloc_tag_mesh,       // vertex and index data
+    alloc_tag_image,      // texture and decoder buffers
+    alloc_tag_loaders,    // temporary data used by file loaders
+    alloc_tag_frame,      // the per-frame arena
+    alloc_tag_max,
+  };
+
+  /// Live and peak byte counts for each allocator tag.
+  ///
+  /// Counters are atomic so that allocations can be made from any thread.
+  ///
+  /// Example:
+  ///
+  ///     printf("scene uses %d bytes\n", (int)allocator_stats::get_live_bytes(alloc_tag_resources));
+  ///     allocator_stats::dump();
+  class allocator_stats {
     struct state_t {
-      size_t num_bytes;
+      std::atomic<intptr_t> live_bytes[alloc_tag_max];
+      std::atomic<intptr_t> peak_bytes[alloc_tag_max];
+      std::atomic<intptr_t> num_allocs[alloc_tag_max];
     };
 
     static state_t &state() {
@@ -61,9 +88,94 @@ namespace octet { namespace containers {
     }
 
   public:
-    // todo: implement this from scratch using a pool allocator
+    /// Account for an allocation (size > 0) or a free (size < 0).
+    static void add(allocator_tag tag, intptr_t size) {
+      state_t &s = state();
+      intptr_t live = s.live_bytes[tag].fetch_add(size, std::memory_order_relaxed) + size;
+      if (size > 0) {
+        s.num_allocs[tag].fetch_add(1, std::memory_order_relaxed);
+        intptr_t peak = s.peak_bytes[tag].load(std::memory_order_relaxed);
+        while (live > peak && !s.peak_bytes[tag].compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+      }
+    }
+
+    /// Number of bytes currently allocated with this tag.
+    static intptr_t get_live_bytes(allocator_tag tag) {
+      return state().live_bytes[tag].load(std::memory_order_relaxed);
+    }
+
+    /// Largest number of bytes allocated at once with this tag.
+    static intptr_t get_peak_bytes(allocator_tag tag) {
+      return state().peak_bytes[tag].load(std::memory_order_relaxed);
+    }
+
+    /// Number of allocations (not frees) made with this tag.
+    static intptr_t get_num_allocs(allocator_tag tag) {
+      return state().num_allocs[tag].load(std::memory_order_relaxed);
+    }
+
+    /// Forget the peak values, eg. at the start of a level load.
+    static void reset_peaks() {
+      state_t &s = state();
+      for (int i = 0; i != alloc_tag_max; ++i) {
+        s.peak_bytes[i].store(s.live_bytes[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+    }
+
+    /// Name of a tag for reports.
+    static const char *get_tag_name(allocator_tag tag) {
+      static const char *names[] = {
+        "default", "containers", "resources", "mesh", "image", "loaders", "frame",
+      };
+      return (unsigned)tag < alloc_tag_max ? names[tag] : "???";
+    }
+
+    /// Print live and peak bytes for every tag.
+    static void dump(FILE *file = stdout) {
+      fprintf(file, "%-12s %12s %12s %10s\n", "tag", "live", "peak", "allocs");
+      for (int i = 0; i != alloc_tag_max; ++i) {
+        allocator_tag tag = (allocator_tag)i;
+        fprintf(
+          file, "%-12s %12lld %12lld %10lld\n", get_tag_name(tag),
+          (long long)get_live_bytes(tag), (long long)get_peak_bytes(tag), (long long)get_num_allocs(tag)
+        );
+      }
+    }
+  };
+
+  /// The default allocator; a thin layer on top of the system heap.
+  ///
+  /// All allocators used as allocator_t parameters provide the same three static functions:
+  /// malloc(size), free(ptr, size) and realloc(ptr, old_size, size).
+  /// Unlike the C library, free() is told the size of the block.
+  class allocator {
+  public:
+    /// Allocate 16 byte aligned memory from the system heap.
     static void *malloc(size_t size) {
-      state().num_bytes += size;
+      allocator_stats::add(alloc_tag_default, (intptr_t)size);
+      return sys_malloc(size);
+    }
+
+    /// Free memory allocated with malloc or realloc.
+    static void free(void *ptr, size_t size) {
+      allocator_stats::add(alloc_tag_default, -(intptr_t)size);
+      sys_free(ptr);
+    }
+
+    /// Resize a block of memory, copying the contents.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      allocator_stats::add(alloc_tag_default, (intptr_t)size - (intptr_t)old_size);
+      return sys_realloc(ptr, size);
+    }
+
+    /// Total bytes allocated through the default allocator.
+    static size_t get_num_bytes() {
+      return (size_t)allocator_stats::get_live_bytes(alloc_tag_default);
+    }
+
+    /// System heap allocation without accounting; used by the other allocators.
+    static void *sys_malloc(size_t size) {
       #if OCTET_MAC
         void *res = 0;
         posix_memalign(&res, 16, size);
@@ -74,13 +186,24 @@ namespace octet { namespace containers {
       #else
         void *res = ::malloc(size);
       #endif
-      //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
       return res;
     }
 
-    static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
-      //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
+    /// System heap allocation aligned to a power of two, eg. for pool chunks. Never freed.
+    static void *sys_aligned_malloc(size_t size, size_t alignment) {
+      #if defined(WIN32)
+        void *res = ::_aligned_malloc(size, alignment);
+      #elif OCTET_VITA
+        void *res = ::memalign(alignment, size);
+      #else
+        void *res = 0;
+        if (posix_memalign(&res, alignment, size)) res = 0;
+      #endif
+      return res;
+    }
+
+    /// System heap free without accounting.
+    static void sys_free(void *ptr) {
       #if OCTET_MAC
         return ::free(ptr);
       #elif OCTET_SSE
@@ -90,17 +213,15 @@ namespace octet { namespace containers {
       #endif
     }
 
-    static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
+    /// System heap realloc without accounting.
+    static void *sys_realloc(void *ptr, size_t size) {
       #if OCTET_MAC
-        void *res = ::realloc(ptr, size);
+        return ::realloc(ptr, size);
       #elif OCTET_SSE
-        void *res = ::_aligned_realloc(ptr, size, 16);
+        return ::_aligned_realloc(ptr, size, 16);
       #else
-        void *res = ::realloc(ptr, size);
+        return ::realloc(ptr, size);
       #endif
-      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
-      return res;
     }
 
     // crude check of stack integrity
@@ -111,4 +232,3 @@ namespace octet { namespace containers {
     }
   };
 } }
-
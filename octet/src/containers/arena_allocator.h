@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// linear arena allocator
+//
+// allocation is a pointer bump, freeing is done all at once with reset().
+//
+
+namespace octet { namespace containers {
+  /// A linear arena. Memory is handed out in order and released in one go.
+  ///
+  /// Example:
+  ///
+  ///     arena my_arena;
+  ///     char *tmp = (char*)my_arena.alloc(100);
+  ///     ...
+  ///     my_arena.reset(); // all allocations are now invalid.
+  class arena {
+    // blocks are kept in a singly linked list, newest first.
+    struct block_t {
+      block_t *next;
+      size_t size;
+    };
+
+    enum {
+      header_size = (sizeof(block_t) + 15) & ~15,
+      max_block_size = 0x10000,
+    };
+
+    block_t *blocks;
+    uint8_t *cur;
+    uint8_t *end;
+    size_t block_size;
+    size_t bytes_used;
+    size_t capacity;
+
+    void new_block(size_t min_size) {
+      size_t size = min_size > block_size ? min_size : block_size;
+
+      // small arenas grow geometrically, so that a little dictionary does not cost 64k
+      if (block_size < max_block_size) block_size *= 2;
+
+      block_t *block = (block_t*)allocator::sys_malloc(header_size + size);
+      block->next = blocks;
+      block->size = size;
+      blocks = block;
+      cur = (uint8_t*)block + header_size;
+      end = cur + size;
+      capacity += size;
+    }
+
+    void free_blocks() {
+      while (blocks) {
+        block_t *next = blocks->next;
+        allocator::sys_free(blocks);
+        blocks = next;
+      }
+      cur = end = 0;
+      capacity = 0;
+    }
+
+    // arenas own memory, so no copying
+    arena(const arena &rhs);
+    arena &operator=(const arena &rhs);
+  public:
+    /// Make an empty arena. No memory is allocated until the first alloc().
+    arena(size_t block_size = 0x10000) {
+      blocks = 0;
+      cur = end = 0;
+      this->block_size = block_size;
+      bytes_used = 0;
+      capacity = 0;
+    }
+
+    /// Free all the blocks.
+    ~arena() {
+      free_blocks();
+    }
+
+    /// Allocate some bytes. align must be a power of two.
+    void *alloc(size_t size, size_t align = 16) {
+      uint8_t *ptr = (uint8_t*)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+      if (!blocks || ptr + size > end) {
+        new_block(size + align);
+        ptr = (uint8_t*)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+      }
+      bytes_used += size + (ptr - cur);
+      cur = ptr + size;
+      return ptr;
+    }
+
+    /// Resize the most recent allocation in place if we can, otherwise copy it.
+    void *realloc(void *ptr, size_t old_size, size_t size) {
+      if (ptr && (uint8_t*)ptr + old_size == cur && (uint8_t*)ptr + size <= end) {
+        bytes_used += size - old_size;
+        cur = (uint8_t*)ptr + size;
+        return ptr;
+      }
+      void *res = alloc(size);
+      if (ptr) memcpy(res, ptr, old_size < size ? old_size : size);
+      return res;
+    }
+
+    /// Make a copy of a block of text in the arena, with a zero terminator.
+    const char *copy_string(const char *str, size_t len) {
+      char *res = (char*)alloc(len + 1, 1);
+      memcpy(res, str, len);
+      res[len] = 0;
+      return res;
+    }
+
+    /// Free everything at once.
+    ///
+    /// If we needed more than one block, merge them so that the next round fits in one.
+    void reset() {
+      if (blocks && blocks->next) {
+        size_t total = capacity;
+        free_blocks();
+        new_block(total);
+      } else if (blocks) {
+        cur = (uint8_t*)blocks + header_size;
+      }
+      bytes_used = 0;
+    }
+
+    /// Free all the memory used by the arena.
+    void release() {
+      free_blocks();
+      bytes_used = 0;
+    }
+
+    /// Number of bytes allocated since the last reset.
+    size_t get_bytes_used() const {
+      return bytes_used;
+    }
+
+    /// Number of bytes taken from the system.
+    size_t get_capacity() const {
+      return capacity;
+    }
+  };
+
+  /// Per-frame scratch allocator.
+  ///
+  /// Memory from this allocator lives until the end of the current frame,
+  /// the app calls frame_allocator::reset() in end_frame().
+  /// free() does nothing, so this is ideal for temporary arrays built during rendering.
+  ///
+  /// Use on the main thread only.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<mesh_instance*, frame_allocator> visible;
+  class frame_allocator {
+  public:
+    /// The arena used for this frame.
+    static arena &get_arena() {
+      static arena instance(0x40000);
+      return instance;
+    }
+
+    /// Allocate memory that lasts until the end of the frame.
+    static void *malloc(size_t size) {
+      allocator_stats::add(alloc_tag_frame, (intptr_t)size);
+      return get_arena().alloc(size);
+    }
+
+    /// Does nothing; memory is recovered by reset()
+    static void free(void *, size_t) {
+    }
+
+    /// Grow a block; this is cheap for the last block allocated.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      allocator_stats::add(alloc_tag_frame, (intptr_t)size - (intptr_t)old_size);
+      return get_arena().realloc(ptr, old_size, size);
+    }
+
+    /// Free all the memory allocated this frame.
+    static void reset() {
+      allocator_stats::add(alloc_tag_frame, -allocator_stats::get_live_bytes(alloc_tag_frame));
+      get_arena().reset();
+    }
+  };
+} }
@@ -26,12 +26,17 @@
 #define OCTET_CONTAINERS_INCLUDED
 
 #include "../containers/allocator.h"
+#include "../containers/pool_allocator.h"
+#include "../containers/arena_allocator.h"
+#include "../containers/hash_functions.h"
+#include "../containers/string_view.h"
 #include "../containers/dictionary.h"
 #include "../containers/hash_map.h"
 #include "../containers/double_list.h"
 #include "../containers/dynarray.h"
 #include "../containers/string.h"
 #include "../containers/ref.h"
+#include "../containers/release_queue.h"
 #include "../containers/bitset.h"
 
 namespace octet {
@@ -20,49 +20,62 @@ namespace octet { namespace containers {
   ///
   ///     int annes_age = my_dict["anne"];
   ///
+  /// Keys are copied once into an arena owned by the dictionary, along with their hash and length.
+  /// Lookups take a string_view, so parts of larger strings can be looked up without copying them.
+  /// If you look up the same name often, compute the hash once with calc_hash():
+  ///
+  ///     unsigned hash = dictionary<int>::calc_hash("anne");
+  ///     int annes_age = my_dict.get("anne", hash);
+  ///
+  /// Key text stays put until reset(), so get_key() pointers remain valid after erase() and growth.
   template <class value_t, class allocator_t=allocator> class dictionary {
-    struct entry_t { const char *key; unsigned hash; value_t value; };
+    struct entry_t { const char *key; unsigned hash; unsigned length; value_t value; };
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
-  
-    // hash is a compromise between fewer collisions and
-    // faster hash calculation.
-    unsigned calc_hash( const char *key ) {
-      unsigned hash = 0;
-      for (int i = 0; key[i]; ++i) {
-        hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
-      }
-      return hash;
-    }
-  
-    // internal method to find an entry for a key
-    entry_t *find( const char *key, unsigned hash ) {
+
+    // zero terminated copies of the keys.
+    arena keys;
+
+    // internal method to find an entry for a key, or the empty entry where it should go.
+    entry_t *find(string_view key, unsigned hash) const {
       unsigned mask = max_entries - 1;
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
+      for (unsigned i = hash & mask; ; i = (i + 1) & mask) {
+        entry_t *entry = &entries[i];
         if (!entry->key) {
           return entry;
         }
-        if (entry->hash == hash && !strcmp(entry->key, key)) {
+        if (entry->hash == hash && entry->length == key.size() && !memcmp(entry->key, key.data(), key.size())) {
           return entry;
         }
       }
-      return 0;
     }
-  
+
+    // find an empty entry for a key that is not in the dictionary.
+    entry_t *find_empty(unsigned hash) const {
+      unsigned mask = max_entries - 1;
+      for (unsigned i = hash & mask; ; i = (i + 1) & mask) {
+        if (!entries[i].key) {
+          return &entries[i];
+        }
+      }
+    }
+
     // grow the dictionary when needed
     void expand() {
       entry_t *old_entries = entries;
       unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
       max_entries *= 2;
+      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries);
+      memset(entries, 0, sizeof(entry_t) * max_entries);
+
+      dynarray_dummy_t x;
       for (unsigned i = 0; i != old_max_entries; ++i) {
         entry_t *old_entry = &old_entries[i];
         if (old_entry->key) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+          entry_t *new_entry = find_empty(old_entry->hash);
+          new (new_entry, x) entry_t(*old_entry);
+          old_entry->~entry_t();
         }
       }
       allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
@@ -71,11 +84,12 @@ namespace octet { namespace containers {
     void release() {
       for (unsigned i = 0; i != max_entries; ++i) {
         entry_t *entry = &entries[i];
-        if (entry->key ) {
-          allocator_t::free((void*)entry->key, strlen(entry->key)+1);
+        if (entry->key) {
+          entry->~entry_t();
         }
       }
       allocator_t::free(entries, sizeof(entry_t) * max_entries);
+      keys.release();
       entries = 0;
       num_entries = 0;
       max_entries = 0;
@@ -87,39 +101,123 @@ namespace octet { namespace containers {
       entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
       memset(entries, 0, sizeof(entry_t) * max_entries);
     }
+
+    void copy(const dictionary &rhs) {
+      init();
+      for (unsigned i = 0; i != rhs.max_entries; ++i) {
+        const entry_t *entry = &rhs.entries[i];
+        if (entry->key) {
+          get(string_view(entry->key, entry->length), entry->hash) = entry->value;
+        }
+      }
+    }
   public:
     /// make a new dictionary
-    dictionary() {
+    dictionary() : keys(256) {
       init();
     }
 
-    /// Access an element by name.
+    /// copy a dictionary
+    dictionary(const dictionary &rhs) : keys(256) {
+      copy(rhs);
+    }
+
+    /// replace the contents with a copy of another dictionary
+    dictionary &operator=(const dictionary &rhs) {
+      if (this != &rhs) {
+        release();
+        copy(rhs);
+      }
+      return *this;
+    }
+
+    /// The hash used for keys. Use this with get(), get_index(), contains() and erase()
+    /// to avoid hashing the same name many times.
+    static unsigned calc_hash(string_view key) {
+      return hash_bytes(key.data(), key.size());
+    }
+
+    /// Access an element by name and precomputed hash.
     /// This will create a new element if one does not exist.
-    /// For more detail, use get_index(), get_key() and get_value()
-    value_t &operator[]( const char *key ) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      if (!entry || !entry->key) {
+    value_t &get(string_view key, unsigned hash) {
+      entry_t *entry = find(key, hash);
+      if (!entry->key) {
         // reducing this ratio decreases hot search time at the
         // expense of size (cold search time).
-        if (num_entries > max_entries * 3 / 4) {
+        if (num_entries >= max_entries * 3 / 4) {
           expand();
-          entry = find(key, hash);
+          entry = find_empty(hash);
         }
         num_entries++;
-        size_t bytes = strlen(key) + 1;
-        entry->key = (char *)allocator_t::malloc(bytes);
+        dynarray_dummy_t x;
+        new (&entry->value, x) value_t();
+        entry->key = keys.copy_string(key.data(), key.size());
         entry->hash = hash;
-        memcpy((void*)entry->key, key, bytes);
+        entry->length = key.size();
       }
       return entry->value;
     }
 
+    /// Access an element by name.
+    /// This will create a new element if one does not exist.
+    /// For more detail, use get_index(), get_key() and get_value()
+    value_t &operator[](string_view key) {
+      return get(key, calc_hash(key));
+    }
+
+    /// Access an element by name.
+    value_t &operator[](const char *key) {
+      return (*this)[string_view(key)];
+    }
+
+    /// Return true if the dictionary contains key.
+    bool contains(string_view key, unsigned hash) const {
+      return find(key, hash)->key != 0;
+    }
+
+    /// Return true if the dictionary contains key.
+    bool contains(string_view key) const {
+      return contains(key, calc_hash(key));
+    }
+
     /// Return true if the dictionary contains key.
-    bool contains(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      return entry && entry->key;
+    bool contains(const char *key) const {
+      return contains(string_view(key));
+    }
+
+    /// Remove a key and its value. Returns false if the key was not there.
+    bool erase(string_view key, unsigned hash) {
+      entry_t *entry = find(key, hash);
+      if (!entry->key) {
+        return false;
+      }
+
+      // shift later entries in the same run back to fill the hole.
+      unsigned mask = max_entries - 1;
+      unsigned hole = (unsigned)(entry - entries);
+      entry->~entry_t();
+      dynarray_dummy_t x;
+      for (unsigned next = (hole + 1) & mask; entries[next].key; next = (next + 1) & mask) {
+        unsigned home = entries[next].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+          new (&entries[hole], x) entry_t(entries[next]);
+          entries[next].~entry_t();
+          hole = next;
+        }
+      }
+      memset((void*)&entries[hole], 0, sizeof(entry_t));
+      num_entries--;
+      return true;
+    }
+
+    /// Remove a key and its value. Returns false if the key was not there.
+    bool erase(string_view key) {
+      return erase(key, calc_hash(key));
+    }
+
+    /// Remove a key and its value. Returns false if the key was not there.
+    bool erase(const char *key) {
+      return erase(string_view(key));
     }
 
     /// Return the number of entries stored in the dictionary.
@@ -132,23 +230,45 @@ namespace octet { namespace containers {
       return max_entries;
     }
 
-    /// When iterating, get the key for a certain index. Index can also be found by get_index()
+    /// When iterating, get the key for a certain index, or NULL if the index is not used.
+    /// Index can also be found by get_index()
     const char *get_key(unsigned index) const {
       assert(index < max_entries);
       return entries[index].key;
     }
 
+    /// Length of the key at this index.
+    unsigned get_key_length(unsigned index) const {
+      assert(index < max_entries);
+      return entries[index].length;
+    }
+
     /// When iterating, access a specified value.
     value_t &get_value(unsigned index) {
       assert(index < max_entries);
       return entries[index].value;
     }
 
+    /// When iterating, read a specified value.
+    const value_t &get_value(unsigned index) const {
+      assert(index < max_entries);
+      return entries[index].value;
+    }
+
+    /// Get the index for a certain key and precomputed hash, or -1 if the key is not found.
+    int get_index(string_view key, unsigned hash) const {
+      entry_t *entry = find(key, hash);
+      return entry->key ? (int)(entry - entries) : -1;
+    }
+
     /// Get the index for a certain key, or -1 if the key is not found.
-    int get_index(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      return entry && entry->key ? (int)(entry - entries) : -1;
+    int get_index(string_view key) const {
+      return get_index(key, calc_hash(key));
+    }
+
+    /// Get the index for a certain key, or -1 if the key is not found.
+    int get_index(const char *key) const {
+      return get_index(string_view(key));
     }
 
     /// Reset the dictionary to empty and free up the resources.
@@ -159,7 +279,7 @@ namespace octet { namespace containers {
   
     /// Bye bye dictionary. Use the allocator to free up memory.
     ~dictionary() {
-      reset();
+      release();
     }
   };
 } }
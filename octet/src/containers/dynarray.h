@@ -7,6 +7,20 @@
 
 
 namespace octet { namespace containers {
+  /// Type trait: true if an object can be moved to a new address with memcpy,
+  /// leaving nothing behind to destroy.
+  ///
+  /// This is true of plain types and of most of our classes (strings, refs, arrays)
+  /// which do not point into themselves. dynarray uses it to grow with realloc
+  /// and to insert and erase with memmove.
+  ///
+  /// Example
+  ///
+  ///     template <> struct is_trivially_relocatable<my_class> { enum { value = true }; };
+  template <class item_t> struct is_trivially_relocatable {
+    enum { value = std::is_trivially_copyable<item_t>::value };
+  };
+
   /// Dynamic array class similar to std::vector.
   ///
   /// Example
@@ -26,13 +40,56 @@ namespace octet { namespace containers {
   ///     dynarray<ref<mesh> > meshes; // ok. managed pointers to meshes.
   template <class item_t, class allocator_t=allocator, bool use_new_delete=true> class dynarray {
     item_t *data_;
-    typedef unsigned int_size_t;
+    typedef size_t int_size_t;
 
-    // note we don't use size_t for these as we don't expect to use arrays > 4G and we care about performance!
+    // sizes are 64 bit on 64 bit platforms so that we can hold very large vertex buffers.
     int_size_t size_;
     int_size_t capacity_;
     enum { min_capacity = 8 };
 
+    // items that can be moved with memcpy. If use_new_delete is false, we never construct.
+    enum { relocatable = !use_new_delete || is_trivially_relocatable<item_t>::value };
+
+    // move n items from src to uninitialized memory at dest.
+    static void relocate(item_t *dest, item_t *src, int_size_t n) {
+      if (relocatable) {
+        if (n) memcpy((void*)dest, (void*)src, n * sizeof(item_t));
+      } else {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != n; ++i) {
+          new (dest + i, x) item_t(std::move(src[i]));
+          src[i].~item_t();
+        }
+      }
+    }
+
+    // make the array big enough for one more item.
+    void grow() {
+      // growing array by 1: round up to power of two.
+      reserve(capacity_ == 0 ? (int_size_t)min_capacity : capacity_ * 2);
+    }
+
+    // return true if this item is stored in the array.
+    bool contains_ptr(const item_t *item) const {
+      return item >= data_ && item < data_ + size_;
+    }
+
+    // open an uninitialized gap at elem, moving the subsequent items up.
+    void open_gap(int_size_t elem) {
+      if (size_ == capacity_) grow();
+      if (relocatable) {
+        memmove((void*)(data_ + elem + 1), (void*)(data_ + elem), (size_ - elem) * sizeof(item_t));
+      } else if (elem != size_) {
+        dynarray_dummy_t x;
+        new (data_ + size_, x) item_t(std::move(data_[size_-1]));
+        for (int_size_t i = size_ - 1; i != elem; --i) {
+          data_[i] = std::move(data_[i-1]);
+        }
+        data_[elem].~item_t();
+      }
+      size_++;
+    }
+
   public:
     /// Create a new, empty, dynamic array
     dynarray() {
@@ -43,7 +100,7 @@ namespace octet { namespace containers {
 
     /// Create a new dynamic array of a certain size.
     dynarray(int_size_t size) {
-      data_ = (item_t*)allocator::malloc(size * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(size * sizeof(item_t));
       size_ = capacity_ = size;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -57,7 +114,7 @@ namespace octet { namespace containers {
     ///
     /// Note: this is very slow and will happen frequently in naive code.
     dynarray(const dynarray &rhs) {
-      data_ = (item_t*)allocator::malloc(rhs.size_ * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(rhs.size_ * sizeof(item_t));
       size_ = capacity_ = rhs.size_;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -69,11 +126,46 @@ namespace octet { namespace containers {
       }
     }
 
+    /// Take the contents of another array. This is very fast.
+    dynarray(dynarray &&rhs) {
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+      capacity_ = rhs.capacity_;
+      rhs.data_ = 0;
+      rhs.size_ = 0;
+      rhs.capacity_ = 0;
+    }
+
+    /// Copy another array.
+    dynarray &operator=(const dynarray &rhs) {
+      if (this != &rhs) {
+        dynarray tmp(rhs);
+        swap(tmp);
+      }
+      return *this;
+    }
+
+    /// Take the contents of another array.
+    dynarray &operator=(dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        swap(rhs);
+      }
+      return *this;
+    }
+
     /// Destroy the array and its contents.
     ~dynarray() {
       reset();
     }
 
+    /// Exchange the contents of two arrays.
+    void swap(dynarray &rhs) {
+      item_t *data = data_; data_ = rhs.data_; rhs.data_ = data;
+      int_size_t size = size_; size_ = rhs.size_; rhs.size_ = size;
+      int_size_t capacity = capacity_; capacity_ = rhs.capacity_; rhs.capacity_ = capacity;
+    }
+
     /// iterator class for use with this dynamic array.
     ///
     /// Note: this is for STL compatibility. We recommend that you use code like this instead:
@@ -86,7 +178,7 @@ namespace octet { namespace containers {
       dynarray *vec;
       friend class dynarray;
     public:
-      iterator(dynarray *vec_, int_size_t elem_) : vec(vec_), elem(elem_) {}
+      iterator(dynarray *vec_, int_size_t elem_) : elem(elem_), vec(vec_) {}
       item_t *operator ->() { return &(*vec)[elem]; }
       item_t &operator *() { return (*vec)[elem]; }
       bool operator != (const iterator &rhs) const { return elem != rhs.elem; }
@@ -108,37 +200,109 @@ namespace octet { namespace containers {
   
     /// iterator insert for STL compatibility
     iterator insert(iterator it, const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      for (int_size_t i = old_length; i != it.elem; --i) {
-        data_[i] = data_[i-1];
+      if (contains_ptr(&new_item)) {
+        item_t tmp(new_item);
+        return insert(it, std::move(tmp));
       }
-      data_[it.elem] = new_item;
+      open_gap(it.elem);
+      dynarray_dummy_t x;
+      new (data_ + it.elem, x) item_t(new_item);
+      return it;
+    }
+
+    /// iterator insert for STL compatibility
+    iterator insert(iterator it, item_t &&new_item) {
+      open_gap(it.elem);
+      dynarray_dummy_t x;
+      new (data_ + it.elem, x) item_t(std::move(new_item));
       return it;
     }
 
     /// iterator erase for STL compatibility
     iterator erase(iterator it) {
-      for (int_size_t i = it.elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
-      }
-      resize(size_-1);
+      erase(it.elem);
       return it;
     }
   
     /// Erase an item; move subsequent items down to fill the gap.
-    void erase(unsigned elem) {
-      for (int_size_t i = elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+    void erase(int_size_t elem) {
+      if (relocatable) {
+        if (use_new_delete) data_[elem].~item_t();
+        memmove((void*)(data_ + elem), (void*)(data_ + elem + 1), (size_ - elem - 1) * sizeof(item_t));
+        size_--;
+      } else {
+        for (int_size_t i = elem; i < size_-1; ++i) {
+          data_[i] = std::move(data_[i+1]);
+        }
+        pop_back();
+      }
+    }
+
+    /// Erase an item by moving the last item into its place.
+    ///
+    /// This is much faster than erase() but changes the order of the items.
+    void erase_unordered(int_size_t elem) {
+      if (elem != size_ - 1) {
+        data_[elem] = std::move(data_[size_ - 1]);
       }
-      resize(size_-1);
+      pop_back();
     }
 
     /// Add an item at the back of the array.
     void push_back(const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      data_[old_length] = new_item;
+      if (size_ == capacity_) {
+        if (contains_ptr(&new_item)) {
+          // the item will move when we grow.
+          item_t tmp(new_item);
+          grow();
+          dynarray_dummy_t x;
+          new (data_ + size_, x) item_t(std::move(tmp));
+          size_++;
+          return;
+        }
+        grow();
+      }
+      dynarray_dummy_t x;
+      new (data_ + size_, x) item_t(new_item);
+      size_++;
+    }
+
+    /// Add an item at the back of the array, taking its contents.
+    void push_back(item_t &&new_item) {
+      if (size_ == capacity_) {
+        if (contains_ptr(&new_item)) {
+          item_t tmp(std::move(new_item));
+          grow();
+          dynarray_dummy_t x;
+          new (data_ + size_, x) item_t(std::move(tmp));
+          size_++;
+          return;
+        }
+        grow();
+      }
+      dynarray_dummy_t x;
+      new (data_ + size_, x) item_t(std::move(new_item));
+      size_++;
+    }
+
+    /// Construct an item at the back of the array from some constructor arguments.
+    ///
+    /// Example
+    ///
+    ///     dynarray<vec3> points;
+    ///     points.emplace_back(1.0f, 2.0f, 3.0f);
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      if (size_ == capacity_) {
+        // the arguments may refer to items in the array, so construct first.
+        item_t tmp(std::forward<args_t>(args)...);
+        grow();
+        dynarray_dummy_t x;
+        new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        dynarray_dummy_t x;
+        new (data_ + size_, x) item_t(std::forward<args_t>(args)...);
+      }
+      return data_[size_++];
     }
 
     /// Get the last element in the array.
@@ -172,75 +336,50 @@ namespace octet { namespace containers {
   
     /// Resize the array to make it bigger or smaller.
     void resize(size_t new_length) {
-      bool trace = false; // hack this for detailed traces
       dynarray_dummy_t x;
-      if (new_length >= size_ && new_length <= capacity_) {
-        if (trace) printf("case 1: growing dynarray up to capacity_\n");
-        if (use_new_delete) {
-          int_size_t len = size_; // avoid aliases
-          while (len < new_length) {
-            new (data_ + len, x)item_t;
-            ++len;
-          }
-        }
-        size_ = (int_size_t)new_length;
-      } else if (new_length > capacity_) {
-        if (trace) printf("case 2: growing dynarray beyond capacity_\n");
-        int_size_t new_capacity = ((int_size_t)new_length < size_ ? size_ : (int_size_t)new_length);
+      if (new_length > capacity_) {
+        int_size_t new_capacity = (int_size_t)new_length;
 
         if (new_length == size_ + 1) {
           // growing array by 1: round up to power of two.
-          new_capacity = capacity_ == 0 ? min_capacity : capacity_ * 2;
+          new_capacity = capacity_ == 0 ? (int_size_t)min_capacity : capacity_ * 2;
           while (new_capacity < new_length) new_capacity *= 2;
         }
 
         reserve(new_capacity);
+      }
 
-        if (use_new_delete) {
+      if (use_new_delete) {
+        int_size_t len = size_; // avoid aliases
+        while (len < new_length) {
           // initialize the rest to default
-          for (int_size_t i = size_; i < new_length; ++i) {
-            new (data_ + i, x) item_t;
-          }
+          new (data_ + len, x) item_t;
+          ++len;
         }
-
-        size_ = (int_size_t)new_length;
-      } else {
-        if (trace) printf("case 3: shrinking dynarray\n");
-
-        if (use_new_delete) {
-          int_size_t len = size_; // avoid aliases
-          while (len > new_length) {
-            --len;
-            data_[len].~item_t();
-          }
+        while (len > new_length) {
+          --len;
+          data_[len].~item_t();
         }
-        size_ = (int_size_t)new_length;
-        //if (size_ == 0) reset();
       }
+      size_ = (int_size_t)new_length;
     }
 
     /// Reserve an amount of memory to use with this array.
     /// Use this before you start a loop with push_back calls, for example.
+    ///
+    /// Items are moved, not copied, to the new memory.
     void reserve(int_size_t new_capacity) {
-      if (new_capacity >= size_) {
-        dynarray_dummy_t x;
-        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
-      
-        if (use_new_delete) {
-          // initialize new data_ elements from old ones
-          for (int_size_t i = 0; i != size_; ++i) {
-            new (new_data + i, x) item_t(data_[i]);
-            data_[i].~item_t();
-          }
-        }
-
-        // free up data_
-        if (data_) {
-          allocator_t::free(data_, capacity_ * sizeof(item_t));
-        }
+      if (new_capacity > capacity_) {
+        set_capacity(new_capacity);
+      }
+    }
 
-        data_ = new_data;
-        capacity_ = new_capacity;
+    /// Free any memory we are not using.
+    void shrink_to_fit() {
+      if (size_ == 0) {
+        reset();
+      } else if (size_ != capacity_) {
+        set_capacity(size_);
       }
     }
 
@@ -248,6 +387,9 @@ namespace octet { namespace containers {
     void pop_back() {
       assert(size_ != 0);
       size_--;
+      if (use_new_delete) {
+        data_[size_].~item_t();
+      }
     }
 
     /// Reset the array to zero size, freeing up the data.
@@ -265,10 +407,35 @@ namespace octet { namespace containers {
       size_ = 0;
       capacity_ = 0;
     }
+
+  private:
+    // move the items to a block of a new size, new_capacity >= size_.
+    void set_capacity(int_size_t new_capacity) {
+      if (relocatable && data_) {
+        // relocatable items can move with realloc, which may not have to copy.
+        data_ = (item_t *)allocator_t::realloc(data_, capacity_ * sizeof(item_t), new_capacity * sizeof(item_t));
+      } else {
+        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+        relocate(new_data, data_, size_);
+
+        // free up data_
+        if (data_) {
+          allocator_t::free(data_, capacity_ * sizeof(item_t));
+        }
+        data_ = new_data;
+      }
+      capacity_ = new_capacity;
+    }
+  };
+
+  /// arrays only hold a pointer to their data, so they can be moved with memcpy.
+  template <class item_t, class allocator_t, bool use_new_delete>
+  struct is_trivially_relocatable<dynarray<item_t, allocator_t, use_new_delete> > {
+    enum { value = true };
   };
 
   inline void vformat(dynarray <char> &ary, const char *fmt, va_list v) {
-    unsigned old_size = ary.size();
+    size_t old_size = ary.size();
     #ifdef WIN32
       int len = _vscprintf(fmt, v);
       if (len) {
@@ -281,17 +448,16 @@ namespace octet { namespace containers {
         }
       }
     #else
-      char tmp[1024];
-      size_t len = vsnprintf(tmp, sizeof(tmp)-1, fmt, v);
-      if (len) {
-        if (old_size) {
-          ary.resize((int)(old_size + len));
-          strcpy(&ary[old_size-1], tmp);
-        } else {
-          ary.resize((int)len + 1);
-          strcpy(&ary[0], tmp);
-        }
+      // format straight into the array, there is no limit on the length.
+      va_list v2;
+      va_copy(v2, v);
+      int len = vsnprintf(NULL, 0, fmt, v);
+      if (len > 0) {
+        size_t pos = old_size ? old_size - 1 : 0;
+        ary.resize(pos + len + 1);
+        vsnprintf(&ary[pos], len + 1, fmt, v2);
       }
+      va_end(v2);
     #endif
   }
 
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// hash functions used by hash_map and dictionary
+//
+// hash_mix32 and hash_mix64 are finalisers that spread every input bit over the result.
+// hash_bytes is a wyhash-style function for blocks of memory such as strings.
+//
+
+namespace octet { namespace containers {
+  /// Scramble a 32 bit value (murmur3 finaliser).
+  inline unsigned hash_mix32(unsigned h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  /// Scramble a 64 bit value down to 32 bits (murmur3 64 bit finaliser).
+  inline unsigned hash_mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return (unsigned)h;
+  }
+
+  // 64x64 -> 128 bit multiply, folded to 64 bits.
+  inline uint64_t hash_mum(uint64_t a, uint64_t b) {
+    #if defined(__SIZEOF_INT128__)
+      __uint128_t r = (__uint128_t)a * b;
+      return (uint64_t)r ^ (uint64_t)(r >> 64);
+    #else
+      uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+      uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+      uint64_t t = rl + (rm0 << 32), c = t < rl;
+      uint64_t lo = t + (rm1 << 32);
+      c += lo < t;
+      uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+      return lo ^ hi;
+    #endif
+  }
+
+  // little endian reads of unaligned data.
+  inline uint64_t hash_read8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+  inline uint64_t hash_read4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+  /// Hash a block of bytes to 64 bits (wyhash).
+  ///
+  /// Short keys, which are most of our names and ids, take one or two multiplies.
+  inline uint64_t hash_bytes64(const void *key, size_t len, uint64_t seed = 0) {
+    static const uint64_t s0 = 0xa0761d6478bd642full, s1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t s2 = 0x8ebc6af09c88c6e3ull, s3 = 0x589965cc75374cc3ull;
+    const uint8_t *p = (const uint8_t*)key;
+    seed ^= hash_mum(seed ^ s0, s1);
+    uint64_t a, b;
+    if (len <= 16) {
+      if (len >= 4) {
+        a = (hash_read4(p) << 32) | hash_read4(p + ((len >> 3) << 2));
+        b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - ((len >> 3) << 2));
+      } else if (len > 0) {
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      size_t i = len;
+      if (i > 48) {
+        uint64_t see1 = seed, see2 = seed;
+        do {
+          seed = hash_mum(hash_read8(p) ^ s1, hash_read8(p + 8) ^ seed);
+          see1 = hash_mum(hash_read8(p + 16) ^ s2, hash_read8(p + 24) ^ see1);
+          see2 = hash_mum(hash_read8(p + 32) ^ s3, hash_read8(p + 40) ^ see2);
+          p += 48;
+          i -= 48;
+        } while (i > 48);
+        seed ^= see1 ^ see2;
+      }
+      while (i > 16) {
+        seed = hash_mum(hash_read8(p) ^ s1, hash_read8(p + 8) ^ seed);
+        i -= 16;
+        p += 16;
+      }
+      a = hash_read8(p + i - 16);
+      b = hash_read8(p + i - 8);
+    }
+    return hash_mum(s1 ^ len, hash_mum(a ^ s1, b ^ seed));
+  }
+
+  /// Hash a block of bytes to 32 bits.
+  inline unsigned hash_bytes(const void *key, size_t len) {
+    return (unsigned)hash_bytes64(key, len);
+  }
+} }
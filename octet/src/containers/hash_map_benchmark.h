@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// hash_map benchmark
+//
+// times insert, hit and miss lookups of random uint64 keys at 1K, 1M and 10M keys
+// for hash_map and the linear probing map it replaced (kept here as legacy_map).
+// run it with bin/example_benchmarks hash_map
+//
+
+namespace octet { namespace containers {
+  /// Benchmark hash_map against the map it replaced.
+  class hash_map_benchmark {
+    enum { num_runs = 5 };
+
+    /// The original hash_map: linear probing, weak hash, full hash per entry and key 0 means empty.
+    template <typename key_t, typename value_t> class legacy_map {
+      struct entry_t { key_t key; unsigned hash; value_t value; };
+
+      entry_t *entries;
+      unsigned num_entries;
+      unsigned max_entries;
+
+      static unsigned get_hash(uint64_t key) {
+        unsigned hash = (unsigned)(key ^ (key >> 32));
+        return hash ^ (hash >> 3) ^ (hash >> 5);
+      }
+
+      entry_t *find(const key_t &key, unsigned hash) {
+        unsigned mask = max_entries - 1;
+        for (unsigned i = 0; i != max_entries; ++i) {
+          entry_t *entry = &entries[(i + hash) & mask];
+          if (!entry->key || (entry->hash == hash && entry->key == key)) {
+            return entry;
+          }
+        }
+        return 0;
+      }
+
+      void expand() {
+        entry_t *old_entries = entries;
+        unsigned old_max_entries = max_entries;
+        max_entries *= 2;
+        entries = (entry_t*)allocator::sys_malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+        for (unsigned i = 0; i != old_max_entries; ++i) {
+          if (old_entries[i].key) {
+            *find(old_entries[i].key, old_entries[i].hash) = old_entries[i];
+          }
+        }
+        allocator::sys_free(old_entries);
+      }
+
+      legacy_map(const legacy_map &);
+      legacy_map &operator=(const legacy_map &);
+    public:
+      legacy_map() {
+        num_entries = 0;
+        max_entries = 4;
+        entries = (entry_t*)allocator::sys_malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+      }
+
+      ~legacy_map() {
+        allocator::sys_free(entries);
+      }
+
+      value_t &operator[](const key_t &key) {
+        unsigned hash = get_hash(key);
+        entry_t *entry = find(key, hash);
+        if (!entry->key) {
+          if (num_entries >= max_entries * 3 / 4) {
+            expand();
+            entry = find(key, hash);
+          }
+          num_entries++;
+          entry->key = key;
+          entry->hash = hash;
+        }
+        return entry->value;
+      }
+
+      bool contains(const key_t &key) {
+        return find(key, get_hash(key))->key != 0;
+      }
+    };
+
+    struct result_t {
+      double insert_ns;
+      double hit_ns;
+      double miss_ns;
+      uint64_t check;
+    };
+
+    static double now() {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // xorshift; never returns 0 so that the legacy map can use the keys.
+    static uint64_t next_key(uint64_t &state) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    }
+
+    template <class map_t> static result_t run_map(unsigned num_keys) {
+      dynarray<uint64_t> keys(num_keys);
+      dynarray<uint64_t> lookups(num_keys);
+      uint64_t state = 0x9e3779b97f4a7c15ull;
+      for (unsigned i = 0; i != num_keys; ++i) {
+        keys[i] = next_key(state);
+      }
+
+      // look the keys up in a different random order to the one we inserted them in.
+      for (unsigned i = 0; i != num_keys; ++i) {
+        lookups[i] = keys[i];
+      }
+      for (unsigned i = num_keys; i > 1; --i) {
+        unsigned j = (unsigned)(next_key(state) % i);
+        uint64_t tmp = lookups[i-1]; lookups[i-1] = lookups[j]; lookups[j] = tmp;
+      }
+
+      // enough passes to time small maps reliably.
+      unsigned passes = num_keys < 100000 ? 10000000 / num_keys : 1;
+
+      result_t res;
+      res.check = 0;
+      double t0 = now();
+      map_t *map = 0;
+      for (unsigned p = 0; p != passes; ++p) {
+        delete map;
+        map = new map_t();
+        for (unsigned i = 0; i != num_keys; ++i) {
+          (*map)[keys[i]] = i;
+        }
+      }
+      double t1 = now();
+      for (unsigned p = 0; p != passes; ++p) {
+        for (unsigned i = 0; i != num_keys; ++i) {
+          res.check += (*map)[lookups[i]];
+        }
+      }
+      double t2 = now();
+      for (unsigned p = 0; p != passes; ++p) {
+        for (unsigned i = 0; i != num_keys; ++i) {
+          res.check += map->contains(next_key(state));
+        }
+      }
+      double t3 = now();
+      delete map;
+
+      double scale = 1e9 / ((double)passes * num_keys);
+      res.insert_ns = (t1 - t0) * scale;
+      res.hit_ns = (t2 - t1) * scale;
+      res.miss_ns = (t3 - t2) * scale;
+      return res;
+    }
+
+    static void keep_best(result_t &best, const result_t &res) {
+      best.insert_ns = std::min(best.insert_ns, res.insert_ns);
+      best.hit_ns = std::min(best.hit_ns, res.hit_ns);
+      best.miss_ns = std::min(best.miss_ns, res.miss_ns);
+    }
+
+  public:
+    /// Print ns per key for each map size.
+    static void run(FILE *file = stdout) {
+      static const unsigned sizes[] = { 1000, 1000000, 10000000 };
+      fprintf(file, "hash_map<uint64_t, uint64_t>, random keys, ns per key (legacy / new)\n");
+      fprintf(file, "%10s %16s %16s %16s\n", "keys", "insert", "hit", "miss");
+      for (unsigned i = 0; i != sizeof(sizes)/sizeof(sizes[0]); ++i) {
+        // alternate the two maps and keep the fastest runs, as other processes add a lot of noise.
+        result_t legacy = run_map<legacy_map<uint64_t, uint64_t> >(sizes[i]);
+        result_t current = run_map<hash_map<uint64_t, uint64_t> >(sizes[i]);
+        for (unsigned j = 1; j != num_runs; ++j) {
+          keep_best(legacy, run_map<legacy_map<uint64_t, uint64_t> >(sizes[i]));
+          keep_best(current, run_map<hash_map<uint64_t, uint64_t> >(sizes[i]));
+        }
+        fprintf(
+          file, "%10u %7.1f / %6.1f %7.1f / %6.1f %7.1f / %6.1f\n", sizes[i],
+          legacy.insert_ns, current.insert_ns, legacy.hit_ns, current.hit_ns, legacy.miss_ns, current.miss_ns
+        );
+        if (legacy.check != current.check) {
+          fprintf(file, "  lookups disagree!\n");
+        }
+      }
+    }
+  };
+} }
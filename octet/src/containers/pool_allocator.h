@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// size-class pool allocator for small objects
+//
+// small blocks are carved out of 64k chunks and kept on thread local free lists,
+// so allocating a scene node costs a couple of loads and stores and no locks.
+// because free() is told the size of the block, we need no headers on blocks.
+// each chunk starts with the heap that owns it so that blocks freed on other threads can go home.
+//
+
+namespace octet { namespace containers {
+  /// Thread local size-class pools; use tagged_allocator<> or pool_allocator rather than this directly.
+  ///
+  /// Blocks of up to max_small_size bytes come from per-thread free lists.
+  /// Larger blocks go to the system heap.
+  ///
+  /// A block freed on another thread goes onto an atomic list in the heap of the thread
+  /// that carved it, which that thread takes back when its own list runs dry.
+  /// Threads that finish should call thread_exit() so that a new thread can adopt their heap.
+  class pool_heap {
+  public:
+    enum {
+      num_small_classes = 16,   // 16, 32, ... 256 bytes
+      num_classes = 28,         // then 320, 384, ... 1024 bytes
+      max_small_size = 1024,
+      chunk_size = 0x10000,     // chunks are aligned to their size
+      chunk_header_size = 64,
+    };
+
+  private:
+    struct free_block_t {
+      free_block_t *next;
+    };
+
+    struct heap_t {
+      // only used by the owning thread
+      free_block_t *free_lists[num_classes];
+
+      // blocks freed by other threads
+      std::atomic<free_block_t*> remote_frees[num_classes];
+
+      // all heaps ever made, so that we can reuse the heaps of finished threads
+      heap_t *next;
+      std::atomic<bool> in_use;
+    };
+
+    struct chunk_header_t {
+      heap_t *owner;
+    };
+
+    static heap_t *&thread_heap() {
+      static OCTET_THREAD_LOCAL heap_t *instance;
+      return instance;
+    }
+
+    static std::atomic<heap_t*> &all_heaps() {
+      static std::atomic<heap_t*> instance;
+      return instance;
+    }
+
+    static std::atomic<intptr_t> &reserved_bytes() {
+      static std::atomic<intptr_t> instance;
+      return instance;
+    }
+
+    // adopt the heap of a finished thread or make a new one.
+    static heap_t *get_heap() {
+      heap_t *heap = thread_heap();
+      if (heap) return heap;
+
+      for (heap = all_heaps().load(std::memory_order_acquire); heap; heap = heap->next) {
+        bool expected = false;
+        if (!heap->in_use.load(std::memory_order_relaxed) && heap->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+          return thread_heap() = heap;
+        }
+      }
+
+      heap = (heap_t*)allocator::sys_malloc(sizeof(heap_t));
+      for (unsigned i = 0; i != num_classes; ++i) {
+        heap->free_lists[i] = 0;
+        heap->remote_frees[i].store(0, std::memory_order_relaxed);
+      }
+      heap->in_use.store(true, std::memory_order_relaxed);
+      heap->next = all_heaps().load(std::memory_order_relaxed);
+      while (!all_heaps().compare_exchange_weak(heap->next, heap, std::memory_order_release)) {
+      }
+      return thread_heap() = heap;
+    }
+
+    static heap_t *get_owner(void *ptr) {
+      return ((chunk_header_t*)((uintptr_t)ptr & ~(uintptr_t)(chunk_size - 1)))->owner;
+    }
+
+    // take back blocks freed by other threads or carve a new chunk into blocks.
+    static free_block_t *refill(heap_t *heap, unsigned size_class) {
+      free_block_t *remote = heap->remote_frees[size_class].exchange(0, std::memory_order_acquire);
+      if (remote) return remote;
+
+      size_t block_size = get_class_size(size_class);
+      uint8_t *chunk = (uint8_t*)allocator::sys_aligned_malloc(chunk_size, chunk_size);
+      if (!chunk) return 0;
+      reserved_bytes().fetch_add(chunk_size, std::memory_order_relaxed);
+      ((chunk_header_t*)chunk)->owner = heap;
+
+      size_t num_blocks = (chunk_size - chunk_header_size) / block_size;
+      free_block_t *head = 0;
+      for (size_t i = num_blocks; i != 0; --i) {
+        free_block_t *block = (free_block_t*)(chunk + chunk_header_size + (i-1) * block_size);
+        block->next = head;
+        head = block;
+      }
+      return head;
+    }
+
+  public:
+    /// Map a size to a size class.
+    static unsigned get_size_class(size_t size) {
+      if (size <= 256) {
+        return size ? (unsigned)((size + 15) >> 4) - 1 : 0;
+      } else {
+        return num_small_classes + (unsigned)((size - 257) >> 6);
+      }
+    }
+
+    /// The number of bytes in a block of this size class.
+    static size_t get_class_size(unsigned size_class) {
+      return size_class < num_small_classes ? (size_class + 1) * 16 : 256 + (size_class - num_small_classes + 1) * 64;
+    }
+
+    /// Total bytes of chunks taken from the system for all pools.
+    static size_t get_reserved_bytes() {
+      return (size_t)reserved_bytes().load(std::memory_order_relaxed);
+    }
+
+    /// Allocate a 16 byte aligned block.
+    static void *malloc(size_t size) {
+      if (size > max_small_size) {
+        return allocator::sys_malloc(size);
+      }
+
+      unsigned size_class = get_size_class(size);
+      heap_t *heap = get_heap();
+      free_block_t *&head = heap->free_lists[size_class];
+      if (!head) {
+        head = refill(heap, size_class);
+        if (!head) return 0;
+      }
+      free_block_t *block = head;
+      head = block->next;
+      return block;
+    }
+
+    /// Free a block, size must be the size given to malloc.
+    static void free(void *ptr, size_t size) {
+      if (!ptr) return;
+      if (size > max_small_size) {
+        allocator::sys_free(ptr);
+        return;
+      }
+
+      unsigned size_class = get_size_class(size);
+      heap_t *owner = get_owner(ptr);
+      free_block_t *block = (free_block_t*)ptr;
+      if (owner == thread_heap()) {
+        free_block_t *&head = owner->free_lists[size_class];
+        block->next = head;
+        head = block;
+      } else {
+        std::atomic<free_block_t*> &remote = owner->remote_frees[size_class];
+        block->next = remote.load(std::memory_order_relaxed);
+        while (!remote.compare_exchange_weak(block->next, block, std::memory_order_release)) {
+        }
+      }
+    }
+
+    /// Call at the end of a thread that used the pools.
+    /// The heap and the blocks on it pass to the next new thread.
+    static void thread_exit() {
+      heap_t *heap = thread_heap();
+      if (heap) {
+        thread_heap() = 0;
+        heap->in_use.store(false, std::memory_order_release);
+      }
+    }
+
+    /// Resize a block. Blocks that stay in the same size class do not move.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      if (!ptr) return malloc(size);
+      if (old_size > max_small_size && size > max_small_size) {
+        return allocator::sys_realloc(ptr, size);
+      }
+      if (old_size <= max_small_size && size <= max_small_size && get_size_class(old_size) == get_size_class(size)) {
+        return ptr;
+      }
+      void *res = malloc(size);
+      if (res) {
+        memcpy(res, ptr, old_size < size ? old_size : size);
+        free(ptr, old_size);
+      }
+      return res;
+    }
+  };
+
+  /// An allocator that accounts for its memory under a subsystem tag.
+  ///
+  /// Use this as the allocator_t parameter of any container.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<float, tagged_allocator<alloc_tag_mesh> > vertices;
+  ///     ...
+  ///     printf("%d\n", (int)allocator_stats::get_peak_bytes(alloc_tag_mesh));
+  template <allocator_tag tag, class heap_t=pool_heap> class tagged_allocator {
+  public:
+    /// Allocate memory and count it against tag.
+    static void *malloc(size_t size) {
+      allocator_stats::add(tag, (intptr_t)size);
+      return heap_t::malloc(size);
+    }
+
+    /// Free memory and remove it from tag.
+    static void free(void *ptr, size_t size) {
+      allocator_stats::add(tag, -(intptr_t)size);
+      heap_t::free(ptr, size);
+    }
+
+    /// Resize memory.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      allocator_stats::add(tag, (intptr_t)size - (intptr_t)old_size);
+      return heap_t::realloc(ptr, old_size, size);
+    }
+
+    /// Bytes currently allocated with this tag.
+    static size_t get_live_bytes() {
+      return (size_t)allocator_stats::get_live_bytes(tag);
+    }
+
+    /// Largest number of bytes allocated at once with this tag.
+    static size_t get_peak_bytes() {
+      return (size_t)allocator_stats::get_peak_bytes(tag);
+    }
+  };
+
+  /// General purpose pooled allocator for containers.
+  typedef tagged_allocator<alloc_tag_containers> pool_allocator;
+
+  /// Allocator used by resource::operator new (scene nodes, mesh instances etc.)
+  typedef tagged_allocator<alloc_tag_resources> resource_allocator;
+} }
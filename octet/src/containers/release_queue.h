@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// deferred release of reference counted objects
+//
+// when an object's reference count reaches zero on a thread with deferral turned on,
+// it is queued here instead of being deleted. The queue is drained once per frame,
+// so destructors (and the cache misses that go with them) do not happen in the middle of
+// rendering and objects released on worker threads are deleted on the thread that made them dead.
+//
+
+namespace octet { namespace containers {
+  /// Per-thread queue of objects waiting to be destroyed.
+  ///
+  /// The app turns deferral on for the main thread and calls drain() at the end of every frame.
+  /// Worker threads can do the same at the end of each batch of work.
+  ///
+  /// Example:
+  ///
+  ///     release_queue::set_deferred(true);
+  ///     ...
+  ///     release_queue::push(obj, my_class::destroy); // instead of delete obj
+  ///     ...
+  ///     release_queue::drain();                      // end of frame: delete everything
+  class release_queue {
+  public:
+    /// Called by drain() to destroy an object.
+    typedef void (*destroy_fn_t)(void *obj);
+
+  private:
+    struct item_t {
+      void *obj;
+      destroy_fn_t destroy;
+    };
+
+    // plain data, so that it can be thread local on every compiler.
+    struct thread_state_t {
+      item_t *items;
+      unsigned size;
+      unsigned capacity;
+      bool deferred;
+    };
+
+    static thread_state_t &thread_state() {
+      static OCTET_THREAD_LOCAL thread_state_t instance;
+      return instance;
+    }
+
+  public:
+    /// Turn deferral on or off for this thread.
+    static void set_deferred(bool value) {
+      thread_state().deferred = value;
+    }
+
+    /// Return true if objects released on this thread should be queued.
+    static bool is_deferred() {
+      return thread_state().deferred;
+    }
+
+    /// Queue an object for destruction by drain().
+    static void push(void *obj, destroy_fn_t destroy) {
+      thread_state_t &ts = thread_state();
+      if (ts.size == ts.capacity) {
+        unsigned new_capacity = ts.capacity ? ts.capacity * 2 : 256;
+        ts.items = (item_t*)allocator::sys_realloc(ts.items, new_capacity * sizeof(item_t));
+        ts.capacity = new_capacity;
+      }
+      item_t &item = ts.items[ts.size++];
+      item.obj = obj;
+      item.destroy = destroy;
+    }
+
+    /// Number of objects waiting on this thread.
+    static unsigned get_size() {
+      return thread_state().size;
+    }
+
+    /// Destroy all the objects queued on this thread.
+    ///
+    /// Destructors may release more objects; these are destroyed too.
+    static void drain() {
+      thread_state_t &ts = thread_state();
+      while (ts.size) {
+        item_t item = ts.items[--ts.size];
+        item.destroy(item.obj);
+      }
+    }
+  };
+} }
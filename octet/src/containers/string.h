@@ -11,25 +11,151 @@
 //   string my_string = "hello world";
 //   printf("%s\n", my_string.c_str());
 //
+// strings of up to 15 bytes are stored inside the string object itself,
+// longer ones on the heap. The length and capacity are cached.
+//
 
 namespace octet { namespace containers {
+  class string;
+
+  /// strings do not point into themselves, so they can be moved with memcpy.
+  template <> struct is_trivially_relocatable<string> {
+    enum { value = true };
+  };
+
+  /// python-style split of some text into views of the text. No strings are allocated.
+  ///
+  /// Example.
+  ///
+  ///     dynarray<string_view> parts;
+  ///     split(parts, "100,fred,bert,harry", ",");
+  ///     // parts now contains four views: "100", "fred", "bert", "harry"
+  inline void split(dynarray<string_view> &result, string_view text, string_view delimiter) {
+    result.resize(0);
+    if (delimiter.empty()) {
+      result.push_back(text);
+      return;
+    }
+    unsigned cur = 0;
+    for (;;) {
+      int next = text.find(delimiter, cur);
+      if (next < 0) break;
+      result.push_back(text.substr(cur, (unsigned)next - cur));
+      cur = (unsigned)next + delimiter.size();
+    }
+    result.push_back(text.substr(cur));
+  }
+
   /// The string class is used to hold persistant text strings.
   ///
   /// Only use this class as a data member in another class. Do not pass strings as parameters
-  /// but instead use const char * to pass strings around locally.
+  /// but instead use const char * or string_view to pass strings around locally.
   ///
   /// This string class has the ability to perform a few common operations such as formatting
   /// and url encode/decode.
   ///
+  /// Short strings do not allocate. Appending grows the buffer geometrically.
+  ///
   class string {
-    char *data_;
+    enum { inline_capacity = 15 };
+
+    // short strings live in inline_, longer ones on the heap.
+    // we do not point into ourselves, so strings can be moved with memcpy.
+    union {
+      char *heap_;
+      char inline_[inline_capacity + 1];
+    } u;
 
-    static char *null_string() { static char c; return &c; }
+    unsigned size_;     // bytes, not including the zero terminator
+    unsigned capacity_; // bytes on the heap, not including the zero terminator. 0 for inline strings
+
+    char *ptr() const {
+      return capacity_ ? u.heap_ : (char*)u.inline_;
+    }
+
+    void init() {
+      u.inline_[0] = 0;
+      size_ = 0;
+      capacity_ = 0;
+    }
 
     void release() {
-      if (data_ != null_string()) {
-        allocator::free((void*)data_, size() + 1);
-        data_ = null_string();
+      if (capacity_) {
+        allocator::free((void*)u.heap_, capacity_ + 1);
+      }
+      init();
+    }
+
+    // make room for new_size bytes keeping the contents.
+    char *grow(unsigned new_size) {
+      unsigned cap = capacity();
+      if (new_size <= cap) {
+        return ptr();
+      }
+
+      // keep the allocation a power of two: 32, 64, 128...
+      unsigned new_capacity = cap * 2 + 1;
+      while (new_capacity < new_size) new_capacity = new_capacity * 2 + 1;
+
+      if (capacity_) {
+        u.heap_ = (char*)allocator::realloc(u.heap_, capacity_ + 1, new_capacity + 1);
+      } else {
+        char *new_data = (char*)allocator::malloc(new_capacity + 1);
+        memcpy(new_data, u.inline_, size_ + 1);
+        u.heap_ = new_data;
+      }
+      capacity_ = new_capacity;
+      return u.heap_;
+    }
+
+    // replace the text from start onwards with formatted text.
+    // the arguments may point into this string, so we format into a separate buffer first.
+    void vformat_at(unsigned start, const char *fmt, va_list v) {
+      char buf[256];
+      char *text = buf;
+      va_list v2;
+      va_copy(v2, v);
+      #ifdef WIN32
+        int len = _vscprintf(fmt, v);
+        if (len >= (int)sizeof(buf)) {
+          text = (char*)allocator::malloc(len + 1);
+        }
+        if (len > 0) {
+          vsprintf_s(text, len + 1, fmt, v2);
+        }
+      #else
+        int len = vsnprintf(buf, sizeof(buf), fmt, v);
+        if (len >= (int)sizeof(buf)) {
+          text = (char*)allocator::malloc(len + 1);
+          vsnprintf(text, len + 1, fmt, v2);
+        }
+      #endif
+      va_end(v2);
+
+      if (len < 0) len = 0;
+      char *dest = grow(start + len);
+      memcpy(dest + start, text, len);
+      size_ = start + len;
+      dest[size_] = 0;
+
+      if (text != buf) {
+        allocator::free(text, len + 1);
+      }
+    }
+
+    // replace the contents, value may be part of this string.
+    void assign(const char *value, unsigned size) {
+      if (size <= capacity()) {
+        char *dest = ptr();
+        memmove(dest, value, size);
+        dest[size] = 0;
+        size_ = size;
+      } else {
+        string tmp;
+        memcpy(tmp.grow(size), value, size);
+        tmp.size_ = size;
+        tmp.ptr()[size] = 0;
+        swap(tmp);
       }
     }
 
@@ -145,23 +271,40 @@ namespace octet { namespace containers {
     }
   public:
     /// Default constructor: empty string.
-    string() { data_ = null_string(); }
+    string() { init(); }
 
     /// Copy a UTF8 C string
-    string(const char *value) { data_ = null_string(); *this = value; }
+    string(const char *value) { init(); *this = value; }
     
     /// Copy of a UFT16 C string
-    string(const wchar_t *value) { data_ = null_string(); *this = value; }
+    string(const wchar_t *value) { init(); *this = value; }
     
     /// Copy of another string
-    string(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); }
+    string(const string& rhs) { init(); assign(rhs.ptr(), rhs.size_); }
+
+    /// Take the contents of another string.
+    string(string &&rhs) {
+      memcpy((void*)this, (void*)&rhs, sizeof(*this));
+      rhs.init();
+    }
     
     /// Copy of a substring
-    string(const char *value, unsigned size) { data_ = null_string(); set(value, size); }
+    string(const char *value, unsigned size) { init(); set(value, size); }
+
+    /// Copy of a view
+    string(string_view value) { init(); assign(value.data(), value.size()); }
 
     /// Free up memory used by the string.
     ~string() { release(); }
 
+    /// Exchange the contents of two strings.
+    void swap(string &rhs) {
+      char tmp[sizeof(string)];
+      memcpy(tmp, (void*)this, sizeof(string));
+      memcpy((void*)this, (void*)&rhs, sizeof(string));
+      memcpy((void*)&rhs, tmp, sizeof(string));
+    }
+
     /// Format a string using sprintf.
     ///
     /// Example
@@ -169,50 +312,38 @@ namespace octet { namespace containers {
     ///     string my_path;
     ///     my_path.format("%s/%s.dat", path, filename);
     string &format(const char *fmt, ...) {
-      release();
       va_list v;
       va_start(v, fmt);
-      vformat(fmt, v);
+      vformat_at(0, fmt, v);
       va_end(v);
       return *this;
     }
 
+    /// Append formatted text using sprintf.
     string &printf(const char *fmt, ...) {
       va_list v;
       va_start(v, fmt);
-      vformat(fmt, v);
+      vformat_at(size_, fmt, v);
       va_end(v);
       return *this;
     }
 
+    /// Append formatted text; there is no limit on the length.
     void vformat(const char *fmt, va_list v) {
-      #ifdef WIN32
-        size_t cur_len = strlen(data_);
-        int len = _vscprintf(fmt, v);
-        if (len) {
-          if (cur_len) {
-            data_ = (char*)allocator::realloc(data_, cur_len+1, cur_len + len + 1);
-            vsprintf_s(data_ + cur_len, len+1, fmt, v);
-          } else {
-            data_ = (char*)allocator::malloc(len+1);
-            vsprintf_s(data_, len+1, fmt, v);
-          }
-        }
-      #else
-        char tmp[1024];
-        vsnprintf(tmp, sizeof(tmp)-1, fmt, v);
-        *this += tmp;
-      #endif
+      vformat_at(size_, fmt, v);
     }
 
     /// Decode url strings - to turn them into filenames, for example.
     string &urldecode(const char *value) {
-      release();
+      size_ = 0;
+      ptr()[0] = 0;
       if (value) {
         unsigned size = urldecode_impl(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          urldecode_impl(data_, value);
+          string tmp;
+          urldecode_impl(tmp.grow(size), value);
+          tmp.size_ = size;
+          swap(tmp);
         }
       }
       return *this;
@@ -220,12 +351,15 @@ namespace octet { namespace containers {
 
     /// encode url strings - to turn them into URLs, for example
     string &urlencode(const char *value) {
-      release();
+      size_ = 0;
+      ptr()[0] = 0;
       if (value) {
         unsigned size = urlencode_impl(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          urlencode_impl(data_, value);
+          string tmp;
+          urlencode_impl(tmp.grow(size), value);
+          tmp.size_ = size;
+          swap(tmp);
         }
       }
       return *this;
@@ -233,104 +367,144 @@ namespace octet { namespace containers {
 
     // copy a utf8 string - unix, mac and the web.
     string &operator=(const char *value) {
-      release();
       if (value) {
-        size_t size = strlen(value);
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          memcpy((char*)data_, value, size+1);
-        }
+        assign(value, (unsigned)strlen(value));
+      } else {
+        assign("", 0);
       }
       return *this;
     }
 
     // copy utf16 unicode strings - microsoft & java
     string &operator=(const wchar_t *value) {
-      release();
+      string tmp;
       if (value) {
         unsigned size = utf16_to_utf8(0, value);
         if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          utf16_to_utf8(data_, value);
+          utf16_to_utf8(tmp.grow(size), value);
+          tmp.size_ = size;
         }
       }
+      swap(tmp);
       return *this;
     }
 
     /// copy another string
-    string &operator=(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); return *this; }
+    string &operator=(const string& rhs) {
+      if (this != &rhs) {
+        assign(rhs.ptr(), rhs.size_);
+      }
+      return *this;
+    }
+
+    /// take the contents of another string
+    string &operator=(string &&rhs) {
+      if (this != &rhs) {
+        release();
+        swap(rhs);
+      }
+      return *this;
+    }
+
+    /// copy a view
+    string &operator=(string_view rhs) {
+      assign(rhs.data(), rhs.size());
+      return *this;
+    }
 
     /// copy a substring
     string &set(const char *value, unsigned size) {
-      release();
       if (value) {
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          memcpy((char*)data_, value, size);
-          data_[size] = 0;
-        }
+        assign(value, size);
+      } else {
+        assign("", 0);
       }
       return *this;
     }
 
+    /// Make room for at least this many bytes without reallocating.
+    void reserve(unsigned size) {
+      grow(size);
+    }
+
+    /// Number of bytes we can hold without reallocating.
+    unsigned capacity() const {
+      return capacity_ ? capacity_ : (unsigned)inline_capacity;
+    }
+
     /// shorten a string to a new length
     string &truncate(int new_len) {
-      int size = (int)strlen(data_);
-      if (new_len < size) {
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(new_len+1);
-        } else {
-          data_ = (char*)allocator::realloc((void*)data_, size+1, new_len+1);
-        }
-        data_[new_len] = 0;
+      if (new_len >= 0 && (unsigned)new_len < size_) {
+        size_ = (unsigned)new_len;
+        ptr()[size_] = 0;
       }
       return *this;
     }
 
     /// compare two strings
-    bool operator==(const char *rhs) const { return strcmp(data_, rhs) == 0; }
+    bool operator==(const char *rhs) const { return strcmp(ptr(), rhs) == 0; }
     /// compare two strings
-    bool operator!=(const char *rhs) const { return strcmp(data_, rhs) != 0; }
+    bool operator!=(const char *rhs) const { return strcmp(ptr(), rhs) != 0; }
     /// compare two strings
-    bool operator<(const char *rhs) const { return strcmp(data_, rhs) < 0; }
+    bool operator<(const char *rhs) const { return strcmp(ptr(), rhs) < 0; }
     /// compare two strings
-    bool operator>(const char *rhs) const { return strcmp(data_, rhs) > 0; }
+    bool operator>(const char *rhs) const { return strcmp(ptr(), rhs) > 0; }
+
+    /// compare with a view
+    bool operator==(string_view rhs) const { return view() == rhs; }
+    /// compare with a view
+    bool operator!=(string_view rhs) const { return view() != rhs; }
+
+    /// Append some bytes.
+    string &append(const char *rhs, unsigned rhs_size) {
+      // rhs may be part of this string, so find it again after growing.
+      const char *old = ptr();
+      bool inside = rhs >= old && rhs <= old + size_;
+      char *dest = grow(size_ + rhs_size);
+      if (inside) rhs = dest + (rhs - old);
+      memmove(dest + size_, rhs, rhs_size);
+      size_ += rhs_size;
+      dest[size_] = 0;
+      return *this;
+    }
 
     /// Append to a string. Note: it is generally better to use format.
     string &operator+=(const char *rhs) {
       if (rhs) {
-        size_t data_size = strlen(data_);
-        size_t rhs_size = strlen(rhs);
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(data_size+rhs_size+1);
-        } else {
-          data_ = (char*)allocator::realloc(data_, data_size + 1, data_size+rhs_size+1);
-        }
-        memcpy(data_ + data_size, rhs, rhs_size+1);
+        append(rhs, (unsigned)strlen(rhs));
       }
       return *this;
     }
 
+    /// Append a view.
+    string &operator+=(string_view rhs) {
+      return append(rhs.data(), rhs.size());
+    }
+
+    /// Append a single byte.
+    string &operator+=(char rhs) {
+      return append(&rhs, 1);
+    }
+
     /// Insert a substring.
     string &insert(unsigned pos, const char *rhs) {
       if (rhs) {
-        size_t data_size = strlen(data_);
-        size_t rhs_size = strlen(rhs);
-        char *new_data = (char*)allocator::malloc(data_size+rhs_size+1);
-        memcpy(new_data, data_, pos);
-        memcpy(new_data + pos, rhs, rhs_size);
-        memcpy(new_data + pos + rhs_size, data_, data_size - pos + 1);
-        release();
-        data_ = new_data;
+        string tmp(rhs);
+        unsigned rhs_size = tmp.size_;
+        char *dest = grow(size_ + rhs_size);
+        memmove(dest + pos + rhs_size, dest + pos, size_ - pos + 1);
+        memcpy(dest + pos, tmp.ptr(), rhs_size);
+        size_ += rhs_size;
       }
       return *this;
     }
 
     /// Find a substring.
     int find(const char *rhs) const {
-      char *d = strstr(data_, rhs);
+      const char *data = ptr();
+      const char *d = strstr(data, rhs);
       if (d) {
-        return (int)(d - data_);
+        return (int)(d - data);
       }
       return -1;
     }
@@ -338,12 +512,13 @@ namespace octet { namespace containers {
     /// Find the position of the extension in a file path.
     int extension_pos() const {
       int res = -1;
-      for (const char *p = data_; *p; ++p) {
+      const char *data = ptr();
+      for (const char *p = data; *p; ++p) {
         char chr = *p;
         if (chr == '/' || chr == '\\') {
           res = -1;  // note  /usr/fred.jim/harry   has no extension
         } else if (chr == '.') {
-          res = (int)(p - data_);
+          res = (int)(p - data);
         }
       }
       return res;
@@ -352,33 +527,37 @@ namespace octet { namespace containers {
     /// Find the position of a filename in a file path
     int filename_pos() const  {
       int res = 0;
-      for (const char *p = data_; *p; ++p) {
+      const char *data = ptr();
+      for (const char *p = data; *p; ++p) {
         char chr = *p;
         if (chr == '/' || chr == '\\') {
-          res = (int)(p - data_ + 1);
+          res = (int)(p - data + 1);
         }
       }
       return res;
     }
 
     /// Number of bytes in a string. Note: this is not the number of characters.
-    int size() { return (int)strlen(data_); }
+    int size() const { return (int)size_; }
 
     /// Get a C string from this string.
-    const char *c_str() const { return data_; }
+    const char *c_str() const { return ptr(); }
     /// Get a C string from this string.
-    operator const char *() { return data_; }
+    operator const char *() { return ptr(); }
 
-    /// raw data access
+    /// Get a view of this string.
+    string_view view() const { return string_view(ptr(), size_); }
+
+    /// raw data access. Do not change the length of the string through this pointer.
     char *data() const {
-      return data_;
+      return ptr();
     }
 
     /// Get/set a byte from the string.
-    char &operator[](int index) { return data_[index]; }
+    char &operator[](int index) { return ptr()[index]; }
     
     /// Get a byte from the string.
-    char operator[](int index) const { return data_[index]; }
+    char operator[](int index) const { return ptr()[index]; }
 
     /// python-style string split.
     ///
@@ -388,24 +567,40 @@ namespace octet { namespace containers {
     ///     string my_csv = "100,fred,bert,harry";
     ///     my_csv.split(parts, ",")
     ///     // parts now contains four strings: "100", "fred", "bert", "harry"
-    void split(dynarray<string> &result, const char *delimiter) {
-      result.resize(0);
-      char *cur = data_;
-      unsigned delim_len = (unsigned)strlen(delimiter);
-      for(;;) {
-        char *next = strstr(cur, delimiter);
-        if (!next) break;
-        result.push_back(string());
-        result.back().set(cur, (int)(next - cur));
-        cur = next + delim_len;
+    void split(dynarray<string> &result, const char *delimiter) const {
+      string_view text = view(), delim(delimiter);
+      if (delim.empty()) {
+        result.resize(1);
+        result[0] = *this;
+        return;
+      }
+
+      // count the parts first so that we only size the array once.
+      unsigned num_parts = 1;
+      for (int pos = text.find(delim); pos >= 0; pos = text.find(delim, pos + delim.size())) {
+        num_parts++;
       }
-      result.push_back(string());
-      result.back() = cur;
+      result.resize(num_parts);
+
+      unsigned cur = 0;
+      for (unsigned i = 0; i != num_parts - 1; ++i) {
+        unsigned next = (unsigned)text.find(delim, cur);
+        result[i] = text.substr(cur, next - cur);
+        cur = next + delim.size();
+      }
+      result[num_parts - 1] = text.substr(cur);
+    }
+
+    /// python-style string split into views of this string.
+    ///
+    /// The views are only valid until this string changes.
+    void split(dynarray<string_view> &result, const char *delimiter) const {
+      containers::split(result, view(), delimiter);
     }
 
     /// return true if the string is empty.
-    bool empty() {
-      return size() == 0;
+    bool empty() const {
+      return size_ == 0;
     }
   };
 } }
@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// string benchmark
+//
+// times format, append, split and compare for containers::string,
+// with std::string doing the same work as a yardstick.
+// run it with bin/example_benchmarks string
+//
+
+namespace octet { namespace containers {
+  /// Micro-benchmarks for string, string_view and split().
+  class string_benchmark {
+    enum { num_runs = 5 };
+
+    typedef void (*test_fn)(unsigned &check);
+
+    static double now() {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // fastest of a few runs in ms, as other processes add noise.
+    static double time_ms(test_fn fn, unsigned &check) {
+      double best = 1e30;
+      for (unsigned i = 0; i != num_runs; ++i) {
+        double t0 = now();
+        fn(check);
+        best = std::min(best, now() - t0);
+      }
+      return best * 1000;
+    }
+
+    static void format_octet(unsigned &check) {
+      string str;
+      for (int i = 0; i != 1000000; ++i) {
+        str.format("node_%d", i);
+        check += str.size();
+      }
+    }
+
+    static void format_std(unsigned &check) {
+      std::string str;
+      char tmp[32];
+      for (int i = 0; i != 1000000; ++i) {
+        snprintf(tmp, sizeof(tmp), "node_%d", i);
+        str = tmp;
+        check += (unsigned)str.size();
+      }
+    }
+
+    static void append_octet(unsigned &check) {
+      for (int i = 0; i != 20000; ++i) {
+        string str;
+        for (int j = 0; j != 100; ++j) {
+          str += "abc";
+        }
+        check += str.size();
+      }
+    }
+
+    static void append_std(unsigned &check) {
+      for (int i = 0; i != 20000; ++i) {
+        std::string str;
+        for (int j = 0; j != 100; ++j) {
+          str += "abc";
+        }
+        check += (unsigned)str.size();
+      }
+    }
+
+    static void split_strings_octet(unsigned &check) {
+      string text("100,fred,bert,harry");
+      dynarray<string> parts;
+      for (int i = 0; i != 200000; ++i) {
+        text.split(parts, ",");
+        check += parts.size();
+      }
+    }
+
+    static void split_views_octet(unsigned &check) {
+      string text("100,fred,bert,harry");
+      dynarray<string_view> parts;
+      for (int i = 0; i != 200000; ++i) {
+        text.split(parts, ",");
+        check += parts.size();
+      }
+    }
+
+    static void split_std(unsigned &check) {
+      std::string text("100,fred,bert,harry");
+      std::vector<std::string> parts;
+      for (int i = 0; i != 200000; ++i) {
+        parts.clear();
+        size_t cur = 0;
+        for (;;) {
+          size_t next = text.find(',', cur);
+          parts.push_back(text.substr(cur, next == std::string::npos ? std::string::npos : next - cur));
+          if (next == std::string::npos) break;
+          cur = next + 1;
+        }
+        check += (unsigned)parts.size();
+      }
+    }
+
+    static const char *compare_text(unsigned i) {
+      static const char *text[] = {
+        "textures/stone_wall_diffuse.jpg", "textures/stone_wall_normal.jpg",
+        "textures/stone_wall_diffuse.jpg", "textures/stone_floor_diffuse.jpg",
+      };
+      return text[i & 3];
+    }
+
+    // index the strings with the loop counter so that the compiler can not hoist the compares.
+    static void compare_octet(unsigned &check) {
+      string strs[4];
+      for (unsigned i = 0; i != 4; ++i) strs[i] = compare_text(i);
+      for (unsigned i = 0; i != 10000000; ++i) {
+        check += strs[i & 3] == strs[(i >> 2) & 3].view();
+      }
+    }
+
+    static void compare_std(unsigned &check) {
+      std::string strs[4];
+      for (unsigned i = 0; i != 4; ++i) strs[i] = compare_text(i);
+      for (unsigned i = 0; i != 10000000; ++i) {
+        check += strs[i & 3] == strs[(i >> 2) & 3];
+      }
+    }
+
+  public:
+    /// Print ms for each test.
+    static void run(FILE *file = stdout) {
+      struct test_t {
+        const char *name;
+        test_fn octet_fn;
+        test_fn std_fn;
+      };
+
+      static const test_t tests[] = {
+        { "format(\"node_%d\") x1M", &format_octet, &format_std },
+        { "100 x += \"abc\", x20k", &append_octet, &append_std },
+        { "split 4 parts to strings x200k", &split_strings_octet, &split_std },
+        { "split 4 parts to views x200k", &split_views_octet, 0 },
+        { "compare x10M", &compare_octet, &compare_std },
+      };
+
+      unsigned check = 0;
+      fprintf(file, "string, best of %d runs in ms\n", (int)num_runs);
+      fprintf(file, "%-32s %10s %12s\n", "test", "string", "std::string");
+      for (unsigned i = 0; i != sizeof(tests)/sizeof(tests[0]); ++i) {
+        const test_t &t = tests[i];
+        double octet_ms = time_ms(t.octet_fn, check);
+        if (t.std_fn) {
+          fprintf(file, "%-32s %10.1f %12.1f\n", t.name, octet_ms, time_ms(t.std_fn, check));
+        } else {
+          fprintf(file, "%-32s %10.1f %12s\n", t.name, octet_ms, "-");
+        }
+      }
+
+      // stop the compiler throwing the work away.
+      if (check == 0) fprintf(file, "\n");
+    }
+  };
+} }
@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// non-owning view of some text
+//
+// example:
+//
+//   string_view name("fred.jpg", 4); // "fred"
+//   if (name == "fred") { ... }
+//
+
+namespace octet { namespace containers {
+  /// A pointer and a length referring to text owned by someone else.
+  ///
+  /// The text does not need a zero terminator, so a view can refer to part of a larger string
+  /// or a file in memory without copying it.
+  ///
+  /// Like const char *, views are for passing text around locally; do not keep them
+  /// after the owner of the text has gone.
+  class string_view {
+    const char *data_;
+    unsigned size_;
+
+  public:
+    /// An empty view.
+    string_view() : data_(""), size_(0) {
+    }
+
+    /// View a C string.
+    string_view(const char *value) : data_(value ? value : ""), size_(value ? (unsigned)strlen(value) : 0) {
+    }
+
+    /// View some bytes of text.
+    string_view(const char *value, unsigned size) : data_(value), size_(size) {
+    }
+
+    /// Pointer to the first byte. Note: not necessarily zero terminated.
+    const char *data() const { return data_; }
+
+    /// Number of bytes in the view.
+    unsigned size() const { return size_; }
+
+    /// Return true if the view is empty.
+    bool empty() const { return size_ == 0; }
+
+    /// Get a byte from the view.
+    char operator[](unsigned index) const { return data_[index]; }
+
+    /// Hash of the text, as used by dictionary.
+    unsigned hash() const { return hash_bytes(data_, size_); }
+
+    /// Part of the view.
+    string_view substr(unsigned pos, unsigned len = ~0u) const {
+      if (pos > size_) pos = size_;
+      if (len > size_ - pos) len = size_ - pos;
+      return string_view(data_ + pos, len);
+    }
+
+    /// Find a substring, return -1 if not found.
+    int find(string_view rhs, unsigned pos = 0) const {
+      if (rhs.size_ == 0) return pos <= size_ ? (int)pos : -1;
+      if (pos > size_ || rhs.size_ > size_ - pos) return -1;
+      // look for the first character with memchr, then check the rest.
+      const char *p = data_ + pos, *last = data_ + size_ - rhs.size_;
+      while (p <= last) {
+        p = (const char*)memchr(p, rhs.data_[0], last - p + 1);
+        if (!p) break;
+        if (!memcmp(p + 1, rhs.data_ + 1, rhs.size_ - 1)) {
+          return (int)(p - data_);
+        }
+        ++p;
+      }
+      return -1;
+    }
+
+    /// Find a character, return -1 if not found.
+    int find(char chr, unsigned pos = 0) const {
+      if (pos >= size_) return -1;
+      const char *p = (const char*)memchr(data_ + pos, chr, size_ - pos);
+      return p ? (int)(p - data_) : -1;
+    }
+
+    /// Return true if the view starts with this text.
+    bool starts_with(string_view rhs) const {
+      return rhs.size_ <= size_ && !memcmp(data_, rhs.data_, rhs.size_);
+    }
+
+    /// Return true if the view ends with this text.
+    bool ends_with(string_view rhs) const {
+      return rhs.size_ <= size_ && !memcmp(data_ + size_ - rhs.size_, rhs.data_, rhs.size_);
+    }
+
+    /// Compare like strcmp.
+    int compare(string_view rhs) const {
+      unsigned len = size_ < rhs.size_ ? size_ : rhs.size_;
+      int res = memcmp(data_, rhs.data_, len);
+      return res ? res : size_ < rhs.size_ ? -1 : size_ > rhs.size_ ? 1 : 0;
+    }
+
+    /// compare two views
+    bool operator==(string_view rhs) const { return size_ == rhs.size_ && !memcmp(data_, rhs.data_, size_); }
+    /// compare two views
+    bool operator!=(string_view rhs) const { return !(*this == rhs); }
+    /// compare two views
+    bool operator<(string_view rhs) const { return compare(rhs) < 0; }
+    /// compare two views
+    bool operator>(string_view rhs) const { return compare(rhs) > 0; }
+  };
+} }
@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Benchmarks for the containers and loaders
+//
+// bin/example_benchmarks              run them all
+// bin/example_benchmarks hash_map     run one of them
+// bin/example_benchmarks zip_decoder silesia/*
+//                                     other arguments are files for the zip_decoder benchmark
+//
+
+#include "../../octet.h"
+
+#include "../../containers/hash_map_benchmark.h"
+#include "../../containers/string_benchmark.h"
+#include "../../loaders/zip_decoder_benchmark.h"
+
+/// Run the benchmarks named on the command line, or all of them.
+int main(int argc, char **argv) {
+  using namespace octet;
+
+  struct benchmark_t {
+    const char *name;
+    void (*run)(FILE *file);
+  };
+
+  static const benchmark_t benchmarks[] = {
+    { "hash_map", &hash_map_benchmark::run },
+    { "string", &string_benchmark::run },
+    { "zip_decoder", &zip_decoder_benchmark::run },
+  };
+  unsigned num_benchmarks = sizeof(benchmarks)/sizeof(benchmarks[0]);
+
+  // the names of benchmarks to run, then any files for zip_decoder.
+  dynarray<const char *> names;
+  dynarray<const char *> files;
+  for (int j = 1; j < argc; ++j) {
+    bool is_name = false;
+    for (unsigned i = 0; i != num_benchmarks; ++i) {
+      if (!strcmp(argv[j], benchmarks[i].name)) is_name = true;
+    }
+    (is_name ? names : files).push_back(argv[j]);
+  }
+  if (!files.empty()) {
+    zip_decoder_benchmark::set_files(files.data(), files.size());
+  }
+
+  for (unsigned i = 0; i != num_benchmarks; ++i) {
+    bool wanted = names.empty();
+    for (unsigned j = 0; j != names.size(); ++j) {
+      if (!strcmp(names[j], benchmarks[i].name)) wanted = true;
+    }
+    if (wanted) {
+      benchmarks[i].run(stdout);
+      printf("\n");
+    }
+  }
+}
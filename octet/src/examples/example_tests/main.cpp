@@ -0,0 +1,52 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Tests for the loaders and scene
+//
+// bin/example_tests                   run them all
+// bin/example_tests gif_decoder       run one of them
+//
+// the exit code is non-zero if any of them fail.
+//
+
+#include "../../octet.h"
+
+#include "../../loaders/gif_decoder_test.h"
+#include "../../scene/image_test.h"
+
+/// Run the tests named on the command line, or all of them.
+int main(int argc, char **argv) {
+  using namespace octet;
+
+  struct test_t {
+    const char *name;
+    bool (*run)(FILE *file);
+  };
+
+  static const test_t tests[] = {
+    { "gif_decoder", &gif_decoder_test::run },
+    { "image", &image_test::run },
+  };
+  unsigned num_tests = sizeof(tests)/sizeof(tests[0]);
+
+  // the url_loader and the decoders use the job scheduler.
+  job_scheduler::create();
+
+  unsigned num_failed = 0;
+  for (unsigned i = 0; i != num_tests; ++i) {
+    bool wanted = argc < 2;
+    for (int j = 1; j < argc; ++j) {
+      if (!strcmp(argv[j], tests[i].name)) wanted = true;
+    }
+    if (wanted) {
+      if (!tests[i].run(stdout)) num_failed++;
+      printf("\n");
+    }
+  }
+
+  printf("%s\n", num_failed ? "FAILED" : "all tests passed");
+  return num_failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// pack the files used by a scene into one zip file.
+//
+// one large file read from start to finish loads much faster than many small ones,
+// especially from a spinning disk, so the files are stored in the order they are loaded.
+//
+
+namespace octet { namespace helpers {
+  /// Bundle tool: packs assets into a zip file in load order.
+  ///
+  /// Run it in the app that builds the scene, as the scene only exists at run time.
+  /// Then load the assets with zip:// urls, eg. "zip://assets/duck.zip/assets/duckCM.gif".
+  ///
+  /// Example:
+  ///
+  ///     asset_bundler bundle;
+  ///     bundle.add_url("assets/duck_triangulate.dae");  // files loaded by code
+  ///     bundle.add_resources(app_scene);                // files used by the scene
+  ///     bundle.write("assets/duck.zip");
+  class asset_bundler {
+    dynarray<string> urls;
+
+    // a file ready to be written
+    struct packed_file {
+      dynarray<uint8_t> data;
+      uint32_t crc;
+      size_t usize;
+      unsigned compression;
+    };
+
+  public:
+    asset_bundler() {
+    }
+
+    /// Add a file that is loaded by code rather than referenced by a resource.
+    void add_url(const char *url) {
+      for (unsigned i = 0; i != urls.size(); ++i) {
+        if (urls[i] == url) return;
+      }
+      urls.push_back(string(url));
+    }
+
+    /// Add the files used by a graph of resources (a visual_scene or resource_dict, for example).
+    void add_resources(resource *root) {
+      dynarray<string> found;
+      url_finder finder(found);
+      ref<resource> root_ref = root;
+      finder.visit(root_ref, atom_);
+      for (unsigned i = 0; i != found.size(); ++i) {
+        add_url(found[i].c_str());
+      }
+    }
+
+    /// Number of files to pack.
+    unsigned get_num_urls() const {
+      return (unsigned)urls.size();
+    }
+
+    /// A file to pack, in load order.
+    const char *get_url(unsigned index) const {
+      return urls[index].c_str();
+    }
+
+    /// Write the zip file. Files are compressed in parallel on the job scheduler
+    /// and written in load order. Returns false if a file is missing or the write failed.
+    bool write(const char *filename, int level = 6) {
+      unsigned num_files = (unsigned)urls.size();
+      dynarray<packed_file> files(num_files);
+      std::atomic<int> num_missing(0);
+
+      job_scheduler::get().parallel_for(0, num_files, 1, [&](unsigned i0, unsigned i1) {
+        zip_encoder encoder;
+        for (unsigned i = i0; i != i1; ++i) {
+          packed_file &f = files[i];
+          ref<file_map> map = app_utils::map_url(urls[i].c_str());
+          const uint8_t *src = map->get_data();
+          f.usize = (size_t)map->get_size();
+          f.crc = zip_writer::crc32(src, f.usize);
+          f.compression = 0;
+          if (f.usize == 0) {
+            num_missing++;
+            continue;
+          }
+          if (level > 0) {
+            encoder.encode(f.data, src, src + f.usize, level);
+            if (f.data.size() < f.usize) {
+              f.compression = 8;
+              continue;
+            }
+          }
+          f.data.resize(f.usize);
+          memcpy(f.data.data(), src, f.usize);
+        }
+      });
+
+      zip_writer zip(filename);
+      size_t total_usize = 0, total_csize = 0;
+      for (unsigned i = 0; i != num_files; ++i) {
+        const packed_file &f = files[i];
+        if (f.usize == 0) {
+          printf("asset_bundler: %s not found\n", urls[i].c_str());
+          continue;
+        }
+        zip.add_compressed_file(urls[i].c_str(), f.data.data(), f.data.size(), f.usize, f.crc, f.compression);
+        total_usize += f.usize;
+        total_csize += f.data.size();
+      }
+      bool ok = zip.close();
+      printf("asset_bundler: %s: %d files, %llu bytes -> %llu bytes\n", filename, num_files - (int)num_missing, (unsigned long long)total_usize, (unsigned long long)total_csize);
+      return ok && num_missing == 0;
+    }
+  };
+} }
@@ -32,33 +32,33 @@ namespace octet { namespace helpers {
     }
 
     void parse_http_request(session &s, char *p) {
-      string header(p);
-
-      dynarray<string> lines;
+      // split the request into views of the receive buffer; no strings are made.
+      dynarray<string_view> lines;
       lines.reserve(32);
-      header.split(lines, "\n");
+      split(lines, p, "\n");
       if (lines.size() == 0) return;
 
-      dynarray<string> line0;
-      lines[0].split(line0, " ");
+      dynarray<string_view> line0;
+      split(line0, lines[0], " ");
       if (line0.size() < 3) return;
       if (line0[0] != "GET") return;
 
-      log("http get from: %s\n", line0[1].c_str());
+      log("http get from: %.*s\n", (int)line0[1].size(), line0[1].data());
 
       // /graph?operation=get_children&id=1
-      dynarray<string> url;
-      line0[1].split(url, "?");
+      dynarray<string_view> url;
+      split(url, line0[1], "?");
       if (url.size() < 2) return;
 
-      dynarray<string> ops;
-      url[1].split(ops, "&");
+      dynarray<string_view> ops;
+      split(ops, url[1], "&");
       string id;
       string callback;
       bool get_children = false;
+      dynarray<string_view> lhsrhs;
       for (unsigned i = 0; i != ops.size(); ++i) {
-        dynarray<string> lhsrhs;
-        ops[i].split(lhsrhs, "=");
+        split(lhsrhs, ops[i], "=");
+        if (lhsrhs.size() < 2) continue;
         if (lhsrhs[0] == "operation") {
           get_children = lhsrhs[1] == "get_children";
         } else if (lhsrhs[0] == "id") {
@@ -66,7 +66,6 @@ namespace octet { namespace helpers {
         } else if (lhsrhs[0] == "callback") {
           callback = lhsrhs[1];
         }
-        //log("%s = %s\n", lhsrhs[0].c_str(), lhsrhs[1].c_str());
       }
 
       if (!get_children) return;
@@ -0,0 +1,651 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// block compression for GPU textures: BC1 (DXT1), BC3 (DXT5), BC4, BC5 and BC7
+//
+// Each 4x4 block is range fitted along the principal axis of its colours,
+// then the endpoints are refined by least squares on the chosen palette indices.
+// BC7 uses mode 6 only: one pair of RGBA endpoints and 16 levels.
+//
+// See https://msdn.microsoft.com/en-us/library/windows/desktop/bb694531.aspx
+//
+namespace octet { namespace loaders {
+  class bc_encoder {
+  public:
+    // these are here to avoid including glext.h which may be platform dependent.
+    enum {
+      COMPRESSED_RGB_S3TC_DXT1_EXT = 0x83F0,
+      COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
+      COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
+      COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
+      COMPRESSED_RED_RGTC1 = 0x8DBB,
+      COMPRESSED_RG_RGTC2 = 0x8DBD,
+      COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C,
+    };
+
+    /// Changes whenever the output changes, so that cached textures can be thrown away.
+    enum { version = 1 };
+
+    /// SIMD levels for set_simd_level()
+    enum { simd_none, simd_sse2 };
+
+  private:
+    // sixteen pixels, one array per channel
+    struct block {
+      float c[4][16];
+    };
+
+    // a way of coding the endpoints and indices of a block
+    struct mode_t {
+      unsigned num_channels;
+      unsigned num_entries;
+
+      // position of each palette entry between the endpoints, or -1 for a constant entry
+      float weights[16];
+
+      // round the endpoints to the values the format can store
+      void (*quantize)(int ends[2][4], const float e[2][4]);
+
+      // the colours the GPU will decode from a pair of endpoints
+      void (*make_palette)(float palette[4][16], const int ends[2][4]);
+    };
+
+    // the nearest palette entry to each pixel and its squared distance
+    typedef void (*fit_indices_fn)(uint8_t *indices, float *errors, const block &b, const float palette[4][16], unsigned num_entries);
+
+    // SIMD versions of the inner loop for 1 to 4 channels. See set_simd_level()
+    struct kernel_table {
+      fit_indices_fn fit_indices[4];
+
+      // a block of RGBA pixels that is inside the image
+      void (*load_rgba)(block &b, const uint8_t *src, size_t stride);
+    };
+
+    const kernel_table *kernels;
+    unsigned refine_iterations;
+
+    template <unsigned num_channels> static void fit_indices_scalar(uint8_t *indices, float *errors, const block &b, const float palette[4][16], unsigned num_entries) {
+      for (unsigned i = 0; i != 16; ++i) {
+        float best = 1e30f;
+        unsigned best_index = 0;
+        for (unsigned j = 0; j != num_entries; ++j) {
+          float d = b.c[0][i] - palette[0][j];
+          float dist = d * d;
+          for (unsigned k = 1; k != num_channels; ++k) {
+            d = b.c[k][i] - palette[k][j];
+            dist = dist + d * d;
+          }
+          if (dist < best) {
+            best = dist;
+            best_index = j;
+          }
+        }
+        indices[i] = (uint8_t)best_index;
+        errors[i] = best;
+      }
+    }
+
+    static void load_rgba_scalar(block &b, const uint8_t *src, size_t stride) {
+      for (unsigned j = 0; j != 4; ++j) {
+        const uint8_t *p = src + j * stride;
+        for (unsigned i = 0; i != 4; ++i) {
+          for (unsigned k = 0; k != 4; ++k) {
+            b.c[k][j*4+i] = p[i*4+k];
+          }
+        }
+      }
+    }
+
+    #if OCTET_SSE2
+      static void load_rgba_sse2(block &b, const uint8_t *src, size_t stride) {
+        __m128i mask = _mm_set1_epi32(0xff);
+        for (unsigned j = 0; j != 4; ++j) {
+          __m128i v = _mm_loadu_si128((const __m128i*)(src + j * stride));
+          _mm_storeu_ps(b.c[0] + j * 4, _mm_cvtepi32_ps(_mm_and_si128(v, mask)));
+          _mm_storeu_ps(b.c[1] + j * 4, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask)));
+          _mm_storeu_ps(b.c[2] + j * 4, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask)));
+          _mm_storeu_ps(b.c[3] + j * 4, _mm_cvtepi32_ps(_mm_srli_epi32(v, 24)));
+        }
+      }
+
+      // four pixels at a time. The sums are done in the same order as the scalar code,
+      // so the results are the same.
+      template <unsigned num_channels> static void fit_indices_sse2(uint8_t *indices, float *errors, const block &b, const float palette[4][16], unsigned num_entries) {
+        for (unsigned i = 0; i != 16; i += 4) {
+          __m128 px[4];
+          for (unsigned k = 0; k != num_channels; ++k) {
+            px[k] = _mm_loadu_ps(b.c[k] + i);
+          }
+          __m128 best = _mm_set1_ps(1e30f);
+          __m128i best_index = _mm_setzero_si128();
+          for (unsigned j = 0; j != num_entries; ++j) {
+            __m128 d = _mm_sub_ps(px[0], _mm_set1_ps(palette[0][j]));
+            __m128 dist = _mm_mul_ps(d, d);
+            for (unsigned k = 1; k != num_channels; ++k) {
+              d = _mm_sub_ps(px[k], _mm_set1_ps(palette[k][j]));
+              dist = _mm_add_ps(dist, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+            best = _mm_min_ps(dist, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)j)), _mm_andnot_si128(closer, best_index));
+          }
+          _mm_storeu_ps(errors + i, best);
+          __m128i packed = _mm_packs_epi32(best_index, best_index);
+          packed = _mm_packus_epi16(packed, packed);
+          int four = _mm_cvtsi128_si32(packed);
+          memcpy(indices + i, &four, 4);
+        }
+      }
+    #endif
+
+    // choose the best kernels for this cpu, up to "level".
+    static const kernel_table *get_kernels(unsigned level) {
+      static const kernel_table scalar = { { fit_indices_scalar<1>, fit_indices_scalar<2>, fit_indices_scalar<3>, fit_indices_scalar<4> }, load_rgba_scalar };
+      #if OCTET_SSE2
+        static const kernel_table sse2 = { { fit_indices_sse2<1>, fit_indices_sse2<2>, fit_indices_sse2<3>, fit_indices_sse2<4> }, load_rgba_sse2 };
+        if (level >= simd_sse2) return &sse2;
+      #endif
+      return &scalar;
+    }
+
+    static int clamp_int(float x, int max) {
+      int i = (int)(x + 0.5f);
+      return i < 0 ? 0 : i > max ? max : i;
+    }
+
+    // 5:6:5 endpoints, expanded to eight bits as the GPU does.
+    static void quantize_565(int ends[2][4], const float e[2][4]) {
+      for (unsigned i = 0; i != 2; ++i) {
+        int r = clamp_int(e[i][0] * (31.0f / 255), 31);
+        int g = clamp_int(e[i][1] * (63.0f / 255), 63);
+        int b = clamp_int(e[i][2] * (31.0f / 255), 31);
+        ends[i][0] = (r << 3) | (r >> 2);
+        ends[i][1] = (g << 2) | (g >> 4);
+        ends[i][2] = (b << 3) | (b >> 2);
+        ends[i][3] = 255;
+      }
+    }
+
+    static void quantize_8bit(int ends[2][4], const float e[2][4]) {
+      for (unsigned i = 0; i != 2; ++i) {
+        for (unsigned k = 0; k != 4; ++k) {
+          ends[i][k] = clamp_int(e[i][k], 255);
+        }
+      }
+    }
+
+    // seven bits per channel and one shared low bit per endpoint, choosing the better low bit.
+    static void quantize_7p(int ends[2][4], const float e[2][4]) {
+      for (unsigned i = 0; i != 2; ++i) {
+        int best[4];
+        float best_error = 1e30f;
+        for (int p = 0; p != 2; ++p) {
+          int v[4];
+          float error = 0;
+          for (unsigned k = 0; k != 4; ++k) {
+            v[k] = (clamp_int((e[i][k] - p) * 0.5f, 127) << 1) | p;
+            float d = v[k] - e[i][k];
+            error += d * d;
+          }
+          if (error < best_error) {
+            best_error = error;
+            memcpy(best, v, sizeof(best));
+          }
+        }
+        memcpy(ends[i], best, sizeof(best));
+      }
+    }
+
+    static void palette_bc1(float palette[4][16], const int ends[2][4]) {
+      for (unsigned k = 0; k != 3; ++k) {
+        float e0 = (float)ends[0][k], e1 = (float)ends[1][k];
+        palette[k][0] = e0;
+        palette[k][1] = e1;
+        palette[k][2] = (e0 * 2 + e1) * (1.0f / 3);
+        palette[k][3] = (e0 + e1 * 2) * (1.0f / 3);
+      }
+    }
+
+    // eight levels
+    static void palette_bc4(float palette[4][16], const int ends[2][4]) {
+      float e0 = (float)ends[0][0], e1 = (float)ends[1][0];
+      palette[0][0] = e0;
+      palette[0][1] = e1;
+      for (unsigned i = 2; i != 8; ++i) {
+        palette[0][i] = (e0 * (8 - i) + e1 * (i - 1)) * (1.0f / 7);
+      }
+    }
+
+    // six levels, black and white
+    static void palette_bc4_6(float palette[4][16], const int ends[2][4]) {
+      float e0 = (float)ends[0][0], e1 = (float)ends[1][0];
+      palette[0][0] = e0;
+      palette[0][1] = e1;
+      for (unsigned i = 2; i != 6; ++i) {
+        palette[0][i] = (e0 * (6 - i) + e1 * (i - 1)) * (1.0f / 5);
+      }
+      palette[0][6] = 0;
+      palette[0][7] = 255;
+    }
+
+    static const uint8_t *bc7_weights() {
+      static const uint8_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+      return weights;
+    }
+
+    static void palette_bc7(float palette[4][16], const int ends[2][4]) {
+      const uint8_t *weights = bc7_weights();
+      for (unsigned k = 0; k != 4; ++k) {
+        for (unsigned i = 0; i != 16; ++i) {
+          palette[k][i] = (float)((ends[0][k] * (64 - weights[i]) + ends[1][k] * weights[i] + 32) >> 6);
+        }
+      }
+    }
+
+    static const mode_t &mode_bc1() {
+      static const mode_t mode = { 3, 4, { 0, 1, 1.0f/3, 2.0f/3 }, quantize_565, palette_bc1 };
+      return mode;
+    }
+
+    static const mode_t &mode_bc4() {
+      static const mode_t mode = { 1, 8, { 0, 1, 1.0f/7, 2.0f/7, 3.0f/7, 4.0f/7, 5.0f/7, 6.0f/7 }, quantize_8bit, palette_bc4 };
+      return mode;
+    }
+
+    static const mode_t &mode_bc4_6() {
+      static const mode_t mode = { 1, 8, { 0, 1, 1.0f/5, 2.0f/5, 3.0f/5, 4.0f/5, -1, -1 }, quantize_8bit, palette_bc4_6 };
+      return mode;
+    }
+
+    // the weights are bc7_weights() / 64.
+    static const mode_t &mode_bc7() {
+      static const mode_t mode = {
+        4, 16, {
+          0, 4.0f/64, 9.0f/64, 13.0f/64, 17.0f/64, 21.0f/64, 26.0f/64, 30.0f/64,
+          34.0f/64, 38.0f/64, 43.0f/64, 47.0f/64, 51.0f/64, 55.0f/64, 60.0f/64, 1
+        },
+        quantize_7p, palette_bc7
+      };
+      return mode;
+    }
+
+    // copy a block of pixels, repeating the edge pixels of the image to fill it.
+    void load_block(block &b, const uint8_t *src, unsigned x, unsigned y, unsigned width, unsigned height, unsigned num_comps) const {
+      if (num_comps == 4 && x + 4 <= width && y + 4 <= height) {
+        kernels->load_rgba(b, src + ((size_t)y * width + x) * 4, (size_t)width * 4);
+        return;
+      }
+      for (unsigned j = 0; j != 4; ++j) {
+        unsigned sy = y + j < height ? y + j : height - 1;
+        for (unsigned i = 0; i != 4; ++i) {
+          unsigned sx = x + i < width ? x + i : width - 1;
+          const uint8_t *p = src + (sy * width + sx) * num_comps;
+          for (unsigned k = 0; k != 4; ++k) {
+            b.c[k][j*4+i] = k < num_comps ? p[k] : 255.0f;
+          }
+        }
+      }
+    }
+
+    // sum of a[i] * b[i], in four parts so that the adds do not wait for each other.
+    static float dot16(const float *a, const float *b) {
+      float sum[4] = { 0, 0, 0, 0 };
+      for (unsigned i = 0; i != 16; i += 4) {
+        for (unsigned j = 0; j != 4; ++j) sum[j] += a[i + j] * b[i + j];
+      }
+      return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    }
+
+    // range fit: the extremes of the pixels along the principal axis of their colours.
+    template <unsigned num_channels> static void range_fit(float e[2][4], const block &b, unsigned first) {
+      const float (*c)[16] = b.c + first;
+      static const float ones[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+      float mean[4], lo[4], hi[4];
+      for (unsigned k = 0; k != num_channels; ++k) {
+        mean[k] = dot16(c[k], ones) * (1.0f / 16);
+        lo[k] = hi[k] = c[k][0];
+        for (unsigned i = 1; i != 16; ++i) {
+          lo[k] = c[k][i] < lo[k] ? c[k][i] : lo[k];
+          hi[k] = c[k][i] > hi[k] ? c[k][i] : hi[k];
+        }
+      }
+
+      if (num_channels == 1) {
+        e[0][0] = lo[0];
+        e[1][0] = hi[0];
+        return;
+      }
+
+      float d[4][16];
+      for (unsigned k = 0; k != num_channels; ++k) {
+        for (unsigned i = 0; i != 16; ++i) d[k][i] = c[k][i] - mean[k];
+      }
+
+      float cov[4][4];
+      for (unsigned k = 0; k != num_channels; ++k) {
+        for (unsigned l = k; l != num_channels; ++l) {
+          cov[k][l] = cov[l][k] = dot16(d[k], d[l]);
+        }
+      }
+
+      // power method, starting with the bounding box diagonal.
+      // the matrix is scaled so that the axis can not overflow, so it only needs normalising at the end.
+      float max_cov = 0;
+      for (unsigned k = 0; k != num_channels; ++k) max_cov = cov[k][k] > max_cov ? cov[k][k] : max_cov;
+      if (max_cov < 1e-6f) {
+        for (unsigned k = 0; k != num_channels; ++k) e[0][k] = e[1][k] = mean[k];
+        return;
+      }
+      float rmax = 1.0f / max_cov;
+      float axis[4];
+      for (unsigned k = 0; k != num_channels; ++k) {
+        axis[k] = hi[k] - lo[k];
+        for (unsigned l = 0; l != num_channels; ++l) cov[k][l] *= rmax;
+      }
+      for (unsigned iter = 0; iter != 4; ++iter) {
+        float next[4];
+        for (unsigned k = 0; k != num_channels; ++k) {
+          float sum = 0;
+          for (unsigned l = 0; l != num_channels; ++l) sum += cov[k][l] * axis[l];
+          next[k] = sum;
+        }
+        for (unsigned k = 0; k != num_channels; ++k) axis[k] = next[k];
+      }
+
+      float len2 = 0;
+      for (unsigned k = 0; k != num_channels; ++k) len2 += axis[k] * axis[k];
+      if (len2 < 1e-12f) {
+        for (unsigned k = 0; k != num_channels; ++k) e[0][k] = e[1][k] = mean[k];
+        return;
+      }
+      float scale = 1.0f / sqrtf(len2);
+      for (unsigned k = 0; k != num_channels; ++k) axis[k] *= scale;
+
+      float p[16];
+      for (unsigned i = 0; i != 16; ++i) p[i] = d[0][i] * axis[0];
+      for (unsigned k = 1; k != num_channels; ++k) {
+        for (unsigned i = 0; i != 16; ++i) p[i] += d[k][i] * axis[k];
+      }
+      float pmin = p[0], pmax = p[0];
+      for (unsigned i = 1; i != 16; ++i) {
+        pmin = p[i] < pmin ? p[i] : pmin;
+        pmax = p[i] > pmax ? p[i] : pmax;
+      }
+      for (unsigned k = 0; k != num_channels; ++k) {
+        e[0][k] = mean[k] + axis[k] * pmin;
+        e[1][k] = mean[k] + axis[k] * pmax;
+      }
+    }
+
+    // the endpoints that best fit the pixels for the chosen indices, by least squares.
+    static bool refine(float e[2][4], const block &b, unsigned first, const mode_t &m, const uint8_t *indices) {
+      float aa = 0, ab = 0, bb = 0;
+      float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+      for (unsigned i = 0; i != 16; ++i) {
+        float w = m.weights[indices[i]];
+        if (w < 0) continue;
+        float v = 1 - w;
+        aa += v * v;
+        ab += v * w;
+        bb += w * w;
+        for (unsigned k = 0; k != m.num_channels; ++k) {
+          ax[k] += v * b.c[first + k][i];
+          bx[k] += w * b.c[first + k][i];
+        }
+      }
+      float det = aa * bb - ab * ab;
+      if (fabsf(det) < 1e-6f) return false;
+      float rdet = 1.0f / det;
+      for (unsigned k = 0; k != m.num_channels; ++k) {
+        float e0 = (bb * ax[k] - ab * bx[k]) * rdet;
+        float e1 = (aa * bx[k] - ab * ax[k]) * rdet;
+        e[0][k] = e0 < 0 ? 0 : e0 > 255 ? 255 : e0;
+        e[1][k] = e1 < 0 ? 0 : e1 > 255 ? 255 : e1;
+      }
+      return true;
+    }
+
+    // find endpoints and indices for one set of channels of a block. returns the squared error.
+    float fit(int ends[2][4], uint8_t *indices, const block &b, unsigned first, const mode_t &m, float e[2][4]) const {
+      float palette[4][16];
+      const block *src = &b;
+      block shifted;
+      if (first) {
+        // the kernels work on channels 0..num_channels-1
+        for (unsigned k = 0; k != m.num_channels; ++k) memcpy(shifted.c[k], b.c[first + k], sizeof(shifted.c[k]));
+        src = &shifted;
+      }
+
+      fit_indices_fn fit_indices = kernels->fit_indices[m.num_channels - 1];
+      float errors[16];
+      m.quantize(ends, e);
+      m.make_palette(palette, ends);
+      fit_indices(indices, errors, *src, palette, m.num_entries);
+      float best = 0;
+      for (unsigned i = 0; i != 16; ++i) best += errors[i];
+
+      for (unsigned iter = 0; iter != refine_iterations && best > 0; ++iter) {
+        int new_ends[2][4];
+        uint8_t new_indices[16];
+        if (!refine(e, *src, 0, m, indices)) break;
+        m.quantize(new_ends, e);
+        if (!memcmp(new_ends, ends, sizeof(new_ends))) break;
+        m.make_palette(palette, new_ends);
+        fit_indices(new_indices, errors, *src, palette, m.num_entries);
+        float error = 0;
+        for (unsigned i = 0; i != 16; ++i) error += errors[i];
+        if (error >= best) break;
+        best = error;
+        memcpy(ends, new_ends, sizeof(new_ends));
+        memcpy(indices, new_indices, 16);
+      }
+      return best;
+    }
+
+    static void write16(uint8_t *dest, unsigned value) {
+      dest[0] = (uint8_t)value;
+      dest[1] = (uint8_t)(value >> 8);
+    }
+
+    void encode_bc1(uint8_t *dest, const block &b) const {
+      float e[2][4];
+      int ends[2][4];
+      uint8_t indices[16];
+      range_fit<3>(e, b, 0);
+      fit(ends, indices, b, 0, mode_bc1(), e);
+
+      unsigned c0 = ((ends[0][0] >> 3) << 11) | ((ends[0][1] >> 2) << 5) | (ends[0][2] >> 3);
+      unsigned c1 = ((ends[1][0] >> 3) << 11) | ((ends[1][1] >> 2) << 5) | (ends[1][2] >> 3);
+
+      // c0 > c1 selects four colours.
+      static const uint8_t swapped[4] = { 1, 0, 3, 2 };
+      if (c0 < c1) {
+        unsigned t = c0; c0 = c1; c1 = t;
+        for (unsigned i = 0; i != 16; ++i) indices[i] = swapped[indices[i]];
+      } else if (c0 == c1) {
+        memset(indices, 0, 16);
+      }
+
+      write16(dest, c0);
+      write16(dest + 2, c1);
+      uint32_t bits = 0;
+      for (unsigned i = 0; i != 16; ++i) bits |= indices[i] << (i * 2);
+      for (unsigned i = 0; i != 4; ++i) dest[4 + i] = (uint8_t)(bits >> (i * 8));
+    }
+
+    void encode_bc4(uint8_t *dest, const block &b, unsigned channel) const {
+      float e[2][4];
+      int ends[2][4];
+      uint8_t indices[16];
+      range_fit<1>(e, b, channel);
+      float error = fit(ends, indices, b, channel, mode_bc4(), e);
+      bool six = false;
+
+      // blocks with black or white may do better with the six level mode, which has them as constants.
+      float lo = e[0][0], hi = e[1][0];
+      if (error > 0 && (lo < 16 || hi > 239)) {
+        float e6[2][4] = { { 255 }, { 0 } };
+        for (unsigned i = 0; i != 16; ++i) {
+          float v = b.c[channel][i];
+          if (v > 0 && v < 255) {
+            e6[0][0] = v < e6[0][0] ? v : e6[0][0];
+            e6[1][0] = v > e6[1][0] ? v : e6[1][0];
+          }
+        }
+        if (e6[0][0] > e6[1][0]) e6[0][0] = e6[1][0] = 0;
+        int ends6[2][4];
+        uint8_t indices6[16];
+        float error6 = fit(ends6, indices6, b, channel, mode_bc4_6(), e6);
+        if (error6 < error) {
+          six = true;
+          memcpy(ends, ends6, sizeof(ends));
+          memcpy(indices, indices6, 16);
+        }
+      }
+
+      int a0 = ends[0][0], a1 = ends[1][0];
+      if (!six) {
+        // a0 > a1 selects eight levels.
+        static const uint8_t swapped[8] = { 1, 0, 7, 6, 5, 4, 3, 2 };
+        if (a0 < a1) {
+          int t = a0; a0 = a1; a1 = t;
+          for (unsigned i = 0; i != 16; ++i) indices[i] = swapped[indices[i]];
+        } else if (a0 == a1) {
+          memset(indices, 0, 16);
+        }
+      } else if (a0 > a1) {
+        static const uint8_t swapped[8] = { 1, 0, 5, 4, 3, 2, 6, 7 };
+        int t = a0; a0 = a1; a1 = t;
+        for (unsigned i = 0; i != 16; ++i) indices[i] = swapped[indices[i]];
+      }
+
+      dest[0] = (uint8_t)a0;
+      dest[1] = (uint8_t)a1;
+      uint64_t bits = 0;
+      for (unsigned i = 0; i != 16; ++i) bits |= (uint64_t)indices[i] << (i * 3);
+      for (unsigned i = 0; i != 6; ++i) dest[2 + i] = (uint8_t)(bits >> (i * 8));
+    }
+
+    // mode 6: 7 mode bits, 7 bit RGBA endpoints, two p-bits and 4 bit indices.
+    void encode_bc7(uint8_t *dest, const block &b) const {
+      float e[2][4];
+      int ends[2][4];
+      uint8_t indices[16];
+      range_fit<4>(e, b, 0);
+      fit(ends, indices, b, 0, mode_bc7(), e);
+
+      // the top bit of the first index is implied zero.
+      if (indices[0] & 8) {
+        for (unsigned k = 0; k != 4; ++k) {
+          int t = ends[0][k]; ends[0][k] = ends[1][k]; ends[1][k] = t;
+        }
+        for (unsigned i = 0; i != 16; ++i) indices[i] = (uint8_t)(15 - indices[i]);
+      }
+
+      uint64_t lo = 1 << 6, hi = 0;
+      unsigned pos = 7;
+      for (unsigned k = 0; k != 4; ++k) {
+        lo |= (uint64_t)(ends[0][k] >> 1) << pos; pos += 7;
+        lo |= (uint64_t)(ends[1][k] >> 1) << pos; pos += 7;
+      }
+      lo |= (uint64_t)(ends[0][0] & 1) << 63;
+      hi |= (uint64_t)(ends[1][0] & 1);
+      pos = 1;
+      for (unsigned i = 0; i != 16; ++i) {
+        hi |= (uint64_t)indices[i] << pos;
+        pos += i == 0 ? 3 : 4;
+      }
+      for (unsigned i = 0; i != 8; ++i) {
+        dest[i] = (uint8_t)(lo >> (i * 8));
+        dest[8 + i] = (uint8_t)(hi >> (i * 8));
+      }
+    }
+
+    void encode_block(uint8_t *dest, unsigned format, const block &b) const {
+      switch (format) {
+        case COMPRESSED_RGB_S3TC_DXT1_EXT: encode_bc1(dest, b); break;
+        case COMPRESSED_RGBA_S3TC_DXT5_EXT: encode_bc4(dest, b, 3); encode_bc1(dest + 8, b); break;
+        case COMPRESSED_RED_RGTC1: encode_bc4(dest, b, 0); break;
+        case COMPRESSED_RG_RGTC2: encode_bc4(dest, b, 0); encode_bc4(dest + 8, b, 1); break;
+        case COMPRESSED_RGBA_BPTC_UNORM: encode_bc7(dest, b); break;
+      }
+    }
+
+    // run fn(i0, i1) over [begin, end) on the job scheduler.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned grain, const fn_t &fn) const {
+      resources::job_scheduler::get().parallel_for(begin, end, grain, fn);
+    }
+
+  public:
+    bc_encoder() {
+      kernels = get_kernels(simd_sse2);
+      refine_iterations = 4;
+    }
+
+    /// The encoder uses the fastest code the cpu supports.
+    /// Use this to choose slower code for testing and benchmarks.
+    void set_simd_level(unsigned level) {
+      kernels = get_kernels(level);
+    }
+
+    /// Number of least squares passes on the endpoints of each block. Zero is fastest.
+    void set_refine_iterations(unsigned iterations) {
+      refine_iterations = iterations;
+    }
+
+    /// Bytes per 4x4 block, or zero if the format is not a block format.
+    static unsigned get_block_bytes(unsigned format) {
+      switch (format) {
+        case COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case COMPRESSED_RED_RGTC1:
+          return 8;
+        case COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case COMPRESSED_RG_RGTC2:
+        case COMPRESSED_RGBA_BPTC_UNORM:
+          return 16;
+      }
+      return 0;
+    }
+
+    /// Size of one compressed image.
+    static size_t get_size(unsigned format, unsigned width, unsigned height) {
+      return (size_t)((width + 3) / 4) * ((height + 3) / 4) * get_block_bytes(format);
+    }
+
+    /// Return true if encode() can make this format.
+    static bool can_encode(unsigned format) {
+      return format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+        format == COMPRESSED_RED_RGTC1 || format == COMPRESSED_RG_RGTC2 || format == COMPRESSED_RGBA_BPTC_UNORM;
+    }
+
+    /// Compress one RGB or RGBA image (num_comps = 3 or 4) into get_size() bytes at dest.
+    ///
+    /// BC1 uses RGB, BC3 and BC7 use RGBA, BC4 uses red and BC5 red and green.
+    /// Rows of blocks are compressed in parallel on the job scheduler.
+    void encode(uint8_t *dest, unsigned format, const uint8_t *src, unsigned width, unsigned height, unsigned num_comps) const {
+      unsigned blocks_x = (width + 3) / 4;
+      unsigned blocks_y = (height + 3) / 4;
+      unsigned block_bytes = get_block_bytes(format);
+      if (!can_encode(format) || !width || !height) return;
+
+      // about 256 blocks per job
+      unsigned grain = 256 / blocks_x + 1;
+      parallel_for(0, blocks_y, grain, [&](unsigned y0, unsigned y1) {
+        block b;
+        for (unsigned by = y0; by != y1; ++by) {
+          uint8_t *row = dest + (size_t)by * blocks_x * block_bytes;
+          for (unsigned bx = 0; bx != blocks_x; ++bx) {
+            load_block(b, src, bx * 4, by * 4, width, height, num_comps);
+            encode_block(row + bx * block_bytes, format, b);
+          }
+        }
+      });
+    }
+  };
+}}
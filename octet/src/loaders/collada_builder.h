@@ -544,7 +544,7 @@ namespace octet { namespace loaders {
           dynarray<scene_node*> nodes;
           dynarray<int> parents;
           node->get_all_child_nodes(nodes, parents);
-          for (int i = 0; i != nodes.size(); ++i) {
+          for (unsigned i = 0; i != nodes.size(); ++i) {
             scene_node *node = nodes[i];
             skel->add_bone(node, parents[i]);
           }
@@ -847,7 +847,7 @@ namespace octet { namespace loaders {
 
     // add matrices and instances
     void build_matrices(dynarray<TiXmlElement *> &node_elems, dynarray<scene_node *> &nodes, resource_dict &dict, visual_scene &s) {
-      for (int ni = 0; ni != node_elems.size(); ++ni) {
+      for (unsigned ni = 0; ni != node_elems.size(); ++ni) {
         TiXmlElement *node_elem = node_elems[ni];
         scene_node *node = nodes[ni];
         mat4t &matrix = node->access_nodeToParent();
@@ -888,7 +888,7 @@ namespace octet { namespace loaders {
 
     // add instances
     void build_instances(dynarray<TiXmlElement *> &node_elems, dynarray<scene_node *> &nodes, resource_dict &dict, visual_scene &s) {
-      for (int ni = 0; ni != node_elems.size(); ++ni) {
+      for (unsigned ni = 0; ni != node_elems.size(); ++ni) {
         TiXmlElement *node_elem = node_elems[ni];
         scene_node *node = nodes[ni];
 
@@ -1168,16 +1168,16 @@ namespace octet { namespace loaders {
       }
       if (0) {
         FILE *f = log("raw weights & indices\n");
-        for (int i = 0; i != skin->raw_indices.size(); ++i) {
+        for (unsigned i = 0; i != skin->raw_indices.size(); ++i) {
           fprintf(f, "ri %d %d\n", i, skin->raw_indices[i]);
         }
-        for (int i = 0; i != skin->raw_weights.size(); ++i) {
+        for (unsigned i = 0; i != skin->raw_weights.size(); ++i) {
           fprintf(f, "rw %d %f\n", i, skin->raw_weights[i]);
         }
-        for (int i = 0; i != skin->gl_indices.size(); ++i) {
+        for (unsigned i = 0; i != skin->gl_indices.size(); ++i) {
           fprintf(f, "i %d %d\n", i, skin->gl_indices[i]);
         }
-        for (int i = 0; i != skin->gl_weights.size(); ++i) {
+        for (unsigned i = 0; i != skin->gl_weights.size(); ++i) {
           fprintf(f, "w %d %f\n", i, skin->gl_weights[i]);
         }
       }
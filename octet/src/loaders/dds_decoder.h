@@ -10,7 +10,7 @@
 
 namespace octet { namespace loaders {
   /// Class for loading DDS texture files
-  class dds_decoder {
+  class dds_decoder : public image_decoder {
     // http://en.wikipedia.org/wiki/DirectDraw_Surface
     // http://www.mindcontrol.org/~hplus/graphics/dds-info/
     //
@@ -186,12 +186,12 @@ namespace octet { namespace loaders {
       p2[2] = (s1 >> 16) & 0xff;
     }
 
-    void flip_dxt1(dynarray<uint8_t> &image, unsigned width, unsigned height) {
+    void flip_dxt1(uint8_t *image, size_t image_size, unsigned width, unsigned height) {
       unsigned offset = 0;
       while (width >= 4 && height >= 4) {
         unsigned xmax = width < 4 ? 1 : width/4;
         unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 8 > image.size()) break; 
+        if (offset + xmax * ymax * 8 > image_size) break; 
         for (unsigned y = 0; y < height/8; y++) {
           uint8_t *p1 = &image[offset + (y * xmax) * 8];
           uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 8];
@@ -211,12 +211,12 @@ namespace octet { namespace loaders {
       }
     }
 
-    void flip_dxt3(dynarray<uint8_t> &image, unsigned width, unsigned height) {
+    void flip_dxt3(uint8_t *image, size_t image_size, unsigned width, unsigned height) {
       unsigned offset = 0;
       while (width >= 4 && height >= 4) {
         unsigned xmax = width < 4 ? 1 : width/4;
         unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 16 > image.size()) break; 
+        if (offset + xmax * ymax * 16 > image_size) break; 
         for (unsigned y = 0; y < height/8; y++) {
           uint8_t *p1 = &image[offset + (y * xmax) * 16];
           uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 16];
@@ -246,12 +246,12 @@ namespace octet { namespace loaders {
       }
     }
 
-    void flip_dxt5(dynarray<uint8_t> &image, unsigned width, unsigned height) {
+    void flip_dxt5(uint8_t *image, size_t image_size, unsigned width, unsigned height) {
       unsigned offset = 0;
       while (width >= 4 && height >= 4) {
         unsigned xmax = width < 4 ? 1 : width/4;
         unsigned ymax = height < 4 ? 1 : height/4;
-        if (offset + xmax * ymax * 16 > image.size()) break; 
+        if (offset + xmax * ymax * 16 > image_size) break; 
         for (unsigned y = 0; y < height/8; y++) {
           uint8_t *p1 = &image[offset + (y * xmax) * 16];
           uint8_t *p2 = &image[offset + ((ymax - y - 1) * xmax) * 16];
@@ -278,42 +278,84 @@ namespace octet { namespace loaders {
         offset += xmax * ymax * 16;
       }
     }
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+    unsigned num_levels;
+
+    void reset() {
+      num_levels = 1;
+    }
+
+    // compressed textures are not much use until they are complete, so wait for the end.
+    bool decode(bool at_end) {
+      if (!at_end) return true;
+
       // convert the data
+      if (src_size < 128) return false;
+      const uint8_t *src = src_data;
       dds_header *header = (dds_header*)src;
 
-      if (le4(header->magic) != dds_magic) return;
+      if (le4(header->magic) != dds_magic) return false;
 
       unsigned pf_flags = le4(header->pf.flags);
 
       if (pf_flags & ddpf_fourcc) {
         uint8_t *fourcc = header->pf.fourcc;
         if (fourcc[0] == 'D' && fourcc[1] == 'X' && fourcc[2] == 'T') {
-          width = le4(header->width);
-          height = le4(header->height);
+          uint16_t width = le4(header->width);
+          uint16_t height = le4(header->height);
 
-          format =
+          uint16_t format =
             fourcc[3] == '1' ? COMPRESSED_RGB_S3TC_DXT1_EXT :
             fourcc[3] == '3' ? COMPRESSED_RGBA_S3TC_DXT3_EXT :
             fourcc[3] == '5' ? COMPRESSED_RGBA_S3TC_DXT5_EXT :
             0
           ;
-          unsigned size = (unsigned)(src_max - src - 128);
-          image.resize(size);
-          memcpy(&image[0], src + 128, size);
+          size_t size = src_size - 128;
+          uint8_t *image = begin_image(format, width, height, size);
+          memcpy(image, src + 128, size);
+
+          // the levels in the file, up to the mipmap count
+          unsigned max_levels = le4(header->flags) & ddsd_mipmapcount ? le4(header->mipmap_count) : 1;
+          unsigned block_bytes = format == COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+          size_t offset = 0;
+          num_levels = 0;
+          for (unsigned w = width, h = height; num_levels < max_levels && num_levels < 16; ++num_levels) {
+            offset += (size_t)((w + 3) / 4) * ((h + 3) / 4) * block_bytes;
+            if (offset > size) break;
+            w = w > 1 ? w >> 1 : 1;
+            h = h > 1 ? h >> 1 : 1;
+          }
+          num_levels = num_levels ? num_levels : 1;
 
           // dds textures are upside down, flip them!
           switch (format) {
-            case COMPRESSED_RGB_S3TC_DXT1_EXT: flip_dxt1(image, width, height); break;
-            case COMPRESSED_RGBA_S3TC_DXT3_EXT: flip_dxt3(image, width, height); break;
-            case COMPRESSED_RGBA_S3TC_DXT5_EXT: flip_dxt5(image, width, height); break;
+            case COMPRESSED_RGB_S3TC_DXT1_EXT: flip_dxt1(image, size, width, height); break;
+            case COMPRESSED_RGBA_S3TC_DXT3_EXT: flip_dxt3(image, size, width, height); break;
+            case COMPRESSED_RGBA_S3TC_DXT5_EXT: flip_dxt5(image, size, width, height); break;
           }
-          return;
+          return true;
         }
       }
       printf("warning: DDS decoder only supports DXTn\n");
+      return false;
+    }
+  public:
+    dds_decoder() {
+      reset();
+    }
+
+    /// Number of mipmap levels in the file.
+    unsigned get_num_levels() const {
+      return num_levels;
+    }
+
+    // get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      image.resize(0);
+      if (decode_file(image, src, src_max)) {
+        format = image_format;
+        width = image_width;
+        height = image_height;
+      }
     }
   };
 }}
@@ -7,204 +7,440 @@
 //
 // gif file decoder - only the most common variants
 // 
+// All the frames of an animated gif are decoded, see get_frames().
+// 
 namespace octet { namespace loaders {
-  class gif_decoder {
-    uint16_t lzw_head[0x1001];
-    uint8_t lzw_tail[0x1001];
+  class gif_decoder : public image_decoder {
     enum { debug_gif = 0 };
 
-    // add a lzw string for a specific code.
-    // all strings consist of a head and a single byte tail.
-    // we follow the chains to get the whole string.
-    uint8_t add_lwz_string(unsigned code, uint8_t *&bytes, uint8_t *max_bytes, unsigned reset_code) {
-      unsigned i = code;
-      unsigned num_bytes = 1;
-      for (; i > reset_code; i = lzw_head[i]) {
-        num_bytes++;
-      }
+    // lzw string table: where each string was written to the output and its length.
+    // A new string is an old one plus the first byte of the next, so it can be copied
+    // forwards from the output rather than built backwards by following a chain of codes.
+    uint32_t lzw_offset[0x1000];
+    uint16_t lzw_length[0x1000];
 
-      uint8_t *dest = bytes += num_bytes;
-      if (bytes > max_bytes) return 0;
-      i = code;
-      for (; i > reset_code; i = lzw_head[i]) {
-        *--dest = lzw_tail[i];
-      }
-      *--dest = i;
+    // where we are in the file
+    enum stage_t { stage_header, stage_blocks, stage_image_data, stage_end };
+    stage_t stage;
 
-      if (debug_gif) {
-        for (unsigned i = 0; i != num_bytes; ++i) {
-          printf("out %02x\n", dest[i]);
-        }
-      }    
-      return i;
+    // global colour table
+    size_t gct_offset;
+    unsigned gct_size;
+
+    // graphics control extension for the next image
+    unsigned transparency_index;
+    unsigned disposal;
+    unsigned delay;
+
+    // delays of the frames so far, in 1/100ths of a second
+    dynarray<uint16_t> delays;
+
+    // how to dispose of the previous frame before drawing the next one
+    unsigned prev_disposal;
+    unsigned prev_left;
+    unsigned prev_top;
+    unsigned prev_width;
+    unsigned prev_height;
+
+    // the area under the current frame, for disposal method 3 (restore to previous)
+    dynarray<uint8_t> prev_pixels;
+
+    // the image being decoded
+    unsigned left;
+    unsigned top;
+    unsigned lwidth;
+    unsigned lheight;
+    bool interlaced;
+    unsigned frame_transparency;
+
+    // the colour table of the image, padded with black to 256 entries
+    // so that any index can be looked up, even in a broken file.
+    uint8_t palette[256*3];
+
+    // the lzw decoder state is kept between sub-blocks, which may arrive separately
+    unsigned min_lzw_size;
+    unsigned lzw_size;
+    unsigned reset_code;
+    unsigned mask;
+    unsigned cur_code;
+    unsigned prev_code;
+    size_t prev_start;
+    unsigned acc;
+    unsigned bits;
+    bool lzw_end;
+
+    // palette indices of the image and how many rows have been converted to colours
+    dynarray<uint8_t> indices;
+    size_t num_indices;
+    unsigned rows_done;
+
+    // start the lzw decoder for a new image
+    void lzw_begin(unsigned min_size) {
+      min_lzw_size = min_size;
+      lzw_size = min_lzw_size + 1;
+      reset_code = ( 1 << min_lzw_size );
+      mask = reset_code * 2 - 1;
+      cur_code = reset_code + 2;
+      acc = 0;
+      bits = 0;
+      prev_code = ~0;
+      prev_start = 0;
+      lzw_end = false;
     }
 
-    // decode image data from a gif file as a lzw coding of palette values
-    bool gif_decode_bytes(uint8_t *bytes, uint8_t *max_bytes, int min_lzw_size, const uint8_t *&srcref) {
-      const uint8_t *src = srcref;
-      unsigned lzw_size = min_lzw_size + 1;
-      unsigned reset_code = ( 1 << min_lzw_size );
-      unsigned mask = reset_code * 2 - 1;
-      unsigned cur_code = reset_code + 1;
-
-      unsigned acc = 0;
-      unsigned bits = 0;
-      unsigned prev_code = ~0;
-
-      while (*src) {
-        unsigned len = *src++;
-        do {
-          unsigned byte = *src++;
-          acc |= byte << bits;
+    // decode the sub-blocks of image data that have arrived, as a lzw coding of palette values.
+    // extra codes at the end of an image are ignored.
+    bool lzw_decode() {
+      // the output has eight bytes of slack so that strings can be copied eight bytes at a time.
+      uint8_t *out = indices.data();
+      size_t out_max = indices.size() - 8;
+      size_t pos = num_indices;
+      unsigned acc = this->acc;
+      unsigned bits = this->bits;
+
+      while (src_pos < src_size && src_data[src_pos]) {
+        unsigned len = src_data[src_pos];
+        if (src_pos + 1 + len > src_size) break;
+        const uint8_t *src = src_data + src_pos + 1;
+        for (const uint8_t *src_max = src + len; src != src_max && !lzw_end; ) {
+          acc |= *src++ << bits;
           bits += 8;
-          if (debug_gif) printf("byte %02x acc=%08x bits=%d\n", byte, acc, bits);
           while (bits >= lzw_size) {
             unsigned code = acc & mask;
             if (debug_gif) printf("code=%03x\n", code);
             bits -= lzw_size;
             acc >>= lzw_size;
-            if ((code & ~1) == reset_code) {
-              if (code == reset_code+1) {
-                // end
-                break;
-              } else {
-                // reset
-                lzw_size = min_lzw_size + 1;
-                cur_code = reset_code + 1;
-                mask = reset_code * 2 - 1;
-              }
-            } else {
-              if (
-                (prev_code == ~0 && code >= reset_code) ||
-                code > cur_code
-              ) {
-                return true;
-              }
 
-              uint8_t tail = 0;
-              if (code == cur_code) {
-                *bytes++ = tail = add_lwz_string(prev_code, bytes, max_bytes-1, reset_code);
-                if (debug_gif) printf("out %02x\n", tail);
-              } else {
-                tail = add_lwz_string(code, bytes, max_bytes, reset_code);
-              }
+            if (code == reset_code) {
+              lzw_size = min_lzw_size + 1;
+              mask = reset_code * 2 - 1;
+              cur_code = reset_code + 2;
+              prev_code = ~0;
+              continue;
+            } else if (code == reset_code + 1 || pos == out_max) {
+              // end
+              lzw_end = true;
+              break;
+            }
 
-              if (bytes > max_bytes) return true;
+            size_t start = pos;
+            if (code < reset_code) {
+              out[pos++] = (uint8_t)code;
+            } else if (code <= cur_code && prev_code != ~0u) {
+              // a copy of an earlier string, or for a new code the previous string and its first byte.
+              bool is_new = code == cur_code;
+              size_t offset = is_new ? prev_start : lzw_offset[code];
+              size_t length = is_new ? start - prev_start : lzw_length[code];
+              size_t max_length = out_max - pos - is_new;
+              if (length > max_length) length = max_length;
 
-              lzw_head[cur_code] = prev_code;
-              lzw_tail[cur_code] = tail;
-              prev_code = code;
+              // the string always ends before pos, so eight byte copies do not overlap what they read.
+              for (size_t i = 0; i < length; i += 8) {
+                uint64_t chunk;
+                memcpy(&chunk, out + offset + i, 8);
+                memcpy(out + pos + i, &chunk, 8);
+              }
+              pos += length;
+              if (is_new) out[pos++] = out[offset];
+            } else {
+              this->acc = acc;
+              this->bits = bits;
+              num_indices = pos;
+              src_pos += 1 + len;
+              return false;
+            }
 
+            // the previous string plus the first byte of this one.
+            if (prev_code != ~0u && cur_code < 0x1000) {
+              lzw_offset[cur_code] = (uint32_t)prev_start;
+              lzw_length[cur_code] = (uint16_t)(start - prev_start + 1);
               cur_code++;
-              if (cur_code > mask) {
+              if (cur_code > mask && mask != 0xfff) {
                 if (debug_gif) printf("resize\n");
-                if (mask != 0xfff) {
-                  lzw_size++;
-                  mask = mask * 2 + 1;
-                } else {
-                  cur_code = 0x1000;
-                }
+                lzw_size++;
+                mask = mask * 2 + 1;
               }
             }
-          } 
-        } while( --len );
+            prev_code = code;
+            prev_start = start;
+          }
+        }
+
+        src_pos += 1 + len;
       }
-      src++;
-      srcref = src;
-      return false;
+
+      this->acc = acc;
+      this->bits = bits;
+      num_indices = pos;
+      return true;
     }
 
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
-      width = src[6] + src[7]*256;
-      height = src[8] + src[9]*256;
-      unsigned flags = src[10];
-      unsigned gct_size = flags & 0x80 ? 1 << ((flags & 7)+1) : 0;
-      //unsigned background = src[11];
-      //unsigned aspect = src[12];
-      unsigned transparency_index = 0x100; // disable transparency
-
-      unsigned size = width * height * 4;
-      image.resize(size);
-      format = 0x1908; // GL_RGBA
-
-      memset(&image[0], 0xff, size);
-      src += 13;
-      const uint8_t *gct = src;
-      src += gct_size * 3;
-      while (src < src_max) {
-        unsigned code = *src++;
-        if (code == 0x3b) {
-          // end
-          break;
-        } else if (code == 0x21) {
-          if (*src == 0xf9) {
-            // graphics control extension
-            //unsigned block_size = src[1];
-            unsigned flags = src[2];
-            //unsigned delay = src[3] + src[4] * 256;
-            transparency_index = flags & 1 ? src[5] : 0x100;
-
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
-            }
-            src++;
-          } else {
-            // unknown extension
-            src++;
-            while (*src) {
-              if (debug_gif) printf("    len=%02x\n", *src);
-              src += *src + 1;
+    // interlaced images store every eighth row, then the rows between in three more passes.
+    static unsigned interlaced_row(unsigned row, unsigned height) {
+      unsigned n = (height + 7) / 8;
+      if (row < n) return row * 8;
+      row -= n;
+      n = (height + 3) / 8;
+      if (row < n) return row * 8 + 4;
+      row -= n;
+      n = (height + 1) / 4;
+      if (row < n) return row * 4 + 2;
+      return (row - n) * 2 + 1;
+    }
+
+    unsigned get_num_frames() const {
+      return delays.size();
+    }
+
+    size_t get_frame_size() const {
+      return (size_t)image_width * image_height * 4;
+    }
+
+    // colour the rows of the image that have been decoded.
+    // rows of the first frame are passed on to the sink.
+    void convert_rows() {
+      unsigned rows = (unsigned)(lwidth ? num_indices / lwidth : lheight);
+      if (rows <= rows_done) return;
+
+      unsigned frame = get_num_frames() - 1;
+      uint8_t *frame_base = get_output() + frame * get_frame_size();
+      const uint8_t *src = indices.data() + rows_done * lwidth;
+      for (unsigned j = rows_done; j != rows; ++j) {
+        unsigned y = top + (interlaced ? interlaced_row(j, lheight) : j);
+        uint8_t *dest = frame_base + ((image_height - 1 - y) * image_width + left) * 4;
+        if (frame == 0) {
+          for (unsigned i = 0; i != lwidth; ++i) {
+            unsigned idx = *src++;
+            dest[0] = palette[idx*3+0];
+            dest[1] = palette[idx*3+1];
+            dest[2] = palette[idx*3+2];
+            dest[3] = idx == frame_transparency ? 0x00 : 0xff;
+            dest += 4;
+          }
+          if (interlaced) add_rows(image_height - 1 - y, 1);
+        } else {
+          // transparent pixels of later frames show the frame before.
+          for (unsigned i = 0; i != lwidth; ++i) {
+            unsigned idx = *src++;
+            if (idx != frame_transparency) {
+              dest[0] = palette[idx*3+0];
+              dest[1] = palette[idx*3+1];
+              dest[2] = palette[idx*3+2];
+              dest[3] = 0xff;
             }
-            src++;
+            dest += 4;
           }
-        } else if (code == 0x2c) {
-          // image descriptor
-          unsigned left = src[0] + src[1]*256;
-          unsigned top = src[2] + src[3]*256;
-          unsigned lwidth = src[4] + src[5]*256;
-          unsigned lheight = src[6] + src[7]*256;
-          unsigned flags = src[8];
-          unsigned lct_size = ( flags & 0x80 ) ? 1 << ((flags & 7)+1) : 0;
-          src += 9;
-          const uint8_t *color_table = ( flags & 0x80 ) ? src : gct;
-          src += lct_size * 3;
-          unsigned min_lzw_size = *src++;
-
-          dynarray<uint8_t> bytes(lwidth*lheight);
-          bool error = 
-            left + lwidth > width ||
-            top + lheight > height ||
-            gif_decode_bytes(&bytes[0], &bytes[lwidth*lheight], min_lzw_size, src)
-          ;
-          if (error) {
-            printf("warning: gif_decode_bytes - broken gif file\n");
-            goto fail;
-          } else {
-            uint8_t *src = &bytes[0];
-            for (unsigned j = 0; j != lheight; ++j) {
-              uint8_t *dest = &image[((height - 1 - j - top) * width + left) * 4];
-              for (unsigned i = 0; i != lwidth; ++i) {
-                unsigned idx = *src++;
-                dest[0] = color_table[idx*3+0];
-                dest[1] = color_table[idx*3+1];
-                dest[2] = color_table[idx*3+2];
-                dest[3] = idx == transparency_index ? 0x00 : 0xff;
-                //printf("%02x %02x %02x\n", dest[0], dest[1], dest[2]);
-                dest += 4;
+        }
+      }
+
+      // the image is upside down, so the rows go downwards.
+      if (frame == 0 && !interlaced) {
+        add_rows(image_height - top - rows, rows - rows_done);
+      }
+      rows_done = rows;
+    }
+
+    // copy a rectangle of a frame to or from a buffer
+    void copy_rect(uint8_t *frame_base, uint8_t *buffer, bool to_frame) {
+      for (unsigned j = 0; j != prev_height; ++j) {
+        uint8_t *row = frame_base + ((image_height - 1 - prev_top - j) * image_width + prev_left) * 4;
+        uint8_t *saved = buffer + j * prev_width * 4;
+        if (to_frame) {
+          memcpy(row, saved, prev_width * 4);
+        } else {
+          memcpy(saved, row, prev_width * 4);
+        }
+      }
+    }
+
+    // start a new frame as a copy of the last one, disposing of the last one's image.
+    void begin_frame() {
+      unsigned frame = get_num_frames();
+      size_t frame_size = get_frame_size();
+      if (frame != 0) {
+        resize_output(output_base + (frame + 1) * frame_size);
+        uint8_t *cur = get_output() + frame * frame_size;
+        memcpy(cur, cur - frame_size, frame_size);
+        if (prev_disposal == 2) {
+          // restore to the background
+          for (unsigned j = 0; j != prev_height; ++j) {
+            memset(cur + ((image_height - 1 - prev_top - j) * image_width + prev_left) * 4, 0xff, prev_width * 4);
+          }
+        } else if (prev_disposal == 3) {
+          // restore to the previous frame
+          copy_rect(cur, prev_pixels.data(), true);
+        }
+      }
+
+      prev_disposal = disposal;
+      prev_left = left;
+      prev_top = top;
+      prev_width = lwidth;
+      prev_height = lheight;
+      if (disposal == 3) {
+        prev_pixels.resize(lwidth * lheight * 4);
+        copy_rect(get_output() + frame * frame_size, prev_pixels.data(), false);
+      }
+
+      delays.push_back((uint16_t)delay);
+      frame_transparency = transparency_index;
+
+      // the graphics control extension is only for one image.
+      transparency_index = 0x100;
+      disposal = 0;
+      delay = 0;
+    }
+
+    // find the end of a chain of sub-blocks, or zero if it has not all arrived.
+    size_t skip_sub_blocks(size_t pos) const {
+      while (pos < src_size) {
+        if (!src_data[pos]) return pos + 1;
+        pos += src_data[pos] + 1;
+      }
+      return 0;
+    }
+
+    void reset() {
+      stage = stage_header;
+      transparency_index = 0x100; // disable transparency
+      disposal = 0;
+      delay = 0;
+      prev_disposal = 0;
+      delays.resize(0);
+    }
+
+    // decode as much as possible.
+    bool decode(bool at_end) {
+      const uint8_t *src = src_data;
+      for (;;) {
+        switch (stage) {
+          case stage_header: {
+            if (src_size < 13) return !at_end;
+            unsigned flags = src[10];
+            unsigned gct_size = flags & 0x80 ? 1 << ((flags & 7)+1) : 0;
+            //unsigned background = src[11];
+            //unsigned aspect = src[12];
+            if (src_size < 13 + gct_size * 3) return !at_end;
+
+            uint16_t width = src[6] + src[7]*256;
+            uint16_t height = src[8] + src[9]*256;
+            size_t size = (size_t)width * height * 4;
+            memset(begin_image(0x1908, width, height, size), 0xff, size); // GL_RGBA
+            gct_offset = 13;
+            this->gct_size = gct_size;
+            src_pos = 13 + gct_size * 3;
+            stage = stage_blocks;
+          } break;
+
+          case stage_blocks: {
+            if (src_pos >= src_size) return !at_end || get_num_frames() != 0;
+            unsigned code = src[src_pos];
+            if (code == 0x3b) {
+              // end
+              src_pos++;
+              stage = stage_end;
+            } else if (code == 0x21) {
+              // extension
+              size_t end = src_pos + 2 < src_size ? skip_sub_blocks(src_pos + 2) : 0;
+              if (!end) return !at_end || get_num_frames() != 0;
+              if (src[src_pos + 1] == 0xf9 && src[src_pos + 2] >= 4) {
+                // graphics control extension
+                unsigned flags = src[src_pos + 3];
+                disposal = (flags >> 2) & 7;
+                delay = src[src_pos + 4] + src[src_pos + 5] * 256;
+                transparency_index = flags & 1 ? src[src_pos + 6] : 0x100;
+              }
+              src_pos = end;
+            } else if (code == 0x2c) {
+              // image descriptor
+              if (src_pos + 11 > src_size) return !at_end || get_num_frames() != 0;
+              const uint8_t *p = src + src_pos + 1;
+              unsigned flags = p[8];
+              unsigned lct_size = ( flags & 0x80 ) ? 1 << ((flags & 7)+1) : 0;
+              if (src_pos + 11 + lct_size * 3 > src_size) return !at_end || get_num_frames() != 0;
+
+              left = p[0] + p[1]*256;
+              top = p[2] + p[3]*256;
+              lwidth = p[4] + p[5]*256;
+              lheight = p[6] + p[7]*256;
+              interlaced = (flags & 0x40) != 0;
+              src_pos += 10;
+              memset(palette, 0, sizeof(palette));
+              if (flags & 0x80) {
+                memcpy(palette, src + src_pos, lct_size * 3);
+              } else {
+                memcpy(palette, src + gct_offset, gct_size * 3);
               }
+              src_pos += lct_size * 3;
+              unsigned min_size = src[src_pos++];
+
+              if (left + lwidth > image_width || top + lheight > image_height || min_size < 1 || min_size > 11) {
+                printf("warning: gif_decode_bytes - broken gif file\n");
+                return false;
+              }
+
+              // the frames are stacked up in one image, which can only be so tall.
+              if ((get_num_frames() + 1) * image_height > 0xffff) {
+                printf("warning: gif_decode_bytes - too many frames\n");
+                stage = stage_end;
+                break;
+              }
+
+              begin_frame();
+              lzw_begin(min_size);
+              indices.resize(lwidth * lheight + 8);
+              num_indices = 0;
+              rows_done = 0;
+              stage = stage_image_data;
+            } else {
+              printf("warning: unknown gif file section type\n");
+              return false;
+            }
+          } break;
+
+          case stage_image_data: {
+            // decode the sub-blocks that have arrived.
+            bool ok = lzw_decode();
+            convert_rows();
+            if (!ok) {
+              printf("warning: gif_decode_bytes - broken gif file\n");
+              return false;
             }
+            if (src_pos >= src_size || src[src_pos]) return !at_end;
+            src_pos++;
+            stage = stage_blocks;
+          } break;
+
+          case stage_end: {
+            return true;
           }
-        } else {
-          printf("warning: unknown gif file section type\n");
         }
       }
-    fail:;
-      //num_components = transparency_index == 0x100 ? 3 : 4;
+    }
+
+  public:
+    gif_decoder() {
+      stage = stage_end;
+    }
+
+    /// Delay after a frame in seconds.
+    float get_frame_delay(unsigned frame) const {
+      return frame < delays.size() ? delays[frame] * 0.01f : 0.0f;
+    }
+
+    /// Number of frames. The frames are stacked up in the image, see get_frames().
+    uint32_t get_frames() const {
+      return get_num_frames();
+    }
+
+    // get an opengl texture from a file in memory
+    // animated files give all the frames, one above the other.
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      image.resize(0);
+      decode_file(image, src, src_max);
+      format = image_format;
+      width = image_width;
+      height = (uint16_t)(image_height * (delays.size() ? delays.size() : 1));
     }
   };
 }}
-
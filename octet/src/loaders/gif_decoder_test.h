@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// gif_decoder tests
+//
+// the files are made here, so that broken ones can be tried as well as good ones.
+//
+
+namespace octet { namespace loaders {
+  /// Tests for gif_decoder.
+  class gif_decoder_test {
+    enum { width = 4, height = 2 };
+
+    // flags for a colour table of "size" entries, which is a power of two from 2 to 256.
+    static uint8_t table_flags(unsigned size) {
+      unsigned n = 0;
+      while ((2u << n) < size) ++n;
+      return (uint8_t)(size ? 0x80 | n : 0);
+    }
+
+    // a 4x2 gif with an eight bit lzw code of "pixels", which are not limited to the colour table.
+    // The codes are nine bits: a clear code, one per pixel and an end code.
+    static void make_gif(dynarray<uint8_t> &gif, unsigned gct_size, unsigned lct_size, const uint8_t *table, const uint8_t *pixels) {
+      gif.resize(0);
+      const char *magic = "GIF89a";
+      for (unsigned i = 0; i != 6; ++i) gif.push_back((uint8_t)magic[i]);
+      uint8_t header[] = { width, 0, height, 0, table_flags(gct_size), 0, 0 };
+      for (unsigned i = 0; i != sizeof(header); ++i) gif.push_back(header[i]);
+      for (unsigned i = 0; i != gct_size * 3; ++i) gif.push_back(table[i]);
+
+      uint8_t descriptor[] = { 0x2c, 0, 0, 0, 0, width, 0, height, 0, table_flags(lct_size) };
+      for (unsigned i = 0; i != sizeof(descriptor); ++i) gif.push_back(descriptor[i]);
+      for (unsigned i = 0; i != lct_size * 3; ++i) gif.push_back(table[i]);
+
+      // lzw data in one sub-block
+      gif.push_back(8);
+      dynarray<uint8_t> data;
+      unsigned acc = 0, bits = 0;
+      for (unsigned i = 0; i != width * height + 2; ++i) {
+        unsigned code = i == 0 ? 0x100 : i <= width * height ? pixels[i-1] : 0x101;
+        acc |= code << bits;
+        for (bits += 9; bits >= 8; bits -= 8) {
+          data.push_back((uint8_t)acc);
+          acc >>= 8;
+        }
+      }
+      if (bits) data.push_back((uint8_t)acc);
+      gif.push_back((uint8_t)data.size());
+      for (unsigned i = 0; i != data.size(); ++i) gif.push_back(data[i]);
+      gif.push_back(0);
+      gif.push_back(0x3b);
+    }
+
+    // the colour of a pixel, counting from the top left as in the file.
+    static const uint8_t *get_pixel(const dynarray<uint8_t> &image, unsigned x, unsigned y) {
+      return image.data() + ((height - 1 - y) * width + x) * 4;
+    }
+
+    // decode a file with get_image() and, a byte at a time, with feed().
+    // pixels whose index is past the end of the table should be black.
+    static bool check(FILE *file, const char *name, unsigned gct_size, unsigned lct_size, const uint8_t *table, const uint8_t *pixels) {
+      dynarray<uint8_t> gif;
+      make_gif(gif, gct_size, lct_size, table, pixels);
+      unsigned table_size = lct_size ? lct_size : gct_size;
+
+      bool ok = true;
+      for (unsigned pass = 0; pass != 2; ++pass) {
+        gif_decoder dec;
+        dynarray<uint8_t> image;
+        if (pass == 0) {
+          uint16_t format = 0, w = 0, h = 0;
+          dec.get_image(image, format, w, h, gif.data(), gif.data() + gif.size());
+          ok = ok && w == width && h == height;
+        } else {
+          dec.begin(image);
+          for (unsigned i = 0; i != gif.size(); ++i) {
+            dec.feed(gif.data() + i, 1);
+          }
+          ok = dec.end() && ok;
+        }
+
+        ok = ok && image.size() == width * height * 4;
+        for (unsigned i = 0; ok && i != width * height; ++i) {
+          unsigned idx = pixels[i];
+          const uint8_t *p = get_pixel(image, i % width, i / width);
+          for (unsigned k = 0; k != 3; ++k) {
+            uint8_t expected = idx < table_size ? table[idx * 3 + k] : 0;
+            if (p[k] != expected) ok = false;
+          }
+        }
+      }
+      fprintf(file, "%-40s %s\n", name, ok ? "ok" : "FAILED");
+      return ok;
+    }
+
+  public:
+    /// Decode some small files. Returns false if any of them came out wrong.
+    static bool run(FILE *file = stdout) {
+      static const uint8_t table[] = {
+        0xff, 0x00, 0x00,  0x00, 0xff, 0x00,  0x00, 0x00, 0xff,  0x80, 0x80, 0x80,
+        0x10, 0x20, 0x30,  0x40, 0x50, 0x60,  0x70, 0x80, 0x90,  0xa0, 0xb0, 0xc0,
+      };
+      static const uint8_t good[] = { 0, 1, 1, 0, 1, 0, 0, 1 };
+      static const uint8_t past_end[] = { 0, 1, 2, 3, 200, 255, 7, 1 };
+
+      fprintf(file, "gif_decoder\n");
+      bool ok = true;
+      ok = check(file, "global colour table", 2, 0, table, good) && ok;
+      ok = check(file, "local colour table", 0, 8, table, good) && ok;
+      ok = check(file, "index past the global colour table", 2, 0, table, past_end) && ok;
+      ok = check(file, "index past the local colour table", 8, 4, table, past_end) && ok;
+      ok = check(file, "no colour table", 0, 0, table, past_end) && ok;
+      return ok;
+    }
+  };
+} }
@@ -0,0 +1,234 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// incremental image decoding
+//
+// The decoders can be fed a file a piece at a time as it arrives and report
+// finished rows of the image as they go, so that a large texture can be used
+// (or uploaded to GL) before the whole file has been read.
+//
+
+namespace octet { namespace loaders {
+  /// Receives the parts of an image as an image_decoder finishes them.
+  ///
+  /// The calls come from the thread that calls image_decoder::feed().
+  class image_sink {
+  public:
+    virtual ~image_sink() {
+    }
+
+    /// The size and format of the image are known and space has been made for it.
+    virtual void begin_image(uint16_t, uint16_t, uint16_t) {
+    }
+
+    /// The image needs to grow, for example to hold another frame.
+    /// Override this to lock the image against readers on other threads.
+    virtual void resize_image(dynarray<uint8_t> &image, size_t size) {
+      image.resize(size);
+    }
+
+    /// Rows [y, y + num_rows) of the image are finished.
+    /// Rows count from the bottom of the image, as in OpenGL.
+    virtual void add_rows(unsigned, unsigned) {
+    }
+  };
+
+  /// Base class for the image decoders: feed the file in pieces of any size.
+  ///
+  /// Example:
+  ///
+  ///     jpeg_decoder dec;
+  ///     dec.begin(bytes, &sink);
+  ///     while (size_t size = fread(buf, 1, sizeof(buf), file)) {
+  ///       if (!dec.feed(buf, size)) break;
+  ///     }
+  ///     dec.end();
+  ///
+  /// Compressed textures (DDS) and volumes (NIFTI) are decoded at the end.
+  class image_decoder {
+  public:
+    enum state_t { state_decoding, state_done, state_error };
+
+  private:
+    // copy of the file so far, followed by padding
+    dynarray<uint8_t> input;
+
+    state_t state;
+
+  protected:
+    enum { input_padding = 8 };
+
+    // the file so far: src_data[0..src_size). When feeding, this is followed by
+    // input_padding bytes starting with a JPEG EOI marker (ff d9) so that
+    // bit readers stop at the end of the data.
+    const uint8_t *src_data;
+    size_t src_size;
+
+    // how much of the file the decoder has used.
+    size_t src_pos;
+
+    // the image is added to the end of the output.
+    dynarray<uint8_t> *output;
+    size_t output_base;
+    image_sink *sink;
+
+    uint16_t image_format;
+    uint16_t image_width;
+    uint16_t image_height;
+
+    /// Decode as much as possible of the file from src_pos.
+    /// at_end is true when there is no more file to come.
+    /// Return false if the file is broken (or, at the end, incomplete).
+    virtual bool decode(bool at_end) = 0;
+
+    /// Called by begin() to get ready for a new file.
+    virtual void reset() {
+    }
+
+    /// Make space for the image and tell the sink about it.
+    uint8_t *begin_image(uint16_t format, uint16_t width, uint16_t height, size_t size) {
+      image_format = format;
+      image_width = width;
+      image_height = height;
+      resize_output(output_base + size);
+      if (sink) sink->begin_image(format, width, height);
+      return output->data() + output_base;
+    }
+
+    /// Grow or shrink the output.
+    void resize_output(size_t size) {
+      if (sink) {
+        sink->resize_image(*output, size);
+      } else {
+        output->resize(size);
+      }
+    }
+
+    /// Address of the image.
+    uint8_t *get_output() const {
+      return output->data() + output_base;
+    }
+
+    /// Tell the sink that some rows are done.
+    void add_rows(unsigned y, unsigned num_rows) {
+      if (sink && num_rows) sink->add_rows(y, num_rows);
+    }
+
+    /// Decode a whole file in memory without copying it (for the get_image() functions).
+    bool decode_file(dynarray<uint8_t> &image, const uint8_t *src, const uint8_t *src_max) {
+      begin(image);
+      src_data = src;
+      src_size = src_max - src;
+      state = decode(true) ? state_done : state_error;
+      src_data = 0;
+      src_size = 0;
+      return state == state_done;
+    }
+
+  public:
+    image_decoder() {
+      src_data = 0;
+      src_size = src_pos = 0;
+      output = 0;
+      output_base = 0;
+      sink = 0;
+      image_format = image_width = image_height = 0;
+      state = state_done;
+    }
+
+    virtual ~image_decoder() {
+    }
+
+    /// Start decoding a new file. The image is added to the end of "image".
+    void begin(dynarray<uint8_t> &image, image_sink *sink_ = 0) {
+      input.resize(0);
+      src_data = 0;
+      src_size = src_pos = 0;
+      output = &image;
+      output_base = image.size();
+      sink = sink_;
+      image_format = image_width = image_height = 0;
+      state = state_decoding;
+      reset();
+    }
+
+    /// Add the next part of the file. Returns false if the file is broken.
+    bool feed(const uint8_t *data, size_t size) {
+      if (state != state_decoding) return state == state_done;
+
+      // grow the buffer by doubling so that many small pieces do not copy much.
+      size_t new_size = src_size + size;
+      if (new_size + input_padding > input.capacity()) {
+        size_t capacity = input.capacity() * 2;
+        input.reserve(capacity > new_size + input_padding ? capacity : new_size + input_padding);
+      }
+      input.resize(new_size + input_padding);
+      if (size) memcpy(input.data() + src_size, data, size);
+      memset(input.data() + new_size, 0, input_padding);
+      input[new_size] = 0xff;
+      input[new_size + 1] = 0xd9;
+      src_data = input.data();
+      src_size = new_size;
+
+      if (!decode(false)) state = state_error;
+      return state != state_error;
+    }
+
+    /// There is no more file. Returns true if the image is complete.
+    bool end() {
+      if (state == state_decoding) {
+        if (!src_data) feed(0, 0);
+        if (state == state_decoding) {
+          state = decode(true) ? state_done : state_error;
+        }
+      }
+      return state == state_done;
+    }
+
+    /// state_decoding, state_done or state_error
+    state_t get_state() const {
+      return state;
+    }
+
+    /// GL_RGB, GL_RGBA or a compressed format, once known.
+    uint16_t get_format() const {
+      return image_format;
+    }
+
+    /// width of the image in pixels, once known.
+    uint16_t get_width() const {
+      return image_width;
+    }
+
+    /// height of the image in pixels, once known.
+    uint16_t get_height() const {
+      return image_height;
+    }
+
+    /// Number of frames (or layers) in the image.
+    /// Animations stack their frames up, each get_height() tall, with the first at the bottom.
+    virtual uint32_t get_frames() const {
+      return 1;
+    }
+
+    /// Time to show a frame of an animation for in seconds, if the file gives one.
+    virtual float get_frame_delay(unsigned) const {
+      return 0;
+    }
+
+    /// Number of mipmap levels in the image, for files that hold them (DDS and KTX2).
+    /// The levels follow each other, largest first.
+    virtual unsigned get_num_levels() const {
+      return 1;
+    }
+
+    /// 6 for cube maps, whose faces follow each other, each with all its levels.
+    virtual unsigned get_num_faces() const {
+      return 1;
+    }
+  };
+}}
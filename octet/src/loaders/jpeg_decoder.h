@@ -8,9 +8,15 @@
 // jpeg file decoder - tiny and fast
 //
 // See http://en.wikipedia.org/wiki/JPEG
-// 
+//
+// Baseline and progressive files are supported.
+// Scans with restart markers are decoded in parallel on the job scheduler.
+//
+// When fed a piece at a time (see image_decoder), baseline files are decoded
+// a row of MCUs at a time as the data arrives.
+//
 namespace octet { namespace loaders {
-  class jpeg_decoder {
+  class jpeg_decoder : public image_decoder {
     enum { debug = 0 };
 
     // image dimensions
@@ -21,6 +27,22 @@ namespace octet { namespace loaders {
 
     // What kind of image
     unsigned sof_code;
+    bool progressive;
+
+    // the image is tiled by MCUs of max_hsamp x max_vsamp blocks
+    unsigned max_hsamp;
+    unsigned max_vsamp;
+    unsigned mcus_x;
+    unsigned mcus_y;
+
+    // number of MCUs between restart markers, zero for none.
+    unsigned restart_interval;
+
+    // 0 for full size, 1, 2 or 3 for 1/2, 1/4 and 1/8 size
+    unsigned scale_shift;
+
+    // true when the coefficients are collected from many scans and transformed at the end
+    bool have_coeffs;
 
     // progressive parameters
     unsigned spectral_start;
@@ -32,6 +54,34 @@ namespace octet { namespace loaders {
     unsigned num_mcu_blocks;
     unsigned num_components_in_scan;
 
+    // when fed a piece at a time: what we are waiting for.
+    enum stream_stage_t { stream_chunks, stream_rows, stream_scan, stream_end };
+    stream_stage_t stream_stage;
+    bool streaming;
+
+    // the bit reader of a baseline scan that is decoded a row of MCUs at a time.
+    struct row_reader {
+      size_t pos;
+      unsigned acc;
+      int shift;
+      bool primed;
+      int last_dc[4];
+      unsigned mcu;
+
+      // after running out of data, wait for this much before trying again.
+      size_t retry_size;
+    } reader;
+
+    // start of the current scan and where to carry on looking for its end.
+    size_t scan_start;
+    size_t scan_search;
+
+    // true if the scan still needs decode_scan()
+    bool scan_pending;
+
+    // rows of the image that are finished.
+    unsigned rows_converted;
+
     // skip a number of bits in the file.
     // there is a special case where every 0xff byte is followed by 0x00
     static void skip_bits(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
@@ -49,6 +99,14 @@ namespace octet { namespace loaders {
       }
     }
 
+    // read up to 16 bits from the file.
+    static unsigned get_bits(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
+      uint16_t acc16 = acc >> shift;
+      unsigned v = acc16 >> (16 - bits);
+      skip_bits(bits, acc, src, shift);
+      return v;
+    }
+
     // this is a component usually Y (brightness), Cb (blueness) and Cr (redness)
     // from the file.
     // Some JPEGs have 2x2 blocks for Y and only 1x1 for Cb and Cr (4:2:0)
@@ -58,6 +116,23 @@ namespace octet { namespace loaders {
       uint8_t hsamp;
       uint8_t vsamp;
       uint8_t quantisation_table;
+
+      // size in blocks, whole MCUs
+      unsigned blocks_w;
+      unsigned blocks_h;
+
+      // size in blocks of a scan of this component on its own, which covers just the image
+      unsigned scan_blocks_w;
+      unsigned scan_blocks_h;
+
+      // progressive files: the coefficients of all the blocks, in row order
+      dynarray<int16_t> coeffs;
+
+      // the samples after the IDCT, reduced by "shift"
+      dynarray<uint8_t> plane;
+      unsigned plane_stride;
+      unsigned plane_height;
+      unsigned shift;
     } components[4];
 
     // this is a component that is used for a particluar "scan"
@@ -67,15 +142,12 @@ namespace octet { namespace loaders {
       uint8_t comp;
       uint8_t ac_table;
       uint8_t dc_table;
-      unsigned width_in_blocks;
-      unsigned height_in_blocks;
-      int last_dc;
     } scan_components[4];
 
     // quantisation table. We multiply the dc and ac coefficients by these numbers.
     // this is the lossy part of the compression
     struct quant_table {
-      float table[64];
+      uint16_t table[64];
     } quant_tables[4];
 
     // A huffman table maps variable length codes to lengths and values.
@@ -83,26 +155,43 @@ namespace octet { namespace loaders {
     // where each code is distinct from the previous one, even if it has more bits.
     // (ie. 100(0) and 100(1) are less than 1010).
     struct huffman_table {
+      enum { fast_bits = 9 };
       unsigned min_len;
       uint8_t huffval[257];
       uint16_t maxcodes[17];
       uint16_t offset[17];
 
+      // (length << 8) | value for codes of up to fast_bits bits, indexed by the next fast_bits bits.
+      uint16_t fast[1 << fast_bits];
+
       // decode a variable length huffman code
-      // we grab the next 16 bits and look in the maxcodes table to see how many
+      // most codes are short and are found in the fast table.
+      // otherwise we grab the next 16 bits and look in the maxcodes table to see how many
       // bits the code has. After that, we strip the right hand bits and
       // look up the code in a table.
-      unsigned decode(unsigned &acc, const uint8_t *&src, int &shift) {
+      unsigned decode(unsigned &acc, const uint8_t *&src, int &shift) const {
         unsigned i = min_len;
         unsigned short acc16 = acc >> shift;
 
+        unsigned entry = fast[acc16 >> (16 - fast_bits)];
+        if (entry) {
+          skip_bits(entry >> 8, acc, src, shift);
+          return entry & 0xff;
+        }
+
         // find the shortest code that this could be
-        for (; acc16 > maxcodes[i]; ++i) {
+        for (; i < 16 && acc16 > maxcodes[i]; ++i) {
+        }
+
+        // bad data: no code matches
+        if (i == 16) {
+          skip_bits(16, acc, src, shift);
+          return 0;
         }
 
         unsigned code = ( acc16 >> (15-i) ) - offset[i];
         skip_bits(i + 1, acc, src, shift);
-        return huffval[code];
+        return huffval[code & 0xff];
       }
     } huffman_tables[2][4];
 
@@ -113,11 +202,26 @@ namespace octet { namespace loaders {
       huffman_table *dc_table;
       huffman_table *ac_table;
       quant_table *quant;
-      scan_component *scan_comp;
-    } mcu_blocks[8];
+      uint8_t comp;
+      uint8_t scan_index;
+      uint8_t x;        // position in the MCU in blocks
+      uint8_t y;
+    } mcu_blocks[10];
+
+    // SIMD versions of the IDCT and colour conversion. See set_simd_level()
+    struct kernel_table {
+      // IDCT of one block of dequantised coefficients to 8x8 samples
+      void (*idct)(uint8_t *dest, unsigned stride, const int16_t *coeffs);
+
+      // convert a row of pixels to RGBA
+      void (*convert_grey)(uint8_t *dest, const uint8_t *y, unsigned n);
+      void (*convert_444)(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n);
 
-    float dct_coeffs[8*64];
-    float ycrcb_values[8*64];
+      // cb and cr have half the horizontal resolution of y
+      void (*convert_422)(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n);
+    };
+
+    const kernel_table *kernels;
 
     unsigned u2(const uint8_t *src) {
       return src[0] * 256 + src[1];
@@ -125,7 +229,7 @@ namespace octet { namespace loaders {
 
     // dct coefficients are stored in zig-zag order because the top
     // left is far more common.
-    uint8_t zig_zag(unsigned i) {
+    static uint8_t zig_zag(unsigned i) {
       static const uint8_t zig_zag_[64] = {
         0, 1, 8, 16, 9, 2, 3, 10,
         17, 24, 32, 25, 18, 11, 4, 5,
@@ -143,15 +247,15 @@ namespace octet { namespace loaders {
     static int extend(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
       uint16_t acc16 = acc >> shift;
       unsigned v = acc16 >> (16 - bits);
-      return v < ( 1u << ( bits-1 ) ) ? (int)v + ( -1 << bits ) + 1 : (int)v;
+      return v < ( 1u << ( bits-1 ) ) ? (int)v - ( 1 << bits ) + 1 : (int)v;
     }
 
     // decode one block of an MCU which may contain many blocks
     // The Y component may have four blocks, for example, and only one each of Cr, Cb
-    void decode_mcu_block(unsigned block_num, unsigned &acc, const uint8_t *&src, int &shift, float *outptr) {
-      mcu_block &block = mcu_blocks[block_num];
-
-      unsigned value = block.dc_table->decode(acc, src, shift);
+    // The coefficients are dequantised as we go and stored in row order.
+    // Returns the zig-zag index of the last coefficient, so zero means only a DC term.
+    static unsigned decode_block(const mcu_block &block, int &last_dc, unsigned &acc, const uint8_t *&src, int &shift, int16_t *outptr) {
+      unsigned value = block.dc_table->decode(acc, src, shift) & 0x0f;
 
       int dc = 0;
       if (value) {
@@ -159,9 +263,10 @@ namespace octet { namespace loaders {
         skip_bits(value, acc, src, shift);
         //if (debug) printf("dc=%d\n", dc);
       }
-      int abs_dc = block.scan_comp->last_dc += dc;
-      outptr[0] = abs_dc * block.quant->table[0];
+      int abs_dc = last_dc += dc;
+      outptr[0] = (int16_t)(abs_dc * block.quant->table[0]);
 
+      unsigned last = 0;
       for (int ac_coef = 1; ac_coef < 64; ++ac_coef) {
         unsigned value = block.ac_table->decode(acc, src, shift);
         unsigned skip = value >> 4;
@@ -172,7 +277,9 @@ namespace octet { namespace loaders {
           int ac = extend(value, acc, src, shift);
           skip_bits(value, acc, src, shift);
           //if (debug) printf("ac=%d,%d coef=%d zig_zag=%d\n", skip, ac, ac_coef, zig_zag(ac_coef));
-          outptr[zig_zag(ac_coef)] = (float)ac * block.quant->table[ac_coef];
+          unsigned k = ac_coef < 63 ? ac_coef : 63;
+          outptr[zig_zag(k)] = (int16_t)(ac * block.quant->table[k]);
+          last = k;
         } else if (skip != 15) {
           break;
         }
@@ -180,193 +287,764 @@ namespace octet { namespace loaders {
       if (debug) {
         for (int j = 0; j != 8; ++j) {
           for (int i = 0; i != 8; ++i) {
-            printf("%3.0f ", outptr[i+j*8]);
+            printf("%4d ", outptr[i+j*8]);
           }
           printf("\n");
         }
       }
+      return last;
     }
 
-    // one dimensional inverse DCT.
-    // c0 is the DC term and c1..c7 increase in frequency
-    // example: c0 = 128, c1..c7 = 0 -> 128, 128, 128, 128, 128, 128, 128, 128
-    // todo: improve this!
-    OCTET_HOT void idct(float &c0, float &c1, float &c2, float &c3, float &c4, float &c5, float &c6, float &c7) {
-      float c2c6_1 = (c2 + c6) * 0.541196100f;
-      float c2c6_2 = c2c6_1 + c6 * -1.847759065f;
-      float c2c6_3 = c2c6_1 + c2 * 0.765366865f;
-    
-      float c0c4_1 = c0 + c4;
-      float c0c4_2 = c0 - c4;
-    
-      float ceven_1 = c0c4_1 + c2c6_3;
-      float ceven_2 = c0c4_1 - c2c6_3;
-      float ceven_3 = c0c4_2 + c2c6_2;
-      float ceven_4 = c0c4_2 - c2c6_2;
-    
-      float c1c7 = c7 + c1;
-      float c3c5 = c5 + c3;
-      float c7c3 = c7 + c3;
-      float c5c1 = c5 + c1;
-      float codd_0 = (c7c3 + c5c1) * 1.175875602f;
-    
-      float codd_4 = c7 * 0.298631336f;
-      float codd_3 = c5 * 2.053119869f;
-      float codd_2 = c3 * 3.072711026f;
-      float codd_1 = c1 * 1.501321110f;
-      c1c7 = c1c7 * -0.899976223f;
-      c3c5 = c3c5 * -2.562915447f;
-      c7c3 = c7c3 * -1.961570560f;
-      c5c1 = c5c1 * -0.390180644f;
-    
-      c7c3 += codd_0;
-      c5c1 += codd_0;
-    
-      codd_4 += c1c7 + c7c3;
-      codd_3 += c3c5 + c5c1;
-      codd_2 += c3c5 + c7c3;
-      codd_1 += c1c7 + c5c1;
-    
-      c0 = ceven_1 + codd_1;
-      c7 = ceven_1 - codd_1;
-      c1 = ceven_3 + codd_2;
-      c6 = ceven_3 - codd_2;
-      c2 = ceven_4 + codd_3;
-      c5 = ceven_4 - codd_3;
-      c3 = ceven_2 + codd_4;
-      c4 = ceven_2 - codd_4;
+    // progressive files send the coefficients in several scans:
+    // first the DC terms, then bands of AC terms, then lower bits of each.
+    // These are not dequantised until all the scans are done.
+    // See ITU T.81 section G.1.2
+
+    // first scan of the DC terms: the top bits
+    static void decode_dc_first(const mcu_block &block, int &last_dc, unsigned al, unsigned &acc, const uint8_t *&src, int &shift, int16_t *outptr) {
+      unsigned value = block.dc_table->decode(acc, src, shift) & 0x0f;
+      if (value) {
+        last_dc += extend(value, acc, src, shift);
+        skip_bits(value, acc, src, shift);
+      }
+      outptr[0] = (int16_t)(last_dc * (1 << al));
     }
 
-    // Two dimensional inverse DCT
-    // we can do the rows and columns separately.
-    // Optimisations include spotting blank rows and columns, but this
-    // is just a reference design.
-    void inverse_dct(float *inptr) {
-      // do rows
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*0+i], inptr[8*1+i], inptr[8*2+i], inptr[8*3+i], inptr[8*4+i], inptr[8*5+i], inptr[8*6+i], inptr[8*7+i]);
+    // later DC scans: one more bit of each DC term
+    static void decode_dc_refine(unsigned al, unsigned &acc, const uint8_t *&src, int &shift, int16_t *outptr) {
+      if (get_bits(1, acc, src, shift)) {
+        outptr[0] |= (int16_t)(1 << al);
       }
+    }
 
-      // do columns
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*i+0], inptr[8*i+1], inptr[8*i+2], inptr[8*i+3], inptr[8*i+4], inptr[8*i+5], inptr[8*i+6], inptr[8*i+7]);
+    // first scan of a band of AC terms: the top bits.
+    // eobrun is the number of following blocks that have nothing in this band.
+    static void decode_ac_first(const mcu_block &block, unsigned ss, unsigned se, unsigned al, unsigned &eobrun, unsigned &acc, const uint8_t *&src, int &shift, int16_t *outptr) {
+      if (eobrun) {
+        eobrun--;
+        return;
+      }
+      for (unsigned k = ss; k <= se; ++k) {
+        unsigned value = block.ac_table->decode(acc, src, shift);
+        unsigned run = value >> 4;
+        value &= 0x0f;
+        if (value) {
+          k += run;
+          if (k > 63) break;
+          int ac = extend(value, acc, src, shift);
+          skip_bits(value, acc, src, shift);
+          outptr[zig_zag(k)] = (int16_t)(ac * (1 << al));
+        } else if (run == 15) {
+          k += 15;
+        } else {
+          eobrun = (1 << run) - 1;
+          if (run) eobrun += get_bits(run, acc, src, shift);
+          break;
+        }
       }
+    }
 
-      if (debug) {
-        for (int j = 0; j != 8; ++j) {
-          for (int i = 0; i != 8; ++i) {
-            printf("%f ", inptr[i+j*8]);
+    // refine one AC term which is already non-zero.
+    static void refine_ac(int16_t &coeff, int16_t bit, unsigned &acc, const uint8_t *&src, int &shift) {
+      if (get_bits(1, acc, src, shift) && (coeff & bit) == 0) {
+        coeff += coeff >= 0 ? bit : -bit;
+      }
+    }
+
+    // later scans of a band of AC terms: one more bit of the non-zero terms and
+    // new terms which have become +1 or -1 in this bit.
+    static void decode_ac_refine(const mcu_block &block, unsigned ss, unsigned se, unsigned al, unsigned &eobrun, unsigned &acc, const uint8_t *&src, int &shift, int16_t *outptr) {
+      int16_t bit = (int16_t)(1 << al);
+      unsigned k = ss;
+      if (eobrun == 0) {
+        for (; k <= se; ++k) {
+          unsigned value = block.ac_table->decode(acc, src, shift);
+          int run = value >> 4;
+          value &= 0x0f;
+          int16_t new_coeff = 0;
+          if (value) {
+            new_coeff = get_bits(1, acc, src, shift) ? bit : -bit;
+          } else if (run != 15) {
+            eobrun = 1 << run;
+            if (run) eobrun += get_bits(run, acc, src, shift);
+            break;
+          }
+
+          // skip run zero terms, refining the non-zero ones on the way.
+          for (; k <= se; ++k) {
+            int16_t &coeff = outptr[zig_zag(k)];
+            if (coeff) {
+              refine_ac(coeff, bit, acc, src, shift);
+            } else if (--run < 0) {
+              break;
+            }
+          }
+
+          if (new_coeff && k <= se) {
+            outptr[zig_zag(k)] = new_coeff;
+          }
+        }
+      }
+
+      if (eobrun) {
+        // the rest of the band has no new terms.
+        for (; k <= se; ++k) {
+          int16_t &coeff = outptr[zig_zag(k)];
+          if (coeff) {
+            refine_ac(coeff, bit, acc, src, shift);
           }
-          printf("\n");
         }
+        eobrun--;
       }
     }
 
-    // clamp to 0..255 range without using branches.
-    // fabsf is usually implemented in hardware (with fast math options)
-    OCTET_HOT uint8_t clamp(float v) {
-      // v + fabsf(v) = 2v when v > 0
-      // v + fabsf(v) = 0  when v < 0
-      float clamp0 = v + fabsf(v);
+    // IDCT constants in fixed point with 12 fractional bits
+    enum {
+      fix_0_298631336 = 1223,
+      fix_0_390180644 = 1598,
+      fix_0_541196100 = 2217,
+      fix_0_765366865 = 3135,
+      fix_0_899976223 = 3686,
+      fix_1_175875602 = 4816,
+      fix_1_501321110 = 6149,
+      fix_1_847759065 = 7568,
+      fix_1_961570560 = 8035,
+      fix_2_053119869 = 8410,
+      fix_2_562915447 = 10498,
+      fix_3_072711026 = 12586,
+    };
+
+    // one dimensional inverse DCT.
+    // s0 is the DC term and s1..s7 increase in frequency
+    // This is the Loeffler, Ligtenberg and Moschytz factorisation used by the IJG's jidctint.c
+    // in integers: the results are scaled by 4096.
+    // The SIMD versions below do exactly the same sums, eight at a time.
+    static OCTET_HOT void idct_1d(int *out, int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7) {
+      // even part
+      int t2 = s2 * fix_0_541196100 + s6 * (fix_0_541196100 - fix_1_847759065);
+      int t3 = s2 * (fix_0_541196100 + fix_0_765366865) + s6 * fix_0_541196100;
+      int sum04 = (s0 + s4) * 4096;
+      int dif04 = (s0 - s4) * 4096;
+      int x0 = sum04 + t3;
+      int x3 = sum04 - t3;
+      int x1 = dif04 + t2;
+      int x2 = dif04 - t2;
 
-      // v - fabsf(v-n) = n when v > n
-      // v - fabsf(v-n) = 2v - n when v < n
-      return (uint8_t)( ( clamp0 - fabsf( clamp0 - (255.999f * 2) ) ) * 0.25f + 128 );
+      // odd part
+      int y0 = s7 * (fix_0_298631336 - fix_1_961570560) + s3 * -fix_1_961570560;
+      int y2 = s7 * -fix_1_961570560 + s3 * (fix_3_072711026 - fix_1_961570560);
+      int y1 = s5 * (fix_2_053119869 - fix_0_390180644) + s1 * -fix_0_390180644;
+      int y3 = s5 * -fix_0_390180644 + s1 * (fix_1_501321110 - fix_0_390180644);
+      int y4 = (s1 + s7) * (fix_1_175875602 - fix_0_899976223) + (s3 + s5) * fix_1_175875602;
+      int y5 = (s1 + s7) * fix_1_175875602 + (s3 + s5) * (fix_1_175875602 - fix_2_562915447);
+      int o0 = y0 + y4;
+      int o1 = y1 + y5;
+      int o2 = y2 + y5;
+      int o3 = y3 + y4;
+
+      out[0] = x0 + o3;
+      out[7] = x0 - o3;
+      out[1] = x1 + o2;
+      out[6] = x1 - o2;
+      out[2] = x2 + o1;
+      out[5] = x2 - o1;
+      out[3] = x3 + o0;
+      out[4] = x3 - o0;
+    }
+
+    static OCTET_HOT uint8_t clamp(int v) {
+      return (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
     }
 
-    // convert from Y to RGB
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444_greyscale(uint8_t *outptr, int stride, float *inptr) {
+    // Two dimensional inverse DCT
+    // we can do the columns and rows separately.
+    // The first pass keeps two extra bits of precision, the second removes them,
+    // the DCT's scale of 8 and adds 128.
+    static void idct_scalar(uint8_t *dest, unsigned stride, const int16_t *in) {
+      int16_t tmp[64];
+      int out[8];
+      for (unsigned i = 0; i != 8; ++i) {
+        idct_1d(out, in[8*0+i], in[8*1+i], in[8*2+i], in[8*3+i], in[8*4+i], in[8*5+i], in[8*6+i], in[8*7+i]);
+        for (unsigned j = 0; j != 8; ++j) {
+          tmp[8*j+i] = (int16_t)((out[j] + 512) >> 10);
+        }
+      }
+
       for (unsigned j = 0; j != 8; ++j) {
+        const int16_t *t = tmp + 8*j;
+        idct_1d(out, t[0], t[1], t[2], t[3], t[4], t[5], t[6], t[7]);
         for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f);
-          outptr[1] = clamp(128 + y * 0.125f);
-          outptr[2] = clamp(128 + y * 0.125f);
-          outptr[3] = 0xff;
-          outptr += 4;
+          dest[i] = clamp((out[i] + 65536 + (128 << 17)) >> 17);
         }
-        outptr += stride - 32;
+        dest += stride;
       }
     }
 
-    // convert from YCrCb to RGB
-    // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          float cb = inptr[64];
-          float cr = inptr[128];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
+    // Most blocks in a typical JPEG have only a DC term, so the IDCT is a constant.
+    // This gives the same result as the full IDCT and is also the 1/8 scale IDCT.
+    static void idct_dc(uint8_t *dest, unsigned stride, int dc, unsigned size = 8) {
+      uint8_t value = clamp(((dc + 4) >> 3) + 128);
+      for (unsigned j = 0; j != size; ++j) {
+        memset(dest, value, size);
+        dest += stride;
+      }
+    }
+
+    // reduced size IDCT for scale_shift 1 and 2: the average of each 2x2 or 4x4 square of the full IDCT.
+    void idct_reduced(uint8_t *dest, unsigned stride, const int16_t *in, unsigned shift) const {
+      uint8_t full[64];
+      kernels->idct(full, 8, in);
+
+      unsigned size = 8 >> shift;
+      unsigned step = 1 << shift;
+      unsigned round = step * step / 2;
+      for (unsigned j = 0; j != size; ++j) {
+        for (unsigned i = 0; i != size; ++i) {
+          const uint8_t *src = full + (j * 8 + i) * step;
+          unsigned sum = 0;
+          for (unsigned y = 0; y != step; ++y) {
+            for (unsigned x = 0; x != step; ++x) {
+              sum += src[y * 8 + x];
+            }
+          }
+          dest[i] = (uint8_t)((sum + round) >> (shift * 2));
         }
-        outptr += stride - 32;
+        dest += stride;
       }
     }
 
     // convert from YCrCb to RGB
     // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_411(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
+    // This is done with 16 bit fixed point (six fractional bits) and
+    // multipliers less than one so the SIMD versions can use mulhi.
+    // eg. 1.402 * cr = cr + 0.402 * cr = cr + (cr * 26345) >> 16
+    enum {
+      mul_0_402 = 26345,
+      mul_0_34414 = 22554,
+      mul_0_28586 = 18734,   // 0.71414 = 1 - 0.28586
+      mul_0_228 = 14942,     // 1.772 = 2 - 0.228
+    };
+
+    static OCTET_HOT void ycbcr_to_rgba(uint8_t *dest, int y, int cb, int cr) {
+      int yv = y << 6;
+      int cbv = (cb - 128) * 64;
+      int crv = (cr - 128) * 64;
+      int r = yv + crv + ((crv * mul_0_402) >> 16);
+      int g = yv - ((cbv * mul_0_34414) >> 16) - crv + ((crv * mul_0_28586) >> 16);
+      int b = yv + cbv * 2 - ((cbv * mul_0_228) >> 16);
+      dest[0] = clamp((r + 32) >> 6);
+      dest[1] = clamp((g + 32) >> 6);
+      dest[2] = clamp((b + 32) >> 6);
+      dest[3] = 0xff;
+    }
+
+    static void convert_grey_scalar(uint8_t *dest, const uint8_t *y, unsigned n) {
+      for (unsigned i = 0; i != n; ++i) {
+        dest[0] = dest[1] = dest[2] = y[i];
+        dest[3] = 0xff;
+        dest += 4;
+      }
+    }
+
+    static void convert_444_scalar(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+      for (unsigned i = 0; i != n; ++i) {
+        ycbcr_to_rgba(dest + i * 4, y[i], cb[i], cr[i]);
+      }
+    }
+
+    static void convert_422_scalar(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+      for (unsigned i = 0; i != n; ++i) {
+        ycbcr_to_rgba(dest + i * 4, y[i], cb[i >> 1], cr[i >> 1]);
+      }
+    }
+
+    #if OCTET_SSE2
+      // transpose eight rows of eight 16 bit values
+      static OCTET_HOT void transpose_sse2(__m128i *r) {
+        __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+        __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+        __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+        __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+        __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+        __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+        __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+        __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+        r[0] = _mm_unpacklo_epi64(b0, b4); r[1] = _mm_unpackhi_epi64(b0, b4);
+        r[2] = _mm_unpacklo_epi64(b1, b5); r[3] = _mm_unpackhi_epi64(b1, b5);
+        r[4] = _mm_unpacklo_epi64(b2, b6); r[5] = _mm_unpackhi_epi64(b2, b6);
+        r[6] = _mm_unpacklo_epi64(b3, b7); r[7] = _mm_unpackhi_epi64(b3, b7);
+      }
+
+      // x * c0 + y * c1 for eight pairs, giving two registers of 32 bit results
+      static OCTET_HOT void rotate_sse2(__m128i &lo, __m128i &hi, __m128i x, __m128i y, int c0, int c1) {
+        __m128i c = _mm_set1_epi32((int)((c0 & 0xffff) | ((unsigned)c1 << 16)));
+        lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), c);
+        hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), c);
+      }
+
+      // (x + y + bias) >> shift and (x - y + bias) >> shift back to 16 bits
+      static OCTET_HOT void butterfly_sse2(__m128i &out0, __m128i &out1, __m128i x_lo, __m128i x_hi, __m128i y_lo, __m128i y_hi, __m128i bias, int shift) {
+        x_lo = _mm_add_epi32(x_lo, bias);
+        x_hi = _mm_add_epi32(x_hi, bias);
+        out0 = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(x_lo, y_lo), shift), _mm_srai_epi32(_mm_add_epi32(x_hi, y_hi), shift));
+        out1 = _mm_packs_epi32(_mm_srai_epi32(_mm_sub_epi32(x_lo, y_lo), shift), _mm_srai_epi32(_mm_sub_epi32(x_hi, y_hi), shift));
+      }
+
+      // idct_1d() on eight columns at once
+      static OCTET_HOT void idct_pass_sse2(__m128i *r, __m128i bias, int shift) {
+        // even part
+        __m128i t2_lo, t2_hi, t3_lo, t3_hi;
+        rotate_sse2(t2_lo, t2_hi, r[2], r[6], fix_0_541196100, fix_0_541196100 - fix_1_847759065);
+        rotate_sse2(t3_lo, t3_hi, r[2], r[6], fix_0_541196100 + fix_0_765366865, fix_0_541196100);
+        __m128i zero = _mm_setzero_si128();
+        __m128i sum04 = _mm_add_epi16(r[0], r[4]);
+        __m128i dif04 = _mm_sub_epi16(r[0], r[4]);
+        __m128i sum04_lo = _mm_srai_epi32(_mm_unpacklo_epi16(zero, sum04), 4);
+        __m128i sum04_hi = _mm_srai_epi32(_mm_unpackhi_epi16(zero, sum04), 4);
+        __m128i dif04_lo = _mm_srai_epi32(_mm_unpacklo_epi16(zero, dif04), 4);
+        __m128i dif04_hi = _mm_srai_epi32(_mm_unpackhi_epi16(zero, dif04), 4);
+        __m128i x0_lo = _mm_add_epi32(sum04_lo, t3_lo), x0_hi = _mm_add_epi32(sum04_hi, t3_hi);
+        __m128i x3_lo = _mm_sub_epi32(sum04_lo, t3_lo), x3_hi = _mm_sub_epi32(sum04_hi, t3_hi);
+        __m128i x1_lo = _mm_add_epi32(dif04_lo, t2_lo), x1_hi = _mm_add_epi32(dif04_hi, t2_hi);
+        __m128i x2_lo = _mm_sub_epi32(dif04_lo, t2_lo), x2_hi = _mm_sub_epi32(dif04_hi, t2_hi);
+
+        // odd part
+        __m128i y0_lo, y0_hi, y1_lo, y1_hi, y2_lo, y2_hi, y3_lo, y3_hi, y4_lo, y4_hi, y5_lo, y5_hi;
+        rotate_sse2(y0_lo, y0_hi, r[7], r[3], fix_0_298631336 - fix_1_961570560, -fix_1_961570560);
+        rotate_sse2(y2_lo, y2_hi, r[7], r[3], -fix_1_961570560, fix_3_072711026 - fix_1_961570560);
+        rotate_sse2(y1_lo, y1_hi, r[5], r[1], fix_2_053119869 - fix_0_390180644, -fix_0_390180644);
+        rotate_sse2(y3_lo, y3_hi, r[5], r[1], -fix_0_390180644, fix_1_501321110 - fix_0_390180644);
+        __m128i sum17 = _mm_add_epi16(r[1], r[7]);
+        __m128i sum35 = _mm_add_epi16(r[3], r[5]);
+        rotate_sse2(y4_lo, y4_hi, sum17, sum35, fix_1_175875602 - fix_0_899976223, fix_1_175875602);
+        rotate_sse2(y5_lo, y5_hi, sum17, sum35, fix_1_175875602, fix_1_175875602 - fix_2_562915447);
+        __m128i o0_lo = _mm_add_epi32(y0_lo, y4_lo), o0_hi = _mm_add_epi32(y0_hi, y4_hi);
+        __m128i o1_lo = _mm_add_epi32(y1_lo, y5_lo), o1_hi = _mm_add_epi32(y1_hi, y5_hi);
+        __m128i o2_lo = _mm_add_epi32(y2_lo, y5_lo), o2_hi = _mm_add_epi32(y2_hi, y5_hi);
+        __m128i o3_lo = _mm_add_epi32(y3_lo, y4_lo), o3_hi = _mm_add_epi32(y3_hi, y4_hi);
+
+        butterfly_sse2(r[0], r[7], x0_lo, x0_hi, o3_lo, o3_hi, bias, shift);
+        butterfly_sse2(r[1], r[6], x1_lo, x1_hi, o2_lo, o2_hi, bias, shift);
+        butterfly_sse2(r[2], r[5], x2_lo, x2_hi, o1_lo, o1_hi, bias, shift);
+        butterfly_sse2(r[3], r[4], x3_lo, x3_hi, o0_lo, o0_hi, bias, shift);
+      }
+
+      // idct_scalar() with a row of the block in each register
+      static void idct_sse2(uint8_t *dest, unsigned stride, const int16_t *in) {
+        __m128i r[8];
         for (unsigned i = 0; i != 8; ++i) {
-          float y0 = inptr[0x00];
-          float y1 = inptr[0x40];
-          float y2 = inptr[0x80];
-          float y3 = inptr[0xc0];
-          float cb = inptr[0x100];
-          float cr = inptr[0x140];
-          inptr++;
-          outptr[0] = clamp(128 + y0 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y0 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y0 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y1 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y1 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y1 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += stride - 4;
-          outptr[0] = clamp(128 + y2 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y2 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y2 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y3 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y3 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y3 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += -stride + 4;
-        }
-        outptr += stride*2 - 64;
+          r[i] = _mm_loadu_si128((const __m128i*)(in + i * 8));
+        }
+
+        // columns
+        idct_pass_sse2(r, _mm_set1_epi32(512), 10);
+        transpose_sse2(r);
+
+        // rows
+        idct_pass_sse2(r, _mm_set1_epi32(65536 + (128 << 17)), 17);
+        transpose_sse2(r);
+
+        for (unsigned i = 0; i != 8; i += 2) {
+          __m128i bytes = _mm_packus_epi16(r[i], r[i+1]);
+          _mm_storel_epi64((__m128i*)dest, bytes);
+          _mm_storel_epi64((__m128i*)(dest + stride), _mm_srli_si128(bytes, 8));
+          dest += stride * 2;
+        }
+      }
+
+      // ycbcr_to_rgba() on eight pixels of 16 bit values
+      static OCTET_HOT void ycbcr_to_rgba_sse2(uint8_t *dest, __m128i y, __m128i cb, __m128i cr) {
+        __m128i offset = _mm_set1_epi16(128 << 6);
+        __m128i round = _mm_set1_epi16(32);
+        __m128i yv = _mm_slli_epi16(y, 6);
+        __m128i cbv = _mm_sub_epi16(_mm_slli_epi16(cb, 6), offset);
+        __m128i crv = _mm_sub_epi16(_mm_slli_epi16(cr, 6), offset);
+        __m128i r = _mm_add_epi16(_mm_add_epi16(yv, crv), _mm_mulhi_epi16(crv, _mm_set1_epi16(mul_0_402)));
+        __m128i g = _mm_sub_epi16(_mm_sub_epi16(yv, _mm_mulhi_epi16(cbv, _mm_set1_epi16(mul_0_34414))), crv);
+        g = _mm_add_epi16(g, _mm_mulhi_epi16(crv, _mm_set1_epi16(mul_0_28586)));
+        __m128i b = _mm_sub_epi16(_mm_add_epi16(yv, _mm_add_epi16(cbv, cbv)), _mm_mulhi_epi16(cbv, _mm_set1_epi16(mul_0_228)));
+        r = _mm_srai_epi16(_mm_add_epi16(r, round), 6);
+        g = _mm_srai_epi16(_mm_add_epi16(g, round), 6);
+        b = _mm_srai_epi16(_mm_add_epi16(b, round), 6);
+
+        // r0..r7 b0..b7 and g0..g7 a0..a7 -> r0 g0 b0 a0 r1 g1 b1 a1 ...
+        __m128i rb = _mm_packus_epi16(r, b);
+        __m128i ga = _mm_packus_epi16(g, _mm_set1_epi16(0xff));
+        __m128i rg = _mm_unpacklo_epi8(rb, ga);
+        __m128i ba = _mm_unpackhi_epi8(rb, ga);
+        _mm_storeu_si128((__m128i*)dest, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dest + 16), _mm_unpackhi_epi16(rg, ba));
+      }
+
+      // the SIMD converters leave any odd pixels at the end to the scalar code.
+      static void convert_grey_sse2(uint8_t *dest, const uint8_t *y, unsigned n) {
+        __m128i alpha = _mm_set1_epi8((char)0xff);
+        unsigned i = 0;
+        for (; i + 8 <= n; i += 8) {
+          __m128i y8 = _mm_loadl_epi64((const __m128i*)(y + i));
+          __m128i yy = _mm_unpacklo_epi8(y8, y8);
+          __m128i ya = _mm_unpacklo_epi8(y8, alpha);
+          _mm_storeu_si128((__m128i*)(dest + i * 4), _mm_unpacklo_epi16(yy, ya));
+          _mm_storeu_si128((__m128i*)(dest + i * 4 + 16), _mm_unpackhi_epi16(yy, ya));
+        }
+        convert_grey_scalar(dest + i * 4, y + i, n - i);
+      }
+
+      static void convert_444_sse2(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+        __m128i zero = _mm_setzero_si128();
+        unsigned i = 0;
+        for (; i + 8 <= n; i += 8) {
+          __m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + i)), zero);
+          __m128i cb16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cb + i)), zero);
+          __m128i cr16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cr + i)), zero);
+          ycbcr_to_rgba_sse2(dest + i * 4, y16, cb16, cr16);
+        }
+        convert_444_scalar(dest + i * 4, y + i, cb + i, cr + i, n - i);
+      }
+
+      // chroma is upsampled by repeating each sample.
+      static void convert_422_sse2(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+        __m128i zero = _mm_setzero_si128();
+        unsigned i = 0;
+        for (; i + 16 <= n; i += 16) {
+          __m128i cb8 = _mm_loadl_epi64((const __m128i*)(cb + i / 2));
+          __m128i cr8 = _mm_loadl_epi64((const __m128i*)(cr + i / 2));
+          cb8 = _mm_unpacklo_epi8(cb8, cb8);
+          cr8 = _mm_unpacklo_epi8(cr8, cr8);
+          __m128i y8 = _mm_loadu_si128((const __m128i*)(y + i));
+          ycbcr_to_rgba_sse2(dest + i * 4, _mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi8(cb8, zero), _mm_unpacklo_epi8(cr8, zero));
+          ycbcr_to_rgba_sse2(dest + i * 4 + 32, _mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(cb8, zero), _mm_unpackhi_epi8(cr8, zero));
+        }
+        convert_422_scalar(dest + i * 4, y + i, cb + i / 2, cr + i / 2, n - i);
+      }
+    #endif
+
+    #if OCTET_AVX2
+      // ycbcr_to_rgba() on sixteen pixels of 16 bit values
+      static OCTET_TARGET_AVX2 void ycbcr_to_rgba_avx2(uint8_t *dest, __m256i y, __m256i cb, __m256i cr) {
+        __m256i offset = _mm256_set1_epi16(128 << 6);
+        __m256i round = _mm256_set1_epi16(32);
+        __m256i yv = _mm256_slli_epi16(y, 6);
+        __m256i cbv = _mm256_sub_epi16(_mm256_slli_epi16(cb, 6), offset);
+        __m256i crv = _mm256_sub_epi16(_mm256_slli_epi16(cr, 6), offset);
+        __m256i r = _mm256_add_epi16(_mm256_add_epi16(yv, crv), _mm256_mulhi_epi16(crv, _mm256_set1_epi16(mul_0_402)));
+        __m256i g = _mm256_sub_epi16(_mm256_sub_epi16(yv, _mm256_mulhi_epi16(cbv, _mm256_set1_epi16(mul_0_34414))), crv);
+        g = _mm256_add_epi16(g, _mm256_mulhi_epi16(crv, _mm256_set1_epi16(mul_0_28586)));
+        __m256i b = _mm256_sub_epi16(_mm256_add_epi16(yv, _mm256_add_epi16(cbv, cbv)), _mm256_mulhi_epi16(cbv, _mm256_set1_epi16(mul_0_228)));
+        r = _mm256_srai_epi16(_mm256_add_epi16(r, round), 6);
+        g = _mm256_srai_epi16(_mm256_add_epi16(g, round), 6);
+        b = _mm256_srai_epi16(_mm256_add_epi16(b, round), 6);
+
+        // the packs and unpacks work on each 128 bit half, giving pixels 0-3 8-11 and 4-7 12-15
+        __m256i rb = _mm256_packus_epi16(r, b);
+        __m256i ga = _mm256_packus_epi16(g, _mm256_set1_epi16(0xff));
+        __m256i rg = _mm256_unpacklo_epi8(rb, ga);
+        __m256i ba = _mm256_unpackhi_epi8(rb, ga);
+        __m256i lo = _mm256_unpacklo_epi16(rg, ba);
+        __m256i hi = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i*)dest, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dest + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+      }
+
+      static OCTET_TARGET_AVX2 void convert_444_avx2(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+        unsigned i = 0;
+        for (; i + 16 <= n; i += 16) {
+          __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i)));
+          __m256i cb16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(cb + i)));
+          __m256i cr16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(cr + i)));
+          ycbcr_to_rgba_avx2(dest + i * 4, y16, cb16, cr16);
+        }
+        convert_444_sse2(dest + i * 4, y + i, cb + i, cr + i, n - i);
+      }
+
+      static OCTET_TARGET_AVX2 void convert_422_avx2(uint8_t *dest, const uint8_t *y, const uint8_t *cb, const uint8_t *cr, unsigned n) {
+        unsigned i = 0;
+        for (; i + 16 <= n; i += 16) {
+          __m128i cb8 = _mm_loadl_epi64((const __m128i*)(cb + i / 2));
+          __m128i cr8 = _mm_loadl_epi64((const __m128i*)(cr + i / 2));
+          __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i)));
+          __m256i cb16 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(cb8, cb8));
+          __m256i cr16 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(cr8, cr8));
+          ycbcr_to_rgba_avx2(dest + i * 4, y16, cb16, cr16);
+        }
+        convert_422_sse2(dest + i * 4, y + i, cb + i / 2, cr + i / 2, n - i);
+      }
+    #endif
+
+    // choose the best kernels for this cpu, up to "level".
+    static const kernel_table *get_kernels(unsigned level) {
+      static const kernel_table scalar = { idct_scalar, convert_grey_scalar, convert_444_scalar, convert_422_scalar };
+      #if OCTET_AVX2
+        // the IDCT works on one block, whose rows exactly fill SSE2 registers.
+        static const kernel_table avx2 = { idct_sse2, convert_grey_sse2, convert_444_avx2, convert_422_avx2 };
+        if (level >= simd_avx2 && cpu_features::get().has_avx2()) return &avx2;
+      #endif
+      #if OCTET_SSE2
+        static const kernel_table sse2 = { idct_sse2, convert_grey_sse2, convert_444_sse2, convert_422_sse2 };
+        if (level >= simd_sse2) return &sse2;
+      #endif
+      return &scalar;
+    }
+
+    // run fn(i0, i1) over [begin, end) on the job scheduler.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned grain, const fn_t &fn) const {
+      resources::job_scheduler::get().parallel_for(begin, end, grain, fn);
+    }
+
+    // size of the decoded image, which is a whole number of MCUs.
+    unsigned get_output_width() const {
+      return (mcus_x * max_hsamp * 8) >> scale_shift;
+    }
+
+    unsigned get_output_height() const {
+      return (mcus_y * max_vsamp * 8) >> scale_shift;
+    }
+
+    // transform one block of dequantised coefficients into its component's plane.
+    void idct_block(component &c, unsigned bx, unsigned by, const int16_t *coeffs, bool dc_only) const {
+      unsigned size = 8 >> c.shift;
+      uint8_t *dest = c.plane.data() + (by * c.plane_stride + bx) * size;
+      if (dc_only || c.shift == 3) {
+        idct_dc(dest, c.plane_stride, coeffs[0], size);
+      } else if (c.shift == 0) {
+        kernels->idct(dest, c.plane_stride, coeffs);
+      } else {
+        idct_reduced(dest, c.plane_stride, coeffs, c.shift);
+      }
+    }
+
+    // decode MCUs [begin, end) of the current scan, carrying the decoder state from call to call.
+    void decode_mcus(unsigned begin, unsigned end, int *last_dc, unsigned &eobrun, int16_t *coeffs, unsigned &acc, const uint8_t *&src, int &shift) {
+      for (unsigned mcu = begin; mcu != end; ++mcu) {
+        for (unsigned b = 0; b != num_mcu_blocks; ++b) {
+          const mcu_block &block = mcu_blocks[b];
+          component &c = components[block.comp];
+
+          // a scan of one component has one block per MCU and only covers the image.
+          unsigned bx, by;
+          if (num_components_in_scan == 1) {
+            bx = mcu % c.scan_blocks_w;
+            by = mcu / c.scan_blocks_w;
+          } else {
+            bx = mcu % mcus_x * c.hsamp + block.x;
+            by = mcu / mcus_x * c.vsamp + block.y;
+          }
+
+          if (!have_coeffs) {
+            // baseline files with one scan go straight to the planes.
+            memset(coeffs, 0, 64 * sizeof(int16_t));
+            unsigned last = decode_block(block, last_dc[block.scan_index], acc, src, shift, coeffs);
+            idct_block(c, bx, by, coeffs, last == 0);
+          } else {
+            int16_t *dest = c.coeffs.data() + (by * c.blocks_w + bx) * 64;
+            if (spectral_start == 0) {
+              if (successive_high == 0) {
+                decode_dc_first(block, last_dc[block.scan_index], successive_low, acc, src, shift, dest);
+              } else {
+                decode_dc_refine(successive_low, acc, src, shift, dest);
+              }
+            }
+            if (spectral_end != 0) {
+              unsigned ss = spectral_start ? spectral_start : 1;
+              if (successive_high == 0) {
+                decode_ac_first(block, ss, spectral_end, successive_low, eobrun, acc, src, shift, dest);
+              } else {
+                decode_ac_refine(block, ss, spectral_end, successive_low, eobrun, acc, src, shift, dest);
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // decode MCUs [begin, end) of the current scan starting at src.
+    // this is called from many threads at once for scans with restart markers.
+    void decode_mcus(unsigned begin, unsigned end, const uint8_t *src) {
+      unsigned acc = 0;
+      int shift = 0;
+      skip_bits(16, acc, src, shift);
+
+      // restart markers reset the DC predictions and the end of band run.
+      int last_dc[4] = { 0, 0, 0, 0 };
+      unsigned eobrun = 0;
+      int16_t coeffs[64];
+
+      decode_mcus(begin, end, last_dc, eobrun, coeffs, acc, src, shift);
+    }
+
+    // decode the entropy coded data of a scan and return the marker after it.
+    // The data is split at the restart markers and the intervals decoded in parallel.
+    const uint8_t *decode_scan(const uint8_t *src, const uint8_t *src_max) {
+      dynarray<const uint8_t *> starts;
+      starts.push_back(src);
+      const uint8_t *end = src;
+      for (;;) {
+        end = (const uint8_t *)memchr(end, 0xff, src_max - end);
+        if (!end || end + 1 >= src_max) {
+          end = src_max;
+          break;
+        }
+        unsigned code = end[1];
+        if (code == 0x00) {
+          end += 2;
+        } else if (code == 0xff) {
+          end += 1;
+        } else if (code >= 0xd0 && code <= 0xd7) {
+          end += 2;
+          starts.push_back(end);
+        } else {
+          break;
+        }
       }
+
+      // a truncated file has no marker after the scan. Decode a copy that has one
+      // so that the bit reader stops there.
+      dynarray<uint8_t> padded;
+      if (end == src_max) {
+        size_t size = src_max - src;
+        padded.resize(size + 2);
+        memcpy(padded.data(), src, size);
+        padded[size] = 0xff;
+        padded[size + 1] = 0xd9;
+        for (unsigned i = 0; i != starts.size(); ++i) {
+          starts[i] = padded.data() + (starts[i] - src);
+        }
+      }
+
+      const component &c = components[scan_components[0].comp];
+      unsigned num_mcus = num_components_in_scan == 1 ? c.scan_blocks_w * c.scan_blocks_h : mcus_x * mcus_y;
+      unsigned interval = restart_interval ? restart_interval : num_mcus;
+      unsigned num_intervals = restart_interval ? starts.size() : 1;
+      if (debug) printf("scan: %d mcus %d intervals\n", num_mcus, num_intervals);
+
+      // a few hundred MCUs per job.
+      unsigned grain = 256 / interval + 1;
+      parallel_for(0, num_intervals, grain, [&](unsigned i0, unsigned i1) {
+        for (unsigned i = i0; i != i1; ++i) {
+          unsigned begin = i * interval;
+          // if markers are missing, the last interval runs to the end.
+          unsigned end = i == num_intervals - 1 || begin + interval > num_mcus ? num_mcus : begin + interval;
+          if (begin < end) {
+            decode_mcus(begin, end, starts[i]);
+          }
+        }
+      });
+      return end;
+    }
+
+    // colour convert rows [begin, end) of the image, which is upside down for OpenGL.
+    void convert_rows(uint8_t *image_base, unsigned begin, unsigned end) const {
+      unsigned out_width = get_output_width();
+      unsigned out_height = get_output_height();
+      const component &y_comp = components[0];
+      for (unsigned j = begin; j != end; ++j) {
+        uint8_t *dest = image_base + (out_height - 1 - j) * out_width * 4;
+        const uint8_t *y = y_comp.plane.data() + j * y_comp.plane_stride;
+        if (num_components == 1) {
+          kernels->convert_grey(dest, y, out_width);
+        } else {
+          const component &cb_comp = components[1];
+          const component &cr_comp = components[2];
+          unsigned cj = j * cb_comp.plane_height / y_comp.plane_height;
+          const uint8_t *cb = cb_comp.plane.data() + cj * cb_comp.plane_stride;
+          const uint8_t *cr = cr_comp.plane.data() + cj * cr_comp.plane_stride;
+          if (cb_comp.plane_stride == y_comp.plane_stride) {
+            kernels->convert_444(dest, y, cb, cr, out_width);
+          } else {
+            kernels->convert_422(dest, y, cb, cr, out_width);
+          }
+        }
+      }
+    }
+
+    // turn the coefficients that the scans have built up into the planes.
+    void transform_coeffs() {
+      // progressive files: dequantise and transform all the blocks.
+      if (have_coeffs) {
+        for (unsigned i = 0; i != num_components; ++i) {
+          component &c = components[i];
+          int16_t quant[64];
+          for (unsigned k = 0; k != 64; ++k) {
+            quant[zig_zag(k)] = (int16_t)quant_tables[c.quantisation_table].table[k];
+          }
+
+          parallel_for(0, c.blocks_h, 4, [&](unsigned by0, unsigned by1) {
+            int16_t coeffs[64];
+            for (unsigned by = by0; by != by1; ++by) {
+              for (unsigned bx = 0; bx != c.blocks_w; ++bx) {
+                const int16_t *src = c.coeffs.data() + (by * c.blocks_w + bx) * 64;
+                int ac = 0;
+                coeffs[0] = (int16_t)(src[0] * quant[0]);
+                for (unsigned k = 1; k != 64; ++k) {
+                  coeffs[k] = (int16_t)(src[k] * quant[k]);
+                  ac |= coeffs[k];
+                }
+                idct_block(c, bx, by, coeffs, ac == 0);
+              }
+            }
+          });
+        }
+      }
+    }
+
+    // after the last scan, make the image.
+    void finish(dynarray<uint8_t> &image, uint16_t &format) {
+      transform_coeffs();
+
+      unsigned out_width = get_output_width();
+      unsigned out_height = get_output_height();
+      size_t base = image.size();
+      image.resize(base + out_width * out_height * 4);
+      format = 0x1908; // GL_RGBA
+
+      uint8_t *image_base = image.data() + base;
+      parallel_for(0, out_height, 64, [&](unsigned j0, unsigned j1) {
+        convert_rows(image_base, j0, j1);
+      });
+    }
+
+    // make space for the coefficients of all the scans.
+    void alloc_coeffs() {
+      have_coeffs = true;
+      for (unsigned i = 0; i != num_components; ++i) {
+        component &c = components[i];
+        c.coeffs.resize(c.blocks_w * c.blocks_h * 64);
+        memset(c.coeffs.data(), 0, c.coeffs.size() * sizeof(int16_t));
+      }
+    }
+
+    // all chunks except SOI, EOI and RSTn have a length.
+    static bool chunk_has_length(unsigned code) {
+      return !(code == 0xd8 || code == 0xd9 || code == 0xff || (code >= 0xd0 && code <= 0xd7));
     }
 
     // JPEG files are split up into chunks starting with 0xff
-    unsigned decode_chunk(const uint8_t *src, dynarray<uint8_t> &image, uint16_t &format) {
+    unsigned decode_chunk(const uint8_t *src, const uint8_t *src_max) {
       if (debug) printf("decode_chunk %02x\n", src[1]);
 
       unsigned length = 2;
 
-      switch (src[1]) {
+      // chunks with a length must fit in the file.
+      unsigned code = src[1];
+      bool has_length = chunk_has_length(code);
+      if (has_length && (src + 4 > src_max || src + u2(src + 2) + 2 > src_max)) {
+        return 0;
+      }
+
+      switch (code) {
         // different kinds of image (SOF0-7)
         case 0xc0: case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7: {
           sof_code = src[1];
           length = u2(src + 2) + 2;
+          if (length < 10 || length < 10 + src[9] * 3u) return 0;
           precision = src[4];
           height = u2(src + 5);
           width = u2(src + 7);
           num_components = src[9];
+          progressive = src[1] == 0xc2;
 
-          if (src[1] != 0xc0) {
-            printf("warning: only baseline JPEG is supported - disable progressive\n");
+          if (src[1] != 0xc0 && src[1] != 0xc1 && src[1] != 0xc2) {
+            printf("warning: only baseline and progressive JPEG are supported\n");
             return 0;
           }
 
@@ -383,15 +1061,62 @@ namespace octet { namespace loaders {
             return 0;
           }
 
+          max_hsamp = 1;
+          max_vsamp = 1;
           for (unsigned i = 0; i != num_components; ++i) {
             component &c = components[i];
             c.id = src[10 + i*3 + 0];
             c.hsamp = src[10 + i*3 + 1] >> 4;
             c.vsamp = src[10 + i*3 + 1] & 15;
             c.quantisation_table = src[10 + i*3 + 2] & 3;
+            if (num_components == 1) {
+              // greyscale images are never interleaved, so the sampling does not matter.
+              c.hsamp = c.vsamp = 1;
+            }
+            max_hsamp = c.hsamp > max_hsamp ? c.hsamp : max_hsamp;
+            max_vsamp = c.vsamp > max_vsamp ? c.vsamp : max_vsamp;
             if (debug) printf("id=%d h=%d v=%d q=%d\n", c.id, c.hsamp, c.vsamp, c.quantisation_table);
           }
-          
+
+          // one block each of Cb and Cr with one, two or four of Y.
+          // eg. 4:4:4, 4:2:2 or 4:2:0
+          if (num_components == 3) {
+            component *c = components;
+            if (
+              c[0].hsamp > 2 || c[0].vsamp > 2 || c[0].hsamp == 0 || c[0].vsamp == 0 ||
+              c[1].hsamp != 1 || c[1].vsamp != 1 || c[2].hsamp != 1 || c[2].vsamp != 1
+            ) {
+              printf("warning: unsupported chroma sampling\n");
+              return 0;
+            }
+          }
+
+          mcus_x = (width + max_hsamp * 8 - 1) / (max_hsamp * 8);
+          mcus_y = (height + max_vsamp * 8 - 1) / (max_vsamp * 8);
+
+          for (unsigned i = 0; i != num_components; ++i) {
+            component &c = components[i];
+            c.blocks_w = mcus_x * c.hsamp;
+            c.blocks_h = mcus_y * c.vsamp;
+            c.scan_blocks_w = ((width * c.hsamp + max_hsamp - 1) / max_hsamp + 7) / 8;
+            c.scan_blocks_h = ((height * c.vsamp + max_vsamp - 1) / max_vsamp + 7) / 8;
+
+            // when scaling down 4:2:0, reduce the chroma less to keep it at full resolution.
+            c.shift = scale_shift;
+            while (c.shift && c.hsamp * 2 <= max_hsamp >> (scale_shift - c.shift) && c.vsamp * 2 <= max_vsamp >> (scale_shift - c.shift)) {
+              c.shift--;
+            }
+
+            unsigned size = 8 >> c.shift;
+            c.plane_stride = c.blocks_w * size;
+            c.plane_height = c.blocks_h * size;
+            c.plane.resize(c.plane_stride * c.plane_height);
+            memset(c.plane.data(), 0x80, c.plane.size());
+          }
+
+          if (progressive) {
+            alloc_coeffs();
+          }
         } break;
 
         // huffman tables
@@ -434,7 +1159,21 @@ namespace octet { namespace loaders {
               if (debug) printf("h.maxcodes[%d] = %04x\n", len-1, h.maxcodes[len-1]);
             }
             h.maxcodes[16] = 0xffff;
-            
+
+            memset(h.fast, 0, sizeof(h.fast));
+            code = 0;
+            dest = 0;
+            for (unsigned len = 1; len <= huffman_table::fast_bits; ++len) {
+              for (unsigned i = 0; i != num_codes[len-1]; ++i, ++code, ++dest) {
+                if (code >= 1u << len) return 0; // too many codes
+                unsigned fill = 1 << (huffman_table::fast_bits - len);
+                for (unsigned j = 0; j != fill; ++j) {
+                  h.fast[code * fill + j] = (uint16_t)(len << 8 | h.huffval[dest]);
+                }
+              }
+              code *= 2;
+            }
+
             if (debug) printf("DHT %d\n", index);
           }
         } break;
@@ -449,21 +1188,28 @@ namespace octet { namespace loaders {
           if (debug) printf("EOI\n");
         } break;
 
+        // restart interval
+        case 0xdd: {
+          length = u2(src + 2) + 2;
+          if (length < 6) return 0;
+          restart_interval = u2(src + 4);
+          if (debug) printf("DRI %d\n", restart_interval);
+        } break;
+
         // image data
         case 0xda: {
-          const uint8_t *src0 = src;
           length = u2(src + 2) + 2;
-          src += 4;
-          num_components_in_scan = *src++;
-          unsigned max_hsamp = 1;
-          unsigned max_vsamp = 1;
+          if (length < 5 || length < 8 + src[4] * 2u) return 0;
+          const uint8_t *p = src + 4;
+          num_components_in_scan = *p++;
+          if (!mcus_x || num_components_in_scan == 0 || num_components_in_scan > num_components) return 0;
+
           num_mcu_blocks = 0;
-          const uint8_t *src_max = src + length;
           for (unsigned i = 0; i != num_components_in_scan; ++i) {
             scan_component &sc = scan_components[i];
-            unsigned id = *src++;
-            sc.ac_table = *src & 0x0f;
-            sc.dc_table = *src++ >> 4;
+            unsigned id = *p++;
+            sc.ac_table = *p & 0x03;
+            sc.dc_table = (*p++ >> 4) & 0x03;
             unsigned comp = 0;
             while (comp < num_components) {
               if (components[comp].id == id) break;
@@ -471,12 +1217,13 @@ namespace octet { namespace loaders {
             }
             if (comp >= num_components) return 0;
             component &c = components[comp];
-            max_hsamp = c.hsamp > max_hsamp ? c.hsamp : max_hsamp;
-            max_vsamp = c.vsamp > max_vsamp ? c.vsamp : max_vsamp;
             sc.comp = comp;
             if (debug) printf("SOS comp=%d ac=%d dc=%d\n", comp, sc.ac_table, sc.dc_table);
-            unsigned samps = c.hsamp * c.vsamp;
 
+            // a scan with one component has one block per MCU whatever the sampling.
+            unsigned hsamp = num_components_in_scan == 1 ? 1 : c.hsamp;
+            unsigned vsamp = num_components_in_scan == 1 ? 1 : c.vsamp;
+            unsigned samps = hsamp * vsamp;
             if (num_mcu_blocks + samps > sizeof(mcu_blocks)/sizeof(mcu_blocks[0])) {
               printf("too many mcu blocks\n");
               return 0;
@@ -487,73 +1234,43 @@ namespace octet { namespace loaders {
               m.dc_table = &huffman_tables[0][sc.dc_table];
               m.ac_table = &huffman_tables[1][sc.ac_table];
               m.quant = &quant_tables[c.quantisation_table];
-              m.scan_comp = &sc;
+              m.comp = (uint8_t)comp;
+              m.scan_index = (uint8_t)i;
+              m.x = (uint8_t)(j % hsamp);
+              m.y = (uint8_t)(j / hsamp);
             }
-
-            sc.last_dc = 0;
           }
 
-          // at present, we only support YCrCb in 4:4:4
-          if (num_mcu_blocks != 1 && num_mcu_blocks != 3 && num_mcu_blocks != 6) {
-            printf("only 4:4:4 and 4:1:1 greyscale and ycrcb supported (%d mcu blocks)\n", num_mcu_blocks);
-            return 0;
-          }
+          spectral_start = *p++;
+          spectral_end = *p++;
+          successive_high = p[0] >> 4;
+          successive_low = *p++ & 0x0f;
+          if (p > src + length) return 0;
+          if (debug) printf("Ss=%d Se=%d Ah=%d Al=%d\n", spectral_start, spectral_end, successive_high, successive_low);
 
-          spectral_start = *src++;
-          spectral_end = *src++;
-          successive_high = src[0] >> 4;
-          successive_low = *src++ & 0x0f;
-          if (src > src_max) return 0;
+          if (progressive) {
+            // DC scans may be interleaved, AC scans are one component at a time.
+            bool dc = spectral_start == 0;
+            if (spectral_end > 63 || spectral_start > spectral_end || dc != (spectral_end == 0) || (!dc && num_components_in_scan != 1) || successive_low > 13) {
+              printf("warning: bad progressive scan\n");
+              return 0;
+            }
+          } else {
+            spectral_start = 0;
+            spectral_end = 63;
+            successive_high = successive_low = 0;
 
-          for (unsigned i = 0; i != num_components_in_scan; ++i) {
-            scan_component &sc = scan_components[i];
-            component &c = components[sc.comp];
-            sc.width_in_blocks = width * c.hsamp / max_hsamp;
-            sc.height_in_blocks = height * c.hsamp / max_hsamp;
+            // baseline files with one component in each scan need the coefficients of each scan.
+            if (!have_coeffs && num_components_in_scan != num_components) {
+              alloc_coeffs();
+            }
           }
 
-          width = (width + max_hsamp * 8 - 1) & ~(max_hsamp * 8 - 1);
-          height = (height + max_vsamp * 8 - 1) & ~(max_vsamp * 8 - 1);
-
-          unsigned xmax = ( width + max_hsamp * 8 - 1 ) / (max_hsamp * 8);
-          unsigned ymax = ( height + max_vsamp * 8 - 1 ) / (max_vsamp * 8);
+          // when streaming, decode() reads the scan as it arrives.
+          if (streaming) break;
 
-          unsigned acc = 0;
-          int shift = 0;
-          skip_bits(16, acc, src, shift);
-          
-          int stride = width * 4;
-
-          unsigned size = width * height * 4;
-          size_t base = image.size();
-          image.resize(base + size);
-          format = 0x1908; // GL_RGBA
-
-          uint8_t *image_base = image.data() + base;
-
-          for (unsigned y = 0; y != ymax; ++y) {
-            for (unsigned x = 0; x != xmax; ++x) {
-              float *coeffs = dct_coeffs;
-              memset(coeffs, 0, 64 * num_mcu_blocks * sizeof(float));
-              for (unsigned b = 0; b < num_mcu_blocks; ++b) {
-                decode_mcu_block(b, acc, src, shift, coeffs);
-                inverse_dct(coeffs);
-                coeffs += 64;
-              }
-              if (num_mcu_blocks == 1) {
-                // assume 4:4:4 Greyscale
-                color_convert_444_greyscale(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 3) {
-                // assume 4:4:4 YCbCr
-                color_convert_444(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 6) {
-                // assume 4:1:1 YCbCr
-                color_convert_411(&image_base[((height - 1 - y * 16) * stride) + (x * 16 * 4)], -stride, dct_coeffs);
-              }
-            }
-          }
-          skip_bits(shift, acc, src, shift);
-          length = (unsigned)(src - src0);
+          const uint8_t *end = decode_scan(src + length, src_max);
+          length = (unsigned)(end - src);
         } break;
 
         // quantisation tables (the lossy bit)
@@ -565,8 +1282,9 @@ namespace octet { namespace loaders {
             unsigned prec = (src[0] >> 4) & 1;
             unsigned n = src[0] & 0x0f;
             src++;
+            if (src + 64 * (prec + 1) > src_max) return 0;
             for (unsigned i = 0; i != 64; ++i) {
-              quant_tables[n&3].table[i] = (float)( prec ? u2(src) : *src );
+              quant_tables[n&3].table[i] = (uint16_t)( prec ? u2(src) : *src );
               src += prec + 1;
             }
             if (debug) printf("DQT %d %d\n", prec, n);
@@ -581,31 +1299,265 @@ namespace octet { namespace loaders {
 
         // unknown chunk
         default: {
-          if (src[2] != 0xff) length = u2(src + 2) + 2;
+          if (has_length) length = u2(src + 2) + 2;
           if (debug) printf("unknown\n");
         } break;
       }
       return length;
     }
+    // find the marker after some entropy coded data, or src_max if it has not arrived.
+    static const uint8_t *find_marker(const uint8_t *src, const uint8_t *src_max) {
+      for (;;) {
+        src = (const uint8_t *)memchr(src, 0xff, src_max - src);
+        if (!src || src + 1 >= src_max) return src_max;
+        unsigned code = src[1];
+        if (code == 0x00 || (code >= 0xd0 && code <= 0xd7)) {
+          src += 2;
+        } else if (code == 0xff) {
+          src += 1;
+        } else {
+          return src;
+        }
+      }
+    }
+
+    // colour convert MCU rows that are finished and pass them on.
+    void add_mcu_rows(unsigned end) {
+      unsigned out_height = get_output_height();
+      if (end > out_height) end = out_height;
+      if (end <= rows_converted) return;
+      convert_rows(get_output(), rows_converted, end);
+      add_rows(out_height - end, end - rows_converted);
+      rows_converted = end;
+    }
+
+    // decode whole rows of MCUs of a baseline scan as the data arrives.
+    // A row that runs out of data is decoded again when more arrives.
+    void decode_rows(bool at_end) {
+      const uint8_t *src_max = src_data + src_size;
+      unsigned num_mcus = mcus_x * mcus_y;
+      unsigned mcu_height = (max_vsamp * 8) >> scale_shift;
+      unsigned eobrun = 0;
+      int16_t coeffs[64];
+
+      if (!at_end && src_size < reader.retry_size) return;
+
+      while (reader.mcu != num_mcus) {
+        // the padding after the data is an EOI marker, which stalls the bit reader.
+        row_reader r = reader;
+        const uint8_t *src = src_data + r.pos;
+        if (!r.primed) {
+          skip_bits(16, r.acc, src, r.shift);
+          r.primed = true;
+        }
+
+        unsigned end = r.mcu + mcus_x;
+        for (; r.mcu != end; ++r.mcu) {
+          if (restart_interval && r.mcu && r.mcu % restart_interval == 0) {
+            // skip to just after the RSTn marker and start again.
+            while (src + 1 < src_max && !(src[0] == 0xff && src[1] != 0x00 && src[1] != 0xff)) {
+              src++;
+            }
+            if (src + 1 < src_max && src[1] >= 0xd0 && src[1] <= 0xd7) {
+              src += 2;
+            } else if (!at_end) {
+              break;
+            }
+            r.acc = 0;
+            r.shift = 0;
+            skip_bits(16, r.acc, src, r.shift);
+            memset(r.last_dc, 0, sizeof(r.last_dc));
+          }
+          decode_mcus(r.mcu, r.mcu + 1, r.last_dc, eobrun, coeffs, r.acc, src, r.shift);
+        }
+
+        // wait for more data.
+        if (!at_end && (r.mcu != end || src + 1 >= src_max)) {
+          reader.retry_size = src_size + (src_data + reader.pos < src ? src - (src_data + reader.pos) : 0);
+          return;
+        }
+
+        r.pos = src - src_data;
+        reader = r;
+        add_mcu_rows(reader.mcu / mcus_x * mcu_height);
+      }
+    }
+
+    // the end of the file: make the rest of the image.
+    bool finish_stream() {
+      stream_stage = stream_end;
+      if (!mcus_x) {
+        printf("warning: no image in JPEG file\n");
+        return false;
+      }
+
+      if (have_coeffs) {
+        transform_coeffs();
+        rows_converted = 0;
+      }
+
+      unsigned out_height = get_output_height();
+      unsigned first = rows_converted;
+      uint8_t *image = get_output();
+      parallel_for(first, out_height, 64, [&](unsigned j0, unsigned j1) {
+        convert_rows(image, j0, j1);
+      });
+      rows_converted = out_height;
+      add_rows(0, out_height - first);
+      return true;
+    }
+
+    void reset() {
+      mcus_x = mcus_y = 0;
+      num_components = 0;
+      restart_interval = 0;
+      progressive = false;
+      have_coeffs = false;
+
+      // a bad file may use tables it has not defined.
+      memset(huffman_tables, 0, sizeof(huffman_tables));
+
+      streaming = true;
+      stream_stage = stream_chunks;
+      rows_converted = 0;
+    }
+
+    // decode the chunks and scans that have arrived.
+    bool decode(bool at_end) {
+      const uint8_t *src_max = src_data + src_size;
+      for (;;) {
+        switch (stream_stage) {
+          case stream_chunks: {
+            // wait for a whole chunk (or the header of a scan).
+            const uint8_t *src = src_data + src_pos;
+            if (src + 2 > src_max) {
+              return at_end ? finish_stream() : true;
+            }
+            unsigned code = src[1];
+            if (src[0] != 0xff) {
+              printf("warning: bad JPEG file\n");
+              return false;
+            }
+            if (chunk_has_length(code) && (src + 4 > src_max || src + u2(src + 2) + 2 > src_max)) {
+              if (!at_end) return true;
+              printf("warning: bad JPEG file @ chunk %02x\n", code);
+              return false;
+            }
+            if (code == 0xd9) {
+              src_pos += 2;
+              return finish_stream();
+            }
+
+            unsigned length = decode_chunk(src, src_max);
+            if (!length) {
+              printf("warning: bad JPEG file @ chunk %02x\n", code);
+              return false;
+            }
+            src_pos += length;
+
+            // make space for the image as soon as we know its size.
+            if (mcus_x && !image_width) {
+              unsigned out_width = get_output_width();
+              unsigned out_height = get_output_height();
+              begin_image(0x1908, out_width, out_height, out_width * out_height * 4); // GL_RGBA
+            }
+
+            if (code == 0xda) {
+              scan_start = scan_search = src_pos;
+              if (!have_coeffs) {
+                // one scan of all the components: decode it a row at a time.
+                memset(&reader, 0, sizeof(reader));
+                reader.pos = src_pos;
+                stream_stage = stream_rows;
+                scan_pending = false;
+              } else {
+                // progressive scans: wait for the whole scan.
+                stream_stage = stream_scan;
+                scan_pending = true;
+              }
+            }
+          } break;
+
+          case stream_rows: {
+            decode_rows(at_end);
+            if (reader.mcu != mcus_x * mcus_y) return true;
+            scan_search = reader.pos;
+            stream_stage = stream_scan;
+          } break;
+
+          case stream_scan: {
+            // find the marker after the scan.
+            const uint8_t *end = find_marker(src_data + scan_search, src_max);
+            if (end == src_max && !at_end) {
+              scan_search = src_size - 1 > scan_search ? src_size - 1 : scan_search;
+              return true;
+            }
+            if (scan_pending) {
+              end = decode_scan(src_data + scan_start, src_max);
+            }
+            src_pos = end - src_data;
+            stream_stage = stream_chunks;
+          } break;
+
+          case stream_end: {
+            return true;
+          }
+        }
+      }
+    }
   public:
+    /// SIMD levels for set_simd_level()
+    enum { simd_none, simd_sse2, simd_avx2 };
+
+    jpeg_decoder() {
+      kernels = get_kernels(simd_avx2);
+      scale_shift = 0;
+      streaming = false;
+      stream_stage = stream_end;
+    }
+
+    /// The decoder uses the fastest code the cpu supports.
+    /// Use this to choose slower code for testing and benchmarks.
+    void set_simd_level(unsigned level) {
+      kernels = get_kernels(level);
+    }
+
+    /// Decode at 1/2, 1/4 or 1/8 of the size (shift = 1, 2 or 3) for thumbnails and distant LODs.
+    ///
+    /// This goes straight from the DCT coefficients to the smaller image, so there is no
+    /// full size image to make and shrink. At 1/8 size only the DC terms are used.
+    /// The huffman decode still reads the whole file.
+    void set_scale_shift(unsigned shift) {
+      scale_shift = shift < 3 ? shift : 3;
+    }
+
     // get an opengl texture from a file in memory
     void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
-      while (src < src_max) {
+      // the whole file is here, so scans with restart markers can be decoded in parallel.
+      reset();
+      streaming = false;
+
+      while (src + 2 <= src_max) {
         if (src[0] != 0xff) {
           printf("warning: bad JPEG file\n");
           return;
         }
-        unsigned length = decode_chunk(src, image, format);
+        unsigned length = decode_chunk(src, src_max);
         if (!length) {
           printf("warning: bad JPEG file @ chunk %02x\n", src[1]);
           return;
         }
         src += length;
       }
-      width_ = width;
-      height_ = height;
-      num_components = 3;
+
+      if (!mcus_x) {
+        printf("warning: no image in JPEG file\n");
+        return;
+      }
+
+      finish(image, format);
+      width_ = get_output_width();
+      height_ = get_output_height();
     }
   };
 }}
-
@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// KTX2 texture container decoder
+//
+// KTX2 files hold every mip level and cube face of a texture, ready for the GPU,
+// so loading one is a copy with no decoding. See ktx_encoder for the writer.
+//
+// See https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+//
+namespace octet { namespace loaders {
+  /// Decoder for uncompressed and BC compressed KTX2 files.
+  ///
+  /// The image holds each face in turn, with its levels largest first.
+  class ktx_decoder : public image_decoder {
+  public:
+    // layout of the formats we can read and write
+    struct format_info {
+      uint16_t gl_format;
+      uint16_t vk_format;
+      uint8_t color_model;    // khronos data format color model
+      uint8_t block_size;     // 4 for block compressed formats, otherwise 1
+      uint8_t block_bytes;    // bytes per block or pixel
+      uint8_t num_samples;    // channels in the data format descriptor
+      uint8_t channels[4];    // khronos data format channel ids
+    };
+
+    /// Bytes before the level index.
+    enum { header_size = 80 };
+
+    /// Table of formats, ending with a zero gl_format.
+    static const format_info *get_formats() {
+      static const format_info formats[] = {
+        // gl_format  vk_format  model  block  bytes  samples  channels
+        { 0x1907,     23,        1,     1,     3,     3,       { 0, 1, 2, 0 } },   // RGB, R8G8B8_UNORM
+        { 0x1908,     37,        1,     1,     4,     4,       { 0, 1, 2, 15 } },  // RGBA, R8G8B8A8_UNORM
+        { 0x1909,     9,         1,     1,     1,     1,       { 0, 0, 0, 0 } },   // LUMINANCE, R8_UNORM
+        { 0x190A,     16,        1,     1,     2,     2,       { 0, 1, 0, 0 } },   // LUMINANCE_ALPHA, R8G8_UNORM
+        { 0x83F0,     131,       128,   4,     8,     1,       { 0, 0, 0, 0 } },   // DXT1, BC1_RGB_UNORM_BLOCK
+        { 0x83F1,     133,       128,   4,     8,     1,       { 1, 0, 0, 0 } },   // DXT1 with alpha, BC1_RGBA_UNORM_BLOCK
+        { 0x83F2,     135,       129,   4,     16,    2,       { 15, 0, 0, 0 } },  // DXT3, BC2_UNORM_BLOCK
+        { 0x83F3,     137,       130,   4,     16,    2,       { 15, 0, 0, 0 } },  // DXT5, BC3_UNORM_BLOCK
+        { 0x8DBB,     139,       131,   4,     8,     1,       { 0, 0, 0, 0 } },   // RGTC1, BC4_UNORM_BLOCK
+        { 0x8DBD,     141,       132,   4,     16,    2,       { 0, 1, 0, 0 } },   // RGTC2, BC5_UNORM_BLOCK
+        { 0x8E8C,     145,       134,   4,     16,    1,       { 0, 0, 0, 0 } },   // BPTC, BC7_UNORM_BLOCK
+        { 0,          0,         0,     0,     0,     0,       { 0, 0, 0, 0 } },
+      };
+      return formats;
+    }
+
+    /// Find a format by its GL or Vulkan number. Returns null if there is none.
+    static const format_info *find_format(unsigned gl_format, unsigned vk_format = 0) {
+      for (const format_info *f = get_formats(); f->gl_format; ++f) {
+        if (gl_format ? f->gl_format == gl_format : f->vk_format == vk_format) return f;
+      }
+      return 0;
+    }
+
+    /// Bytes in one level of one face.
+    static size_t get_level_size(const format_info *f, unsigned width, unsigned height) {
+      unsigned bs = f->block_size;
+      return (size_t)((width + bs - 1) / bs) * ((height + bs - 1) / bs) * f->block_bytes;
+    }
+
+    /// The twelve bytes at the start of every KTX2 file.
+    static const uint8_t *get_identifier() {
+      static const uint8_t identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, 0x0d, 0x0a, 0x1a, 0x0a };
+      return identifier;
+    }
+
+  private:
+    unsigned num_levels;
+    unsigned num_faces;
+
+    static uint32_t r4(const uint8_t *src) {
+      return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+    }
+
+    static uint64_t r8(const uint8_t *src) {
+      return r4(src) | ((uint64_t)r4(src + 4) << 32);
+    }
+
+    // true if rows go from the top of the image down, the default for KTX2.
+    static bool is_top_down(const uint8_t *kvd, size_t size) {
+      for (size_t pos = 0; pos + 4 <= size; ) {
+        size_t length = r4(kvd + pos);
+        if (length > size - pos - 4) break;
+        const char *key = (const char*)kvd + pos + 4;
+        if (length >= 17 && !memcmp(key, "KTXorientation", 15)) {
+          return key[16] != 'u';
+        }
+        pos += 4 + ((length + 3) & ~3);
+      }
+      return true;
+    }
+
+    void reset() {
+      num_levels = num_faces = 1;
+    }
+
+    // textures are not much use until they are complete, so wait for the end.
+    bool decode(bool at_end) {
+      if (!at_end) return true;
+
+      const uint8_t *src = src_data;
+      size_t size = src_size;
+      if (size < header_size || memcmp(src, get_identifier(), 12)) return false;
+
+      const format_info *f = find_format(0, r4(src + 12));
+      unsigned width = r4(src + 20);
+      unsigned height = r4(src + 24);
+      unsigned faces = r4(src + 36);
+      unsigned levels = r4(src + 40);
+      levels = levels ? levels : 1;
+      if (!f) {
+        printf("warning: KTX2 format %d not supported\n", r4(src + 12));
+        return false;
+      }
+      if (r4(src + 28) != 0 || r4(src + 32) > 1 || (faces != 1 && faces != 6) || r4(src + 44) != 0) {
+        printf("warning: KTX2 decoder only supports 2D textures and cube maps\n");
+        return false;
+      }
+      if (width == 0 || height == 0 || width > 0xffff || height > 0xffff || levels > 16 || header_size + levels * 24 > size) {
+        return false;
+      }
+
+      // sizes and positions of the levels
+      size_t face_size = 0;
+      for (unsigned level = 0; level != levels; ++level) {
+        const uint8_t *index = src + header_size + level * 24;
+        unsigned w = width >> level ? width >> level : 1;
+        unsigned h = height >> level ? height >> level : 1;
+        size_t level_size = get_level_size(f, w, h);
+        uint64_t offset = r8(index), length = r8(index + 8);
+        if (length != level_size * faces || offset > size || length > size - offset) return false;
+        face_size += level_size;
+      }
+
+      size_t kvd_offset = r4(src + 56), kvd_size = r4(src + 60);
+      bool flip = kvd_offset <= size && kvd_size <= size - kvd_offset ? is_top_down(src + kvd_offset, kvd_size) : true;
+      if (flip && f->block_size != 1) {
+        printf("warning: KTX2 compressed texture is upside down\n");
+        flip = false;
+      }
+
+      num_levels = levels;
+      num_faces = faces;
+      uint8_t *dest = begin_image(f->gl_format, (uint16_t)width, (uint16_t)height, face_size * faces);
+      for (unsigned face = 0; face != faces; ++face) {
+        for (unsigned level = 0; level != levels; ++level) {
+          const uint8_t *index = src + header_size + level * 24;
+          unsigned w = width >> level ? width >> level : 1;
+          unsigned h = height >> level ? height >> level : 1;
+          size_t level_size = get_level_size(f, w, h);
+          const uint8_t *level_src = src + r8(index) + level_size * face;
+          if (flip) {
+            size_t stride = (size_t)w * f->block_bytes;
+            for (unsigned y = 0; y != h; ++y) {
+              memcpy(dest + stride * (h - 1 - y), level_src + stride * y, stride);
+            }
+          } else {
+            memcpy(dest, level_src, level_size);
+          }
+          dest += level_size;
+        }
+      }
+      return true;
+    }
+
+  public:
+    ktx_decoder() {
+      reset();
+    }
+
+    /// Return true if a file is a KTX2 file.
+    static bool is_ktx2(const uint8_t *src, size_t size) {
+      return size >= 12 && !memcmp(src, get_identifier(), 12);
+    }
+
+    /// Number of mipmap levels in the file.
+    unsigned get_num_levels() const {
+      return num_levels;
+    }
+
+    /// 6 for cube maps, 1 for 2D textures.
+    unsigned get_num_faces() const {
+      return num_faces;
+    }
+
+    /// get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      image.resize(0);
+      if (decode_file(image, src, src_max)) {
+        format = image_format;
+        width = image_width;
+        height = image_height;
+      }
+    }
+  };
+}}
@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// KTX2 texture container encoder
+//
+// Writes textures as the GPU wants them, so that they can be loaded again
+// with a copy. Rows are written bottom up, as octet keeps them, and the file
+// says so with a KTXorientation of "ru".
+//
+namespace octet { namespace loaders {
+  /// Write uncompressed or BC compressed textures to KTX2 files.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<uint8_t> file;
+  ///     ktx_encoder::encode(file, format, width, height, num_levels, 1, &bytes[0], bytes.size());
+  class ktx_encoder {
+    typedef ktx_decoder::format_info format_info;
+
+    static void w4(uint8_t *dest, uint32_t value) {
+      dest[0] = (uint8_t)value; dest[1] = (uint8_t)(value >> 8); dest[2] = (uint8_t)(value >> 16); dest[3] = (uint8_t)(value >> 24);
+    }
+
+    static void w8(uint8_t *dest, uint64_t value) {
+      w4(dest, (uint32_t)value);
+      w4(dest + 4, (uint32_t)(value >> 32));
+    }
+
+    static size_t align(size_t value, size_t alignment) {
+      return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // the data format descriptor: one basic block describing the channels
+    static size_t write_dfd(uint8_t *dest, const format_info *f) {
+      size_t block_size = 24 + 16 * f->num_samples;
+      if (dest) {
+        memset(dest, 0, 4 + block_size);
+        w4(dest, (uint32_t)(4 + block_size));
+        w4(dest + 8, 2 | ((uint32_t)block_size << 16));  // version 2
+        dest[12] = f->color_model;
+        dest[13] = 1;  // BT.709 primaries
+        dest[14] = 1;  // linear transfer, as for UNORM formats
+        dest[16] = (uint8_t)(f->block_size - 1);
+        dest[17] = (uint8_t)(f->block_size - 1);
+        dest[20] = f->block_bytes;
+
+        // compressed formats have 64 bit samples, the others 8 bit.
+        unsigned bits = f->block_size == 1 ? 8 : f->num_samples == 1 ? f->block_bytes * 8 : 64;
+        for (unsigned i = 0; i != f->num_samples; ++i) {
+          uint8_t *sample = dest + 28 + i * 16;
+          sample[0] = (uint8_t)(bits * i);
+          sample[1] = (uint8_t)((bits * i) >> 8);
+          sample[2] = (uint8_t)(bits - 1);
+          sample[3] = f->channels[i];
+          w4(sample + 12, bits == 8 ? 255 : 0xffffffff);
+        }
+      }
+      return 4 + block_size;
+    }
+
+    // one key/value pair, padded to four bytes
+    static size_t write_kv(uint8_t *dest, const char *key, const char *value) {
+      size_t length = strlen(key) + 1 + strlen(value) + 1;
+      if (dest) {
+        memset(dest, 0, 4 + align(length, 4));
+        w4(dest, (uint32_t)length);
+        memcpy(dest + 4, key, strlen(key));
+        memcpy(dest + 4 + strlen(key) + 1, value, strlen(value));
+      }
+      return 4 + align(length, 4);
+    }
+
+  public:
+    /// Return true if encode() can write this format.
+    static bool can_encode(unsigned format) {
+      return ktx_decoder::find_format(format) != 0;
+    }
+
+    /// Make a KTX2 file from an image with num_levels levels and num_faces faces (1 or 6).
+    ///
+    /// src holds each face in turn with its levels largest first, as ktx_decoder makes them.
+    /// Returns false if the format is not supported or src is too small.
+    static bool encode(dynarray<uint8_t> &file, unsigned format, unsigned width, unsigned height, unsigned num_levels, unsigned num_faces, const uint8_t *src, size_t src_size) {
+      const format_info *f = ktx_decoder::find_format(format);
+      if (!f || !width || !height || !num_levels || num_levels > 16 || (num_faces != 1 && num_faces != 6)) return false;
+
+      size_t level_sizes[16];
+      size_t face_size = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        unsigned w = width >> level ? width >> level : 1;
+        unsigned h = height >> level ? height >> level : 1;
+        level_sizes[level] = ktx_decoder::get_level_size(f, w, h);
+        face_size += level_sizes[level];
+      }
+      if (face_size * num_faces > src_size) return false;
+
+      // header, level index, data format descriptor, key/value data, then the levels, smallest first.
+      size_t dfd_offset = ktx_decoder::header_size + num_levels * 24;
+      size_t kvd_offset = dfd_offset + write_dfd(0, f);
+      size_t kvd_size = write_kv(0, "KTXorientation", "ru") + write_kv(0, "KTXwriter", "octet");
+      // levels start at a multiple of both the block size and four bytes.
+      unsigned bb = f->block_bytes;
+      size_t level_alignment = bb % 4 == 0 ? bb : bb % 2 == 0 ? bb * 2 : bb * 4;
+      size_t level_offsets[16];
+      size_t offset = kvd_offset + kvd_size;
+      for (unsigned level = num_levels; level-- != 0; ) {
+        offset = align(offset, level_alignment);
+        level_offsets[level] = offset;
+        offset += level_sizes[level] * num_faces;
+      }
+
+      file.resize(offset);
+      uint8_t *dest = file.data();
+      memset(dest, 0, kvd_offset + kvd_size);
+      memcpy(dest, ktx_decoder::get_identifier(), 12);
+      w4(dest + 12, f->vk_format);
+      w4(dest + 16, 1);  // type size
+      w4(dest + 20, width);
+      w4(dest + 24, height);
+      w4(dest + 36, num_faces);
+      w4(dest + 40, num_levels);
+      w4(dest + 48, (uint32_t)dfd_offset);
+      w4(dest + 52, (uint32_t)(kvd_offset - dfd_offset));
+      w4(dest + 56, (uint32_t)kvd_offset);
+      w4(dest + 60, (uint32_t)kvd_size);
+      write_dfd(dest + dfd_offset, f);
+      size_t kv = kvd_offset;
+      kv += write_kv(dest + kv, "KTXorientation", "ru");
+      write_kv(dest + kv, "KTXwriter", "octet");
+
+      size_t level_src = 0;
+      for (unsigned level = 0; level != num_levels; ++level) {
+        w8(dest + ktx_decoder::header_size + level * 24, level_offsets[level]);
+        w8(dest + ktx_decoder::header_size + level * 24 + 8, level_sizes[level] * num_faces);
+        w8(dest + ktx_decoder::header_size + level * 24 + 16, level_sizes[level] * num_faces);
+        for (unsigned face = 0; face != num_faces; ++face) {
+          memcpy(dest + level_offsets[level] + level_sizes[level] * face, src + face_size * face + level_src, level_sizes[level]);
+        }
+        level_src += level_sizes[level];
+      }
+
+      // padding between the levels
+      size_t pos = kvd_offset + kvd_size;
+      for (unsigned level = num_levels; level-- != 0; ) {
+        memset(dest + pos, 0, level_offsets[level] - pos);
+        pos = level_offsets[level] + level_sizes[level] * num_faces;
+      }
+      return true;
+    }
+  };
+}}
@@ -28,11 +28,17 @@
 #define OCTET_LOADERS_INCLUDED
 
   #include "../loaders/zip_decoder.h"
+  #include "../loaders/zip_encoder.h"
+  #include "../loaders/image_decoder.h"
   #include "../loaders/gif_decoder.h"
   #include "../loaders/jpeg_decoder.h"
   #include "../loaders/jpeg_encoder.h"
   #include "../loaders/tga_decoder.h"
   #include "../loaders/dds_decoder.h"
+  #include "../loaders/ktx_decoder.h"
+  #include "../loaders/ktx_encoder.h"
+  #include "../loaders/bc_encoder.h"
+  #include "../loaders/mipmap_generator.h"
   #include "../loaders/nifti_decoder.h"
 
 #endif
@@ -0,0 +1,534 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// mipmap generation for 8 bit images
+//
+// Each level is made from the one above with a separable filter, in linear space
+// for sRGB colours, so that mipmaps of bright detail do not go dark.
+// Levels are sized as OpenGL expects: half the size, rounded down, but at least one,
+// so non-square and non-power-of-two images get a complete set of levels.
+//
+// The filters are worked out once per level as a list of taps for each row and column,
+// which works for any change of size, not just halving.
+//
+namespace octet { namespace loaders {
+  /// Make mipmaps for ALPHA, LUMINANCE, LUMINANCE_ALPHA, RGB or RGBA images.
+  ///
+  /// Example:
+  ///
+  ///     mipmap_generator gen;
+  ///     gen.set_filter(mipmap_generator::filter_kaiser);
+  ///     bytes.resize(mipmap_generator::get_size(format, width, height));
+  ///     gen.generate(&bytes[0], format, width, height);
+  class mipmap_generator {
+  public:
+    /// Filters for set_filter()
+    enum filter_t {
+      filter_box,      // average of the pixels under each new pixel: fast and soft.
+      filter_kaiser,   // Kaiser windowed sinc: sharper, with very little ringing.
+      filter_lanczos,  // Lanczos 3: sharpest, with some ringing at hard edges.
+    };
+
+    /// SIMD levels for set_simd_level()
+    enum { simd_none, simd_sse2 };
+
+    /// Changes whenever the output changes, so that cached textures can be thrown away.
+    enum { version = 1 };
+
+  private:
+    enum {
+      // these are here to avoid including glext.h which may be platform dependent.
+      ALPHA = 0x1906,
+      RGB = 0x1907,
+      RGBA = 0x1908,
+      LUMINANCE = 0x1909,
+      LUMINANCE_ALPHA = 0x190A,
+
+      // entries in the tables from floats to bytes
+      float_table_size = 16384,
+
+      // about this many new pixels per job
+      pixels_per_job = 16384,
+    };
+
+    // for each new pixel in a row or column: the pixels it is made from and their weights.
+    // Every pixel has num_taps taps, some with zero weight.
+    struct taps_t {
+      unsigned num_taps;
+      dynarray<uint32_t> index;
+      dynarray<float> weights;
+    };
+
+    // tables to convert to and from floats in linear space: [0] for linear channels, [1] for sRGB.
+    struct tables_t {
+      float to_float[2][256];
+      uint8_t from_float[2][float_table_size];
+
+      static float decode(float x) {
+        return x <= 0.04045f ? x * (1.0f / 12.92f) : powf((x + 0.055f) * (1.0f / 1.055f), 2.4f);
+      }
+
+      static float encode(float x) {
+        return x <= 0.0031308f ? x * 12.92f : 1.055f * powf(x, 1.0f / 2.4f) - 0.055f;
+      }
+
+      tables_t() {
+        for (unsigned i = 0; i != 256; ++i) {
+          to_float[0][i] = i * (1.0f / 255);
+          to_float[1][i] = decode(i * (1.0f / 255));
+        }
+        for (unsigned i = 0; i != float_table_size; ++i) {
+          float x = i * (1.0f / (float_table_size - 1));
+          from_float[0][i] = (uint8_t)(x * 255 + 0.5f);
+          from_float[1][i] = (uint8_t)(encode(x) * 255 + 0.5f);
+        }
+      }
+    };
+
+    // how to convert each channel to and from linear floats
+    struct channels_t {
+      unsigned num_comps;
+      const float *to_float[4];
+      const uint8_t *from_float[4];
+      int alpha;
+    };
+
+    // SIMD versions of the filters. See set_simd_level()
+    struct kernel_table {
+      // dest[x] = sum of weights[j] * src[index[j]] for a row of four channel pixels.
+      void (*filter_row)(float *dest, const float *src, const uint32_t *index, const float *weights, unsigned num_taps, unsigned width);
+
+      // dest[i] = sum of weights[j] * rows[j][i]
+      void (*filter_column)(float *dest, const float *const *rows, const float *weights, unsigned num_taps, unsigned count);
+
+      // four channel floats to 1 to 4 channel bytes
+      void (*store_row[4])(uint8_t *dest, const float *src, unsigned width, const channels_t &ch);
+    };
+
+    const kernel_table *kernels;
+    filter_t filter;
+    bool srgb;
+    float alpha_ref;
+
+    static void filter_row_scalar(float *dest, const float *src, const uint32_t *index, const float *weights, unsigned num_taps, unsigned width) {
+      for (unsigned x = 0; x != width; ++x) {
+        float r = 0, g = 0, b = 0, a = 0;
+        for (unsigned j = 0; j != num_taps; ++j) {
+          float w = weights[j];
+          const float *p = src + index[j] * 4;
+          r = r + w * p[0];
+          g = g + w * p[1];
+          b = b + w * p[2];
+          a = a + w * p[3];
+        }
+        dest[0] = r; dest[1] = g; dest[2] = b; dest[3] = a;
+        dest += 4;
+        index += num_taps;
+        weights += num_taps;
+      }
+    }
+
+    template <unsigned nc> static void store_row_scalar(uint8_t *dest, const float *src, unsigned width, const channels_t &ch) {
+      for (unsigned x = 0; x != width; ++x) {
+        for (unsigned c = 0; c != nc; ++c) {
+          float v = src[c];
+          v = v < 0 ? 0 : v > 1 ? 1 : v;
+          dest[c] = ch.from_float[c][(int)(v * (float_table_size - 1) + 0.5f)];
+        }
+        dest += nc;
+        src += 4;
+      }
+    }
+
+    static void filter_column_scalar(float *dest, const float *const *rows, const float *weights, unsigned num_taps, unsigned count) {
+      for (unsigned i = 0; i != count; ++i) {
+        float sum = 0;
+        for (unsigned j = 0; j != num_taps; ++j) {
+          sum = sum + weights[j] * rows[j][i];
+        }
+        dest[i] = sum;
+      }
+    }
+
+    #if OCTET_SSE2
+      // one pixel at a time, the sums are done in the same order as the scalar code.
+      static void filter_row_sse2(float *dest, const float *src, const uint32_t *index, const float *weights, unsigned num_taps, unsigned width) {
+        if (num_taps == 2) {
+          // halving with a box filter
+          for (unsigned x = 0; x != width; ++x) {
+            __m128 sum = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(src + index[0] * 4)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[1]), _mm_loadu_ps(src + index[1] * 4)));
+            _mm_storeu_ps(dest, sum);
+            dest += 4;
+            index += 2;
+            weights += 2;
+          }
+          return;
+        }
+
+        for (unsigned x = 0; x != width; ++x) {
+          __m128 sum = _mm_setzero_ps();
+          for (unsigned j = 0; j != num_taps; ++j) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[j]), _mm_loadu_ps(src + index[j] * 4)));
+          }
+          _mm_storeu_ps(dest, sum);
+          dest += 4;
+          index += num_taps;
+          weights += num_taps;
+        }
+      }
+
+      template <unsigned nc> static void store_row_sse2(uint8_t *dest, const float *src, unsigned width, const channels_t &ch) {
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        __m128 scale = _mm_set1_ps(float_table_size - 1), half = _mm_set1_ps(0.5f);
+        for (unsigned x = 0; x != width; ++x) {
+          __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), zero), one);
+          union { __m128i v; int i[4]; } index;
+          index.v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half));
+          for (unsigned c = 0; c != nc; ++c) {
+            dest[c] = ch.from_float[c][index.i[c]];
+          }
+          dest += nc;
+          src += 4;
+        }
+      }
+
+      // count is a multiple of four
+      static void filter_column_sse2(float *dest, const float *const *rows, const float *weights, unsigned num_taps, unsigned count) {
+        if (num_taps == 2) {
+          __m128 w0 = _mm_set1_ps(weights[0]), w1 = _mm_set1_ps(weights[1]);
+          const float *r0 = rows[0], *r1 = rows[1];
+          for (unsigned i = 0; i != count; i += 4) {
+            __m128 sum = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(w0, _mm_loadu_ps(r0 + i)));
+            _mm_storeu_ps(dest + i, _mm_add_ps(sum, _mm_mul_ps(w1, _mm_loadu_ps(r1 + i))));
+          }
+          return;
+        }
+
+        for (unsigned i = 0; i != count; i += 4) {
+          __m128 sum = _mm_setzero_ps();
+          for (unsigned j = 0; j != num_taps; ++j) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[j]), _mm_loadu_ps(rows[j] + i)));
+          }
+          _mm_storeu_ps(dest + i, sum);
+        }
+      }
+    #endif
+
+    static const kernel_table *get_kernels(unsigned level) {
+      static const kernel_table scalar = {
+        filter_row_scalar, filter_column_scalar,
+        { store_row_scalar<1>, store_row_scalar<2>, store_row_scalar<3>, store_row_scalar<4> }
+      };
+      #if OCTET_SSE2
+        static const kernel_table sse2 = {
+          filter_row_sse2, filter_column_sse2,
+          { store_row_sse2<1>, store_row_sse2<2>, store_row_sse2<3>, store_row_sse2<4> }
+        };
+        if (level >= simd_sse2) return &sse2;
+      #endif
+      return &scalar;
+    }
+
+    static const tables_t &get_tables() {
+      static tables_t tables;
+      return tables;
+    }
+
+    static float sinc(float x) {
+      const float pi = 3.14159265f;
+      return x == 0 ? 1.0f : sinf(pi * x) / (pi * x);
+    }
+
+    // modified bessel function of the first kind, for the Kaiser window
+    static float bessel_i0(float x) {
+      float sum = 1, term = 1;
+      for (unsigned k = 1; k != 20; ++k) {
+        term *= (x * 0.5f / k) * (x * 0.5f / k);
+        sum += term;
+      }
+      return sum;
+    }
+
+    // size of the filter in new pixels
+    float get_radius() const {
+      return filter == filter_box ? 0.5f : 3.0f;
+    }
+
+    // weight of a pixel x new pixels away from the centre of a new pixel.
+    float get_weight(float x) const {
+      float r = get_radius();
+      if (x <= -r || x >= r) return 0;
+      if (filter == filter_lanczos) {
+        return sinc(x) * sinc(x / r);
+      } else {
+        const float alpha = 4;
+        float t = x / r;
+        return sinc(x) * bessel_i0(alpha * sqrtf(1 - t * t)) / bessel_i0(alpha);
+      }
+    }
+
+    // work out the taps for shrinking src_size pixels to dest_size.
+    void make_taps(taps_t &taps, unsigned src_size, unsigned dest_size) const {
+      float scale = (float)src_size / dest_size;
+      float r = get_radius() * scale;
+
+      // the widest range of pixels under any new pixel
+      unsigned num_taps = 1;
+      for (unsigned d = 0; d != dest_size; ++d) {
+        float centre = (d + 0.5f) * scale;
+        int lo = (int)floorf(centre - r), hi = (int)ceilf(centre + r);
+        num_taps = (unsigned)(hi - lo) > num_taps ? (unsigned)(hi - lo) : num_taps;
+      }
+
+      taps.num_taps = num_taps;
+      taps.index.resize(dest_size * num_taps);
+      taps.weights.resize(dest_size * num_taps);
+      for (unsigned d = 0; d != dest_size; ++d) {
+        float centre = (d + 0.5f) * scale;
+        int lo = (int)floorf(centre - r);
+        uint32_t *index = &taps.index[d * num_taps];
+        float *weights = &taps.weights[d * num_taps];
+        float total = 0;
+        for (unsigned j = 0; j != num_taps; ++j) {
+          int s = lo + (int)j;
+          float w;
+          if (filter == filter_box) {
+            // the part of pixel s under the new pixel
+            float x0 = (float)s > centre - r ? (float)s : centre - r;
+            float x1 = (float)(s + 1) < centre + r ? (float)(s + 1) : centre + r;
+            w = x1 > x0 ? x1 - x0 : 0;
+          } else {
+            w = get_weight((s + 0.5f - centre) / scale);
+          }
+          // clamp to the edge of the image
+          index[j] = s < 0 ? 0 : s >= (int)src_size ? src_size - 1 : (uint32_t)s;
+          weights[j] = w;
+          total += w;
+        }
+        for (unsigned j = 0; j != num_taps; ++j) {
+          weights[j] /= total;
+        }
+      }
+    }
+
+    void get_channels(channels_t &ch, unsigned format) const {
+      const tables_t &tables = get_tables();
+      ch.num_comps = get_num_comps(format);
+      ch.alpha = format == RGBA ? 3 : format == LUMINANCE_ALPHA ? 1 : format == ALPHA ? 0 : -1;
+      for (unsigned c = 0; c != 4; ++c) {
+        unsigned is_srgb = srgb && (int)c != ch.alpha;
+        ch.to_float[c] = tables.to_float[is_srgb];
+        ch.from_float[c] = tables.from_float[is_srgb];
+      }
+    }
+
+    template <unsigned nc> static void load_row(float *dest, const uint8_t *src, unsigned width, const channels_t &ch) {
+      const float *t0 = ch.to_float[0], *t1 = ch.to_float[1], *t2 = ch.to_float[2], *t3 = ch.to_float[3];
+      for (unsigned x = 0; x != width; ++x) {
+        dest[0] = t0[src[0]];
+        dest[1] = nc > 1 ? t1[src[1]] : 0.0f;
+        dest[2] = nc > 2 ? t2[src[2]] : 0.0f;
+        dest[3] = nc > 3 ? t3[src[3]] : 0.0f;
+        dest += 4;
+        src += nc;
+      }
+    }
+
+    static void load_row(float *dest, const uint8_t *src, unsigned width, const channels_t &ch) {
+      switch (ch.num_comps) {
+        case 1: load_row<1>(dest, src, width, ch); break;
+        case 2: load_row<2>(dest, src, width, ch); break;
+        case 3: load_row<3>(dest, src, width, ch); break;
+        case 4: load_row<4>(dest, src, width, ch); break;
+      }
+    }
+
+    // shrink one level to make the next.
+    void make_level(uint8_t *dest, unsigned dw, unsigned dh, const uint8_t *src, unsigned sw, unsigned sh, const channels_t &ch) const {
+      taps_t xtaps, ytaps;
+      make_taps(xtaps, sw, dw);
+      make_taps(ytaps, sh, dh);
+
+      unsigned grain = pixels_per_job / dw + 1;
+      parallel_for(0, dh, grain, [&](unsigned y0, unsigned y1) {
+        // the rows of the old level under these new rows, filtered across.
+        unsigned ny = ytaps.num_taps;
+        unsigned first = ytaps.index[y0 * ny];
+        unsigned last = ytaps.index[(y1 - 1) * ny + ny - 1];
+        dynarray<float> src_row(sw * 4);
+        dynarray<float> rows((last - first + 1) * dw * 4);
+        for (unsigned y = first; y <= last; ++y) {
+          load_row(&src_row[0], src + (size_t)y * sw * ch.num_comps, sw, ch);
+          kernels->filter_row(&rows[(y - first) * dw * 4], &src_row[0], &xtaps.index[0], &xtaps.weights[0], xtaps.num_taps, dw);
+        }
+
+        // then filtered down.
+        dynarray<float> dest_row(dw * 4);
+        dynarray<const float *> row_ptrs(ny);
+        for (unsigned y = y0; y != y1; ++y) {
+          for (unsigned j = 0; j != ny; ++j) {
+            row_ptrs[j] = &rows[(ytaps.index[y * ny + j] - first) * dw * 4];
+          }
+          kernels->filter_column(&dest_row[0], &row_ptrs[0], &ytaps.weights[y * ny], ny, dw * 4);
+          kernels->store_row[ch.num_comps - 1](dest + (size_t)y * dw * ch.num_comps, &dest_row[0], dw, ch);
+        }
+      });
+    }
+
+    // fraction of pixels whose alpha, times scale, is above the reference value.
+    static float get_coverage(const unsigned histogram[256], unsigned num_pixels, float scale, float ref) {
+      unsigned covered = 0;
+      for (unsigned i = 0; i != 256; ++i) {
+        if (i * scale > ref * 255) covered += histogram[i];
+      }
+      return (float)covered / num_pixels;
+    }
+
+    static void get_histogram(unsigned histogram[256], const uint8_t *image, unsigned num_pixels, const channels_t &ch) {
+      memset(histogram, 0, sizeof(unsigned) * 256);
+      for (unsigned i = 0; i != num_pixels; ++i) {
+        histogram[image[i * ch.num_comps + ch.alpha]]++;
+      }
+    }
+
+    // scale the alpha of a level so that as many pixels pass the alpha test as in the first level.
+    void keep_coverage(uint8_t *image, unsigned num_pixels, float coverage, const channels_t &ch) const {
+      if (coverage <= 0) return;
+
+      unsigned histogram[256];
+      get_histogram(histogram, image, num_pixels, ch);
+      float lo = 0, hi = 4;
+      for (unsigned i = 0; i != 16; ++i) {
+        float mid = (lo + hi) * 0.5f;
+        if (get_coverage(histogram, num_pixels, mid, alpha_ref) < coverage) {
+          lo = mid;
+        } else {
+          hi = mid;
+        }
+      }
+      float scale = hi;
+      for (unsigned i = 0; i != num_pixels; ++i) {
+        uint8_t &a = image[i * ch.num_comps + ch.alpha];
+        float v = a * scale + 0.5f;
+        a = (uint8_t)(v > 255 ? 255 : v);
+      }
+    }
+
+    // run fn(i0, i1) over [begin, end) on the job scheduler.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned grain, const fn_t &fn) const {
+      resources::job_scheduler::get().parallel_for(begin, end, grain, fn);
+    }
+
+  public:
+    mipmap_generator() {
+      kernels = get_kernels(simd_sse2);
+      filter = filter_box;
+      srgb = true;
+      alpha_ref = 0;
+    }
+
+    /// The generator uses the fastest code the cpu supports.
+    /// Use this to choose slower code for testing and benchmarks.
+    void set_simd_level(unsigned level) {
+      kernels = get_kernels(level);
+    }
+
+    /// Choose the filter. The default is filter_box.
+    void set_filter(filter_t new_filter) {
+      filter = new_filter;
+    }
+
+    /// The image holds sRGB colours (the default), so it is filtered in linear space.
+    /// Turn this off for data such as normal maps. Alpha is always linear.
+    void set_srgb(bool new_srgb) {
+      srgb = new_srgb;
+    }
+
+    /// For alpha tested textures: keep the fraction of pixels with alpha above
+    /// ref the same in every level, so that foliage and fences do not fade away in the distance.
+    /// Zero (the default) turns this off.
+    void set_alpha_coverage(float ref) {
+      alpha_ref = ref;
+    }
+
+    /// Settings that change the output, for cache keys: the version, filter, sRGB flag and alpha reference.
+    void get_settings(uint32_t settings[4]) const {
+      settings[0] = version;
+      settings[1] = filter;
+      settings[2] = srgb;
+      memcpy(&settings[3], &alpha_ref, sizeof(uint32_t));
+    }
+
+    /// Bytes per pixel, or zero if generate() does not handle the format.
+    static unsigned get_num_comps(unsigned format) {
+      switch (format) {
+        case ALPHA: case LUMINANCE: return 1;
+        case LUMINANCE_ALPHA: return 2;
+        case RGB: return 3;
+        case RGBA: return 4;
+      }
+      return 0;
+    }
+
+    /// Number of levels down to 1x1, including the first.
+    static unsigned get_num_levels(unsigned width, unsigned height) {
+      unsigned size = width > height ? width : height;
+      unsigned num_levels = 1;
+      while (size > 1) {
+        size >>= 1;
+        num_levels++;
+      }
+      return num_levels;
+    }
+
+    /// Size of the next level down.
+    static unsigned get_level_size(unsigned size) {
+      return size > 1 ? size >> 1 : 1;
+    }
+
+    /// Bytes in an image and all its mipmaps.
+    static size_t get_size(unsigned format, unsigned width, unsigned height) {
+      size_t size = 0;
+      for (unsigned level = get_num_levels(width, height); level != 0; --level) {
+        size += (size_t)width * height * get_num_comps(format);
+        width = get_level_size(width);
+        height = get_level_size(height);
+      }
+      return size;
+    }
+
+    /// Make the mipmaps of the image at "image", which has get_size() bytes.
+    ///
+    /// Levels follow each other with no gaps. The rows of each level are made in parallel on the job scheduler.
+    void generate(uint8_t *image, unsigned format, unsigned width, unsigned height) const {
+      channels_t ch;
+      get_channels(ch, format);
+      if (!ch.num_comps || !width || !height) return;
+
+      bool use_coverage = alpha_ref > 0 && ch.alpha >= 0;
+      float coverage = 0;
+      if (use_coverage) {
+        unsigned histogram[256];
+        get_histogram(histogram, image, width * height, ch);
+        coverage = get_coverage(histogram, width * height, 1.0f, alpha_ref);
+      }
+
+      uint8_t *src = image;
+      unsigned w = width, h = height;
+      for (unsigned level = get_num_levels(width, height); level != 1; --level) {
+        uint8_t *dest = src + (size_t)w * h * ch.num_comps;
+        unsigned dw = get_level_size(w), dh = get_level_size(h);
+        make_level(dest, dw, dh, src, w, h, ch);
+        if (use_coverage) keep_coverage(dest, dw * dh, coverage, ch);
+        src = dest;
+        w = dw;
+        h = dh;
+      }
+    }
+  };
+}}
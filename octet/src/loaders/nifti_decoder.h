@@ -8,7 +8,7 @@
 namespace octet { namespace loaders {
   /// NIFTI NMR data decoder. ie. 3d textures.
   /// This loader only handles very simple NIFTI files.
-  class nifti_decoder {
+  class nifti_decoder : public image_decoder {
     unsigned vox_offset;
     unsigned layer_stride;
     unsigned frame_stride;
@@ -67,23 +67,25 @@ namespace octet { namespace loaders {
       char    magic[4] ;      /// MUST be "ni1\0" or "n+1\0".
     };
 
-  public:
-    /// get data for a texture in memory.
-    void get_image(dynarray<uint8_t> &bytes, uint16_t &format, uint16_t &width, uint16_t &height, uint16_t &depth, uint32_t &frames, const uint8_t *src, const uint8_t *src_max) {
+    uint16_t depth;
+    uint32_t frames;
+
+    // volumes are decoded when the file is complete.
+    bool decode(bool at_end) {
+      if (!at_end) return true;
+      if (src_size < sizeof(nifti_header)) return false;
+
       // convert the data
-      nifti_header header = *(nifti_header*)src;
-    
-      width = 0;
-      height = 0;
-      format = 0;
+      nifti_header header;
+      memcpy(&header, src_data, sizeof(header));
 
       if (header.dim[0] != 4) {
         log("warning: NIFTI image type not supported (dim[0] = %d)\n", header.dim[0]);
-        return;
+        return false;
       }
 
-      width = header.dim[1];
-      height = header.dim[2];
+      uint16_t width = header.dim[1];
+      uint16_t height = header.dim[2];
       depth = header.dim[3];
       frames = 1; //header.dim[4];
       vox_offset = (int)header.vox_offset;
@@ -91,16 +93,45 @@ namespace octet { namespace loaders {
       frame_stride = layer_stride * depth;
       unsigned size = frame_stride * frames;
 
-      if ((int)header.vox_offset + (int)size > src_max - src) {
+      if ((int)header.vox_offset + (int)size > (int)src_size) {
         log("warning: NIFTI image too small\n");
-        return;
+        return false;
       }
 
-      format = header.bitpix == 24 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
+      uint16_t format = header.bitpix == 24 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
 
       // get one frame (of 3D data)
-      bytes.resize(frame_stride);
-      memcpy(&bytes[0], src + vox_offset, frame_stride);
+      memcpy(begin_image(format, width, height, frame_stride), src_data + vox_offset, frame_stride);
+      return true;
+    }
+
+  public:
+    nifti_decoder() {
+      depth = 0;
+      frames = 0;
+    }
+
+    /// get data for a texture in memory.
+    void get_image(dynarray<uint8_t> &bytes, uint16_t &format, uint16_t &width, uint16_t &height, uint16_t &depth_, uint32_t &frames_, const uint8_t *src, const uint8_t *src_max) {
+      bytes.resize(0);
+      decode_file(bytes, src, src_max);
+      format = image_format;
+      width = image_width;
+      height = image_height;
+      if (format) {
+        depth_ = depth;
+        frames_ = frames;
+      }
+    }
+
+    /// number of layers in the volume, once known.
+    uint16_t get_depth() const {
+      return depth;
+    }
+
+    /// number of frames of the volume, once known.
+    uint32_t get_frames() const {
+      return frames;
     }
 
     /// get the offset of a specific layer in a specific frame.
@@ -12,7 +12,7 @@
 // 
 
 namespace octet { namespace loaders {
-  class tga_decoder {
+  class tga_decoder : public image_decoder {
     typedef unsigned char uint8_t;
     // this is the TGA header
     // http://en.wikipedia.org/wiki/Truevision_TGA
@@ -35,41 +35,36 @@ namespace octet { namespace loaders {
       uint8_t descriptor;         // image descriptor bits (vh flip bits)
     };
 
+    // 3 or 4 once the header has been read
+    unsigned num_components;
+
+    // true if the first row in the file is the top of the image
+    bool top_first;
+
+    // rows converted so far
+    unsigned num_rows;
+
+    // where the pixels start in the file
+    size_t data_offset;
+
     // read a pair of bytes as a little-endian value
     int le2( uint8_t val[2] )
     {
       return val[0] + val[1] * 0x100;
     }
-  public:
-    // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
-      // convert the data
-      TgaHeader *header = (TgaHeader*)src;
-      const uint8_t *data = (uint8_t *)src + sizeof(TgaHeader);
-    
-      width = le2(header->width);
-      height = le2(header->height);
-
-      // make sure this is the GIMP flavour  
-      assert(header->identsize == 0);
-      assert(header->colourmaptype == 0);
-      assert(header->imagetype == 2);
-      //assert(header->descriptor == 0);
-      assert(header->bits == 32 || header->bits == 24);
-    
-      unsigned num_components = header->bits / 8;
-
-      unsigned size = width * height * num_components;
-      image.resize(size);
-      format = num_components == 3 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
-
-      uint8_t *dest = &image[0];
+
+    // swap red and blue in rows [y0, y1) of the file.
+    void convert_rows(unsigned y0, unsigned y1) {
+      uint16_t width = image_width;
+      const uint8_t *data = src_data + data_offset;
+      size_t stride = width * num_components;
 
       if (num_components == 4) {
         // swap red and blue!
-        for (int y = 0; y != height; ++y)
+        for (unsigned y = y0; y != y1; ++y)
         {
           const uint8_t *src = data + y * width * num_components;
+          uint8_t *dest = get_output() + (top_first ? image_height - 1 - y : y) * stride;
           for (int x = 0; x != width; ++x)
           {
             uint8_t alpha = src[ x*4 + 3 ];
@@ -84,9 +79,10 @@ namespace octet { namespace loaders {
           }
         }
       } else {
-        for (int y = 0; y != height; ++y)
+        for (unsigned y = y0; y != y1; ++y)
         {
           const uint8_t *src = data + y * width * num_components;
+          uint8_t *dest = get_output() + (top_first ? image_height - 1 - y : y) * stride;
           for (int x = 0; x != width; ++x)
           {
             uint8_t red = src[ x*3 + 2 ];
@@ -100,5 +96,60 @@ namespace octet { namespace loaders {
         }
       }
     }
+
+    void reset() {
+      num_components = 0;
+      num_rows = 0;
+      data_offset = 0;
+    }
+
+    // convert the rows that have arrived.
+    bool decode(bool at_end) {
+      if (!num_components) {
+        if (src_size < sizeof(TgaHeader)) return !at_end;
+        TgaHeader *header = (TgaHeader*)src_data;
+
+        // make sure this is the GIMP flavour
+        if (header->colourmaptype != 0 || header->imagetype != 2 || (header->bits != 32 && header->bits != 24)) {
+          printf("warning: TGA decoder only supports uncompressed RGB\n");
+          return false;
+        }
+
+        num_components = header->bits / 8;
+        top_first = (header->descriptor & 0x20) != 0;
+        uint16_t width = le2(header->width);
+        uint16_t height = le2(header->height);
+        uint16_t format = num_components == 3 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
+        begin_image(format, width, height, width * height * num_components);
+        data_offset = sizeof(TgaHeader) + header->identsize;
+        src_pos = data_offset;
+      }
+
+      // rows are bottom first, unless the descriptor says otherwise.
+      size_t stride = image_width * num_components;
+      unsigned first_row = num_rows;
+      size_t rows_read = image_height;
+      if (stride) rows_read = src_size > data_offset ? (src_size - data_offset) / stride : 0;
+      num_rows = rows_read < image_height ? (unsigned)rows_read : image_height;
+      convert_rows(first_row, num_rows);
+      src_pos = data_offset + num_rows * stride;
+
+      if (top_first) {
+        add_rows(image_height - num_rows, num_rows - first_row);
+      } else {
+        add_rows(first_row, num_rows - first_row);
+      }
+      return num_rows == image_height || !at_end;
+    }
+
+  public:
+    // get an opengl texture from a file in memory
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max) {
+      image.resize(0);
+      decode_file(image, src, src_max);
+      format = image_format;
+      width = image_width;
+      height = image_height;
+    }
   };
 }}
@@ -6,352 +6,482 @@
 //
 //
 // zip deflate format decoder
-// 
+//
+// huffman codes are decoded with lookup tables indexed by the next few bits of the stream.
+// short codes (almost all of them) are resolved by one lookup in the primary table,
+// longer codes take a second lookup in a small subtable.
+//
+// bits are kept in a 64 bit buffer which is refilled eight bytes at a time,
+// so a whole length/distance pair can be decoded with only one refill.
+//
 namespace octet { namespace loaders {
+  /// Inflate (RFC 1951) decoder for compressed files in zip files.
+  ///
+  /// The decoder has no state between calls, so one decoder can be used by many threads.
+  ///
+  /// Example:
+  ///
+  ///     zip_decoder dec;
+  ///     if (!dec.decode(dest, dest + usize, src, src + csize)) printf("corrupt file\n");
   class zip_decoder {
-    enum { debug = 1 };
-
-    struct huffman_table {
-      uint8_t min_lit_length;
-      uint8_t max_lit_length;
-      uint8_t min_dist_length;
-      uint8_t max_dist_length;
-
-      //uint8_t lit_lengths[288];
-      uint16_t lit_codes[288];
-      uint16_t lit_limits[18];
-      uint16_t lit_base[18];
-
-      //uint8_t dist_lengths[32];
-      uint16_t dist_codes[32];
-      uint16_t dist_limits[18];
-      uint16_t dist_base[18];
+    enum { debug = 0 };
+
+    // table entries are 32 bits:
+    //   bits 0-7    number of bits in the code (for links: bits in the primary index)
+    //   bits 8-11   number of extra bits after the code (for links: bits in the subtable index)
+    //   bits 12-15  flags
+    //   bits 16-31  literal byte, length or distance base, or subtable offset
+    enum {
+      entry_invalid = 0x1000,
+      entry_end = 0x2000,
+      entry_link = 0x4000,
+      entry_literal = 0x8000,
+
+      // the primary tables cover most codes in a typical file.
+      lit_bits = 10,
+      dist_bits = 8,
+      length_bits = 7,
+
+      // worst case table sizes including subtables (from zlib's "enough" utility).
+      lit_table_size = 1334,
+      dist_table_size = 402,
+      length_table_size = 1 << length_bits,
+
+      max_code_length = 15,
+
+      // a length/distance pair uses at most 15+5+15+13 bits.
+      max_symbol_bits = 48,
+
+      // longest match, plus slack for eight byte copies.
+      max_match = 258,
+      copy_slack = 8,
     };
 
-    huffman_table fixed_;
-    huffman_table var_;
-
-    // on ARM we can do this faster with the "rev" instruction
-    inline static uint16_t rev16(uint16_t value) {
-      // small table version.
-      //static const uint8_t r16[] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
-      //return r16[value&0x0f] * 0x1000 | r16[(value>>4)&0x0f] * 0x100 | r16[(value>>8)&0x0f] * 0x10 | r16[value>>12];
-
-      // this table is probably too big to be efficient. L1 cache misses are very expensive.
-      static const uint8_t r256[] = {
-        0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 
-        0x00+0x10, 0x80+0x10, 0x40+0x10, 0xc0+0x10, 0x20+0x10, 0xa0+0x10, 0x60+0x10, 0xe0+0x10, 
-        0x00+8, 0x80+8, 0x40+8, 0xc0+8, 0x20+8, 0xa0+8, 0x60+8, 0xe0+8, 
-        0x00+0x10+8, 0x80+0x10+8, 0x40+0x10+8, 0xc0+0x10+8, 0x20+0x10+8, 0xa0+0x10+8, 0x60+0x10+8, 0xe0+0x10+8, 
-        0x00+ 4, 0x80+ 4, 0x40+ 4, 0xc0+ 4, 0x20+ 4, 0xa0+ 4, 0x60+ 4, 0xe0+ 4, 
-        0x00+0x10+ 4, 0x80+0x10+ 4, 0x40+0x10+ 4, 0xc0+0x10+ 4, 0x20+0x10+ 4, 0xa0+0x10+ 4, 0x60+0x10+ 4, 0xe0+0x10+ 4, 
-        0x00+8+ 4, 0x80+8+ 4, 0x40+8+ 4, 0xc0+8+ 4, 0x20+8+ 4, 0xa0+8+ 4, 0x60+8+ 4, 0xe0+8+ 4, 
-        0x00+0x10+8+ 4, 0x80+0x10+8+ 4, 0x40+0x10+8+ 4, 0xc0+0x10+8+ 4, 0x20+0x10+8+ 4, 0xa0+0x10+8+ 4, 0x60+0x10+8+ 4, 0xe0+0x10+8+ 4, 
-        0x00+ 2, 0x80+ 2, 0x40+ 2, 0xc0+ 2, 0x20+ 2, 0xa0+ 2, 0x60+ 2, 0xe0+ 2, 
-        0x00+0x10+ 2, 0x80+0x10+ 2, 0x40+0x10+ 2, 0xc0+0x10+ 2, 0x20+0x10+ 2, 0xa0+0x10+ 2, 0x60+0x10+ 2, 0xe0+0x10+ 2, 
-        0x00+8+ 2, 0x80+8+ 2, 0x40+8+ 2, 0xc0+8+ 2, 0x20+8+ 2, 0xa0+8+ 2, 0x60+8+ 2, 0xe0+8+ 2, 
-        0x00+0x10+8+ 2, 0x80+0x10+8+ 2, 0x40+0x10+8+ 2, 0xc0+0x10+8+ 2, 0x20+0x10+8+ 2, 0xa0+0x10+8+ 2, 0x60+0x10+8+ 2, 0xe0+0x10+8+ 2, 
-        0x00+ 4+ 2, 0x80+ 4+ 2, 0x40+ 4+ 2, 0xc0+ 4+ 2, 0x20+ 4+ 2, 0xa0+ 4+ 2, 0x60+ 4+ 2, 0xe0+ 4+ 2, 
-        0x00+0x10+ 4+ 2, 0x80+0x10+ 4+ 2, 0x40+0x10+ 4+ 2, 0xc0+0x10+ 4+ 2, 0x20+0x10+ 4+ 2, 0xa0+0x10+ 4+ 2, 0x60+0x10+ 4+ 2, 0xe0+0x10+ 4+ 2, 
-        0x00+8+ 4+ 2, 0x80+8+ 4+ 2, 0x40+8+ 4+ 2, 0xc0+8+ 4+ 2, 0x20+8+ 4+ 2, 0xa0+8+ 4+ 2, 0x60+8+ 4+ 2, 0xe0+8+ 4+ 2, 
-        0x00+0x10+8+ 4+ 2, 0x80+0x10+8+ 4+ 2, 0x40+0x10+8+ 4+ 2, 0xc0+0x10+8+ 4+ 2, 0x20+0x10+8+ 4+ 2, 0xa0+0x10+8+ 4+ 2, 0x60+0x10+8+ 4+ 2, 0xe0+0x10+8+ 4+ 2, 
-        0x00+ 1, 0x80+ 1, 0x40+ 1, 0xc0+ 1, 0x20+ 1, 0xa0+ 1, 0x60+ 1, 0xe0+ 1, 
-        0x00+0x10+ 1, 0x80+0x10+ 1, 0x40+0x10+ 1, 0xc0+0x10+ 1, 0x20+0x10+ 1, 0xa0+0x10+ 1, 0x60+0x10+ 1, 0xe0+0x10+ 1, 
-        0x00+8+ 1, 0x80+8+ 1, 0x40+8+ 1, 0xc0+8+ 1, 0x20+8+ 1, 0xa0+8+ 1, 0x60+8+ 1, 0xe0+8+ 1, 
-        0x00+0x10+8+ 1, 0x80+0x10+8+ 1, 0x40+0x10+8+ 1, 0xc0+0x10+8+ 1, 0x20+0x10+8+ 1, 0xa0+0x10+8+ 1, 0x60+0x10+8+ 1, 0xe0+0x10+8+ 1, 
-        0x00+ 4+ 1, 0x80+ 4+ 1, 0x40+ 4+ 1, 0xc0+ 4+ 1, 0x20+ 4+ 1, 0xa0+ 4+ 1, 0x60+ 4+ 1, 0xe0+ 4+ 1, 
-        0x00+0x10+ 4+ 1, 0x80+0x10+ 4+ 1, 0x40+0x10+ 4+ 1, 0xc0+0x10+ 4+ 1, 0x20+0x10+ 4+ 1, 0xa0+0x10+ 4+ 1, 0x60+0x10+ 4+ 1, 0xe0+0x10+ 4+ 1, 
-        0x00+8+ 4+ 1, 0x80+8+ 4+ 1, 0x40+8+ 4+ 1, 0xc0+8+ 4+ 1, 0x20+8+ 4+ 1, 0xa0+8+ 4+ 1, 0x60+8+ 4+ 1, 0xe0+8+ 4+ 1, 
-        0x00+0x10+8+ 4+ 1, 0x80+0x10+8+ 4+ 1, 0x40+0x10+8+ 4+ 1, 0xc0+0x10+8+ 4+ 1, 0x20+0x10+8+ 4+ 1, 0xa0+0x10+8+ 4+ 1, 0x60+0x10+8+ 4+ 1, 0xe0+0x10+8+ 4+ 1, 
-        0x00+ 2+ 1, 0x80+ 2+ 1, 0x40+ 2+ 1, 0xc0+ 2+ 1, 0x20+ 2+ 1, 0xa0+ 2+ 1, 0x60+ 2+ 1, 0xe0+ 2+ 1, 
-        0x00+0x10+ 2+ 1, 0x80+0x10+ 2+ 1, 0x40+0x10+ 2+ 1, 0xc0+0x10+ 2+ 1, 0x20+0x10+ 2+ 1, 0xa0+0x10+ 2+ 1, 0x60+0x10+ 2+ 1, 0xe0+0x10+ 2+ 1, 
-        0x00+8+ 2+ 1, 0x80+8+ 2+ 1, 0x40+8+ 2+ 1, 0xc0+8+ 2+ 1, 0x20+8+ 2+ 1, 0xa0+8+ 2+ 1, 0x60+8+ 2+ 1, 0xe0+8+ 2+ 1, 
-        0x00+0x10+8+ 2+ 1, 0x80+0x10+8+ 2+ 1, 0x40+0x10+8+ 2+ 1, 0xc0+0x10+8+ 2+ 1, 0x20+0x10+8+ 2+ 1, 0xa0+0x10+8+ 2+ 1, 0x60+0x10+8+ 2+ 1, 0xe0+0x10+8+ 2+ 1, 
-        0x00+ 4+ 2+ 1, 0x80+ 4+ 2+ 1, 0x40+ 4+ 2+ 1, 0xc0+ 4+ 2+ 1, 0x20+ 4+ 2+ 1, 0xa0+ 4+ 2+ 1, 0x60+ 4+ 2+ 1, 0xe0+ 4+ 2+ 1, 
-        0x00+0x10+ 4+ 2+ 1, 0x80+0x10+ 4+ 2+ 1, 0x40+0x10+ 4+ 2+ 1, 0xc0+0x10+ 4+ 2+ 1, 0x20+0x10+ 4+ 2+ 1, 0xa0+0x10+ 4+ 2+ 1, 0x60+0x10+ 4+ 2+ 1, 0xe0+0x10+ 4+ 2+ 1, 
-        0x00+8+ 4+ 2+ 1, 0x80+8+ 4+ 2+ 1, 0x40+8+ 4+ 2+ 1, 0xc0+8+ 4+ 2+ 1, 0x20+8+ 4+ 2+ 1, 0xa0+8+ 4+ 2+ 1, 0x60+8+ 4+ 2+ 1, 0xe0+8+ 4+ 2+ 1, 
-        0x00+0x10+8+ 4+ 2+ 1, 0x80+0x10+8+ 4+ 2+ 1, 0x40+0x10+8+ 4+ 2+ 1, 0xc0+0x10+8+ 4+ 2+ 1, 0x20+0x10+8+ 4+ 2+ 1, 0xa0+0x10+8+ 4+ 2+ 1, 0x60+0x10+8+ 4+ 2+ 1, 0xe0+0x10+8+ 4+ 2+ 1, 
-      };
-      return r256[value&0xff] << 8 | r256[(value>>8)&0xff];
-
-      //value = ( ( value >> 1 ) & 0x5555 ) | ( ( value & 0x5555 ) << 1 );
-      //value = ( ( value >> 2 ) & 0x3333 ) | ( ( value & 0x3333 ) << 2 );
-      //value = ( ( value >> 4 ) & 0x0f0f ) | ( ( value & 0x0f0f ) << 4 );
-      //value = ( ( value >> 8 ) & 0x00ff ) | ( ( value & 0x00ff ) << 8 );
-      //return value;
-    }
-
-    bool build_huffman(uint8_t *lengths, unsigned num_lengths, uint8_t &min_length, uint8_t &max_length, uint16_t *codes, uint16_t *limits, uint16_t *base) {
-      min_length = 16;
-      max_length = 0;
-      for (unsigned i = 0; i != num_lengths; ++i) {
-        if (debug) printf("%d,", lengths[i]);
-        if (lengths[i]) {
-          if (min_length > lengths[i]) min_length = lengths[i];
-          if (max_length < lengths[i]) max_length = lengths[i];
-        }
-      }
-      if (debug) printf("\n");
+    struct huffman_tables {
+      uint32_t lit[lit_table_size];
+      uint32_t dist[dist_table_size];
+    };
 
-      if (debug) printf("min_length=%d\n", min_length);
-      if (debug) printf("max_length=%d\n", max_length);
+    // the next bits of the input.
+    struct bit_reader {
+      const uint8_t *src;
+      const uint8_t *src_max;
+      uint64_t bits;
+      unsigned num_bits;
 
-      if ( min_length <= 0 || min_length > max_length || max_length > 16 ) {
-        return false;
-      }
+      // number of zero bytes added after the end of the input.
+      unsigned overrun;
+    };
 
-      unsigned code = 0;
-      unsigned huffcode = 0;
-      for (unsigned length = min_length; length <= max_length; ++length) {
-        base[length-min_length] = huffcode - code;
-        for (unsigned i = 0; i != num_lengths; ++i) {
-          if (lengths[i] == length) {
-            codes[code++] = i;
-            //dump_bits(huffcode << (16-length), 16, "huffcode");
-            huffcode++;
+    // make sure there are at least 56 bits in the buffer.
+    static void refill(uint64_t &bits, unsigned &num_bits, const uint8_t *&src, const uint8_t *src_max, unsigned &overrun) {
+      if (src_max - src >= 8) {
+        // read eight bytes and keep as many whole bytes as will fit.
+        // note: this will have to be fixed on PPC and other big-endian devices
+        uint64_t word;
+        memcpy(&word, src, 8);
+        bits |= word << num_bits;
+        src += (63 - num_bits) >> 3;
+        num_bits |= 56;
+      } else {
+        // near the end, pad with zeros. We check that the padding is never used.
+        while (num_bits <= 56) {
+          uint64_t byte = 0;
+          if (src != src_max) {
+            byte = *src++;
+          } else {
+            overrun++;
           }
+          bits |= byte << num_bits;
+          num_bits += 8;
         }
-        limits[length-min_length] = (uint16_t)( ( huffcode << (16-length) ) - 1 );
-        if (debug) printf("length %d: lim=%04x base=%04x\n", length, ( huffcode << (16-length) ) - 1, base[length-min_length]);
-        if (( huffcode << (16-length) ) - 1 > 0xffff) {
-          if (debug) printf("invalid huffman table\n");
-          return false;
-        }
-        huffcode *= 2;
       }
-
-      // prevent escape from bitstream decoding loop.
-      limits[max_length+1-min_length] = 0xffff;
-      return true;
     }
 
-    /// debug function for dumping bit fields
-    void dump_bits(unsigned value, unsigned bits, const char *name) {
-      char tmp[64];
-      assert(bits<63);
-      for (unsigned i = 0; i != bits; ++i) tmp[i] = ( ( value >> (bits-1-i) ) & 1 ) + '0';
-      tmp[bits] = 0;
-      printf("[%s] %s\n", tmp, name);
+    // get a few bits from the stream; used for block headers.
+    static unsigned get_bits(bit_reader &br, unsigned n) {
+      if (br.num_bits < n) refill(br.bits, br.num_bits, br.src, br.src_max, br.overrun);
+      unsigned value = (unsigned)br.bits & ((1u << n) - 1);
+      br.bits >>= n;
+      br.num_bits -= n;
+      return value;
     }
 
-    /// peek a fixed number of little-endian bits from the bitstream
-    /// note: this will have to be fixed on PPC and other big-endian devices
-    unsigned peek(const uint8_t *src, unsigned bitptr, unsigned bits, const char *name) {
-      unsigned i = bitptr >> 3, j = bitptr & 7;
-      unsigned value = ( (unsigned&)src[i] >> j ) & ( (1u << bits) - 1 );
-      if (name) dump_bits(value, bits, name);
-      return value;
+    // return true if we have used bits beyond the end of the input.
+    static bool is_overrun(const bit_reader &br) {
+      return br.num_bits < br.overrun * 8;
     }
 
-    unsigned decode_uncompressed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      bitptr = ( bitptr + 7 ) & ~7;
-      unsigned bytes_to_copy = peek(src, bitptr, 16, "bytes_to_copy");
-      unsigned clength = peek(src, bitptr + 16, 16, "store length check");
-      bitptr += 32;
+    // table entry for a literal/length symbol, without the code length.
+    static uint32_t lit_entry(unsigned symbol) {
+      static const uint16_t base[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+      };
+      static const uint8_t extra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+      };
+      if (symbol < 256) return entry_literal | symbol << 16;
+      if (symbol == 256) return entry_end;
+      if (symbol < 286) return (uint32_t)base[symbol-257] << 16 | extra[symbol-257] << 8;
+      return entry_invalid;
+    }
 
-      if (bytes_to_copy != (clength^0xffff)) return ~0;
-      if (dest + bytes_to_copy > dest_max) return ~0;
-      if ((src + bitptr/8) + bytes_to_copy > src_max) return ~0;
+    // table entry for a distance symbol, without the code length.
+    static uint32_t dist_entry(unsigned symbol) {
+      static const uint16_t base[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+      };
+      static const uint8_t extra[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+      };
+      if (symbol < 30) return (uint32_t)base[symbol] << 16 | extra[symbol] << 8;
+      return entry_invalid;
+    }
 
-      memcpy(dest, src + bitptr/8, bytes_to_copy);
-      dest += bytes_to_copy;
-      bitptr += bytes_to_copy * 8;
-      return bitptr;
+    // table entry for a code length symbol, without the code length.
+    static uint32_t length_entry(unsigned symbol) {
+      return symbol << 16;
     }
 
-    unsigned decode_lz77(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr, huffman_table *table_) {
-      for(;;) {
-        if (src + bitptr/8 > src_max) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > table_->lit_limits[index]) {
-          index++;
+    // build a decoding table from a list of code lengths.
+    // codes are stored most significant bit first, so we index the table with reversed codes.
+    static bool build_table(const uint8_t *lengths, unsigned num_symbols, uint32_t (*get_entry)(unsigned), uint32_t *table, unsigned table_bits, unsigned table_size) {
+      unsigned count[max_code_length+1] = { 0 };
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        count[lengths[i]]++;
+      }
+      count[0] = 0;
+
+      // reject over-subscribed codes; incomplete codes leave invalid entries.
+      int left = 1;
+      for (unsigned length = 1; length <= max_code_length; ++length) {
+        left = left * 2 - count[length];
+        if (left < 0) {
+          if (debug) printf("zip_decoder: over-subscribed huffman code\n");
+          return false;
         }
-        unsigned length = table_->min_lit_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = table_->lit_codes[offset - table_->lit_base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "code");
-
-        if (code < 256) {
-          if (dest+1 > dest_max) return ~0;
-          *dest++ = code;
-          if (debug) printf("%02x\n", code);
-        } else if (code == 256) {
-          return bitptr;
-        } else {
-          unsigned block_length;
-          unsigned distance;
-          {
-            if (debug) printf("[%d]\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
-            };
-            static const uint8_t base[] = {
-              3-3, 4-3, 5-3, 6-3, 7-3, 8-3, 9-3, 10-3,
-              11-3, 13-3, 15-3, 17-3, 19-3, 23-3, 27-3, 31-3,
-              35-3, 43-3, 51-3, 59-3, 67-3, 83-3, 99-3, 115-3,
-              131-3, 163-3, 195-3, 227-3, 258-3,
-            };
-            if (code-257 > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code-257 ];
-            block_length = base[ code-257 ] + 3 + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
-          }
-          {
-            //if (src + (bitptr + table_->max_dist_length)/8 > src_max ) return ~0;
-            unsigned peek16 = peek(src, bitptr, 16, NULL);
-            unsigned value = rev16(peek16);
-            unsigned index = 0;
-            while (value > table_->dist_limits[index]) {
-              index++;
-            }
-            unsigned length = table_->min_dist_length + index;
-            unsigned offset = ( value >> ( 16 - length ) );
-            unsigned code = table_->dist_codes[offset - table_->dist_base[index]];
-            bitptr += length;
-
-            if (debug) printf("{%d}\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0, 0,
-            };
-            static const uint16_t base[] = {
-              1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
-            };
-            if (code > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code ];
-            distance = base[ code ] + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
-          }
+      }
+
+      // first canonical code for each length.
+      unsigned first_code[max_code_length+1];
+      unsigned code = 0;
+      first_code[0] = 0;
+      for (unsigned length = 1; length <= max_code_length; ++length) {
+        code = (code + count[length-1]) << 1;
+        first_code[length] = code;
+      }
 
-          if (debug) printf("length=%d distance=%d\n", block_length, distance);
+      unsigned primary_size = 1 << table_bits;
+      unsigned primary_mask = primary_size - 1;
+      for (unsigned i = 0; i != primary_size; ++i) {
+        table[i] = entry_invalid;
+      }
 
-          if (dest+block_length > dest_max) return ~0;
+      // size the subtables for codes longer than the primary table.
+      uint8_t sub_bits[1 << lit_bits];
+      memset(sub_bits, 0, primary_size);
+      unsigned next_code[max_code_length+1];
+      memcpy(next_code, first_code, sizeof(next_code));
+      bool has_long_codes = false;
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        unsigned length = lengths[i];
+        if (length > table_bits) {
+          unsigned rev = reverse(next_code[length]++, length);
+          uint8_t &bits = sub_bits[rev & primary_mask];
+          if (bits < length - table_bits) bits = (uint8_t)(length - table_bits);
+          has_long_codes = true;
+        }
+      }
+
+      if (has_long_codes) {
+        unsigned next = primary_size;
+        for (unsigned i = 0; i != primary_size; ++i) {
+          if (sub_bits[i]) {
+            unsigned size = 1 << sub_bits[i];
+            if (next + size > table_size) return false;
+            table[i] = entry_link | next << 16 | sub_bits[i] << 8 | table_bits;
+            for (unsigned j = 0; j != size; ++j) {
+              table[next + j] = entry_invalid;
+            }
+            next += size;
+          }
+        }
+      }
 
-          for(unsigned i = 0; i != block_length; ++i) {
-            dest[0] = dest[-(int)distance];
-            dest++;
+      // fill in the entries, repeating short codes for every value of the unused bits.
+      memcpy(next_code, first_code, sizeof(next_code));
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        unsigned length = lengths[i];
+        if (length == 0) continue;
+        unsigned rev = reverse(next_code[length]++, length);
+        uint32_t entry = get_entry(i);
+        if (length <= table_bits) {
+          for (unsigned j = rev; j < primary_size; j += 1 << length) {
+            table[j] = entry | length;
+          }
+        } else {
+          uint32_t link = table[rev & primary_mask];
+          uint32_t *sub = table + (link >> 16);
+          unsigned sub_size = 1 << ((link >> 8) & 0x0f);
+          unsigned sub_length = length - table_bits;
+          for (unsigned j = rev >> table_bits; j < sub_size; j += 1 << sub_length) {
+            sub[j] = entry | sub_length;
           }
         }
       }
+      return true;
     }
 
-    unsigned decode_fixed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &fixed_);
+    // reverse the bottom bits of a value.
+    static unsigned reverse(unsigned value, unsigned bits) {
+      unsigned result = 0;
+      for (unsigned i = 0; i != bits; ++i) {
+        result = result * 2 + (value & 1);
+        value >>= 1;
+      }
+      return result;
+    }
+
+    // tables for the fixed code, built once.
+    static const huffman_tables &fixed_tables() {
+      struct fixed : huffman_tables {
+        fixed() {
+          uint8_t lit_lengths[288];
+          uint8_t dist_lengths[32];
+          memset(lit_lengths +   0, 8, 144 - 0);
+          memset(lit_lengths + 144, 9, 256-144);
+          memset(lit_lengths + 256, 7, 280-256);
+          memset(lit_lengths + 280, 8, 288-280);
+          memset(dist_lengths, 5, 32);
+          build_table(lit_lengths, 288, lit_entry, lit, lit_bits, lit_table_size);
+          build_table(dist_lengths, 32, dist_entry, dist, dist_bits, dist_table_size);
+        }
+      };
+      static fixed instance;
+      return instance;
     }
 
-    unsigned decode_variable(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      unsigned num_lit_codes = peek(src, bitptr, 5, "num_lit_codes") + 257;
-      unsigned num_dist_codes = peek(src, bitptr+5, 5, "num_dist_codes") + 1;
-      unsigned num_length_codes = peek(src, bitptr+10, 4, "num_length_codes") + 4;
-      
-      bitptr += 14;
+    // read the code lengths of a dynamic block and build its tables.
+    static bool read_dynamic_tables(bit_reader &br, huffman_tables &tables) {
+      unsigned num_lit_codes = get_bits(br, 5) + 257;
+      unsigned num_dist_codes = get_bits(br, 5) + 1;
+      unsigned num_length_codes = get_bits(br, 4) + 4;
+      if (num_lit_codes > 286 || num_dist_codes > 30) return false;
 
+      static const uint8_t order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
       uint8_t lengths[288 + 32];
-      memset(lengths, 0, 20);
-      if (src + bitptr/8 + num_length_codes > src_max ) return ~0;
+      memset(lengths, 0, 19);
       for (unsigned i = 0; i != num_length_codes; ++i) {
-        static const uint8_t order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-        lengths[order[i]] = peek(src, bitptr, 3, "length code lenghs");
-        bitptr += 3;
+        lengths[order[i]] = (uint8_t)get_bits(br, 3);
       }
-      
-      uint16_t codes[19];
-      uint16_t limits[18];
-      uint16_t base[18];
-      uint8_t min_length;
-      uint8_t max_length;
-      if (!build_huffman(lengths, 19, min_length, max_length, codes, limits, base)) return ~0;
-      
+
+      uint32_t length_table[length_table_size];
+      if (!build_table(lengths, 19, length_entry, length_table, length_bits, length_table_size)) return false;
+
       unsigned todo = num_lit_codes + num_dist_codes;
-      for(unsigned done = 0; done < todo;) {
-        if (src + bitptr/8 + max_length > src_max ) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > limits[index]) {
-          index++;
-        }
-        unsigned length = min_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = codes[offset - base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "length");
-        //fprintf(source_.debug(), "code=%03x\n", code);
+      for (unsigned done = 0; done < todo;) {
+        if (br.num_bits < max_code_length + 7) refill(br.bits, br.num_bits, br.src, br.src_max, br.overrun);
+        uint32_t entry = length_table[br.bits & (length_table_size - 1)];
+        if (entry & entry_invalid) return false;
+        br.bits >>= entry & 0xff;
+        br.num_bits -= entry & 0xff;
+
+        unsigned code = entry >> 16;
         unsigned copy = 1;
-        if (code < 16) {
-        } else if(code == 16) {
-          if (src + (bitptr+2)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 2, NULL) + 3;
-          bitptr += 2;
-          if (done == 0) return ~0;
-          code = lengths[ done-1 ];
-        } else if(code == 17) {
-          if (src + (bitptr+3)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 3, NULL) + 3;
-          bitptr += 3;
+        if (code == 16) {
+          if (done == 0) return false;
+          copy = get_bits(br, 2) + 3;
+          code = lengths[done-1];
+        } else if (code == 17) {
+          copy = get_bits(br, 3) + 3;
           code = 0;
-        } else if(code == 18) {
-          if (src + (bitptr+7)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 7, NULL) + 11;
-          bitptr += 7;
+        } else if (code == 18) {
+          copy = get_bits(br, 7) + 11;
           code = 0;
-        } else {
-          return ~0;
         }
-        if (done + copy > todo) return ~0;
-        do {
-          lengths[done++] = code;
-        } while( --copy );
+        if (done + copy > todo) return false;
+        memset(lengths + done, code, copy);
+        done += copy;
       }
 
-      if (debug) printf("lengths done\n");
+      if (is_overrun(br)) return false;
+
+      // a block without an end code would never finish.
+      if (lengths[256] == 0) return false;
 
-      if(
-        !build_huffman(lengths, num_lit_codes, var_.min_lit_length, var_.max_lit_length, var_.lit_codes, var_.lit_limits, var_.lit_base) ||
-        !build_huffman(lengths+num_lit_codes, num_dist_codes, var_.min_dist_length, var_.max_dist_length, var_.dist_codes, var_.dist_limits, var_.dist_base)
-      ) {
-        return ~0;
+      if (debug) printf("zip_decoder: %d literal codes %d distance codes\n", num_lit_codes, num_dist_codes);
+
+      return
+        build_table(lengths, num_lit_codes, lit_entry, tables.lit, lit_bits, lit_table_size) &&
+        build_table(lengths + num_lit_codes, num_dist_codes, dist_entry, tables.dist, dist_bits, dist_table_size)
+      ;
+    }
+
+    // copy a stored block.
+    static bool decode_uncompressed(bit_reader &br, uint8_t *&dest, uint8_t *dest_max) {
+      // skip to a byte boundary.
+      get_bits(br, br.num_bits & 7);
+      unsigned bytes_to_copy = get_bits(br, 16);
+      unsigned clength = get_bits(br, 16);
+      if (is_overrun(br)) return false;
+      if (bytes_to_copy != (clength^0xffff)) return false;
+
+      // return the bytes in the buffer to the input.
+      br.src -= br.num_bits / 8 - br.overrun;
+      br.bits = 0;
+      br.num_bits = 0;
+      br.overrun = 0;
+
+      if ((unsigned)(dest_max - dest) < bytes_to_copy) return false;
+      if ((unsigned)(br.src_max - br.src) < bytes_to_copy) return false;
+
+      memcpy(dest, br.src, bytes_to_copy);
+      dest += bytes_to_copy;
+      br.src += bytes_to_copy;
+      return true;
+    }
+
+    // decode the symbols of a huffman coded block.
+    // the bit buffer is kept in local variables so that it stays in registers
+    // (stores to dest may alias anything).
+    static bool decode_lz77(bit_reader &br, uint8_t *&dest_ref, uint8_t *dest_min, uint8_t *dest_max, const huffman_tables &tables) {
+      uint64_t bits = br.bits;
+      unsigned num_bits = br.num_bits;
+      const uint8_t *src = br.src;
+      const uint8_t *src_max = br.src_max;
+      unsigned overrun = br.overrun;
+      uint8_t *dest = dest_ref;
+      const uint32_t *lit_table = tables.lit;
+      const uint32_t *dist_table = tables.dist;
+      bool result = false;
+
+      for (;;) {
+        if (num_bits < max_symbol_bits) {
+          refill(bits, num_bits, src, src_max, overrun);
+          // stop garbage from running on past the end of the input.
+          if (overrun > 8) break;
+        }
+
+        uint32_t entry = lit_table[bits & ((1 << lit_bits) - 1)];
+        if (entry & entry_link) {
+          bits >>= lit_bits;
+          num_bits -= lit_bits;
+          entry = lit_table[(entry >> 16) + (bits & ((1u << ((entry >> 8) & 0x0f)) - 1))];
+        }
+        bits >>= entry & 0xff;
+        num_bits -= entry & 0xff;
+
+        if (entry & entry_literal) {
+          if (dest == dest_max) break;
+          *dest++ = (uint8_t)(entry >> 16);
+          continue;
+        }
+
+        if (entry & (entry_end|entry_invalid)) {
+          result = (entry & entry_end) != 0;
+          break;
+        }
+
+        unsigned extra = (entry >> 8) & 0x0f;
+        unsigned length = (entry >> 16) + ((unsigned)bits & ((1u << extra) - 1));
+        bits >>= extra;
+        num_bits -= extra;
+
+        entry = dist_table[bits & ((1 << dist_bits) - 1)];
+        if (entry & entry_link) {
+          bits >>= dist_bits;
+          num_bits -= dist_bits;
+          entry = dist_table[(entry >> 16) + (bits & ((1u << ((entry >> 8) & 0x0f)) - 1))];
+        }
+        bits >>= entry & 0xff;
+        num_bits -= entry & 0xff;
+        if (entry & entry_invalid) break;
+
+        extra = (entry >> 8) & 0x0f;
+        unsigned distance = (entry >> 16) + ((unsigned)bits & ((1u << extra) - 1));
+        bits >>= extra;
+        num_bits -= extra;
+
+        if (debug) printf("length=%d distance=%d\n", length, distance);
+
+        if (distance > (unsigned)(dest - dest_min) || length > (unsigned)(dest_max - dest)) break;
+
+        const uint8_t *from = dest - distance;
+        uint8_t *end = dest + length;
+        if (distance >= 8 && dest_max - end >= copy_slack) {
+          // copy eight bytes at a time. This may write past the end of the match,
+          // but the bytes are overwritten by the next symbol.
+          do {
+            uint64_t word;
+            memcpy(&word, from, 8);
+            memcpy(dest, &word, 8);
+            from += 8;
+            dest += 8;
+          } while (dest < end);
+          dest = end;
+        } else if (distance == 1) {
+          // runs of one byte are common in images.
+          memset(dest, *from, length);
+          dest = end;
+        } else {
+          // short overlapping copy.
+          do {
+            *dest++ = *from++;
+          } while (dest != end);
+        }
       }
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &var_);
+
+      br.bits = bits;
+      br.num_bits = num_bits;
+      br.src = src;
+      br.overrun = overrun;
+      dest_ref = dest;
+      return result && !is_overrun(br);
     }
+
   public:
     zip_decoder() {
-      uint8_t lit_lengths[288];
-      uint8_t dist_lengths[32];
-      memset(lit_lengths +   0, 8, 144 - 0);
-      memset(lit_lengths + 144, 9, 256-144);
-      memset(lit_lengths + 256, 7, 280-256);
-      memset(lit_lengths + 280, 8, 288-280);
-      memset(dist_lengths, 5, 32);
-      build_huffman(lit_lengths, 288, fixed_.min_lit_length, fixed_.max_lit_length, fixed_.lit_codes, fixed_.lit_limits, fixed_.lit_base);
-      build_huffman(dist_lengths, 32, fixed_.min_dist_length, fixed_.max_dist_length, fixed_.dist_codes, fixed_.dist_limits, fixed_.dist_base);
+      // build the fixed tables now rather than on the first fixed block.
+      fixed_tables();
     }
 
-    void decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
-      unsigned bitptr = 0;
+    /// Decode a deflate stream into a buffer.
+    ///
+    /// Returns false if the data is corrupt or does not fit in the buffer.
+    /// This never reads beyond src_max or writes beyond dest_max.
+    bool decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) const {
+      bit_reader br;
+      br.src = src;
+      br.src_max = src_max;
+      br.bits = 0;
+      br.num_bits = 0;
+      br.overrun = 0;
+
+      uint8_t *dest_min = dest;
+      huffman_tables dynamic_tables;
       unsigned is_last_block;
 
       // for each "deflate" block:
       do {
-        // prevent (bitptr / 8) from overflowing (>512Mib)
-        src += bitptr / 8;
-        bitptr %= 8;
-
         // three bits determine kind and exit condition
-        is_last_block = peek(src, bitptr, 1, "deflate last") != 0;
-        unsigned kind = peek(src, bitptr + 1, 2, "deflate kind");
+        is_last_block = get_bits(br, 1);
+        unsigned kind = get_bits(br, 2);
+        if (debug) printf("zip_decoder: block kind %d last %d\n", kind, is_last_block);
 
-        bitptr += 3;
+        bool ok = false;
         switch (kind) {
-        case 0: bitptr = decode_uncompressed(dest, dest_max, src, src_max, bitptr); break;
-        case 1: bitptr = decode_fixed(dest, dest_max, src, src_max, bitptr); break;
-        case 2: bitptr = decode_variable(dest, dest_max, src, src_max, bitptr); break;
-        default: return;
+          case 0: ok = decode_uncompressed(br, dest, dest_max); break;
+          case 1: ok = decode_lz77(br, dest, dest_min, dest_max, fixed_tables()); break;
+          case 2: ok = read_dynamic_tables(br, dynamic_tables) && decode_lz77(br, dest, dest_min, dest_max, dynamic_tables); break;
         }
-      } while( !is_last_block && bitptr != ~0);
+        if (!ok) return false;
+      } while (!is_last_block);
+
+      return true;
     }
   };
 }}
-
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// zip_decoder benchmark
+//
+// compresses each file with zip_encoder at level 6 and times zip_decoder inflating it.
+// there is no copy of a standard corpus in the repository, so by default the largest
+// assets are used (XML, text and audio). To time a standard corpus such as Silesia, run
+//
+//   bin/example_benchmarks zip_decoder silesia/dickens silesia/mozilla ...
+//
+
+namespace octet { namespace loaders {
+  /// Benchmark inflate speed on a corpus of files.
+  class zip_decoder_benchmark {
+    enum { num_runs = 5 };
+
+    // decode at least this many bytes per run so that small files time reliably.
+    enum { min_bytes_per_run = 64 << 20 };
+
+    static double now() {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static dynarray<const char *> &files() {
+      static dynarray<const char *> instance;
+      return instance;
+    }
+
+    static void run_file(FILE *file, const char *name) {
+      string path;
+      resources::app_utils::get_path(path, name);
+      file_map map(path.c_str());
+      if (!map.get_data()) {
+        fprintf(file, "%-32s not found\n", name);
+        return;
+      }
+
+      const uint8_t *src = map.get_data();
+      size_t size = (size_t)map.get_size();
+      dynarray<uint8_t> compressed;
+      zip_encoder enc;
+      enc.encode(compressed, src, src + size, 6);
+
+      zip_decoder dec;
+      dynarray<uint8_t> decoded(size);
+      unsigned passes = size < min_bytes_per_run ? (unsigned)(min_bytes_per_run / (size + 1)) + 1 : 1;
+      bool ok = true;
+
+      // fastest of a few runs, as other processes add noise.
+      double best = 1e30;
+      for (unsigned i = 0; i != num_runs; ++i) {
+        double t0 = now();
+        for (unsigned p = 0; p != passes; ++p) {
+          ok = dec.decode(decoded.data(), decoded.data() + size, compressed.data(), compressed.data() + compressed.size()) && ok;
+        }
+        best = std::min(best, now() - t0);
+      }
+
+      ok = ok && (size == 0 || !memcmp(decoded.data(), src, size));
+      const char *base = strrchr(name, '/');
+      fprintf(
+        file, "%-32s %10u %7.1f%% %10.1f%s\n", base ? base + 1 : name, (unsigned)size,
+        compressed.size() * 100.0 / (size ? size : 1), (double)size * passes / best / 1e6, ok ? "" : "  decode failed!"
+      );
+    }
+
+  public:
+    /// Use these files instead of the default ones.
+    static void set_files(const char *const *names, unsigned num_names) {
+      files().resize(0);
+      for (unsigned i = 0; i != num_names; ++i) {
+        files().push_back(names[i]);
+      }
+    }
+
+    /// Print the compressed size and inflate speed of each file.
+    static void run(FILE *file = stdout) {
+      static const char *default_files[] = {
+        "assets/Laurana50k.dae",
+        "assets/jenga.dae",
+        "assets/duck_triangulate.dae",
+        "assets/molecules/pdb1fha.ent",
+        "assets/invaderers/bang.wav",
+      };
+
+      if (files().empty()) {
+        set_files(default_files, sizeof(default_files)/sizeof(default_files[0]));
+      }
+
+      fprintf(file, "zip_decoder, level 6 streams from zip_encoder, best of %d runs\n", (int)num_runs);
+      fprintf(file, "%-32s %10s %8s %10s\n", "file", "bytes", "ratio", "MB/s");
+      for (unsigned i = 0; i != files().size(); ++i) {
+        run_file(file, files()[i]);
+      }
+    }
+  };
+} }
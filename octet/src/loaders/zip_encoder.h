@@ -0,0 +1,691 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+//
+// zip deflate format encoder
+//
+// matches are found with hash chains: every position is linked to the previous
+// position with the same three byte hash. Higher levels search longer chains and
+// try "lazy" matches (a literal then a longer match) as zlib does.
+//
+// each block of tokens is written with whichever of the dynamic, fixed or stored
+// codings is smallest.
+//
+namespace octet { namespace loaders {
+  /// Deflate (RFC 1951) encoder, the partner of zip_decoder.
+  ///
+  /// Level 0 stores the data, 1 is fastest and 9 is smallest. 6 is the usual choice.
+  ///
+  /// Example:
+  ///
+  ///     zip_encoder enc;
+  ///     dynarray<uint8_t> compressed;
+  ///     enc.encode(compressed, src, src + size, 6);
+  class zip_encoder {
+    enum {
+      window_size = 32768,
+      window_mask = window_size - 1,
+      hash_bits = 15,
+      hash_size = 1 << hash_bits,
+      min_match = 3,
+      max_match = 258,
+
+      // length 3 matches further back than this cost more than three literals.
+      too_far = 4096,
+
+      // tokens in a block; each block gets its own huffman codes.
+      max_tokens = 16384,
+
+      max_code_length = 15,
+      max_length_code_length = 7,
+    };
+
+    // a literal (dist == 0) or a match
+    struct token {
+      uint16_t value;
+      uint16_t dist;
+    };
+
+    // search effort for each level
+    struct level_params {
+      uint16_t max_chain;     // how many earlier positions to try
+      uint16_t good_length;   // search less if we already have a match this long
+      uint16_t nice_length;   // stop searching when a match is this long
+      uint16_t lazy_length;   // do not look for a better match if we have one this long
+      bool lazy;              // try a literal followed by a longer match
+    };
+
+    // the next bits of the output.
+    struct bit_writer {
+      uint8_t *dest;
+      uint64_t bits;
+      unsigned num_bits;
+
+      void put(unsigned value, unsigned n) {
+        bits |= (uint64_t)value << num_bits;
+        num_bits += n;
+        if (num_bits >= 32) {
+          // note: this will have to be fixed on PPC and other big-endian devices
+          uint32_t word = (uint32_t)bits;
+          memcpy(dest, &word, 4);
+          dest += 4;
+          bits >>= 32;
+          num_bits -= 32;
+        }
+      }
+
+      // write any whole bytes and pad the last one.
+      void align() {
+        while (num_bits > 0) {
+          *dest++ = (uint8_t)bits;
+          bits >>= 8;
+          num_bits = num_bits > 8 ? num_bits - 8 : 0;
+        }
+        bits = 0;
+      }
+    };
+
+    // a huffman code for writing
+    struct huffman_code {
+      uint16_t codes[288];     // reversed, ready for bit_writer
+      uint8_t lengths[288];
+    };
+
+    // length and distance symbols
+    struct symbol_tables {
+      uint8_t length_symbol[max_match+1];   // symbol - 257 for each length
+      uint8_t dist_symbol[512];             // see get_dist_symbol
+      uint16_t length_base[29];
+      uint8_t length_extra[29];
+      uint16_t dist_base[30];
+      uint8_t dist_extra[30];
+
+      symbol_tables() {
+        static const uint16_t lbase[] = {
+          3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+        };
+        static const uint8_t lextra[] = {
+          0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+        };
+        static const uint16_t dbase[] = {
+          1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+          257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+        };
+        static const uint8_t dextra[] = {
+          0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+          7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+        };
+        memcpy(length_base, lbase, sizeof(lbase));
+        memcpy(length_extra, lextra, sizeof(lextra));
+        memcpy(dist_base, dbase, sizeof(dbase));
+        memcpy(dist_extra, dextra, sizeof(dextra));
+
+        for (unsigned sym = 0; sym != 29; ++sym) {
+          unsigned end = sym == 28 ? max_match + 1 : lbase[sym] + (1 << lextra[sym]);
+          for (unsigned len = lbase[sym]; len < end && len <= max_match; ++len) {
+            length_symbol[len] = (uint8_t)sym;
+          }
+        }
+        // length 258 has its own symbol even though 227 + 31 covers it.
+        length_symbol[max_match] = 28;
+
+        // distances 1-256 directly, larger ones in steps of 128.
+        for (unsigned sym = 0; sym != 30; ++sym) {
+          for (unsigned d = dbase[sym]; d < dbase[sym] + (1u << dextra[sym]); ++d) {
+            if (d <= 256) {
+              dist_symbol[d-1] = (uint8_t)sym;
+            } else {
+              dist_symbol[256 + ((d-1) >> 7)] = (uint8_t)sym;
+            }
+          }
+        }
+      }
+
+      unsigned get_dist_symbol(unsigned dist) const {
+        return dist <= 256 ? dist_symbol[dist-1] : dist_symbol[256 + ((dist-1) >> 7)];
+      }
+    };
+
+    static const symbol_tables &get_symbol_tables() {
+      static symbol_tables instance;
+      return instance;
+    }
+
+    static const level_params &get_level_params(int level) {
+      static const level_params params[] = {
+        {    0,  0,   0,   0, false }, // 0: stored
+        {    4,  4,   8,   0, false }, // 1
+        {    8,  4,  16,   0, false }, // 2
+        {   32,  4,  32,   0, false }, // 3
+        {   16,  4,  16,   4, true  }, // 4
+        {   32,  8,  32,  16, true  }, // 5
+        {  128,  8, 128,  16, true  }, // 6
+        {  256,  8, 128,  32, true  }, // 7
+        { 1024, 32, 258, 128, true  }, // 8
+        { 4096, 32, 258, 258, true  }, // 9
+      };
+      return params[level < 0 ? 0 : level > 9 ? 9 : level];
+    }
+
+    // matcher state
+    const uint8_t *src_begin;
+    const uint8_t *src_end;
+    dynarray<int32_t> head;
+    dynarray<int32_t> prev;
+
+    // tokens for the current block
+    dynarray<token> tokens;
+    unsigned lit_freq[288];
+    unsigned dist_freq[30];
+    size_t block_start;
+    size_t block_bytes;
+
+    // output
+    dynarray<uint8_t> *dest;
+    bit_writer writer;
+
+    static unsigned hash3(const uint8_t *p) {
+      unsigned v = p[0] | p[1] << 8 | p[2] << 16;
+      return (v * 2654435761u) >> (32 - hash_bits);
+    }
+
+    void insert(size_t pos) {
+      if (pos + min_match <= (size_t)(src_end - src_begin)) {
+        unsigned h = hash3(src_begin + pos);
+        prev[pos & window_mask] = head[h];
+        head[h] = (int32_t)pos;
+      }
+    }
+
+    // length of the common prefix of two positions, up to max_len.
+    static unsigned match_length(const uint8_t *a, const uint8_t *b, unsigned max_len) {
+      unsigned len = 0;
+      while (len + 8 <= max_len) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        uint64_t diff = x ^ y;
+        if (diff) {
+          // note: this will have to be fixed on PPC and other big-endian devices
+          unsigned bytes = 0;
+          while (!(diff & 0xff)) { diff >>= 8; bytes++; }
+          return len + bytes;
+        }
+        len += 8;
+      }
+      while (len < max_len && a[len] == b[len]) {
+        len++;
+      }
+      return len;
+    }
+
+    // find the longest match at pos that is longer than best_len.
+    unsigned find_match(size_t pos, unsigned best_len, unsigned &best_dist, const level_params &params) {
+      size_t remaining = (size_t)(src_end - src_begin) - pos;
+      if (remaining < min_match) return 0;
+      unsigned max_len = remaining < max_match ? (unsigned)remaining : (unsigned)max_match;
+      if (best_len >= max_len) return 0;
+      unsigned nice_length = params.nice_length < max_len ? params.nice_length : max_len;
+      const uint8_t *cur = src_begin + pos;
+      unsigned found = 0;
+
+      int32_t cand = head[hash3(cur)];
+      unsigned max_chain = best_len >= params.good_length ? params.max_chain >> 2 : params.max_chain;
+      for (unsigned chain = max_chain; cand >= 0 && chain != 0; --chain) {
+        size_t dist = pos - (size_t)cand;
+        if (dist == 0 || dist > window_size) break;
+        const uint8_t *p = src_begin + cand;
+
+        // check the byte that would make this match better first.
+        if (p[best_len] == cur[best_len] && p[0] == cur[0]) {
+          unsigned len = match_length(p, cur, max_len);
+          if (len > best_len) {
+            best_len = len;
+            best_dist = (unsigned)dist;
+            found = len;
+            if (len >= nice_length) break;
+          }
+        }
+
+        int32_t next = prev[cand & window_mask];
+        // the chain has been overwritten by a newer position.
+        if (next >= cand) break;
+        cand = next;
+      }
+
+      if (found == min_match && best_dist > too_far) return 0;
+      return found;
+    }
+
+    void add_literal(unsigned value) {
+      token t = { (uint16_t)value, 0 };
+      tokens.push_back(t);
+      lit_freq[value]++;
+      block_bytes++;
+    }
+
+    void add_match(unsigned length, unsigned dist) {
+      const symbol_tables &st = get_symbol_tables();
+      token t = { (uint16_t)length, (uint16_t)dist };
+      tokens.push_back(t);
+      lit_freq[257 + st.length_symbol[length]]++;
+      dist_freq[st.get_dist_symbol(dist)]++;
+      block_bytes += length;
+    }
+
+    // make huffman code lengths no longer than max_length from symbol frequencies.
+    static void build_lengths(const unsigned *freq, unsigned num_symbols, uint8_t *lengths, unsigned max_length) {
+      // symbols with non-zero frequency, sorted by frequency.
+      uint16_t symbols[288];
+      unsigned weights[288];
+      unsigned n = 0;
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        lengths[i] = 0;
+        if (freq[i]) symbols[n++] = (uint16_t)i;
+      }
+      if (n == 0) return;
+      if (n == 1) {
+        // some decoders reject a code with only one symbol, so add another.
+        lengths[symbols[0]] = 1;
+        lengths[symbols[0] ? 0 : 1] = 1;
+        return;
+      }
+      std::sort(symbols, symbols + n, [freq](uint16_t a, uint16_t b) { return freq[a] < freq[b] || (freq[a] == freq[b] && a < b); });
+
+      // in-place minimum redundancy code (Moffat and Katajainen).
+      unsigned *w = weights;
+      for (unsigned i = 0; i != n; ++i) w[i] = freq[symbols[i]];
+      w[0] += w[1];
+      unsigned root = 0, leaf = 2;
+      for (unsigned next = 1; next < n - 1; ++next) {
+        if (leaf >= n || w[root] < w[leaf]) {
+          w[next] = w[root];
+          w[root++] = next;
+        } else {
+          w[next] = w[leaf++];
+        }
+        if (leaf >= n || (root < next && w[root] < w[leaf])) {
+          w[next] += w[root];
+          w[root++] = next;
+        } else {
+          w[next] += w[leaf++];
+        }
+      }
+      w[n-2] = 0;
+      for (int next = (int)n - 3; next >= 0; --next) {
+        w[next] = w[w[next]] + 1;
+      }
+      int avail = 1, used = 0, depth = 0, root_i = (int)n - 2, next_i = (int)n - 1;
+      while (avail > 0) {
+        while (root_i >= 0 && (int)w[root_i] == depth) {
+          used++;
+          root_i--;
+        }
+        while (avail > used) {
+          w[next_i--] = depth;
+          avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+      }
+
+      // count codes of each length, folding long codes into max_length.
+      unsigned count[32] = { 0 };
+      for (unsigned i = 0; i != n; ++i) {
+        count[w[i] < max_length ? w[i] : max_length]++;
+      }
+
+      // then lengthen shorter codes until the code is complete again.
+      uint32_t total = 0;
+      for (unsigned i = 1; i <= max_length; ++i) {
+        total += count[i] << (max_length - i);
+      }
+      while (total != (1u << max_length)) {
+        count[max_length]--;
+        for (unsigned i = max_length - 1; i > 0; --i) {
+          if (count[i]) {
+            count[i]--;
+            count[i+1] += 2;
+            break;
+          }
+        }
+        total--;
+      }
+
+      // the least frequent symbols get the longest codes.
+      unsigned j = 0;
+      for (unsigned length = max_length; length > 0; --length) {
+        for (unsigned k = 0; k != count[length]; ++k) {
+          lengths[symbols[j++]] = (uint8_t)length;
+        }
+      }
+    }
+
+    // make canonical codes from lengths, reversed for the bit writer.
+    static void build_codes(huffman_code &code, unsigned num_symbols) {
+      unsigned count[max_code_length+1] = { 0 };
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        count[code.lengths[i]]++;
+      }
+      count[0] = 0;
+      unsigned next_code[max_code_length+1];
+      unsigned c = 0;
+      next_code[0] = 0;
+      for (unsigned length = 1; length <= max_code_length; ++length) {
+        c = (c + count[length-1]) << 1;
+        next_code[length] = c;
+      }
+      for (unsigned i = 0; i != num_symbols; ++i) {
+        unsigned length = code.lengths[i];
+        unsigned value = length ? next_code[length]++ : 0;
+        unsigned rev = 0;
+        for (unsigned b = 0; b != length; ++b) {
+          rev = rev * 2 + (value & 1);
+          value >>= 1;
+        }
+        code.codes[i] = (uint16_t)rev;
+      }
+    }
+
+    static const huffman_code &get_fixed_lit_code() {
+      struct fixed : huffman_code {
+        fixed() {
+          memset(lengths +   0, 8, 144 - 0);
+          memset(lengths + 144, 9, 256-144);
+          memset(lengths + 256, 7, 280-256);
+          memset(lengths + 280, 8, 288-280);
+          build_codes(*this, 288);
+        }
+      };
+      static fixed instance;
+      return instance;
+    }
+
+    static const huffman_code &get_fixed_dist_code() {
+      struct fixed : huffman_code {
+        fixed() {
+          memset(lengths, 5, 30);
+          build_codes(*this, 30);
+        }
+      };
+      static fixed instance;
+      return instance;
+    }
+
+    // run length encode the code lengths of a dynamic block.
+    // each item is a symbol (0-18) in the bottom byte and extra bits above.
+    static unsigned encode_lengths(const uint8_t *lengths, unsigned num_lengths, uint16_t *items, unsigned *freq) {
+      unsigned num_items = 0;
+      for (unsigned i = 0; i != num_lengths;) {
+        unsigned value = lengths[i];
+        unsigned run = 1;
+        while (i + run != num_lengths && lengths[i + run] == value) {
+          run++;
+        }
+        i += run;
+        if (value == 0) {
+          while (run >= 11) {
+            unsigned n = run < 138 ? run : 138;
+            items[num_items++] = (uint16_t)(18 | (n - 11) << 8);
+            freq[18]++;
+            run -= n;
+          }
+          if (run >= 3) {
+            items[num_items++] = (uint16_t)(17 | (run - 3) << 8);
+            freq[17]++;
+            run = 0;
+          }
+        } else {
+          items[num_items++] = (uint16_t)value;
+          freq[value]++;
+          run--;
+          while (run >= 3) {
+            unsigned n = run < 6 ? run : 6;
+            items[num_items++] = (uint16_t)(16 | (n - 3) << 8);
+            freq[16]++;
+            run -= n;
+          }
+        }
+        while (run) {
+          items[num_items++] = (uint16_t)value;
+          freq[value]++;
+          run--;
+        }
+      }
+      return num_items;
+    }
+
+    // bits needed for the tokens with a pair of codes.
+    unsigned token_bits(const huffman_code &lit, const huffman_code &dist) const {
+      const symbol_tables &st = get_symbol_tables();
+      unsigned bits = 0;
+      for (unsigned i = 0; i != 286; ++i) {
+        bits += lit_freq[i] * lit.lengths[i];
+      }
+      for (unsigned i = 0; i != 29; ++i) {
+        bits += lit_freq[257 + i] * st.length_extra[i];
+      }
+      for (unsigned i = 0; i != 30; ++i) {
+        bits += dist_freq[i] * (dist.lengths[i] + st.dist_extra[i]);
+      }
+      return bits;
+    }
+
+    void write_tokens(const huffman_code &lit, const huffman_code &dist) {
+      const symbol_tables &st = get_symbol_tables();
+      for (unsigned i = 0; i != tokens.size(); ++i) {
+        const token &t = tokens[i];
+        if (t.dist == 0) {
+          writer.put(lit.codes[t.value], lit.lengths[t.value]);
+        } else {
+          unsigned lsym = st.length_symbol[t.value];
+          writer.put(lit.codes[257 + lsym], lit.lengths[257 + lsym]);
+          writer.put(t.value - st.length_base[lsym], st.length_extra[lsym]);
+          unsigned dsym = st.get_dist_symbol(t.dist);
+          writer.put(dist.codes[dsym], dist.lengths[dsym]);
+          writer.put(t.dist - st.dist_base[dsym], st.dist_extra[dsym]);
+        }
+      }
+      writer.put(lit.codes[256], lit.lengths[256]);
+    }
+
+    void write_stored(const uint8_t *src, size_t size, bool is_last) {
+      do {
+        unsigned n = size < 65535 ? (unsigned)size : 65535;
+        size -= n;
+        writer.put(is_last && size == 0 ? 1 : 0, 1);
+        writer.put(0, 2);
+        writer.align();
+        writer.put(n, 16);
+        writer.put(n ^ 0xffff, 16);
+        memcpy(writer.dest, src, n);
+        writer.dest += n;
+        src += n;
+      } while (size);
+    }
+
+    // make sure there is room for a block of this many input bytes.
+    void reserve_output(size_t block_size) {
+      size_t pos = writer.dest - dest->data();
+      size_t needed = pos + block_size + (block_size / 65535 + 1) * 5 + 64;
+      if (dest->size() < needed) {
+        dest->resize(needed + needed / 2);
+        writer.dest = dest->data() + pos;
+      }
+    }
+
+    // write the tokens as the smallest of a dynamic, fixed or stored block.
+    void flush_block(bool is_last) {
+      const uint8_t *block_src = src_begin + block_start;
+      reserve_output(block_bytes);
+
+      lit_freq[256] = 1;
+      huffman_code lit, dist;
+      build_lengths(lit_freq, 286, lit.lengths, max_code_length);
+      build_lengths(dist_freq, 30, dist.lengths, max_code_length);
+      build_codes(lit, 286);
+      build_codes(dist, 30);
+
+      unsigned num_lit = 286;
+      while (num_lit > 257 && lit.lengths[num_lit-1] == 0) num_lit--;
+      unsigned num_dist = 30;
+      while (num_dist > 1 && dist.lengths[num_dist-1] == 0) num_dist--;
+
+      // code length codes for the dynamic header.
+      uint8_t all_lengths[286 + 30];
+      memcpy(all_lengths, lit.lengths, num_lit);
+      memcpy(all_lengths + num_lit, dist.lengths, num_dist);
+      uint16_t items[286 + 30];
+      unsigned length_freq[19] = { 0 };
+      unsigned num_items = encode_lengths(all_lengths, num_lit + num_dist, items, length_freq);
+      huffman_code length_code;
+      build_lengths(length_freq, 19, length_code.lengths, max_length_code_length);
+      build_codes(length_code, 19);
+
+      static const uint8_t order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+      unsigned num_length_codes = 19;
+      while (num_length_codes > 4 && length_code.lengths[order[num_length_codes-1]] == 0) num_length_codes--;
+
+      size_t dynamic_bits = 3 + 14 + num_length_codes * 3 + token_bits(lit, dist);
+      for (unsigned i = 0; i != 19; ++i) {
+        static const uint8_t extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+        dynamic_bits += length_freq[i] * (length_code.lengths[i] + extra[i]);
+      }
+      size_t fixed_bits = 3 + token_bits(get_fixed_lit_code(), get_fixed_dist_code());
+      size_t stored_bits = (block_bytes + (block_bytes / 65535 + 1) * 5) * 8 + 7;
+
+      if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits) {
+        write_stored(block_src, block_bytes, is_last);
+      } else if (fixed_bits <= dynamic_bits) {
+        writer.put(is_last ? 1 : 0, 1);
+        writer.put(1, 2);
+        write_tokens(get_fixed_lit_code(), get_fixed_dist_code());
+      } else {
+        writer.put(is_last ? 1 : 0, 1);
+        writer.put(2, 2);
+        writer.put(num_lit - 257, 5);
+        writer.put(num_dist - 1, 5);
+        writer.put(num_length_codes - 4, 4);
+        for (unsigned i = 0; i != num_length_codes; ++i) {
+          writer.put(length_code.lengths[order[i]], 3);
+        }
+        for (unsigned i = 0; i != num_items; ++i) {
+          unsigned sym = items[i] & 0xff;
+          writer.put(length_code.codes[sym], length_code.lengths[sym]);
+          if (sym == 16) writer.put(items[i] >> 8, 2);
+          else if (sym == 17) writer.put(items[i] >> 8, 3);
+          else if (sym == 18) writer.put(items[i] >> 8, 7);
+        }
+        write_tokens(lit, dist);
+      }
+
+      block_start += block_bytes;
+      block_bytes = 0;
+      tokens.resize(0);
+      memset(lit_freq, 0, sizeof(lit_freq));
+      memset(dist_freq, 0, sizeof(dist_freq));
+    }
+
+    void check_flush() {
+      if (tokens.size() >= max_tokens) flush_block(false);
+    }
+
+    // one match per position, taken as soon as it is found.
+    void compress_greedy(const level_params &params) {
+      size_t size = src_end - src_begin;
+      for (size_t pos = 0; pos < size;) {
+        unsigned dist = 0;
+        unsigned len = find_match(pos, min_match - 1, dist, params);
+        insert(pos);
+        if (len) {
+          add_match(len, dist);
+          for (size_t end = pos + len; ++pos != end;) {
+            insert(pos);
+          }
+        } else {
+          add_literal(src_begin[pos++]);
+        }
+        check_flush();
+      }
+    }
+
+    // before taking a match, see if the next position has a longer one.
+    void compress_lazy(const level_params &params) {
+      size_t size = src_end - src_begin;
+      unsigned prev_len = 0, prev_dist = 0;
+      bool have_prev = false;
+      for (size_t pos = 0; pos < size;) {
+        unsigned dist = 0;
+        unsigned len = 0;
+        if (prev_len < params.lazy_length) {
+          len = find_match(pos, prev_len > min_match - 1 ? prev_len : min_match - 1, dist, params);
+        }
+        insert(pos);
+
+        if (prev_len >= min_match && len <= prev_len) {
+          // the match at the previous position is best.
+          add_match(prev_len, prev_dist);
+          for (size_t end = pos - 1 + prev_len; ++pos != end;) {
+            insert(pos);
+          }
+          have_prev = false;
+          prev_len = 0;
+        } else {
+          if (have_prev) add_literal(src_begin[pos-1]);
+          have_prev = true;
+          prev_len = len;
+          prev_dist = dist;
+          pos++;
+        }
+        check_flush();
+      }
+      if (have_prev) add_literal(src_begin[size-1]);
+    }
+
+  public:
+    zip_encoder() {
+    }
+
+    /// Compress some bytes and append a raw deflate stream to dest.
+    void encode(dynarray<uint8_t> &dest, const uint8_t *src, const uint8_t *src_max, int level = 6) {
+      const level_params &params = get_level_params(level);
+      src_begin = src;
+      src_end = src_max;
+      this->dest = &dest;
+      size_t start = dest.size();
+      writer.dest = dest.data() + start;
+      writer.bits = 0;
+      writer.num_bits = 0;
+      block_start = 0;
+      block_bytes = 0;
+      tokens.resize(0);
+      memset(lit_freq, 0, sizeof(lit_freq));
+      memset(dist_freq, 0, sizeof(dist_freq));
+
+      if (params.max_chain == 0) {
+        block_bytes = src_max - src;
+        reserve_output(block_bytes);
+        write_stored(src, block_bytes, true);
+      } else {
+        head.resize(hash_size);
+        prev.resize(window_size);
+        memset(head.data(), 0xff, hash_size * sizeof(int32_t));
+        if (params.lazy) {
+          compress_lazy(params);
+        } else {
+          compress_greedy(params);
+        }
+        flush_block(true);
+      }
+
+      writer.align();
+      dest.resize(writer.dest - dest.data());
+    }
+  };
+}}
@@ -109,6 +109,9 @@
   // CG, GLSL, C++ compiler
   #include "compiler/compiler.h"
 
+  // atoms, the resource base class and the job scheduler used by the loaders
+  #include "resources/resource_core.h"
+
   // loaders (low dependency, so you can use them in other projects)
   #include "loaders/loaders.h"
 
@@ -146,6 +149,7 @@
   #include "helpers/text_overlay.h"
   #include "helpers/object_picker.h"
   #include "helpers/helper_fps_controller.h"
+  #include "helpers/asset_bundler.h"
 
   // asset loaders
   #include "loaders/collada_builder.h"
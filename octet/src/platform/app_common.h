@@ -22,6 +22,7 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_instance_matrix = 10, // four slots (10-13) for a per-instance mat4
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -67,6 +68,82 @@ namespace octet {
     key_rmb,
   };
 
+  /// What the current OpenGL context can do.
+  ///
+  /// OCTET_INSTANCING, OCTET_VERTEX_ARRAYS and OCTET_UNIFORM_BLOCKS say what we compile for,
+  /// but an OpenGL 3.0 driver does not have instanced arrays even when they are compiled in.
+  /// The context is asked the first time get() is called, so call it after the window is made.
+  class gl_features {
+    int major;
+    int minor;
+    bool es;
+    bool compatibility;
+
+    gl_features() {
+      major = minor = 0;
+      const char *version = (const char*)glGetString(GL_VERSION);
+      // "4.5 (Compatibility Profile) Mesa 21.0" or "OpenGL ES 3.0 ..."
+      es = version && !strncmp(version, "OpenGL ES", 9);
+      while (version && *version && (*version < '0' || *version > '9')) ++version;
+      if (version) sscanf(version, "%d.%d", &major, &minor);
+      compatibility = !es && (major < 3 || has_extension("GL_ARB_compatibility"));
+    }
+
+    bool at_least(int gl_major, int gl_minor, int es_major) const {
+      return es ? major >= es_major : major > gl_major || (major == gl_major && minor >= gl_minor);
+    }
+
+  public:
+    static const gl_features &get() {
+      static gl_features instance;
+      return instance;
+    }
+
+    /// Does the context have this extension?
+    bool has_extension(const char *name) const {
+      #if OCTET_UNIFORM_BLOCKS
+        // OpenGL 3 lists extensions one at a time; core profiles have no GL_EXTENSIONS string.
+        if (at_least(3, 0, 3)) {
+          GLint num_extensions = 0;
+          glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+          for (GLint i = 0; i != num_extensions; ++i) {
+            const char *ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (ext && !strcmp(ext, name)) return true;
+          }
+          return false;
+        }
+      #endif
+      const char *ext = (const char*)glGetString(GL_EXTENSIONS);
+      size_t len = strlen(name);
+      for (const char *p = ext ? strstr(ext, name) : NULL; p; p = strstr(p + len, name)) {
+        if ((p == ext || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) return true;
+      }
+      return false;
+    }
+
+    /// glDrawElementsInstanced and glVertexAttribDivisor: OpenGL 3.3 or OpenGLES3.
+    bool has_instancing() const {
+      return OCTET_INSTANCING && at_least(3, 3, 3);
+    }
+
+    /// vertex array objects: OpenGL 3.0 or OpenGLES3.
+    bool has_vertex_arrays() const {
+      return OCTET_VERTEX_ARRAYS && at_least(3, 0, 3);
+    }
+
+    /// uniform blocks in shaders compiled as GLSL 1.40: OpenGL 3.1 with ARB_compatibility.
+    /// Our shaders use attribute, varying and gl_FragColor, which GLSL 1.40 only keeps in compatibility contexts.
+    bool has_uniform_blocks() const {
+      return OCTET_UNIFORM_BLOCKS && !es && compatibility && at_least(3, 1, 3);
+    }
+  };
+
+  namespace resources {
+    // see job.h
+    inline void create_job_scheduler();
+    inline void run_main_thread_jobs();
+  }
+
   class app_common {
     bitset<256> keys;
     bitset<256> prev_keys;
@@ -93,9 +170,17 @@ namespace octet {
       mouse_abs_x = mouse_abs_y = 0;
       is_gles3 = false;
       frame_number = 0;
+
+      // the app is made on the main thread, which the scheduler needs to know.
+      resources::create_job_scheduler();
+
+      // resources released on the main thread are deleted at the end of the frame.
+      release_queue::set_deferred(true);
     }
 
     virtual ~app_common() {
+      release_queue::drain();
+      release_queue::set_deferred(false);
     }
 
     void begin_frame() {
@@ -106,6 +191,9 @@ namespace octet {
 
     void end_frame() {
       prev_keys = keys;
+      resources::run_main_thread_jobs();
+      release_queue::drain();
+      frame_allocator::reset();
     }
 
     virtual void draw_world(int x, int y, int w, int h) = 0;
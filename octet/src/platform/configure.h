@@ -36,6 +36,49 @@
   #define GL_UNIFORM_BUFFER 0
 #endif
 
+// instanced arrays (glDrawElementsInstanced, glVertexAttribDivisor) need OpenGLES3 or OpenGL 3.3,
+// vertex array objects need OpenGLES3 or OpenGL 3.0 and uniform blocks need OpenGL 3.1 (GLSL 1.40).
+// the legacy OSX context only has the ARB and APPLE versions.
+// these say what we compile; gl_features says what the driver has at run time.
+#if defined(OCTET_GLES2) || defined(__APPLE__)
+  #define OCTET_INSTANCING 0
+  #define OCTET_VERTEX_ARRAYS 0
+  #define OCTET_UNIFORM_BLOCKS 0
+#else
+  #define OCTET_INSTANCING 1
+  #define OCTET_VERTEX_ARRAYS 1
+  #define OCTET_UNIFORM_BLOCKS 1
+#endif
+
+// SSE2 intrinsics are available on all x64 targets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define OCTET_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled into functions marked OCTET_TARGET_AVX2
+// and only called when cpu_features says the cpu has it.
+#if OCTET_SSE2 && defined(__GNUC__)
+  #define OCTET_AVX2 1
+  #define OCTET_TARGET_AVX2 __attribute__((target("avx2")))
+  #include <immintrin.h>
+  #include <cpuid.h>
+#elif OCTET_SSE2 && defined(_MSC_VER) && _MSC_VER >= 1800
+  #define OCTET_AVX2 1
+  #define OCTET_TARGET_AVX2
+  #include <immintrin.h>
+#else
+  #define OCTET_AVX2 0
+  #define OCTET_TARGET_AVX2
+#endif
+
+// thread local storage for plain old data (pointers, counters)
+#if defined(WIN32)
+  #define OCTET_THREAD_LOCAL __declspec(thread)
+#else
+  #define OCTET_THREAD_LOCAL __thread
+#endif
+
 // use <> to include from standard directories
 // use "" to include from our own project
 #include <stdio.h>
@@ -55,9 +98,17 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <type_traits>
 
 #if defined(WIN32)
   #include <direct.h>
+  #include <intrin.h>
 #endif
 
 namespace octet {
@@ -72,5 +123,47 @@ namespace octet {
     //fflush(file);
     return file;
   }
+
+  /// Instruction set extensions of the cpu we are running on.
+  ///
+  /// Use this to choose SIMD code at run time:
+  ///
+  ///     if (cpu_features::get().has_avx2()) { ... }
+  class cpu_features {
+    bool avx2;
+
+    cpu_features() {
+      avx2 = false;
+      #if OCTET_AVX2 && defined(__GNUC__)
+        unsigned a, b, c, d;
+        if (__get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 27))) {
+          // the os must save the ymm registers (xgetbv) as well as the cpu having avx2.
+          unsigned xcr0, xcr0_hi;
+          __asm__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+          if ((xcr0 & 6) == 6 && __get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+            avx2 = (b & (1 << 5)) != 0;
+          }
+        }
+      #elif OCTET_AVX2
+        int regs[4];
+        __cpuid(regs, 1);
+        if ((regs[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+          __cpuidex(regs, 7, 0);
+          avx2 = (regs[1] & (1 << 5)) != 0;
+        }
+      #endif
+    }
+  public:
+    /// the features of this cpu.
+    static const cpu_features &get() {
+      static cpu_features features;
+      return features;
+    }
+
+    /// true if we can call OCTET_TARGET_AVX2 functions.
+    bool has_avx2() const {
+      return avx2;
+    }
+  };
 }
 
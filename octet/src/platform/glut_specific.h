@@ -152,11 +152,9 @@ namespace octet {
     static void timer(int value) {
       glutTimerFunc(16, timer, 1);
       map_t &m = map();
-      for (int i = 0; i != m.size(); ++i) {
-        if (m.get_key(i)) {
-          glutSetWindow(m.get_key(i));
-          glutPostRedisplay();
-        }
+      for (map_t::iterator i = m.begin(); i != m.end(); ++i) {
+        glutSetWindow(i.key());
+        glutPostRedisplay();
       }
     }
   
@@ -177,19 +175,17 @@ namespace octet {
 
     static void run_all_apps() {
       map_t &m = map();
-      for (int i = 0; i != m.size(); ++i) {
-        if (m.get_key(i)) {
-          glutSetWindow(m.get_key(i));
-          glutDisplayFunc(display);
-          glutReshapeFunc(reshape);
-          glutKeyboardFunc(do_key_down);
-          glutKeyboardUpFunc(do_key_up);
-          glutSpecialFunc(do_special_down);
-          glutSpecialUpFunc(do_special_up);
-          glutMouseFunc(do_mouse_button);
-          glutMotionFunc(do_mouse);
-          glutPassiveMotionFunc(do_mouse);
-        }
+      for (map_t::iterator i = m.begin(); i != m.end(); ++i) {
+        glutSetWindow(i.key());
+        glutDisplayFunc(display);
+        glutReshapeFunc(reshape);
+        glutKeyboardFunc(do_key_down);
+        glutKeyboardUpFunc(do_key_up);
+        glutSpecialFunc(do_special_down);
+        glutSpecialUpFunc(do_special_up);
+        glutMouseFunc(do_mouse_button);
+        glutMotionFunc(do_mouse);
+        glutPassiveMotionFunc(do_mouse);
       }
       glutTimerFunc(16, timer, 1);
       glutMainLoop();
@@ -341,10 +341,10 @@ namespace octet {
         // waste some time. (do not do this in real games!)
         Sleep(1000/30);
 
-        for (int i = 0; i != m.size(); ++i) {
-          // note: because Win8 generates an invisible window, we need to check m.value(i)
-          if (m.get_key(i) && m.get_value(i)) {
-            m.get_value(i)->render();
+        for (map_t::iterator i = m.begin(); i != m.end(); ++i) {
+          // note: because Win8 generates an invisible window, we need to check i.value()
+          if (i.value()) {
+            i.value()->render();
           }
         }
 
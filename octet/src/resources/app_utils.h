@@ -6,25 +6,250 @@
 //
 //
 
-namespace octet {
-  // this enum is used to avoid using strings in code and files
-  enum atom_t {
-    atom_, // null atom
-    
-    #define OCTET_ATOM(X) atom_##X,
-    #include "atoms.h"
-    #undef OCTET_ATOM
-
-    // put classes at a fixed offset to prevent older files becomming obsolete
-    atom_class_base = 0x10000,
-    #define OCTET_CLASS(C, X) atom_##X,
-    //#pragma message("app_utils.h")
-    #include "classes.h"
-    #undef OCTET_CLASS
+namespace octet { namespace resources {
+  /// Hash used for atom names (FNV-1a). Where the compiler has constexpr, names can be hashed at compile time.
+  ///
+  /// Example:
+  ///
+  ///     atom_t atom_camera_pos = OCTET_GET_ATOM("camera_pos");
+  #if defined(_MSC_VER) && _MSC_VER < 1900
+    // VS2013 (v120) has no constexpr, so hash at run time.
+    inline unsigned atom_hash(const char *name, unsigned hash = 2166136261u) {
+      for (; *name; ++name) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+      }
+      return hash;
+    }
+
+    #define OCTET_ATOM_HASH(name) (octet::resources::atom_hash(name))
+  #else
+    inline constexpr unsigned atom_hash(const char *name, unsigned hash = 2166136261u) {
+      return *name ? atom_hash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+    }
+
+    /// Compute the hash of an atom name at compile time.
+    #define OCTET_ATOM_HASH(name) (std::integral_constant<unsigned, octet::resources::atom_hash(name)>::value)
+  #endif
+
+  /// Get the atom for a string literal without measuring or hashing it at run time.
+  #define OCTET_GET_ATOM(name) (octet::resources::app_utils::get_atom(name, (unsigned)sizeof(name) - 1, OCTET_ATOM_HASH(name)))
+
+  /// Thread safe two way map between names and atoms; used by app_utils::get_atom().
+  ///
+  /// Lookups do not take a lock: they read an open addressing table of published records.
+  /// New names are added under a mutex, which is rare once a game has loaded.
+  /// Tables that are replaced when we grow are kept, so a reader can never see freed memory.
+  ///
+  /// Names of dynamic atoms are kept in a dense array of chunks so that get_name() is an index.
+  class atom_table {
+    struct record_t {
+      const char *name;
+      unsigned length;
+      unsigned hash;
+      atom_t atom;
+    };
+
+    struct table_t {
+      unsigned mask;
+      table_t *prev;                  // retired tables, freed with the atom_table
+      std::atomic<record_t*> slots[1]; // mask+1 slots
+    };
+
+    enum {
+      chunk_bits = 10,
+      chunk_size = 1 << chunk_bits,
+      max_chunks = 4096,
+    };
+
+    std::atomic<table_t*> table;
+    std::atomic<unsigned> num_records;
+
+    // atom -> name for atoms first_dynamic and above
+    unsigned first_dynamic;
+    std::atomic<unsigned> num_dynamic;
+    std::atomic<const char **> chunks[max_chunks];
+
+    // writers only.
+    std::mutex writer;
+    arena text;
+
+    static table_t *new_table(unsigned size, table_t *prev) {
+      size_t bytes = sizeof(table_t) + sizeof(std::atomic<record_t*>) * (size - 1);
+      table_t *res = (table_t*)allocator::sys_malloc(bytes);
+      res->mask = size - 1;
+      res->prev = prev;
+      for (unsigned i = 0; i != size; ++i) {
+        new (&res->slots[i]) std::atomic<record_t*>(0);
+      }
+      return res;
+    }
+
+    static unsigned slot_of(unsigned hash) {
+      return hash_mix32(hash);
+    }
+
+    static void insert_record(table_t *tab, record_t *rec) {
+      for (unsigned i = slot_of(rec->hash); ; ++i) {
+        std::atomic<record_t*> &slot = tab->slots[i & tab->mask];
+        if (!slot.load(std::memory_order_relaxed)) {
+          slot.store(rec, std::memory_order_release);
+          return;
+        }
+      }
+    }
+
+    record_t *find(const char *name, unsigned length, unsigned hash) const {
+      table_t *tab = table.load(std::memory_order_acquire);
+      for (unsigned i = slot_of(hash); ; ++i) {
+        record_t *rec = tab->slots[i & tab->mask].load(std::memory_order_acquire);
+        if (!rec) return 0;
+        if (rec->hash == hash && rec->length == length && !memcmp(rec->name, name, length)) {
+          return rec;
+        }
+      }
+    }
+
+    // make a record that nobody can see yet; call with the writer lock held.
+    record_t *new_record(const char *name, unsigned length, unsigned hash, atom_t atom) {
+      record_t *rec = (record_t*)text.alloc(sizeof(record_t), sizeof(void*));
+      rec->name = text.copy_string(name, length);
+      rec->length = length;
+      rec->hash = hash;
+      rec->atom = atom;
+      return rec;
+    }
+
+    // make a record visible to find(); call with the writer lock held.
+    void publish(record_t *rec) {
+      table_t *tab = table.load(std::memory_order_relaxed);
+      unsigned count = num_records.load(std::memory_order_relaxed) + 1;
+      if (count * 2 > tab->mask + 1) {
+        // publish a bigger table; readers of the old one still see a consistent map.
+        table_t *bigger = new_table((tab->mask + 1) * 2, tab);
+        for (unsigned i = 0; i <= tab->mask; ++i) {
+          record_t *rec = tab->slots[i].load(std::memory_order_relaxed);
+          if (rec) insert_record(bigger, rec);
+        }
+        table.store(bigger, std::memory_order_release);
+        tab = bigger;
+      }
+
+      insert_record(tab, rec);
+      num_records.store(count, std::memory_order_relaxed);
+    }
+
+    // atom_table is a singleton
+    atom_table(const atom_table &);
+    atom_table &operator=(const atom_table &);
+  public:
+    /// Get the text of a predefined atom (atom_*)
+    static const char *get_predefined_name(unsigned i) {
+      static const char *atom_names[] = {
+        "",
+
+        #define OCTET_ATOM(X) #X,
+        #include "atoms.h"
+        #undef OCTET_ATOM
+        NULL
+      };
+      static const char *class_names[] = {
+        "",
+
+        #define OCTET_CLASS(N, X) #X,
+        //#pragma message("app_utils.h 2")
+        #include "classes.h"
+        #undef OCTET_CLASS
+        NULL
+      };
+      if (i < sizeof(atom_names)/sizeof(atom_names[0])-1) {
+        return atom_names[i];
+      } else if (i-(unsigned)atom_class_base < sizeof(class_names)/sizeof(class_names[0])-1) {
+        return class_names[i-(unsigned)atom_class_base];
+      } else {
+        return NULL;
+      }
+    }
+
+    /// Make a table holding the predefined atoms and class names.
+    atom_table() : text(0x1000) {
+      table.store(new_table(1024, 0), std::memory_order_relaxed);
+      num_records.store(0, std::memory_order_relaxed);
+      num_dynamic.store(0, std::memory_order_relaxed);
+      for (unsigned i = 0; i != max_chunks; ++i) {
+        chunks[i].store(0, std::memory_order_relaxed);
+      }
+
+      unsigned i = 1;
+      for (; get_predefined_name(i); ++i) {
+        const char *name = get_predefined_name(i);
+        publish(new_record(name, (unsigned)strlen(name), atom_hash(name), (atom_t)i));
+      }
+      first_dynamic = i;
+
+      for (unsigned j = (unsigned)atom_class_base + 1; get_predefined_name(j); ++j) {
+        const char *name = get_predefined_name(j);
+        publish(new_record(name, (unsigned)strlen(name), atom_hash(name), (atom_t)j));
+      }
+    }
+
+    ~atom_table() {
+      table_t *tab = table.load(std::memory_order_relaxed);
+      while (tab) {
+        table_t *prev = tab->prev;
+        allocator::sys_free(tab);
+        tab = prev;
+      }
+      for (unsigned i = 0; i != max_chunks; ++i) {
+        const char **chunk = chunks[i].load(std::memory_order_relaxed);
+        if (chunk) allocator::sys_free(chunk);
+      }
+    }
+
+    /// Find or add a name, hash must be atom_hash(name).
+    atom_t get_atom(const char *name, unsigned length, unsigned hash) {
+      record_t *rec = find(name, length, hash);
+      if (rec) return rec->atom;
+
+      std::lock_guard<std::mutex> lock(writer);
+
+      // someone may have beaten us to it.
+      rec = find(name, length, hash);
+      if (rec) return rec->atom;
+
+      unsigned index = num_dynamic.load(std::memory_order_relaxed);
+      if ((index >> chunk_bits) >= max_chunks || first_dynamic + index >= (unsigned)atom_class_base) {
+        assert(0 && "atom_table: too many atoms");
+        return atom_;
+      }
+
+      const char **chunk = chunks[index >> chunk_bits].load(std::memory_order_relaxed);
+      if (!chunk) {
+        chunk = (const char **)allocator::sys_malloc(sizeof(const char *) * chunk_size);
+        chunks[index >> chunk_bits].store(chunk, std::memory_order_release);
+      }
+
+      // fill in the name before anyone can find the atom, so that get_name() always works.
+      atom_t atom = (atom_t)(first_dynamic + index);
+      rec = new_record(name, length, hash, atom);
+      chunk[index & (chunk_size - 1)] = rec->name;
+      num_dynamic.store(index + 1, std::memory_order_release);
+      publish(rec);
+      return atom;
+    }
+
+    /// Get the name of a dynamic atom or NULL if this is not one.
+    const char *get_name(atom_t atom) const {
+      unsigned index = (unsigned)atom - first_dynamic;
+      if (index >= num_dynamic.load(std::memory_order_acquire)) return NULL;
+      return chunks[index >> chunk_bits].load(std::memory_order_acquire)[index & (chunk_size - 1)];
+    }
+
+    /// Number of atoms added at run time.
+    unsigned get_num_dynamic() const {
+      return num_dynamic.load(std::memory_order_acquire);
+    }
   };
-}
 
-namespace octet { namespace resources {
   /// A set of utilities   
   class app_utils {
   public:
@@ -49,17 +274,44 @@ namespace octet { namespace resources {
       return value;
     }
 
+    /// Lock used to serialise opening zip files from loader threads.
+    static std::mutex &get_zip_mutex() {
+      static std::mutex instance;
+      return instance;
+    }
+
     /// open a zip file for a given URL
+    ///
+    /// Zip files stay open, so the result can be used on any thread without a lock.
     static zip_file *get_zip_file(const char *url) {
+      std::lock_guard<std::mutex> guard(get_zip_mutex());
       static dictionary<ref<zip_file> > zip_files;
       int index = zip_files.get_index(url);
       if (index == -1) {
-        return zip_files[url] = new zip_file(get_path(url));
+        string path;
+        get_path(path, url);
+        return zip_files[url] = new zip_file(path.c_str());
       } else {
         return zip_files.get_value(index);
       }
     }
   
+    /// Open the zip file of a "zip://path/file.zip/name" URL and find the name of the file in it.
+    ///
+    /// Returns null if the URL does not name a zip file.
+    static zip_file *get_zip_url(const char *url, const char *&file) {
+      const char *path = url + 6;
+      const char *zip = strstr(path, ".zip");
+      if (!zip) return 0;
+
+      int path_len = (int)(zip - path + 4);
+      string zip_url;
+      zip_url.set(path, path_len);
+      file = path + path_len;
+      file += file[0] == '/';
+      return get_zip_file(zip_url.c_str());
+    }
+
     /// utility function to set rgb values in a buffer.
     static void setrgb(dynarray<unsigned char> &buffer, int size, int x, int y, unsigned rgb, unsigned a = 0xff) {
       buffer[(y*size+x)*4+0] = rgb >> 16;
@@ -68,13 +320,15 @@ namespace octet { namespace resources {
       buffer[(y*size+x)*4+3] = a;
     }
   
-    /// Convert a url into a file path.
-    static const char *get_path(const char *url) {
-      if (url == NULL) return "";
+    /// Convert a url into a file path. This version is safe to use on any thread.
+    static void get_path(string &path, const char *url) {
+      if (url == NULL) {
+        path = "";
+        return;
+      }
 
       string url_str;
       url_str.urldecode(url);
-      static string path;
 
       if (url[0] == '/' || (url[0] >= 'A' && url[0] <= 'Z' && url[1] == ':')) {
         path = url_str;
@@ -82,40 +336,66 @@ namespace octet { namespace resources {
         // relative path
         path.format("%s%s", prefix(), url_str.c_str());
       }
+    }
+
+    /// Convert a url into a file path. The result is only valid until the next call.
+    static const char *get_path(const char *url) {
+      static string path;
+      get_path(path, url);
       return path;
     }
 
-    /// Get a file into a buffer, given a URL.
-    static void get_url(dynarray<unsigned char> &buffer, const char *url) {
+    /// Map the contents of a URL into memory, given a URL.
+    ///
+    /// Files are mapped, not read, and files stored in zip files are not copied.
+    /// Returns an empty map if the URL can not be found; check get_size().
+    /// This may be called on any thread.
+    ///
+    /// Example:
+    ///
+    ///     ref<file_map> map = app_utils::map_url("assets/big.jpg");
+    ///     decode(map->get_data(), map->get_size());
+    static file_map *map_url(const char *url) {
+      file_map *result = 0;
+      const char *file = 0;
       if (!strncmp(url, "zip://", 6)) {
-        const char *zip = strstr(url + 6, ".zip");
-        if (zip) {
-          int path_len = (int)(zip - (url + 6) + 4);
-          string zip_url;
-          zip_url.set(url + 6, path_len);
-          const char *file = (url + 6) + path_len;
-          file += file[0] == '/';
-          zip_file *zip = get_zip_file(zip_url.c_str());
-          zip->get_file(buffer, file);
-        }
+        zip_file *zip = get_zip_url(url, file);
+        if (zip) result = zip->map_file(file);
       } else if (!strncmp(url, "http://", 7)) {
         // http
       } else {
-        const char *path = get_path(url);
-        FILE *file = fopen(path, "rb");
-        if (!file) {
+        string path;
+        get_path(path, url);
+        result = new file_map(path.c_str());
+        if (result->get_error()) {
           char tmp[1024];
-          printf("file %s not found. cwd=%s\n", path, getcwd(tmp, sizeof(tmp)));
-        } else {
-          fseek(file, 0, SEEK_END);
-          unsigned size = (unsigned)ftell(file);
-          buffer.reserve(size+1); // 1 more byte for zero terminator on a text file
-          buffer.resize(size);
-          fseek(file, 0, SEEK_SET);
-          fread(buffer.data(), 1, buffer.size(), file);
-          fclose(file);
+          printf("file %s not found. cwd=%s\n", path.c_str(), getcwd(tmp, sizeof(tmp)));
         }
       }
+
+      if (!result) {
+        dynarray<uint8_t> empty;
+        result = new file_map(empty);
+      }
+      return result;
+    }
+
+    /// Get a file into a buffer, given a URL.
+    ///
+    /// This may be called on any thread; see map_url to avoid the copy
+    /// and url_loader for asynchronous loads.
+    static void get_url(dynarray<unsigned char> &buffer, const char *url) {
+      const char *file = 0;
+      if (!strncmp(url, "zip://", 6)) {
+        zip_file *zip = get_zip_url(url, file);
+        if (zip) zip->get_file(buffer, file);
+      } else {
+        ref<file_map> map = map_url(url);
+        size_t size = (size_t)map->get_size();
+        buffer.reserve(size+1); // 1 more byte for zero terminator on a text file
+        buffer.resize(size);
+        if (size) memcpy(buffer.data(), map->get_data(), size);
+      }
     }
 
     /// Generate a stock texture. To be deprecated.
@@ -154,7 +434,7 @@ namespace octet { namespace resources {
             setrgb(buffer, size, x, y, r * 0x10000 + g * 0x100);
           }
         }
-        return make_texture(gl_kind, &buffer[0], buffer.size(), GL_RGBA, size, size);
+        return make_texture(gl_kind, &buffer[0], buffer.size(), GL_RGBA, size, size, false);
       } else {
         printf("warning: stock texture %s not found\n", name);
         return 0;
@@ -185,17 +465,37 @@ namespace octet { namespace resources {
 
     /// Utility function for making textures from arrays of bytes.
     /// gl_kind is GL_RGB or GL_RGBA
-    static GLuint make_texture(unsigned gl_kind, uint8_t *image, unsigned size, unsigned in_format, unsigned width, unsigned height) {
+    ///
+    /// The mipmaps are made here, in linear space unless srgb is false (eg. for normal maps).
+    static GLuint make_texture(unsigned gl_kind, uint8_t *image, unsigned size, unsigned in_format, unsigned width, unsigned height, bool srgb = true) {
       //assert(buffer.size() == width * height * 4);
       // make a new texture handle
       GLuint handle = 0;
       glGenTextures(1, &handle);
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, handle);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-      glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)image);
+      unsigned num_comps = mipmap_generator::get_num_comps(in_format);
+      if (num_comps && size >= width * height * num_comps) {
+        dynarray<uint8_t> levels(mipmap_generator::get_size(in_format, width, height));
+        memcpy(&levels[0], image, width * height * num_comps);
+        mipmap_generator gen;
+        gen.set_srgb(srgb);
+        gen.generate(&levels[0], in_format, width, height);
 
-      glGenerateMipmap(GL_TEXTURE_2D);
+        const uint8_t *src = &levels[0];
+        unsigned num_levels = mipmap_generator::get_num_levels(width, height);
+        for (unsigned level = 0, w = width, h = height; level != num_levels; ++level) {
+          glTexImage2D(GL_TEXTURE_2D, level, gl_kind, w, h, 0, in_format, GL_UNSIGNED_BYTE, (void*)src);
+          src += w * h * num_comps;
+          w = mipmap_generator::get_level_size(w);
+          h = mipmap_generator::get_level_size(h);
+        }
+      } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+      }
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       return handle;
@@ -209,64 +509,49 @@ namespace octet { namespace resources {
       return id;
     }
 
-    /// Get the system atom dictionary. Atoms are unique names with an integer representation.
-    static dictionary<atom_t> *get_atom_dict() {
-      static dictionary<atom_t> *dict;
-      if (!dict) dict = new dictionary<atom_t>();
-      return dict;
+    /// Get the system atom table. Atoms are unique names with an integer representation.
+    static atom_table &get_atom_table() {
+      static atom_table instance;
+      return instance;
     }
 
     /// Get a unique int for a string (atom). Atoms are unique names with an integer representation.
     /// These values are much cheaper to work with than strings.
+    ///
+    /// This may be called from any thread.
     static atom_t get_atom(const char *name) {
       // the null name is 0
       if (name == 0 || name[0] == 0) {
         return atom_;
       }
 
-      dictionary<atom_t> *dict = get_atom_dict();
+      unsigned hash = 2166136261u;
+      const char *p = name;
+      for (; *p; ++p) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+      }
+      return get_atom_table().get_atom(name, (unsigned)(p - name), hash);
+    }
 
-      static int num_atoms = 0;
-      if (num_atoms == 0) {
-        for (++num_atoms; predefined_atom(num_atoms); num_atoms++) {
-          (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
-        }
+    /// Get an atom using a hash computed at compile time with OCTET_ATOM_HASH(name).
+    static atom_t get_atom(const char *name, unsigned hash) {
+      if (name == 0 || name[0] == 0) {
+        return atom_;
       }
-      if (dict->contains(name)) {
-        //log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
-      } else {
-        //log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
+      return get_atom_table().get_atom(name, (unsigned)strlen(name), hash);
+    }
+
+    /// Get an atom when both the length and the hash of the name are known, see OCTET_GET_ATOM(name).
+    static atom_t get_atom(const char *name, unsigned length, unsigned hash) {
+      if (name == 0 || length == 0) {
+        return atom_;
       }
+      return get_atom_table().get_atom(name, length, hash);
     }
 
     /// Get the text of a predefined atom (atom_*)
     static const char *predefined_atom(unsigned i) {
-      static const char *atom_names[] = {
-        "",
-
-        #define OCTET_ATOM(X) #X,
-        #include "atoms.h"
-        #undef OCTET_ATOM
-        NULL
-      };
-      static const char *class_names[] = {
-        "",
-
-        #define OCTET_CLASS(N, X) #X,
-        //#pragma message("app_utils.h 2")
-        #include "classes.h"
-        #undef OCTET_CLASS
-        NULL
-      };
-      if (i < sizeof(atom_names)/sizeof(atom_names[0])-1) {
-        return atom_names[i];
-      } else if (i-(unsigned)atom_class_base < sizeof(class_names)/sizeof(class_names[0])-1) {
-        return class_names[i-(unsigned)atom_class_base];
-      } else {
-        return NULL;
-      }
+      return atom_table::get_predefined_name(i);
     }
 
     /// Get the name of an atom, either predefined or user defined.
@@ -274,15 +559,8 @@ namespace octet { namespace resources {
       const char *name = predefined_atom((unsigned)atom);
       if (name) return name;
 
-      // slow!
-      dictionary<atom_t> *dict = get_atom_dict();
-      unsigned num_indices = dict->get_num_indices();
-      for (unsigned i = 0; i != num_indices; ++i) {
-        if (dict->get_value(i) == atom) {
-          return dict->get_key(i);
-        }
-      }
-      return "???";
+      name = get_atom_table().get_name(atom);
+      return name ? name : "???";
     }
   };
 } }
@@ -5,7 +5,23 @@
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
 // map a file to memory
+//
+// the operating system pages the file in as we read it, so there is no copy
+// into a buffer and no memory is used for parts of the file we do not touch.
+//
+// a file_map can also hold a buffer (for files that have been decompressed)
+// or a range of another file_map (for files stored in a zip file), so that
+// loaders can parse from a file_map wherever the data came from.
+//
 
+/// Read only view of the contents of a file.
+///
+/// Example:
+///
+///     ref<file_map> map = new file_map("assets/big.jpg");
+///     if (map->get_data()) {
+///       decode(map->get_data(), map->get_size());
+///     }
 class file_map {
   #ifdef WIN32
     HANDLE file_handle;
@@ -16,11 +32,44 @@ class file_map {
   uint64_t size;
   const uint8_t *data;
   const char *error;
-public:
-  file_map(const char *file_name) {
+  bool mapped;
+
+  // contents for buffer maps
+  octet::dynarray<uint8_t> buffer;
+
+  // the map we are a part of, for range maps.
+  file_map *parent;
+
+  // file maps are shared by loader threads.
+  octet::ref_count_atomic ref_count;
+
+  void init() {
+    #ifdef WIN32
+      file_handle = INVALID_HANDLE_VALUE;
+      mapping_handle = NULL;
+    #else
+      file_handle = -1;
+    #endif
     error = 0;
     data = 0;
     size = 0;
+    mapped = false;
+    parent = 0;
+  }
+
+  // file maps own operating system handles, so no copying
+  file_map(const file_map &rhs);
+  file_map &operator=(const file_map &rhs);
+public:
+  /// How will we read the file? This tells the operating system how to page it in.
+  enum access_t {
+    access_sequential,  // read from start to finish once, eg. an image
+    access_random,      // jump around, eg. a zip file
+  };
+
+  /// Map a file into memory.
+  file_map(const char *file_name, access_t access = access_sequential) {
+    init();
 
     if (file_name == NULL) {
       error = "no file name";
@@ -28,11 +77,9 @@ public:
     }
 
     #ifdef WIN32
-      mapping_handle = INVALID_HANDLE_VALUE;
-
       file_handle = CreateFileA(
         file_name, GENERIC_READ, FILE_SHARE_READ, 0,
-        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+        OPEN_EXISTING, access == access_sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, 0
       );
 
       if (file_handle == INVALID_HANDLE_VALUE) {
@@ -42,39 +89,117 @@ public:
 
       DWORD sizehi = 0, sizelo = GetFileSize(file_handle, &sizehi);
       size = ((uint64_t)sizehi << 32) | sizelo;
+
+      // empty files can not be mapped.
+      if (size == 0) return;
+
       mapping_handle = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
 
-      if (mapping_handle == INVALID_HANDLE_VALUE) {
+      if (mapping_handle == NULL) {
         error = "could not map file";
+        size = 0;
         return;
       }
 
       data = (const uint8_t *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+      if (!data) {
+        error = "could not map file";
+        size = 0;
+        return;
+      }
+      mapped = true;
     #else
-      //file_handle = open(file_name, O_RDONLY);
-      //mmap
+      file_handle = open(file_name, O_RDONLY);
+      if (file_handle < 0) {
+        error = "could not open file";
+        return;
+      }
+
+      struct stat st;
+      if (fstat(file_handle, &st) != 0) {
+        error = "could not get file size";
+        return;
+      }
+      size = (uint64_t)st.st_size;
+
+      // empty files can not be mapped.
+      if (size == 0) return;
+
+      void *addr = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE, file_handle, 0);
+      if (addr == MAP_FAILED) {
+        error = "could not map file";
+        size = 0;
+        return;
+      }
+      data = (const uint8_t *)addr;
+      mapped = true;
+
+      // start reading the file now; we will need all of it.
+      madvise(addr, (size_t)size, access == access_sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+      if (access == access_sequential) {
+        madvise(addr, (size_t)size, MADV_WILLNEED);
+      }
     #endif
   }
 
+  /// Make a file map from a buffer, for example a decompressed file. The buffer is emptied.
+  file_map(octet::dynarray<uint8_t> &new_buffer) {
+    init();
+    buffer.swap(new_buffer);
+    data = buffer.data();
+    size = buffer.size();
+  }
+
+  /// Make a file map of part of another file map, for example a file stored in a zip file.
+  file_map(file_map *new_parent, uint64_t offset, uint64_t new_size) {
+    init();
+    if (!new_parent || offset + new_size > new_parent->get_size()) {
+      error = "range outside file";
+      return;
+    }
+    parent = new_parent;
+    parent->add_ref();
+    data = parent->get_data() + offset;
+    size = new_size;
+  }
+
+  /// Unmap the file.
   ~file_map() {
     #ifdef WIN32
-      UnmapViewOfFile(data);
-      CloseHandle(file_handle);
-      CloseHandle(mapping_handle);
+      if (mapped) UnmapViewOfFile(data);
+      if (mapping_handle != NULL) CloseHandle(mapping_handle);
+      if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
     #else
+      if (mapped) munmap((void*)data, (size_t)size);
+      if (file_handle >= 0) close(file_handle);
     #endif
+    if (parent) parent->release();
   }
 
+  /// allow ref<file_map>
+  void add_ref() {
+    ref_count.add();
+  }
+
+  /// allow ref<file_map>
+  void release() {
+    if (ref_count.remove()) {
+      delete this;
+    }
+  }
+
+  /// Description of what went wrong, or null.
   const char *get_error() const {
     return error;
   }
 
+  /// The contents of the file. Null if the file is empty or could not be opened.
   const uint8_t *get_data() const {
     return data;
   }
 
+  /// Number of bytes in the file.
   uint64_t get_size() const {
     return size;
   }
 };
-
@@ -4,52 +4,522 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// work in progress
+// work stealing job scheduler
+//
+// a fixed pool of worker threads, each with its own Chase-Lev deque.
+// A worker pushes and pops jobs at the bottom of its deque with no locks,
+// idle workers steal from the top of other workers' deques.
+//
+// jobs can wait for other jobs (dependencies) and can be counted (job_counter)
+// so that a thread can wait for a batch of work to finish, running jobs while it waits.
+//
+// jobs that need the GL context go on the main thread queue, which is run once per frame.
+//
+// example:
+//
+//   job_counter counter;
+//   job_scheduler &sch = job_scheduler::get();
+//   for (unsigned i = 0; i != num_images; ++i) {
+//     sch.schedule(make_job([=]() { decode(i); }), &counter);
+//   }
+//   sch.wait(counter);
+//
 
 namespace octet { namespace resources {
-  class job : public resource {
-    ref<job> next;
+  /// Counts unfinished jobs so that you can wait for a batch of them.
+  class job_counter {
+    std::atomic<int> count;
+
+    // counters live on the stack of the waiting thread, do not copy them.
+    job_counter(const job_counter &rhs);
+    job_counter &operator=(const job_counter &rhs);
+  public:
+    job_counter() {
+      count.store(0, std::memory_order_relaxed);
+    }
+
+    /// Count some more jobs.
+    void add(int n = 1) {
+      count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /// A job has finished.
+    void remove() {
+      count.fetch_sub(1, std::memory_order_release);
+    }
+
+    /// Return true if all the jobs have finished.
+    bool is_done() const {
+      return count.load(std::memory_order_acquire) == 0;
+    }
+  };
 
+  /// A unit of work for the job scheduler. Override kernel() or use make_job().
+  ///
+  /// Jobs are reference counted; the scheduler keeps a reference until the job has finished.
+  class job : public resource {
+  public:
     enum state_t {
-      state_waiting,
+      state_waiting,   // not scheduled or waiting for dependencies
+      state_queued,    // ready to run
       state_running,
+      state_finished,
     };
 
-    state_t state;
+  private:
+    friend class job_scheduler;
+
+    std::atomic<int> state;
+
+    // one for schedule() plus one for each unfinished dependency.
+    std::atomic<int> num_pending;
+
+    // jobs waiting for this one to finish, guarded by lock.
+    dynarray<job*> successors;
+    std::mutex lock;
+
+    job_counter *counter;
+    bool main_thread;
+
+  public:
+    job() {
+      state.store(state_waiting, std::memory_order_relaxed);
+      num_pending.store(1, std::memory_order_relaxed);
+      counter = 0;
+      main_thread = false;
+
+      // the scheduler's threads add and remove references.
+      set_thread_shared();
+    }
+
+    virtual ~job() {
+    }
+
+    /// Do the work.
+    virtual void kernel() = 0;
+
+    /// Do not run this job until another job has finished.
+    ///
+    /// Call this before scheduling the job.
+    void add_dependency(job *other) {
+      std::lock_guard<std::mutex> guard(other->lock);
+      if (other->get_state() != state_finished) {
+        add_ref();
+        num_pending.fetch_add(1, std::memory_order_relaxed);
+        other->successors.push_back(this);
+      }
+    }
+
+    /// Run this job on the main thread, for jobs that need the GL context.
+    ///
+    /// Main thread jobs run once per frame, after the app has drawn the world.
+    void set_main_thread(bool value = true) {
+      main_thread = value;
+    }
+
+    /// Return true if this job must run on the main thread.
+    bool is_main_thread() const {
+      return main_thread;
+    }
+
+    /// Where is this job in its life?
+    state_t get_state() const {
+      return (state_t)state.load(std::memory_order_acquire);
+    }
+
+    /// Return true if the job has run.
+    bool is_finished() const {
+      return get_state() == state_finished;
+    }
+  };
+
+  /// A job that calls a function object, usually a lambda. See make_job().
+  template <class fn_t> class function_job : public job {
+    fn_t fn;
+  public:
+    function_job(const fn_t &fn) : fn(fn) {
+    }
+
+    void kernel() {
+      fn();
+    }
+  };
+
+  /// Make a job from a function object.
+  template <class fn_t> job *make_job(const fn_t &fn) {
+    return new function_job<fn_t>(fn);
+  }
+
+  /// Fixed size thread pool with a work stealing deque for every thread.
+  ///
+  /// The thread that creates the scheduler (the main thread) owns deque zero
+  /// and runs jobs when it waits; the workers own the others.
+  /// Other threads, such as I/O threads, schedule through a locked queue.
+  class job_scheduler {
+    // Chase-Lev work stealing deque (Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models").
+    // The owner pushes and pops at the bottom, thieves take from the top.
+    class work_deque {
+      enum { capacity = 4096, mask = capacity - 1 };
+      std::atomic<int64_t> top;
+      std::atomic<int64_t> bottom;
+      std::atomic<job*> buffer[capacity];
 
-    class scheduler {
-      job *waiting;
-      job *running;
     public:
-      scheduler() {
-        waiting = 0;
-        running = 0;
+      work_deque() {
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+      }
+
+      // owner only. Return false if the deque is full.
+      bool push(job *jb) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= capacity) return false;
+        buffer[b & mask].store(jb, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
       }
 
-      void add_to_waiting(job *jb) {
-        jb->next = waiting;
-        waiting = this;
+      // owner only: take the most recent job.
+      job *pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        job *jb = 0;
+        if (t <= b) {
+          jb = buffer[b & mask].load(std::memory_order_relaxed);
+          if (t == b) {
+            // last item: race the thieves for it.
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+              jb = 0;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+          }
+        } else {
+          bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return jb;
       }
+
+      // any thread: take the oldest job.
+      job *steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t < b) {
+          job *jb = buffer[t & mask].load(std::memory_order_acquire);
+          if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return jb;
+          }
+        }
+        return 0;
+      }
+    };
+
+    // which deque does this thread own?
+    struct thread_state_t {
+      job_scheduler *scheduler;
+      unsigned index;
     };
 
-    scheduler *get_scheduler() {
-      static scheduler sch;
-      return &sch;
+    static thread_state_t &thread_state() {
+      static OCTET_THREAD_LOCAL thread_state_t instance;
+      return instance;
+    }
+
+    static job_scheduler *&instance_ptr() {
+      static job_scheduler *instance;
+      return instance;
+    }
+
+    unsigned num_deques;
+    work_deque *deques;
+    dynarray<std::thread*> threads;
+
+    // jobs from threads without a deque, or from full deques.
+    dynarray<job*> global_queue;
+    std::mutex global_mutex;
+    std::atomic<int> global_size;
+
+    // jobs that must run on the main thread.
+    dynarray<job*> main_queue;
+    std::mutex main_mutex;
+
+    // sleeping workers
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<int> num_ready;
+    std::atomic<int> num_sleeping;
+    std::atomic<bool> quit;
+
+    // schedulers own threads, so no copying
+    job_scheduler(const job_scheduler &rhs);
+    job_scheduler &operator=(const job_scheduler &rhs);
+
+    // return the deque index of this thread or -1 if it does not have one.
+    int get_index() const {
+      const thread_state_t &ts = thread_state();
+      return ts.scheduler == this ? (int)ts.index : -1;
+    }
+
+    // a job is ready to run: put it somewhere a thread will find it.
+    void enqueue(job *jb) {
+      jb->state.store(job::state_queued, std::memory_order_release);
+
+      if (jb->main_thread) {
+        std::lock_guard<std::mutex> guard(main_mutex);
+        main_queue.push_back(jb);
+        return;
+      }
+
+      num_ready.fetch_add(1, std::memory_order_seq_cst);
+      int index = get_index();
+      if (index < 0 || !deques[index].push(jb)) {
+        std::lock_guard<std::mutex> guard(global_mutex);
+        global_queue.push_back(jb);
+        global_size.fetch_add(1, std::memory_order_release);
+      }
+
+      if (num_sleeping.load(std::memory_order_seq_cst) != 0) {
+        std::lock_guard<std::mutex> guard(sleep_mutex);
+        wake.notify_one();
+      }
+    }
+
+    // find a job: our own deque first, then the other deques, then the global queue.
+    job *find_job(int index) {
+      job *jb = 0;
+      if (index >= 0) {
+        jb = deques[index].pop();
+      }
+
+      for (unsigned i = 1; !jb && i <= num_deques; ++i) {
+        unsigned victim = (unsigned)(index + i) % num_deques;
+        if ((int)victim != index) jb = deques[victim].steal();
+      }
+
+      if (!jb && global_size.load(std::memory_order_acquire) != 0) {
+        std::lock_guard<std::mutex> guard(global_mutex);
+        if (!global_queue.empty()) {
+          jb = global_queue.back();
+          global_queue.pop_back();
+          global_size.fetch_sub(1, std::memory_order_relaxed);
+        }
+      }
+
+      if (jb) num_ready.fetch_sub(1, std::memory_order_relaxed);
+      return jb;
     }
+
+    // run a job and release the jobs that were waiting for it.
+    void execute(job *jb) {
+      jb->state.store(job::state_running, std::memory_order_relaxed);
+      jb->kernel();
+
+      dynarray<job*> successors;
+      {
+        std::lock_guard<std::mutex> guard(jb->lock);
+        jb->state.store(job::state_finished, std::memory_order_release);
+        successors.swap(jb->successors);
+      }
+
+      for (unsigned i = 0; i != successors.size(); ++i) {
+        job *succ = successors[i];
+        if (succ->num_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          enqueue(succ);
+        }
+        succ->release();
+      }
+
+      if (jb->counter) jb->counter->remove();
+      jb->release();
+    }
+
+    void worker_main(unsigned index) {
+      thread_state().scheduler = this;
+      thread_state().index = index;
+
+      while (!quit.load(std::memory_order_relaxed)) {
+        job *jb = find_job((int)index);
+        if (jb) {
+          execute(jb);
+          continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleep_mutex);
+        num_sleeping.fetch_add(1, std::memory_order_seq_cst);
+        while (!quit.load(std::memory_order_relaxed) && num_ready.load(std::memory_order_seq_cst) <= 0) {
+          wake.wait(guard);
+        }
+        num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+      }
+      pool_heap::thread_exit();
+    }
+
   public:
-    job() {
-      scheduler *sch = get_scheduler();
-      sch->add_to_waiting(this);
+    /// Make a scheduler with some worker threads. The calling thread becomes the main thread.
+    ///
+    /// Use create() and get() rather than making your own.
+    job_scheduler(unsigned num_workers) {
+      num_deques = num_workers + 1;
+      deques = new work_deque[num_deques];
+      global_size.store(0, std::memory_order_relaxed);
+      num_ready.store(0, std::memory_order_relaxed);
+      num_sleeping.store(0, std::memory_order_relaxed);
+      quit.store(false, std::memory_order_relaxed);
+
+      thread_state().scheduler = this;
+      thread_state().index = 0;
+
+      for (unsigned i = 1; i != num_deques; ++i) {
+        threads.push_back(new std::thread(&job_scheduler::worker_main, this, i));
+      }
     }
 
-    virtual ~job() {
+    /// Stop the workers. Jobs that have not run are abandoned.
+    ~job_scheduler() {
+      {
+        std::lock_guard<std::mutex> guard(sleep_mutex);
+        quit.store(true, std::memory_order_relaxed);
+        wake.notify_all();
+      }
+      for (unsigned i = 0; i != threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+      }
+      delete [] deques;
+      if (instance_ptr() == this) instance_ptr() = 0;
+      if (thread_state().scheduler == this) thread_state().scheduler = 0;
     }
 
-    virtual void kernel() = 0;
-    virtual bool is_ready() = 0;
+    /// Make the scheduler used by the framework, by default with one worker for each spare core.
+    ///
+    /// The calling thread becomes the main thread, so the app calls this from the main thread
+    /// when it starts. Programs without an app call it at the start of main().
+    static job_scheduler &create(unsigned num_workers = default_num_workers()) {
+      assert(!instance_ptr() && "job_scheduler::create called twice");
+      static job_scheduler instance(num_workers);
+      instance_ptr() = &instance;
+      return instance;
+    }
+
+    /// The scheduler used by the framework. create() must have been called first.
+    static job_scheduler &get() {
+      assert(instance_ptr() && "call job_scheduler::create from the main thread first");
+      return *instance_ptr();
+    }
+
+    /// One worker for each spare core.
+    static unsigned default_num_workers() {
+      unsigned num_cores = std::thread::hardware_concurrency();
+      return num_cores > 2 ? num_cores - 1 : 1;
+    }
 
-    state_t get_state() {
-      return state;
+    /// Return the scheduler if create() has been called, otherwise null.
+    static job_scheduler *get_if_created() {
+      return instance_ptr();
+    }
+
+    /// Number of worker threads, not including the main thread.
+    unsigned get_num_workers() const {
+      return num_deques - 1;
+    }
+
+    /// Run a job when its dependencies have finished.
+    ///
+    /// If counter is given, it counts the job until the job has finished.
+    void schedule(job *jb, job_counter *counter = 0) {
+      jb->add_ref();
+      jb->counter = counter;
+      if (counter) counter->add();
+      if (jb->num_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        enqueue(jb);
+      }
+    }
+
+    /// Run jobs on this thread until all the counted jobs have finished.
+    void wait(job_counter &counter) {
+      int index = get_index();
+      while (!counter.is_done()) {
+        job *jb = find_job(index);
+        if (jb) {
+          execute(jb);
+        } else {
+          // the jobs we are waiting for may be waiting for main thread jobs.
+          if (index == 0) run_main_thread_jobs();
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /// Run jobs on this thread until this job has finished.
+    void wait(job *jb) {
+      int index = get_index();
+      while (!jb->is_finished()) {
+        job *other = find_job(index);
+        if (other) {
+          execute(other);
+        } else {
+          if (index == 0) run_main_thread_jobs();
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /// Run the jobs queued for the main thread. The app calls this once per frame.
+    void run_main_thread_jobs() {
+      dynarray<job*> jobs;
+      {
+        std::lock_guard<std::mutex> guard(main_mutex);
+        jobs.swap(main_queue);
+      }
+      for (unsigned i = 0; i != jobs.size(); ++i) {
+        execute(jobs[i]);
+      }
+    }
+
+    /// Call fn(i0, i1) for ranges of indices covering [begin, end) on all threads,
+    /// returning when all the ranges are done.
+    ///
+    /// grain is the number of indices in each range.
+    ///
+    /// Example:
+    ///
+    ///     sch.parallel_for(0, num_vertices, 1024, [&](unsigned i0, unsigned i1) {
+    ///       for (unsigned i = i0; i != i1; ++i) transform(vertices[i]);
+    ///     });
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned grain, const fn_t &fn) {
+      if (grain == 0) grain = 1;
+      if (end <= begin) return;
+
+      // small loops are not worth a job.
+      if (end - begin <= grain || num_deques == 1) {
+        fn(begin, end);
+        return;
+      }
+
+      job_counter counter;
+      for (unsigned i0 = begin + grain; i0 < end; i0 += grain) {
+        unsigned i1 = end - i0 < grain ? end : i0 + grain;
+        schedule(make_job([=, &fn]() { fn(i0, i1); }), &counter);
+      }
+
+      // do the first range ourselves, then help with the rest.
+      fn(begin, begin + grain);
+      wait(counter);
     }
   };
+
+  /// Make the framework's scheduler; app_common calls this on the main thread.
+  inline void create_job_scheduler() {
+    if (!job_scheduler::get_if_created()) job_scheduler::create();
+  }
+
+  /// Run the main thread jobs of the framework's scheduler, if there is one.
+  inline void run_main_thread_jobs() {
+    job_scheduler *sch = job_scheduler::get_if_created();
+    if (sch) sch->run_main_thread_jobs();
+  }
 } }
@@ -19,13 +19,54 @@ namespace octet { namespace resources {
   /// Base class for resources; provides aligned allocation and reference counting.
   class resource {
     // how many lives do we have?
-    int ref_count;
+    std::atomic<int> ref_count;
+
+    // true if add_ref and release may be called from more than one thread.
+    bool thread_shared;
+
+    // true if we are waiting in the release queue.
+    bool release_queued;
+
+    // called by release_queue::drain(); the resource may have been given a new life since.
+    static void destroy_queued(void *obj) {
+      resource *res = (resource*)obj;
+      res->release_queued = false;
+      if (res->ref_count.load(std::memory_order_acquire) == 0) {
+        delete res;
+      }
+    }
+
+    // nobody is using this resource any more: delete it now or at the end of the frame.
+    void destroy() {
+      if (release_queue::is_deferred()) {
+        if (!release_queued) {
+          release_queued = true;
+          release_queue::push(this, destroy_queued);
+        }
+      } else {
+        delete this;
+      }
+    }
 
   public:
     /// Make a new resource with no lives.
     /// Adding it to a ref<> will give it a life.
     resource() {
-      ref_count = 0;
+      ref_count.store(0, std::memory_order_relaxed);
+      thread_shared = false;
+      release_queued = false;
+    }
+
+    /// A copy of a resource is a new object with no lives.
+    resource(const resource &) {
+      ref_count.store(0, std::memory_order_relaxed);
+      thread_shared = false;
+      release_queued = false;
+    }
+
+    /// Assigning the contents of another resource does not change our lives.
+    resource &operator=(const resource &) {
+      return *this;
     }
 
     /// factory for making new resources of various kinds
@@ -55,24 +96,57 @@ namespace octet { namespace resources {
 
     /// Give this resource an extra life; see the %ref class.
     void add_ref() {
-      ref_count++;
+      if (thread_shared) {
+        ref_count.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        // plain load and store: no locked instruction.
+        ref_count.store(ref_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
     }
 
     /// Remove a life from this resource and delete it if it is dead; see the %ref class.
+    ///
+    /// If the thread has deferred release turned on (the main thread does),
+    /// the resource is deleted at the end of the frame instead.
     void release() {
-      if (--ref_count == 0) {
-        delete this;
+      int new_count;
+      if (thread_shared) {
+        new_count = ref_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+      } else {
+        new_count = ref_count.load(std::memory_order_relaxed) - 1;
+        ref_count.store(new_count, std::memory_order_relaxed);
+      }
+      if (new_count == 0) {
+        destroy();
       }
     }
 
-    /// use the allocator to allocate this resource and its child classes
+    /// Number of lives this resource has.
+    int get_ref_count() const {
+      return ref_count.load(std::memory_order_relaxed);
+    }
+
+    /// Opt in to atomic reference counting.
+    ///
+    /// Call this before sharing the resource with another thread, for example
+    /// when an asset is handed back from a loader thread.
+    void set_thread_shared(bool value = true) {
+      thread_shared = value;
+    }
+
+    /// Return true if this resource uses atomic reference counting.
+    bool is_thread_shared() const {
+      return thread_shared;
+    }
+
+    /// use the pooled resource allocator to allocate this resource and its child classes
     void *operator new (size_t size) {
-      return allocator::malloc(size);
+      return resource_allocator::malloc(size);
     }
 
-    /// use the allocator to free this resource and its child classes
+    /// use the pooled resource allocator to free this resource and its child classes
     void operator delete (void *ptr, size_t size) {
-      return allocator::free(ptr, size);
+      return resource_allocator::free(ptr, size);
     }
 
     // casting and aggregation: make a get_* function for each class
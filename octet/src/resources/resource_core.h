@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// the parts of the resource system that the loaders use:
+// atoms, the resource base class and the job scheduler.
+//
+
+#ifndef OCTET_RESOURCE_CORE_INCLUDED
+#define OCTET_RESOURCE_CORE_INCLUDED
+  namespace octet {
+    namespace scene { class visual_scene; }
+    #define OCTET_CLASS(N, X) namespace N { class X; }
+    #include "classes.h"
+    #undef OCTET_CLASS
+
+    namespace resources { class visitor; }
+  }
+
+  namespace octet {
+    // this enum is used to avoid using strings in code and files
+    enum atom_t {
+      atom_, // null atom
+
+      #define OCTET_ATOM(X) atom_##X,
+      #include "atoms.h"
+      #undef OCTET_ATOM
+
+      // put classes at a fixed offset to prevent older files becomming obsolete
+      atom_class_base = 0x10000,
+      #define OCTET_CLASS(C, X) atom_##X,
+      #include "classes.h"
+      #undef OCTET_CLASS
+    };
+  }
+
+  #include "../resources/resource.h"
+  #include "../resources/job.h"
+
+#endif
@@ -92,11 +92,8 @@ namespace octet { namespace resources {
       }
       if (name[0] == '#') name++;
 
-      if (!dict.contains(name)) {
-        return NULL;
-      } else {
-        return dict[name];
-      }
+      int index = dict.get_index(name);
+      return index < 0 ? NULL : (resource*)dict.get_value(index);
     }
 
     /// As this dict represents a game world, what is the active scene?
@@ -22,7 +22,7 @@ GLuint octet::resources::resource_dict::get_texture_handle_internal(unsigned gl_
     uint16_t height = 0;
     const unsigned char *src = &buffer[0];
     const unsigned char *src_max = src + buffer.size();
-    if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+    if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF8", 4)) {
       gif_decoder dec;
       dec.get_image(image, format, width, height, src, src_max);
     } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// on-disk cache of compressed textures
+//
+// Compressing a texture takes far longer than loading it, so the results are kept
+// in a directory as KTX2 files, one per texture, named after a hash of the source file.
+// A texture in the cache is loaded with a copy: the source file is not decoded.
+//
+
+namespace octet { namespace resources {
+  /// Cache of compressed textures, keyed by a hash of the source file.
+  ///
+  /// The cache is off until it is given a directory, which must exist.
+  ///
+  /// Example:
+  ///
+  ///     texture_cache::get().set_dir("cache/");
+  ///     image *img = new image("assets/big.jpg");
+  ///     img->set_compression(image::COMPRESSED_RGB_S3TC_DXT1_EXT);
+  class texture_cache {
+    // the directory is set once at startup, then the cache is used from the loader threads.
+    string dir;
+
+  public:
+    /// Name of the cache file for a key.
+    void get_file_name(string &name, uint64_t key) const {
+      name.format("%s%08x%08x.ktx2", dir.c_str(), (unsigned)(key >> 32), (unsigned)key);
+    }
+
+    /// The cache used by images.
+    static texture_cache &get() {
+      static texture_cache instance;
+      return instance;
+    }
+
+    /// Directory for the cache files, ending in a slash, or an empty string to turn the cache off.
+    void set_dir(const char *new_dir) {
+      dir = new_dir;
+    }
+
+    /// Return true if the cache is on.
+    bool is_enabled() const {
+      return !dir.empty();
+    }
+
+    /// Key for a source file and the way it is to be loaded.
+    ///
+    /// params should include anything that changes the texture, such as the format and encoder version.
+    static uint64_t make_key(const uint8_t *src, size_t size, const uint32_t *params, unsigned num_params) {
+      return hash_bytes64(src, size, hash_bytes64(params, num_params * sizeof(uint32_t)));
+    }
+
+    /// Map a cached texture into memory. Returns null if there is none.
+    file_map *load(uint64_t key) const {
+      if (dir.empty()) return 0;
+
+      string name;
+      get_file_name(name, key);
+      file_map *map = new file_map(name.c_str());
+      if (!map->get_data()) {
+        delete map;
+        return 0;
+      }
+      return map;
+    }
+
+    /// Store a texture in the cache.
+    ///
+    /// The file is written under a temporary name and then renamed, so other
+    /// programs never see half a file.
+    void save(uint64_t key, const uint8_t *data, size_t size) const {
+      if (dir.empty()) return;
+
+      string name, tmp_name;
+      get_file_name(name, key);
+
+      // loader threads may save the same texture at once, so each save has its own temporary file.
+      static std::atomic<unsigned> num_saves;
+      unsigned thread_hash = (unsigned)std::hash<std::thread::id>()(std::this_thread::get_id());
+      tmp_name.format("%s.%08x.%u.tmp", name.c_str(), thread_hash, num_saves.fetch_add(1, std::memory_order_relaxed));
+      FILE *file = fopen(tmp_name.c_str(), "wb");
+      if (!file) return;
+
+      bool ok = fwrite(data, 1, size, file) == size;
+      ok = fclose(file) == 0 && ok;
+
+      // rename fails on windows if another thread got there first.
+      if (!ok || rename(tmp_name.c_str(), name.c_str()) != 0) {
+        remove(tmp_name.c_str());
+      }
+    }
+  };
+} }
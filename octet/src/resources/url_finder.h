@@ -4,72 +4,80 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// visitor for finding objects by name in the octet graph
+// visitor for finding the files used by an octet graph
 //
-// work in progress
 
 namespace octet { namespace resources {
-  /// Work in progress: Visitor to find objects by name.
+  /// Visitor to find the urls of the files used by a graph of resources.
+  ///
+  /// Urls are returned once each, in the order the resources are visited,
+  /// which is the order in which they were made and loaded.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<string> urls;
+  ///     url_finder finder(urls);
+  ///     ref<resource> root = app_scene;
+  ///     finder.visit(root, atom_);
   class url_finder : public visitor {
-    dynarray<string> &url;
-    int depth;
-    int max_depth;
+    dynarray<string> &urls;
+    dictionary<int> found;
+    hash_map<void *, int> visited;
+
+    void add_url(const char *url) {
+      if (found.get_index(url) < 0) {
+        found[url] = 1;
+        urls.push_back(string(url));
+      }
+    }
   public:
-    url_finder(int depth_, int max_depth_, dynarray<string> &url_, dynarray<string> &response_) : url(url_), response(response_) {
-      depth = depth_;
-      max_depth = max_depth_;
-      response.resize(0);
+    url_finder(dynarray<string> &urls_) : urls(urls_) {
     }
 
-    bool begin_ref(void *ref, const char *sid, atom_t type) {
-      if (depth == max_depth) {
-        return false;
-      } else if (url[depth] == sid) {
-        depth++;
-        return true;
-      } else {
-        return false;
-      }
+    bool begin_ref(void *ref, const char *, atom_t) {
+      // visit every resource once, even if there are cycles.
+      if (!ref) return false;
+      int &seen = visited[ref];
+      if (seen) return false;
+      seen = 1;
+      return true;
     }
 
-    bool begin_ref(void *ref, atom_t sid, atom_t type) {
-      return begin_ref(ref, app_utils::get_atom_name(sid), type);
+    bool begin_ref(void *ref, atom_t, atom_t type) {
+      return begin_ref(ref, "", type);
     }
 
-    bool begin_ref(void *ref, int index, atom_t type) {
-      if (depth == max_depth) {
-        return false;
-      } else if (atoi(url[depth]) == index) {
-        depth++;
-        return true;
-      } else {
-        return false;
-      }
+    bool begin_ref(void *ref, int, atom_t type) {
+      return begin_ref(ref, "", type);
     }
 
     void end_ref() {
-      depth--;
     }
 
-    bool begin_refs(atom_t sid, int &size, bool is_dict) {
-      if (depth == max_depth) {
-        return false;
-      } else if (url[depth] == app_utils::get_atom_name(sid)) {
-        depth++;
-        return true;
-      } else {
-        return false;
-      }
+    bool begin_refs(atom_t, int &, bool) {
+      return true;
+    }
+
+    void end_refs(bool) {
     }
 
-    void end_refs(bool is_dict) {
-      depth--;
+    void visit_bin(void *, size_t, atom_t, atom_t) {
     }
 
-    void visit_bin(void *value, size_t size, atom_t sid, atom_t type) {
-      if (depth == max_depth) {
+    void visit_string(string &value, atom_t sid) {
+      if (sid != atom_url || value.empty()) return;
+
+      if (strstr(value.c_str(), "%s")) {
+        // cube maps have one file per face; see image::load()
+        static const char *faces[] = { "left", "right", "top", "bottom", "front", "back" };
+        for (unsigned i = 0; i != 6; ++i) {
+          string face;
+          face.format(value.c_str(), faces[i]);
+          add_url(face.c_str());
+        }
+      } else {
+        add_url(value.c_str());
       }
     }
   };
-}
-
+} }
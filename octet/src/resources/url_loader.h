@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// asynchronous, prioritised file loading
+//
+// a small pool of I/O threads maps files with app_utils::map_url.
+// requests are taken in priority order, visible assets first.
+// when a file has been read, an optional "loaded" function runs on the job scheduler
+// (to decode images, for example) and then the "complete" function runs on the main thread,
+// where it is safe to make GL objects.
+//
+// example:
+//
+//   ref<url_request> req = url_loader::get().request("assets/big.jpg", url_loader::priority_visible,
+//     [](url_request *req) { decode(req->get_data(), req->get_size()); },   // on a worker thread
+//     [](url_request *req) { upload(); }                    // on the main thread
+//   );
+//
+
+namespace octet { namespace resources {
+  /// An asynchronous request for the contents of a URL. See url_loader.
+  class url_request : public resource {
+  public:
+    enum state_t {
+      state_queued,     // waiting for an I/O thread
+      state_loading,    // being read or decoded
+      state_done,       // the complete function has been called
+      state_failed,     // the file could not be read
+      state_cancelled,  // cancel() was called before completion
+    };
+
+    /// Functions called when the request makes progress.
+    typedef std::function<void (url_request *)> callback_t;
+
+  private:
+    friend class url_loader;
+
+    string url;
+    ref<file_map> map;
+    std::atomic<int> state;
+
+    // set when no thread will touch the request's callbacks or data again.
+    std::atomic<bool> finished;
+    int priority;
+    callback_t on_loaded;
+    callback_t on_complete;
+
+  public:
+    url_request(const char *url, int priority) : url(url), priority(priority) {
+      state.store(state_queued, std::memory_order_relaxed);
+      finished.store(false, std::memory_order_relaxed);
+      set_thread_shared();
+    }
+
+    /// The URL we are loading.
+    const char *get_url() const {
+      return url.c_str();
+    }
+
+    /// The contents of the file, from loading until the complete function returns.
+    const uint8_t *get_data() const {
+      return map ? map->get_data() : 0;
+    }
+
+    /// Number of bytes in the file, from loading until the complete function returns.
+    size_t get_size() const {
+      return map ? (size_t)map->get_size() : 0;
+    }
+
+    /// The mapped file, once loaded. Keep a ref to this to use the data after the request has gone.
+    file_map *get_file_map() const {
+      return map;
+    }
+
+    /// How far has the request got?
+    state_t get_state() const {
+      return (state_t)state.load(std::memory_order_acquire);
+    }
+
+    /// Return true if the request will not make any more progress.
+    ///
+    /// A request cancelled while it was being decoded is not finished until the decode has stopped,
+    /// so the data it was decoding into is safe to use only when this is true.
+    bool is_finished() const {
+      return finished.load(std::memory_order_acquire);
+    }
+
+    /// Priority class; see url_loader.
+    int get_priority() const {
+      return priority;
+    }
+
+    /// Stop the request. The complete function will not be called.
+    ///
+    /// A request that is already being read finishes reading, but its data is discarded.
+    void cancel() {
+      int expected = state_queued;
+      if (state.compare_exchange_strong(expected, state_cancelled)) {
+        // no I/O thread has started on it, so nothing else will run.
+        finished.store(true, std::memory_order_release);
+      } else {
+        expected = state_loading;
+        state.compare_exchange_strong(expected, state_cancelled);
+      }
+    }
+  };
+
+  /// Bounded pool of I/O threads serving url_requests in priority order.
+  class url_loader {
+  public:
+    /// Priority classes, most urgent first.
+    enum {
+      priority_visible,     // needed to draw this frame
+      priority_prefetch,    // likely to be needed soon
+      priority_background,  // the rest of the level
+      num_priorities,
+    };
+
+  private:
+    // a queue for each priority class, guarded by mutex.
+    dynarray<url_request*> queues[num_priorities];
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit;
+
+    dynarray<std::thread*> threads;
+    std::atomic<int> num_in_flight;
+
+    // loaders own threads, so no copying
+    url_loader(const url_loader &rhs);
+    url_loader &operator=(const url_loader &rhs);
+
+    // take the most urgent request, or return null if we are quitting.
+    url_request *next_request() {
+      std::unique_lock<std::mutex> guard(mutex);
+      for (;;) {
+        if (quit) return 0;
+        for (unsigned p = 0; p != num_priorities; ++p) {
+          if (!queues[p].empty()) {
+            url_request *req = queues[p][0];
+            queues[p].erase(0);
+            return req;
+          }
+        }
+        wake.wait(guard);
+      }
+    }
+
+    // the last step of a request; runs on the main thread.
+    void complete(url_request *req) {
+      int expected = url_request::state_loading;
+      if (req->get_state() == url_request::state_loading) {
+        if (req->on_complete) req->on_complete(req);
+        req->state.compare_exchange_strong(expected, url_request::state_done);
+      }
+
+      // free the memory now rather than when the last ref goes.
+      req->map = 0;
+      req->on_loaded = nullptr;
+      req->on_complete = nullptr;
+      req->finished.store(true, std::memory_order_release);
+      num_in_flight.fetch_sub(1, std::memory_order_release);
+      req->release();
+    }
+
+    void io_thread_main() {
+      job_scheduler &sch = job_scheduler::get();
+      while (url_request *req = next_request()) {
+        // don't read the file if the request was cancelled while queued.
+        int expected = url_request::state_queued;
+        if (req->state.compare_exchange_strong(expected, url_request::state_loading)) {
+          req->map = app_utils::map_url(req->get_url());
+          if (req->map->get_size() == 0) {
+            expected = url_request::state_loading;
+            req->state.compare_exchange_strong(expected, url_request::state_failed);
+          }
+        }
+
+        // decode on the job scheduler if we need to, then finish on the main thread.
+        // the callbacks may hold refs to main thread objects, so we always finish there.
+        job *finish = make_job([this, req]() { complete(req); });
+        finish->set_main_thread();
+        if (req->on_loaded && req->get_state() == url_request::state_loading) {
+          ref<job> decode = make_job([req]() {
+            if (req->get_state() == url_request::state_loading) req->on_loaded(req);
+          });
+          finish->add_dependency(decode);
+          sch.schedule(finish);
+          sch.schedule(decode);
+        } else {
+          sch.schedule(finish);
+        }
+      }
+      pool_heap::thread_exit();
+    }
+
+  public:
+    /// Make a loader with a number of I/O threads. Use get() rather than making your own.
+    url_loader(unsigned num_threads = 2) {
+      quit = false;
+      num_in_flight.store(0, std::memory_order_relaxed);
+
+      // make sure these exist before the threads use them; the app makes the scheduler.
+      job_scheduler::get();
+      app_utils::prefix();
+
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads.push_back(new std::thread(&url_loader::io_thread_main, this));
+      }
+    }
+
+    /// Stop the I/O threads. Queued requests are abandoned.
+    ~url_loader() {
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        quit = true;
+        wake.notify_all();
+      }
+      for (unsigned i = 0; i != threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+
+    /// The loader used by the framework. Call this first from the main thread.
+    static url_loader &get() {
+      static url_loader instance;
+      return instance;
+    }
+
+    /// Ask for a URL to be loaded.
+    ///
+    /// on_loaded, if given, runs on a worker thread after the file has been read.
+    /// on_complete, if given, runs on the main thread at the end of a frame.
+    /// Neither is called if the request is cancelled or the file can not be read.
+    ///
+    /// The loader lets go of the request when it is complete, so keep the ref to use it after that.
+    ref<url_request> request(const char *url, int priority = priority_background, url_request::callback_t on_loaded = nullptr, url_request::callback_t on_complete = nullptr) {
+      if (priority < 0) priority = 0;
+      if (priority >= num_priorities) priority = num_priorities - 1;
+
+      ref<url_request> req = new url_request(url, priority);
+      req->on_loaded = on_loaded;
+      req->on_complete = on_complete;
+
+      // the loader keeps a reference until the request is complete.
+      req->add_ref();
+      num_in_flight.fetch_add(1, std::memory_order_relaxed);
+
+      std::lock_guard<std::mutex> guard(mutex);
+      queues[priority].push_back(req);
+      wake.notify_one();
+      return req;
+    }
+
+    /// Move a queued request to a different priority class, when the camera moves, for example.
+    void set_priority(url_request *req, int priority) {
+      if (priority < 0) priority = 0;
+      if (priority >= num_priorities) priority = num_priorities - 1;
+
+      std::lock_guard<std::mutex> guard(mutex);
+      dynarray<url_request*> &queue = queues[req->priority];
+      for (unsigned i = 0; i != queue.size(); ++i) {
+        if (queue[i] == req) {
+          queue.erase(i);
+          queues[priority].push_back(req);
+          break;
+        }
+      }
+      req->priority = priority;
+    }
+
+    /// Number of requests that have not yet completed.
+    int get_num_in_flight() const {
+      return num_in_flight.load(std::memory_order_acquire);
+    }
+
+    /// Block the main thread until a request has finished, running jobs while we wait.
+    void wait(url_request *req) {
+      job_scheduler &sch = job_scheduler::get();
+      while (!req->is_finished()) {
+        sch.run_main_thread_jobs();
+        std::this_thread::yield();
+      }
+    }
+  };
+} }
@@ -4,23 +4,41 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
+// the zip file is mapped into memory and never changes after it is opened,
+// so any number of threads can read files from it at the same time.
+//
+// the directory is an array sorted by the hash of the file name:
+// one allocation for the entries and one for the names.
+//
 
 namespace octet { namespace resources {
   /// Zip file reader, uses zip_decoder to inflate compressed files.
   /// Zip files are smaller and faster than regular files.
   /// They make updates easier and work will over the internet.
+  ///
+  /// All the const functions are safe to call from any thread.
   class zip_file {
-    int ref_cnt;
-    FILE *the_file;
+    // zip files are shared by the loader threads.
+    ref_count_atomic ref_count;
+
+    // the whole zip file, mapped into memory.
+    ref<file_map> map;
 
     struct dir_entry {
+      uint32_t hash;
+      uint32_t name;        // offset in names
+      uint32_t name_len;
       uint32_t offset;
       uint32_t csize;
       uint32_t usize;
       uint32_t compression;
     };
 
-    dictionary<dir_entry> directory;
+    // sorted by hash.
+    dynarray<dir_entry> directory;
+
+    // all the file names, with '/' separators.
+    dynarray<char> names;
 
     zip_decoder decoder;
 
@@ -41,78 +59,83 @@ namespace octet { namespace resources {
       return (int16_t)(src[0] + src[1] * 256);
     }
 
-  public:
-    /// Open a zip file for reading
-    zip_file(const char *filename) {
-      ref_cnt = 0;
-      the_file = fopen(filename, "rb");
-      if (!the_file) {
-        printf("file %s not found\n", filename);
-      } else {
-        uint8_t tmp[256];
-        unsigned tmp_size = (unsigned)sizeof(tmp);
-        fseek(the_file, 0, SEEK_END);
-        long file_size = ftell(the_file);
-        long search_offset = file_size - (long)tmp_size;
-        search_offset = search_offset < 0 ? 0 : search_offset;
-        fseek(the_file, search_offset, SEEK_SET);
-        fread(&tmp, 1, tmp_size, the_file);
-        for( unsigned i = 0; i != tmp_size; ++i) {
-          if (u4(tmp + i) == 0x06054b50) {
-            dynarray<uint8_t> dir;
-            dir.resize(u4(tmp + i + 12));
-            fseek(the_file, (long)u4(tmp + i + 16), SEEK_SET);
-            fread(&dir[0], 1, dir.size(), the_file);
-            for (unsigned i = 0; i + 4 < dir.size();) {
-              uint8_t *p = &dir[i];
+    static bool hash_less(const dir_entry &lhs, const dir_entry &rhs) {
+      return lhs.hash < rhs.hash;
+    }
+
+    // read the central directory at the end of the file.
+    void read_directory() {
+      if (map->get_data()) {
+        const uint8_t *file_data = map->get_data();
+        size_t file_size = (size_t)map->get_size();
+
+        // search the last 256 bytes for the end of central directory record.
+        size_t search_offset = file_size > 256 ? file_size - 256 : 0;
+        for (size_t i = search_offset; i + 22 <= file_size; ++i) {
+          const uint8_t *tmp = file_data + i;
+          if (u4(tmp) == 0x06054b50) {
+            unsigned num_entries = u2(tmp + 10);
+            size_t dir_size = u4(tmp + 12);
+            size_t dir_offset = u4(tmp + 16);
+            if (dir_offset + dir_size > file_size) break;
+
+            directory.reserve(num_entries);
+            names.reserve((unsigned)dir_size);
+
+            const uint8_t *dir = file_data + dir_offset;
+            for (size_t i = 0; i + 46 <= dir_size;) {
+              const uint8_t *p = dir + i;
               if (u4(p) != 0x02014b50) break;
-              struct dir_entry d;
+              unsigned file_name_len = u2(p + 28);
+              unsigned extra_len = u2(p + 30);
+              unsigned comment_len = u2(p + 32);
+              if (i + 46 + file_name_len > dir_size) break;
+
+              dir_entry d;
               d.compression = u2(p + 10);
               d.csize = u4(p + 20);
               d.usize = u4(p + 24);
-              unsigned file_name_len = u2(p + 28);
-              unsigned extra_len = u2(p + 30);
-              string file;
-              file.set((const char*)(p + 46), file_name_len);
-              i += 46 + file_name_len + extra_len;
-              d.offset = u4(p + 42);// + (46 + file_name_len + extra_len);
-              for (unsigned i = 0; file[i]; ++i) {
-                if (file[i] == '\\') file[i] = '/';
+              d.offset = u4(p + 42);
+              d.name = (uint32_t)names.size();
+              d.name_len = file_name_len;
+              const char *file = (const char*)(p + 46);
+              for (unsigned j = 0; j != file_name_len; ++j) {
+                names.push_back(file[j] == '\\' ? '/' : file[j]);
               }
-              //printf("%s\n", file.c_str());
-              directory[file] = d;
+              d.hash = string_view(names.data() + d.name, file_name_len).hash();
+              directory.push_back(d);
+
+              i += 46 + file_name_len + extra_len + comment_len;
             }
             break;
           }
         }
       }
-    }
 
-    /// close the zip file
-    ~zip_file() {
-      if (the_file) fclose(the_file);
-    }
-
-    /// allow ref<zip_file>
-    void add_ref() {
-      ref_cnt++;
+      // stable, so the first of any duplicate names is found.
+      std::stable_sort(directory.data(), directory.data() + directory.size(), hash_less);
     }
 
-    /// allow ref<zip_file>
-    void release() {
-      if (--ref_cnt) {
-        delete this;
+    // find a file in the directory, return -1 if not found.
+    int find(string_view file) const {
+      dir_entry key;
+      key.hash = file.hash();
+      const dir_entry *begin = directory.data(), *end = begin + directory.size();
+      for (const dir_entry *d = std::lower_bound(begin, end, key, hash_less); d != end && d->hash == key.hash; ++d) {
+        if (file == string_view(names.data() + d->name, d->name_len)) {
+          return (int)(d - begin);
+        }
       }
+      return -1;
     }
 
-    /// get a file from a zip file, this is called from get_url with a zip:// prefix.
-    void get_file(dynarray<uint8_t> &buffer, const char *file) {
-      int index = directory.get_index(file);
-      if (index < 0) return;
-      if (!the_file) return;
-      const dir_entry &d = directory.get_value(index);
-      buffer.resize(d.usize);
-      fseek(the_file, d.offset, SEEK_SET);
+    // find the (possibly compressed) data for a file in the mapping.
+    const uint8_t *get_file_data(int index) const {
+      if (index < 0) return 0;
+      if (!map->get_data()) return 0;
+      const dir_entry &d = directory[index];
+      if (d.compression != 0 && d.compression != 8) return 0;
+
       /*local file header signature     4 bytes  (0x04034b50) 0
       version needed to extract       2 bytes 4
       general purpose bit flag        2 bytes 6
@@ -125,18 +148,129 @@ namespace octet { namespace resources {
       file name length                2 bytes 26
       extra field length              2 bytes 28 / 30*/
 
-      uint8_t tmp[30];
-      fread(tmp, 1, sizeof(tmp), the_file);
-      if (u4(tmp) != 0x04034b50) return;
+      uint64_t file_size = map->get_size();
+      if ((uint64_t)d.offset + 30 > file_size) return 0;
+      const uint8_t *tmp = map->get_data() + d.offset;
+      if (u4(tmp) != 0x04034b50) return 0;
       unsigned extra = u2(tmp + 26) + u2(tmp + 28);
-      fseek(the_file, d.offset + 30 + extra, SEEK_SET);
+      if ((uint64_t)d.offset + 30 + extra + d.csize > file_size) return 0;
+      if (d.compression == 0 && d.csize != d.usize) return 0;
+      return tmp + 30 + extra;
+    }
+
+    // zip files own their mapping, so no copying
+    zip_file(const zip_file &rhs);
+    zip_file &operator=(const zip_file &rhs);
+  public:
+    /// Open a zip file for reading
+    zip_file(const char *filename) {
+      // the directory is at the end, the files are all over the place.
+      map = new file_map(filename, file_map::access_random);
+      if (!map->get_data()) {
+        printf("file %s not found\n", filename);
+        return;
+      }
+      read_directory();
+    }
+
+    /// Read a zip file that is already in memory, for example one from a url_request.
+    zip_file(file_map *map_) {
+      map = map_;
+      read_directory();
+    }
+
+    /// close the zip file
+    ~zip_file() {
+    }
+
+    /// allow ref<zip_file>
+    void add_ref() {
+      ref_count.add();
+    }
+
+    /// allow ref<zip_file>
+    void release() {
+      if (ref_count.remove()) {
+        delete this;
+      }
+    }
+
+    /// Number of files in the zip file.
+    unsigned get_num_files() const {
+      return (unsigned)directory.size();
+    }
+
+    /// Name of a file in the zip file, in no particular order.
+    string_view get_file_name(unsigned index) const {
+      const dir_entry &d = directory[index];
+      return string_view(names.data() + d.name, d.name_len);
+    }
+
+    /// Return true if a file is in the zip file.
+    bool has_file(const char *file) const {
+      return find(file) >= 0;
+    }
+
+    /// get a file from a zip file, this is called from get_url with a zip:// prefix.
+    void get_file(dynarray<uint8_t> &buffer, const char *file) const {
+      int index = find(file);
+      const uint8_t *src = get_file_data(index);
+      if (!src) {
+        buffer.resize(0);
+        return;
+      }
+
+      const dir_entry &d = directory[index];
+      buffer.resize(d.usize);
       if (d.compression == 0) {
-        fread(buffer.data(), 1, d.usize, the_file);
+        memcpy(buffer.data(), src, d.usize);
       } else if (d.compression == 8) {
-        dynarray<uint8_t> uncomp(d.csize + 4); // note: + 4 bytes prevents decode() overflowing
-        fread(uncomp.data(), 1, d.csize, the_file);
-        decoder.decode(buffer.data(), buffer.data() + d.usize, uncomp.data(), uncomp.data() + d.csize);
+        if (!decoder.decode(buffer.data(), buffer.data() + d.usize, src, src + d.csize)) {
+          printf("warning: %s is corrupt in zip file\n", file);
+        }
+      }
+    }
+
+    /// get a file from a zip file as a file_map.
+    ///
+    /// Stored files are not copied: the result refers to the zip file's own mapping.
+    /// Returns null if the file is not in the zip file.
+    file_map *map_file(const char *file) const {
+      int index = find(file);
+      const uint8_t *src = get_file_data(index);
+      if (!src) return 0;
+
+      const dir_entry &d = directory[index];
+      if (d.compression == 0) {
+        return new file_map(map, (uint64_t)(src - map->get_data()), d.usize);
+      } else {
+        dynarray<uint8_t> buffer(d.usize);
+        if (!decoder.decode(buffer.data(), buffer.data() + d.usize, src, src + d.csize)) {
+          printf("warning: %s is corrupt in zip file\n", file);
+        }
+        return new file_map(buffer);
       }
     }
+
+    /// Get many files from a zip file, inflating them in parallel on the job scheduler.
+    ///
+    /// results[i] is the file map for files[i], or null if it is not in the zip file.
+    /// Call this from the main thread or a job.
+    ///
+    /// Example:
+    ///
+    ///     const char *files[] = { "big.fnt", "big_0.gif" };
+    ///     dynarray<ref<file_map> > maps;
+    ///     zip->map_files(maps, files, 2);
+    void map_files(dynarray<ref<file_map> > &results, const char *const *files, unsigned num_files) const {
+      results.resize(num_files);
+
+      // one file per job: files vary a lot in size, so let the workers steal them.
+      job_scheduler::get().parallel_for(0, num_files, 1, [&](unsigned i0, unsigned i1) {
+        for (unsigned i = i0; i != i1; ++i) {
+          results[i] = map_file(files[i]);
+        }
+      });
+    }
   };
 } }
@@ -0,0 +1,230 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// write zip files
+//
+// files are written in the order they are added, so a game that reads its assets
+// in the same order reads the zip file from start to finish.
+//
+// stored files are aligned (with padding in the local header's extra field)
+// so that zip_file::map_file gives aligned data without copying.
+//
+
+namespace octet { namespace resources {
+  /// Zip file writer, uses zip_encoder to deflate files.
+  ///
+  /// Example:
+  ///
+  ///     zip_writer zip("assets/bundle.zip");
+  ///     zip.add_file("hello.txt", (const uint8_t*)"hello", 5);
+  ///     zip.close();
+  class zip_writer {
+    struct dir_entry {
+      string name;
+      uint32_t offset;
+      uint32_t csize;
+      uint32_t usize;
+      uint32_t crc;
+      uint16_t compression;
+    };
+
+    enum {
+      // date of all files: 1st January 1980
+      dos_date = (0 << 9) | (1 << 5) | 1,
+
+      // extra field id for padding
+      padding_id = 0xa11e,
+    };
+
+    FILE *file;
+    dynarray<dir_entry> directory;
+    zip_encoder encoder;
+    uint64_t offset;
+    unsigned alignment;
+    bool error;
+
+    // write little endian bytes on any machine
+    static void w4(uint8_t *dest, unsigned value) {
+      dest[0] = (uint8_t)value; dest[1] = (uint8_t)(value >> 8); dest[2] = (uint8_t)(value >> 16); dest[3] = (uint8_t)(value >> 24);
+    }
+
+    static void w2(uint8_t *dest, unsigned value) {
+      dest[0] = (uint8_t)value; dest[1] = (uint8_t)(value >> 8);
+    }
+
+    void write(const void *data, size_t size) {
+      if (!error && size && fwrite(data, 1, size, file) != size) {
+        error = true;
+      }
+      offset += size;
+    }
+
+    // zip writers own a file, so no copying
+    zip_writer(const zip_writer &rhs);
+    zip_writer &operator=(const zip_writer &rhs);
+  public:
+    /// Create a zip file. Stored files are aligned to "alignment" bytes.
+    zip_writer(const char *filename, unsigned alignment = 16) : alignment(alignment ? alignment : 1) {
+      file = fopen(filename, "wb");
+      offset = 0;
+      error = file == 0;
+      if (!file) printf("could not create %s\n", filename);
+    }
+
+    /// Finish the zip file.
+    ~zip_writer() {
+      close();
+    }
+
+    /// Return true if something has gone wrong, eg. the disk is full.
+    bool get_error() const {
+      return error;
+    }
+
+    /// zip checksum, start with crc = 0.
+    static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+      struct table_t {
+        uint32_t values[256];
+        table_t() {
+          for (unsigned i = 0; i != 256; ++i) {
+            uint32_t c = i;
+            for (unsigned j = 0; j != 8; ++j) {
+              c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+          }
+        }
+      };
+      static table_t table;
+      crc = ~crc;
+      for (size_t i = 0; i != size; ++i) {
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      }
+      return ~crc;
+    }
+
+    /// Add a file that has already been compressed, for example by a job.
+    ///
+    /// compression is 0 for stored data and 8 for deflated data.
+    bool add_compressed_file(const char *name, const uint8_t *data, size_t csize, size_t usize, uint32_t crc, unsigned compression) {
+      if (!file || error) return false;
+      if (csize > 0xffffffff || usize > 0xffffffff || offset + csize > 0xffffffff) {
+        printf("zip_writer: %s is too big for a zip file\n", name);
+        error = true;
+        return false;
+      }
+
+      dir_entry d;
+      d.name = name;
+      d.offset = (uint32_t)offset;
+      d.csize = (uint32_t)csize;
+      d.usize = (uint32_t)usize;
+      d.crc = crc;
+      d.compression = (uint16_t)compression;
+
+      unsigned name_len = (unsigned)d.name.size();
+      unsigned padding = 0;
+      if (compression == 0 && alignment > 1) {
+        padding = (unsigned)((alignment - (offset + 30 + name_len) % alignment) % alignment);
+        // an extra field has a four byte header.
+        if (padding && padding < 4) padding += alignment;
+      }
+
+      uint8_t header[30];
+      w4(header + 0, 0x04034b50);
+      w2(header + 4, 20);
+      w2(header + 6, 0);
+      w2(header + 8, compression);
+      w2(header + 10, 0);
+      w2(header + 12, dos_date);
+      w4(header + 14, d.crc);
+      w4(header + 18, d.csize);
+      w4(header + 22, d.usize);
+      w2(header + 26, name_len);
+      w2(header + 28, padding);
+      write(header, sizeof(header));
+      write(d.name.c_str(), name_len);
+      if (padding) {
+        uint8_t pad[64] = { 0 };
+        w2(pad, padding_id);
+        w2(pad + 2, padding - 4);
+        for (unsigned done = 0; done < padding; done += sizeof(pad)) {
+          write(pad, padding - done < sizeof(pad) ? padding - done : sizeof(pad));
+          memset(pad, 0, 4);
+        }
+      }
+      write(data, csize);
+
+      directory.push_back(std::move(d));
+      return !error;
+    }
+
+    /// Add a file, compressing it unless that makes it bigger.
+    ///
+    /// Level 0 stores the file, 1 is fastest and 9 is smallest.
+    bool add_file(const char *name, const uint8_t *data, size_t size, int level = 6) {
+      uint32_t crc = crc32(data, size);
+      if (level > 0) {
+        dynarray<uint8_t> compressed;
+        encoder.encode(compressed, data, data + size, level);
+        if (compressed.size() < size) {
+          return add_compressed_file(name, compressed.data(), compressed.size(), size, crc, 8);
+        }
+      }
+      return add_compressed_file(name, data, size, size, crc, 0);
+    }
+
+    /// Write the directory and close the file. Returns false if anything went wrong.
+    bool close() {
+      if (!file) return !error;
+
+      uint64_t dir_offset = offset;
+      for (unsigned i = 0; i != directory.size(); ++i) {
+        const dir_entry &d = directory[i];
+        uint8_t header[46];
+        w4(header + 0, 0x02014b50);
+        w2(header + 4, 20);
+        w2(header + 6, 20);
+        w2(header + 8, 0);
+        w2(header + 10, d.compression);
+        w2(header + 12, 0);
+        w2(header + 14, dos_date);
+        w4(header + 16, d.crc);
+        w4(header + 20, d.csize);
+        w4(header + 24, d.usize);
+        w2(header + 28, d.name.size());
+        w2(header + 30, 0);
+        w2(header + 32, 0);
+        w2(header + 34, 0);
+        w2(header + 36, 0);
+        w4(header + 38, 0);
+        w4(header + 42, d.offset);
+        write(header, sizeof(header));
+        write(d.name.c_str(), d.name.size());
+      }
+
+      uint8_t end[22];
+      w4(end + 0, 0x06054b50);
+      w2(end + 4, 0);
+      w2(end + 6, 0);
+      w2(end + 8, directory.size());
+      w2(end + 10, directory.size());
+      w4(end + 12, (uint32_t)(offset - dir_offset));
+      w4(end + 16, (uint32_t)dir_offset);
+      w2(end + 20, 0);
+      write(end, sizeof(end));
+
+      if (directory.size() > 0xffff || offset > 0xffffffff) {
+        printf("zip_writer: too many files for a zip file\n");
+        error = true;
+      }
+
+      if (fclose(file) != 0) error = true;
+      file = 0;
+      return !error;
+    }
+  };
+} }
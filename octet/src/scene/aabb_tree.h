@@ -0,0 +1,374 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Dynamic bounding volume hierarchy
+//
+// Each leaf holds a box that is a little larger than the object it contains,
+// so objects can move a short way without changing the tree. Leaves are placed
+// next to the subtree that grows least (the surface area heuristic) and the
+// tree is kept balanced with rotations.
+//
+
+namespace octet { namespace scene {
+  /// Tree of axis aligned boxes for finding visible objects quickly.
+  ///
+  /// Example:
+  ///
+  ///     aabb_tree tree;
+  ///     int leaf = tree.insert(bb, 7);
+  ///     tree.move(leaf, new_bb);
+  ///     tree.cull(visible, planes, 6);   // visible gets 7 if new_bb is in view
+  class aabb_tree {
+    struct node_t {
+      aabb bounds;
+      int parent;       // next free node if this node is free
+      int children[2];  // -1 for leaves
+      int height;       // 0 for leaves, -1 for free nodes
+      unsigned id;
+    };
+
+    dynarray<node_t> nodes;
+    int root;
+    int free_list;
+
+    // traversal stack, kept to save allocations
+    dynarray<int> stack;
+
+    // planes in groups of four for classify()
+    struct frustum_t {
+      float nx[8], ny[8], nz[8], d[8];
+      float ax[8], ay[8], az[8];
+    };
+
+    bool is_leaf(int index) const {
+      return nodes[index].children[0] == -1;
+    }
+
+    static aabb combine(const aabb &a, const aabb &b) {
+      vec3 min = a.get_min().min(b.get_min());
+      vec3 max = a.get_max().max(b.get_max());
+      return aabb((min + max) * 0.5f, (max - min) * 0.5f);
+    }
+
+    // a quarter of the surface area, which is all the heuristic needs.
+    static float area(const aabb &a) {
+      vec3 h = a.get_half_extent();
+      return h.x() * h.y() + h.y() * h.z() + h.z() * h.x();
+    }
+
+    static bool contains(const aabb &outer, const aabb &inner) {
+      vec3 diff = abs(outer.get_center() - inner.get_center()) + inner.get_half_extent();
+      vec3 limit = outer.get_half_extent();
+      return diff.x() <= limit.x() && diff.y() <= limit.y() && diff.z() <= limit.z();
+    }
+
+    int alloc_node() {
+      int index;
+      if (free_list != -1) {
+        index = free_list;
+        free_list = nodes[index].parent;
+      } else {
+        index = (int)nodes.size();
+        nodes.resize(index + 1);
+      }
+      node_t &n = nodes[index];
+      n.parent = -1;
+      n.children[0] = n.children[1] = -1;
+      n.height = 0;
+      n.id = 0;
+      return index;
+    }
+
+    void free_node(int index) {
+      nodes[index].parent = free_list;
+      nodes[index].height = -1;
+      free_list = index;
+    }
+
+    void refit(int index) {
+      node_t &n = nodes[index];
+      const node_t &c0 = nodes[n.children[0]];
+      const node_t &c1 = nodes[n.children[1]];
+      n.bounds = combine(c0.bounds, c1.bounds);
+      n.height = 1 + (c0.height > c1.height ? c0.height : c1.height);
+    }
+
+    // if one child of a is two levels taller than the other, promote its taller child.
+    // Returns the new root of the subtree.
+    int balance(int a) {
+      node_t &na = nodes[a];
+      if (is_leaf(a) || na.height < 2) return a;
+
+      int b = na.children[0], c = na.children[1];
+      int diff = nodes[c].height - nodes[b].height;
+      if (diff > 1) return rotate(a, c, 1);
+      if (diff < -1) return rotate(a, b, 0);
+      return a;
+    }
+
+    // child (side of a) becomes the parent of a.
+    int rotate(int a, int child, int side) {
+      int f = nodes[child].children[0], g = nodes[child].children[1];
+
+      // child takes a's place
+      nodes[child].children[0] = a;
+      nodes[child].parent = nodes[a].parent;
+      nodes[a].parent = child;
+      int old_parent = nodes[child].parent;
+      if (old_parent == -1) {
+        root = child;
+      } else {
+        node_t &p = nodes[old_parent];
+        p.children[p.children[0] == a ? 0 : 1] = child;
+      }
+
+      // the taller grandchild stays under child, the other goes under a.
+      int keep = nodes[f].height > nodes[g].height ? f : g;
+      int give = keep == f ? g : f;
+      nodes[child].children[1] = keep;
+      nodes[a].children[side] = give;
+      nodes[give].parent = a;
+      refit(a);
+      refit(child);
+      return child;
+    }
+
+    void insert_leaf(int leaf) {
+      if (root == -1) {
+        root = leaf;
+        nodes[leaf].parent = -1;
+        return;
+      }
+
+      // find the sibling that makes the tree grow least.
+      aabb leaf_bounds = nodes[leaf].bounds;
+      int index = root;
+      while (!is_leaf(index)) {
+        const node_t &n = nodes[index];
+        float node_area = area(n.bounds);
+        float combined_area = area(combine(n.bounds, leaf_bounds));
+
+        // cost of making a new parent for this node and the leaf
+        float cost = 2 * combined_area;
+
+        // cost of pushing the leaf further down
+        float inheritance = 2 * (combined_area - node_area);
+        float child_cost[2];
+        for (int i = 0; i != 2; ++i) {
+          const node_t &c = nodes[n.children[i]];
+          float grown = area(combine(c.bounds, leaf_bounds));
+          child_cost[i] = (c.children[0] == -1 ? grown : grown - area(c.bounds)) + inheritance;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1]) break;
+        index = n.children[child_cost[0] < child_cost[1] ? 0 : 1];
+      }
+
+      int sibling = index;
+      int old_parent = nodes[sibling].parent;
+      int new_parent = alloc_node();
+      node_t &np = nodes[new_parent];
+      np.parent = old_parent;
+      np.children[0] = sibling;
+      np.children[1] = leaf;
+      nodes[sibling].parent = new_parent;
+      nodes[leaf].parent = new_parent;
+      if (old_parent == -1) {
+        root = new_parent;
+      } else {
+        node_t &p = nodes[old_parent];
+        p.children[p.children[0] == sibling ? 0 : 1] = new_parent;
+      }
+
+      fix_upwards(new_parent);
+    }
+
+    void remove_leaf(int leaf) {
+      if (leaf == root) {
+        root = -1;
+        return;
+      }
+
+      int parent = nodes[leaf].parent;
+      int grandparent = nodes[parent].parent;
+      int sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+      nodes[sibling].parent = grandparent;
+      if (grandparent == -1) {
+        root = sibling;
+      } else {
+        node_t &g = nodes[grandparent];
+        g.children[g.children[0] == parent ? 0 : 1] = sibling;
+      }
+      free_node(parent);
+      if (grandparent != -1) fix_upwards(grandparent);
+    }
+
+    void fix_upwards(int index) {
+      while (index != -1) {
+        index = balance(index);
+        refit(index);
+        index = nodes[index].parent;
+      }
+    }
+
+    // -1 if the box is outside a plane, 1 if it is inside all of them, otherwise 0.
+    static int classify(const frustum_t &f, const aabb &bb) {
+      vec3 c = bb.get_center();
+      vec3 h = bb.get_half_extent();
+      #if OCTET_SSE2
+        __m128 cx = _mm_set1_ps(c.x()), cy = _mm_set1_ps(c.y()), cz = _mm_set1_ps(c.z());
+        __m128 hx = _mm_set1_ps(h.x()), hy = _mm_set1_ps(h.y()), hz = _mm_set1_ps(h.z());
+        int outside = 0, inside = 0xff;
+        for (int i = 0; i != 8; i += 4) {
+          __m128 dist = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(f.nx + i), cx), _mm_mul_ps(_mm_loadu_ps(f.ny + i), cy)),
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(f.nz + i), cz), _mm_loadu_ps(f.d + i))
+          );
+          __m128 radius = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(f.ax + i), hx), _mm_mul_ps(_mm_loadu_ps(f.ay + i), hy)),
+            _mm_mul_ps(_mm_loadu_ps(f.az + i), hz)
+          );
+          outside |= _mm_movemask_ps(_mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), radius)));
+          inside &= _mm_movemask_ps(_mm_cmpge_ps(dist, radius)) << i | (i ? 0x0f : 0xf0);
+        }
+        return outside ? -1 : inside == 0xff ? 1 : 0;
+      #else
+        bool inside = true;
+        for (int i = 0; i != 8; ++i) {
+          float dist = f.nx[i] * c.x() + f.ny[i] * c.y() + f.nz[i] * c.z() + f.d[i];
+          float radius = f.ax[i] * h.x() + f.ay[i] * h.y() + f.az[i] * h.z();
+          if (dist < -radius) return -1;
+          if (dist < radius) inside = false;
+        }
+        return inside ? 1 : 0;
+      #endif
+    }
+
+    // every leaf under index is visible.
+    void add_all(dynarray<unsigned> &ids, int index) {
+      unsigned base = stack.size();
+      stack.push_back(index);
+      while (stack.size() != base) {
+        int i = stack.back();
+        stack.pop_back();
+        const node_t &n = nodes[i];
+        if (n.children[0] == -1) {
+          ids.push_back(n.id);
+        } else {
+          stack.push_back(n.children[0]);
+          stack.push_back(n.children[1]);
+        }
+      }
+    }
+
+  public:
+    aabb_tree() {
+      root = -1;
+      free_list = -1;
+    }
+
+    /// Add an object with bounding box bb. Returns a leaf for move() and remove().
+    int insert(const aabb &bb, unsigned id) {
+      int leaf = alloc_node();
+      nodes[leaf].id = id;
+      set_fat_bounds(leaf, bb);
+      insert_leaf(leaf);
+      return leaf;
+    }
+
+    /// Remove an object.
+    void remove(int leaf) {
+      remove_leaf(leaf);
+      free_node(leaf);
+    }
+
+    /// The object has moved. The tree only changes if the object has left its leaf's box.
+    void move(int leaf, const aabb &bb) {
+      if (contains(nodes[leaf].bounds, bb)) return;
+      remove_leaf(leaf);
+      set_fat_bounds(leaf, bb);
+      insert_leaf(leaf);
+    }
+
+    /// Remove all the objects.
+    void reset() {
+      nodes.reset();
+      root = -1;
+      free_list = -1;
+    }
+
+    /// Make the leaf box bigger than the object, by a tenth of its largest dimension.
+    void set_fat_bounds(int leaf, const aabb &bb) {
+      vec3 h = bb.get_half_extent();
+      float largest = h.x() > h.y() ? h.x() : h.y();
+      largest = largest > h.z() ? largest : h.z();
+      nodes[leaf].bounds = aabb(bb.get_center(), h + vec3(largest * 0.1f));
+    }
+
+    /// Bounding box of a leaf, including its margin.
+    const aabb &get_bounds(int leaf) const {
+      return nodes[leaf].bounds;
+    }
+
+    /// Height of the tree, for balancing statistics. Zero if there is one leaf.
+    int get_height() const {
+      return root == -1 ? 0 : nodes[root].height;
+    }
+
+    /// Add the ids of the objects that may be inside all the planes to ids.
+    /// Planes are (normal, offset) with the inside where dot(normal, p) + offset >= 0.
+    /// Up to eight planes are used.
+    void cull(dynarray<unsigned> &ids, const vec4 *planes, unsigned num_planes) {
+      if (root == -1 || num_planes == 0) return;
+
+      // spare slots repeat the first plane.
+      frustum_t f;
+      for (unsigned i = 0; i != 8; ++i) {
+        const vec4 &p = planes[i < num_planes ? i : 0];
+        f.nx[i] = p.x(); f.ny[i] = p.y(); f.nz[i] = p.z(); f.d[i] = p.w();
+        f.ax[i] = fabsf(p.x()); f.ay[i] = fabsf(p.y()); f.az[i] = fabsf(p.z());
+      }
+
+      stack.resize(0);
+      stack.push_back(root);
+      while (stack.size()) {
+        int index = stack.back();
+        stack.pop_back();
+        const node_t &n = nodes[index];
+        int test = classify(f, n.bounds);
+        if (test < 0) continue;
+        if (n.children[0] == -1) {
+          ids.push_back(n.id);
+        } else if (test > 0) {
+          add_all(ids, index);
+        } else {
+          stack.push_back(n.children[0]);
+          stack.push_back(n.children[1]);
+        }
+      }
+    }
+
+    /// Call fn(id) for each object whose leaf box the ray passes through.
+    template <class fn_t> void cast_ray(const ray &the_ray, fn_t fn) {
+      if (root == -1) return;
+
+      stack.resize(0);
+      stack.push_back(root);
+      while (stack.size()) {
+        int index = stack.back();
+        stack.pop_back();
+        const node_t &n = nodes[index];
+        if (!the_ray.intersects(n.bounds)) continue;
+        if (n.children[0] == -1) {
+          fn(n.id);
+        } else {
+          stack.push_back(n.children[0]);
+          stack.push_back(n.children[1]);
+        }
+      }
+    }
+  };
+}}
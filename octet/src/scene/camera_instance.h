@@ -181,6 +181,26 @@ namespace octet { namespace scene {
       return result;
     }
 
+    /// Get the six planes around the view, as at the last set_cameraToWorld().
+    /// Each is (normal, offset) in world space, with the view where dot(normal, p) + offset >= 0.
+    /// The order is left, right, bottom, top, near, far.
+    void get_frustum_planes(vec4 *planes) const {
+      mat4t worldToProjection = worldToCamera * cameraToProjection;
+      vec4 x = worldToProjection.column(0);
+      vec4 y = worldToProjection.column(1);
+      vec4 z = worldToProjection.column(2);
+      vec4 w = worldToProjection.column(3);
+      planes[0] = w + x;
+      planes[1] = w - x;
+      planes[2] = w + y;
+      planes[3] = w - y;
+      planes[4] = w + z;
+      planes[5] = w - z;
+      for (int i = 0; i != 6; ++i) {
+        planes[i] = planes[i] * (1.0f / length(planes[i].xyz()));
+      }
+    }
+
     /// Get the node used for the transform.
     scene_node *get_node() const {
       return node;
@@ -31,220 +31,280 @@ namespace octet { namespace scene {
     uint8_t mip_levels;
     uint8_t cube_faces;
 
+    // format to compress to after loading, or zero. See set_compression()
+    uint16_t compression;
+
+    // how to make the mipmaps. See set_mipmap_filter()
+    mipmap_generator mipmaps;
+
+    // animations: seconds to show each frame for
+    dynarray<float> frame_delays;
+
     // derived attributes (not for saving)
     // todo: use gl_resource
     GLuint gl_texture;
 
     GLuint gl_target;
 
+    // asynchronous load in progress, see load_async()
+    ref<url_request> pending;
+
+    // Streaming loads: the decoder reports finished rows on a worker thread and
+    // they are copied to the texture on the main thread at the end of the frame.
+    // The url_request keeps the image alive until the uploads are done.
+    class row_uploader : public image_sink {
+      image *img;
+
+      // rows waiting to be uploaded
+      unsigned dirty_begin;
+      unsigned dirty_end;
+      bool upload_queued;
+
+    public:
+      // the main thread reads the image while the decoder is writing to it.
+      std::mutex mutex;
+
+      row_uploader(image *img_) {
+        img = img_;
+        dirty_begin = dirty_end = 0;
+        upload_queued = false;
+      }
+
+      void begin_image(uint16_t format, uint16_t width, uint16_t height) {
+        std::lock_guard<std::mutex> guard(mutex);
+        img->format = format;
+        img->width = width;
+        img->height = height;
+        img->frames = 1;
+        dirty_begin = dirty_end = 0;
+      }
+
+      // more frames of an animation: the bytes may move.
+      void resize_image(dynarray<uint8_t> &image, size_t size) {
+        std::lock_guard<std::mutex> guard(mutex);
+        image.resize(size);
+      }
+
+      void add_rows(unsigned y, unsigned num_rows) {
+        if (img->format != RGB && img->format != RGBA) return;
+
+        std::lock_guard<std::mutex> guard(mutex);
+        if (dirty_begin == dirty_end) {
+          dirty_begin = y;
+          dirty_end = y + num_rows;
+        } else {
+          dirty_begin = y < dirty_begin ? y : dirty_begin;
+          dirty_end = y + num_rows > dirty_end ? y + num_rows : dirty_end;
+        }
+
+        // one upload per frame, however many rows arrive.
+        if (!upload_queued) {
+          upload_queued = true;
+          job *upload = make_job([this]() { upload_rows(); });
+          upload->set_main_thread();
+          job_scheduler::get().schedule(upload);
+        }
+      }
+
+      // main thread: copy the new rows to the texture, making it if we need to.
+      void upload_rows() {
+        std::lock_guard<std::mutex> guard(mutex);
+        upload_queued = false;
+        if (dirty_begin == dirty_end) return;
+
+        // the image has been compressed since the rows arrived.
+        if (img->format != RGB && img->format != RGBA) return;
+
+        unsigned num_comps = img->format == RGBA ? 4 : 3;
+        glActiveTexture(GL_TEXTURE0);
+        if (!img->gl_texture) {
+          glGenTextures(1, &img->gl_texture);
+          glBindTexture(GL_TEXTURE_2D, img->gl_texture);
+          glTexImage2D(GL_TEXTURE_2D, 0, img->format, img->width, img->height, 0, img->format, GL_UNSIGNED_BYTE, 0);
+          // no mipmaps until the load has finished, see end_load()
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        } else {
+          glBindTexture(GL_TEXTURE_2D, img->gl_texture);
+        }
+        const uint8_t *src = img->bytes.data() + dirty_begin * img->width * num_comps;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, dirty_begin, img->width, dirty_end - dirty_begin, img->format, GL_UNSIGNED_BYTE, (void*)src);
+        dirty_begin = dirty_end = 0;
+      }
+    };
+
+    row_uploader *uploader;
+
+    // size of the pieces of file fed to a streaming decoder.
+    enum { stream_chunk_size = 0x10000 };
+
     void init(const char *name) {
       bool is_cubemap = strstr(name, "%s") != 0;
       this->url = name;
       width = height = 0;
       depth = 1;
+      frames = 1;
       gl_texture = 0;
       gl_target = is_cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
       mip_levels = 1;
       cube_faces = is_cubemap ? 6 : 1;
       format = 0;
+      compression = 0;
+      uploader = 0;
     }
 
-    // these are here to avoid including glext.h which may be platform dependent.
-    enum {
-      // format options
-      DEPTH_COMPONENT = 0x1902,
-      ALPHA = 0x1906,
-      RGB = 0x1907,
-      RGBA = 0x1908,
-      LUMINANCE = 0x1909,
-      LUMINANCE_ALPHA = 0x190A,
-      COMPRESSED_RGB_S3TC_DXT1_EXT = 0x83F0,
-      COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
-      COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
-      COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
-    };
+    /// Make mipmaps for this image, filtered in linear space (see set_srgb()),
+    /// unless the file had them already.
+    ///
+    /// If lock is given, it is held while the bytes move. The first level stays where it is
+    /// while the mipmaps are made, so streaming uploads can carry on reading it.
+    void make_mipmaps(std::mutex *lock = 0) {
+      if (mip_levels != 1) return;
+      unsigned num_comps = mipmap_generator::get_num_comps(format);
+      if (!num_comps || !width || !height) return;
+      if (gl_target != GL_TEXTURE_2D && gl_target != GL_TEXTURE_CUBE_MAP) return;
+
+      size_t face_size = (size_t)width * height * num_comps;
+      size_t chain_size = mipmap_generator::get_size(format, width, height);
+      if (bytes.size() != face_size * cube_faces) return;
+
+      if (cube_faces == 1) {
+        if (lock) lock->lock();
+        bytes.resize(chain_size);
+        if (lock) lock->unlock();
+        mipmaps.generate(&bytes[0], format, width, height);
+      } else {
+        // one set of levels for each face
+        dynarray<uint8_t> faces(chain_size * cube_faces);
+        for (unsigned i = 0; i != cube_faces; ++i) {
+          memcpy(&faces[chain_size * i], &bytes[face_size * i], face_size);
+          mipmaps.generate(&faces[chain_size * i], format, width, height);
+        }
+        bytes = std::move(faces);
+      }
+      mip_levels = (uint8_t)mipmap_generator::get_num_levels(width, height);
+    }
 
-    /// Make mipmaps for this image.
-    void make_mipmaps() {
+    /// Compress the image and its mipmaps for the GPU.
+    ///
+    /// If lock is given, it is held while the bytes are replaced.
+    void compress(unsigned new_format, std::mutex *lock = 0) {
       if (format != RGB && format != RGBA) return;
+      if (gl_target != GL_TEXTURE_2D || !width || !height || !bc_encoder::can_encode(new_format)) return;
 
-      bytes.resize(bytes.size() * 4 / 3);
-
+      // the levels made by make_mipmaps()
       unsigned num_comps = format == RGB ? 3 : 4;
-      uint8_t *src = &bytes[0];
-      uint8_t *dest = &bytes[width * height * num_comps];
+      size_t src_size = 0;
+      size_t dest_size = 0;
+      for (unsigned level = 0, w = width, h = height; level != mip_levels; ++level) {
+        src_size += (size_t)w * h * num_comps;
+        dest_size += bc_encoder::get_size(new_format, w, h);
+        w = mipmap_generator::get_level_size(w);
+        h = mipmap_generator::get_level_size(h);
+      }
+      if (src_size > bytes.size()) return;
+
+      dynarray<uint8_t> result(dest_size);
+      bc_encoder encoder;
+      const uint8_t *src = &bytes[0];
+      uint8_t *dest = &result[0];
       unsigned w = width;
       unsigned h = height;
-      unsigned stride = w * num_comps;
-      mip_levels = 0;
-      while (w > 1 && h > 1) {
-        for (unsigned y = 0; y < h/2; ++y) {
-          for (unsigned x = 0; x < w/2; ++x) {
-            // this is a rather dreadful box filter, it is simple to make, but introduces
-            // artifacts. We can do better than this.
-            for (unsigned i = 0; i != num_comps; ++i) {
-              *dest++ = ( src[0] + src[num_comps] + src[stride] + src[stride+num_comps] + 3 ) >> 2;
-              src++;
-            }
-            src += num_comps;
-          }
-          src += stride;
-        }
-        w >>= 1;
-        h >>= 1;
-        stride >>= 1;
-        mip_levels++;
+      for (unsigned level = 0; level != mip_levels; ++level) {
+        encoder.encode(dest, new_format, src, w, h, num_comps);
+        src += (size_t)w * h * num_comps;
+        dest += bc_encoder::get_size(new_format, w, h);
+        w = mipmap_generator::get_level_size(w);
+        h = mipmap_generator::get_level_size(h);
       }
-      assert(dest - &bytes[0] < (int)bytes.size());
-      //printf("%d %d\n", dest - &bytes[0], bytes.size());
+
+      if (lock) lock->lock();
+      bytes = std::move(result);
+      format = (uint16_t)new_format;
+      if (lock) lock->unlock();
     }
 
-    /// DXT encode the image, making it smaller and grainier.
-    /// Todo: do standard error-diffusion and other improvements.
-    void dxt_encode() {
-      if (format != RGB && format != RGBA) return;
+    // Load a texture made earlier from the cache: a copy, with no decoding.
+    bool load_cached(uint64_t key) {
+      if (!key) return false;
+      ref<file_map> map = texture_cache::get().load(key);
+      if (!map) return false;
 
-      unsigned num_comps = format == RGB ? 3 : 4;
+      ktx_decoder dec;
       dynarray<uint8_t> result;
-      result.resize(bytes.size() / num_comps);
-      uint8_t *src = &bytes[0];
-      uint8_t *dest = &result[0];
+      uint16_t new_format = 0, new_width = 0, new_height = 0;
+      const uint8_t *src = map->get_data();
+      dec.get_image(result, new_format, new_width, new_height, src, src + map->get_size());
+      if (result.size() == 0 || new_format != compression || dec.get_num_faces() != 1) return false;
+
+      bytes = std::move(result);
+      format = new_format;
+      width = new_width;
+      height = new_height;
+      frames = 1;
+      frame_delays.resize(0);
+      mip_levels = (uint8_t)dec.get_num_levels();
+      return true;
+    }
+
+    // Store the compressed texture in the cache for next time.
+    void save_cached(uint64_t key) const {
+      if (!key || format != compression) return;
+
+      dynarray<uint8_t> file;
+      if (ktx_encoder::encode(file, format, width, height, mip_levels, 1, &bytes[0], bytes.size())) {
+        texture_cache::get().save(key, &file[0], file.size());
+      }
+    }
+
+    // upload the levels from the file, or made by make_mipmaps(), so the driver does not have to make them.
+    // Compressed levels go to the GPU as they are.
+    void add_levels(GLenum target, const uint8_t *src, const uint8_t *src_max) {
+      unsigned num_comps = mipmap_generator::get_num_comps(format);
+      bool compressed = bc_encoder::get_block_bytes(format) != 0;
       unsigned w = width;
       unsigned h = height;
-      unsigned stride = w * num_comps;
-      unsigned new_mip_levels = 0;
-      while (w > 4 && h > 4 && new_mip_levels < mip_levels) {
-        for (unsigned y = 0; y < h/4; ++y) {
-          log("w=%d y=%d src=%08x\n", w, y, src - &bytes[0]);
-          for (unsigned x = 0; x < w/4; ++x) {
-            // ye olde covariance method http://en.wikipedia.org/wiki/Linear_discriminant_analysis
-            vec4 tot(0, 0, 0, 0);
-            vec4 colours[16];
-            for (unsigned j = 0; j != 4; ++j) {
-              for (unsigned i = 0; i != 4; ++i) {
-                //vec4 colour(src[0] * (1.0f/255), src[1] * (1.0f/255), src[2] * (1.0f/255), (num_comps == 4 ? src[3] * (1.0f/255) : 1.0f));
-                vec4 colour(src[0] * (1.0f/255), src[1] * (1.0f/255), src[2] * (1.0f/255), 1.0f);
-                colours[i+j*4] = colour;
-                tot += colour;
-                src += num_comps;
-              }
-              src += ( w - 4 ) * num_comps;
-            }
-            src -= ( w - 1 ) * 4 * num_comps;
-
-            // calculate the covariance matrix
-            vec4 mean = tot * 0.0625f;
-            mat4t covariance(0);
-            for (unsigned i = 0; i != 16; ++i) {
-              vec4 colour = colours[i] -= mean;
-              covariance += outer(colour, colour);
-            }
-
-            // power method to find largest eigenvector (axis)
-            vec4 axis = covariance.trace();
-            for (unsigned i = 0; i != 4; ++i) {
-              axis = axis * covariance;
-            }
-            float len = axis.length();
-            if (abs(len) >= 0.001f) axis = axis / len;
-            //if (y == 27) log("%s %s %s\n", mean.toString(), axis.toString(), covariance.toString(tmp, sizeof(tmp)));
-
-            // our colours all have to live on the axis.
-            // in practice, we can ignore "odd man out" colours
-            // for better compression. But for now, do all the colours.
-            float pmin = dot(colours[0], axis);
-            float pmax = pmin;
-            float projs[16];
-            projs[0] = pmin;
-            for (unsigned i = 1; i != 16; ++i) {
-              float proj = dot(colours[i], axis);
-              projs[i] = proj;
-              pmin = pmin < proj ? pmin : proj;
-              pmax = pmax > proj ? pmax : proj;
-            }
-            vec4 cmin = mean + axis * pmin;
-            vec4 cmax = mean + axis * pmax;
-            //if (y == 27) log("%s -> %s\n", cmin.toString(), cmax.toString(tmp, sizeof(tmp)));
-            cmin = min(max(cmin, vec4(0, 0, 0, 0)), vec4(1, 1, 1, 1));
-            cmax = min(max(cmax, vec4(0, 0, 0, 0)), vec4(1, 1, 1, 1));
-
-            unsigned c0 =
-              ( (unsigned)(cmin.x() * 31.999f) << 11 ) |
-              ( (unsigned)(cmin.y() * 63.999f) << 5 ) |
-              ( (unsigned)(cmin.z() * 31.999f) << 0 )
-            ;
-            unsigned c1 =
-              ( (unsigned)(cmax.x() * 31.999f) << 11 ) |
-              ( (unsigned)(cmax.y() * 63.999f) << 5 ) |
-              ( (unsigned)(cmax.z() * 31.999f) << 0 )
-            ;
-
-            if (c0 < c1) {
-              unsigned t = c0; c0 = c1; c1 = t;
-              float p = pmin; pmin = pmax; pmax = p;
-            }
-
-            float pscale = abs(pmax - pmin) > 0.001f ? 3.999f / (pmax - pmin) : 0;
-            uint8_t pal[16];
-            for (unsigned i = 0; i != 16; ++i) {
-              pal[i] = (unsigned)( ( projs[i] - pmin ) * pscale );
-            }
-
-            dest[0] = ( c0 >> 0 ) & 0xff;
-            dest[1] = ( c0 >> 8 ) & 0xff;
-            dest[2] = ( c1 >> 0 ) & 0xff;
-            dest[3] = ( c1 >> 8 ) & 0xff;
-            for (int i = 0; i != 4; ++i) {
-              dest[i+4] = pal[i*4+0] + pal[i*4+1] * 4 + pal[i*4+2] * 16 + pal[i*4+3] * 64;
-            }
-            dest += 8;
-          }
-          src += stride * 3;
+      for (unsigned level = 0; level != mip_levels; ++level) {
+        size_t size = compressed ? bc_encoder::get_size(format, w, h) : (size_t)w * h * num_comps;
+        if (size > (size_t)(src_max - src)) break;
+        if (compressed) {
+          glCompressedTexImage2D(target, level, format, w, h, 0, (GLsizei)size, (void*)src);
+        } else {
+          glTexImage2D(target, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
         }
-        w >>= 1;
-        h >>= 1;
-        stride >>= 1;
-        new_mip_levels++;
+        src += size;
+        w = mipmap_generator::get_level_size(w);
+        h = mipmap_generator::get_level_size(h);
       }
-      assert(dest - &result[0] < (int)result.size());
-      bytes.resize((int)(dest - &result[0]));
-      memcpy(&bytes[0], &result[0], dest - &result[0]);
-      format = COMPRESSED_RGB_S3TC_DXT1_EXT;
-      mip_levels = new_mip_levels;
     }
 
     void add_texture() {
       glBindTexture(gl_target, gl_texture);
 
-      if (mip_levels == 1 || gl_target != GL_TEXTURE_2D) {
-        if (gl_target == GL_TEXTURE_2D) {
-          glTexImage2D(gl_target, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
-          // this may not work on very old systems, comment it out.
-          glGenerateMipmap(gl_target);
-        } else if (gl_target == GL_TEXTURE_3D) {
-          glTexImage3D(gl_target, 0, format, width, height, 1, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
-          printf("err=%08x\n", glGetError());
-        } else if (gl_target == GL_TEXTURE_CUBE_MAP) {
-          unsigned num_comps = format == RGBA ? 4 : 3;
-          for (int i = 0; i != 6; ++i) {
-            size_t offset = width * height * num_comps * i;
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[offset]);
-            //static const unsigned cols[6] = { 0xff0000ff, 0xffff00ff, 0xffffffff, 0xff00ffff, 0x0000ffff, 0x00ffffff };
-            //glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, 1, 1, 0, format, GL_UNSIGNED_BYTE, (void*)&cols[i]);
-          }
-          glGenerateMipmap(gl_target);
+      // rows of odd sized levels are not padded.
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+      if (gl_target == GL_TEXTURE_3D) {
+        glTexImage3D(gl_target, 0, format, width, height, 1, 0, format, GL_UNSIGNED_BYTE, (void*)&bytes[0]);
+        printf("err=%08x\n", glGetError());
+      } else if (gl_target == GL_TEXTURE_CUBE_MAP) {
+        size_t face_size = bytes.size() / 6;
+        for (int i = 0; i != 6; ++i) {
+          const uint8_t *face = &bytes[face_size * i];
+          add_levels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, face, face + face_size);
         }
       } else if (gl_target == GL_TEXTURE_2D) {
-        unsigned num_comps = format == RGBA ? 4 : 3;
-        unsigned w = width;
-        unsigned h = height;
-        uint8_t *src = &bytes[0];
-        unsigned level = 0;
-        while (w != 0 && h != 0) {
-          glTexImage2D(gl_target, level++, format, w, h, 0, format, GL_UNSIGNED_BYTE, (void*)src);
-          src += w * h * num_comps;
-          w >>= 1;
-          h >>= 1;
+        add_levels(gl_target, &bytes[0], &bytes[0] + bytes.size());
+      }
+
+      if (gl_target != GL_TEXTURE_3D) {
+        if (mip_levels == 1 && (width > 1 || height > 1) && !bc_encoder::get_block_bytes(format)) {
+          // formats with no mipmaps
+          glGenerateMipmap(gl_target);
+        } else if (mip_levels > 1 && mip_levels < mipmap_generator::get_num_levels(width, height)) {
+          // files with some of the levels
+          glTexParameteri(gl_target, GL_TEXTURE_MAX_LEVEL, mip_levels - 1);
         }
       }
     }
@@ -252,6 +312,24 @@ namespace octet { namespace scene {
   public:
     RESOURCE_META(image)
 
+    // these are here to avoid including glext.h which may be platform dependent.
+    enum {
+      // format options
+      DEPTH_COMPONENT = 0x1902,
+      ALPHA = 0x1906,
+      RGB = 0x1907,
+      RGBA = 0x1908,
+      LUMINANCE = 0x1909,
+      LUMINANCE_ALPHA = 0x190A,
+      COMPRESSED_RGB_S3TC_DXT1_EXT = 0x83F0,
+      COMPRESSED_RGBA_S3TC_DXT1_EXT = 0x83F1,
+      COMPRESSED_RGBA_S3TC_DXT3_EXT = 0x83F2,
+      COMPRESSED_RGBA_S3TC_DXT5_EXT = 0x83F3,
+      COMPRESSED_RED_RGTC1 = 0x8DBB,
+      COMPRESSED_RG_RGTC2 = 0x8DBD,
+      COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C,
+    };
+
     /// default constructor makes a blank image.
     image() {
       init("");
@@ -269,10 +347,14 @@ namespace octet { namespace scene {
       width = _width;
       height = _height;
       depth = _depth; // for 3D textures
+      frames = 1;
+      compression = 0;
+      uploader = 0;
     }
 
     /// release resources.
     ~image() {
+      delete uploader;
     }
 
     /// width in pixels
@@ -296,10 +378,44 @@ namespace octet { namespace scene {
     }
 
     /// animated textures have multiple frames. eg. MPEG file. return ~0 for infinite.
+    /// The frames of a 2D animation are stacked up in the texture, each get_height()/get_frames()
+    /// pixels tall with the first at the bottom, so frame n is at v = n/frames to (n+1)/frames.
     unsigned get_frames() const {
       return frames;
     }
 
+    /// seconds to show a frame of an animation for, or zero if the file does not say.
+    float get_frame_delay(unsigned frame) const {
+      return frame < frame_delays.size() ? frame_delays[frame] : 0.0f;
+    }
+
+    /// Compress the image when it is loaded: COMPRESSED_RGB_S3TC_DXT1_EXT (BC1),
+    /// COMPRESSED_RGBA_S3TC_DXT5_EXT (BC3), COMPRESSED_RED_RGTC1 (BC4), COMPRESSED_RG_RGTC2 (BC5)
+    /// or COMPRESSED_RGBA_BPTC_UNORM (BC7). Zero turns compression off.
+    ///
+    /// BC1 and BC4 textures are an eighth of the size of RGBA, the others a quarter.
+    void set_compression(unsigned new_format) {
+      compression = (uint16_t)new_format;
+    }
+
+    /// Choose the filter for the mipmaps: mipmap_generator::filter_box (the default),
+    /// filter_kaiser or filter_lanczos. Call this before loading.
+    void set_mipmap_filter(unsigned filter) {
+      mipmaps.set_filter((mipmap_generator::filter_t)filter);
+    }
+
+    /// The image holds sRGB colours (the default), so mipmaps are made in linear space.
+    /// Turn this off for normal maps and other data.
+    void set_srgb(bool srgb) {
+      mipmaps.set_srgb(srgb);
+    }
+
+    /// For alpha tested textures: keep the fraction of pixels with alpha above ref the same
+    /// in every mipmap, so that leaves and fences do not thin out in the distance.
+    void set_alpha_coverage(float ref) {
+      mipmaps.set_alpha_coverage(ref);
+    }
+
     /// access attributes by name
     void visit(visitor &v) {
       v.visit(url, atom_url);
@@ -334,24 +450,185 @@ namespace octet { namespace scene {
       }
     }
 
+    /// Key for the texture made from a source file with the current settings,
+    /// or zero if it is not to be cached. Only compressed textures are worth caching.
+    uint64_t get_cache_key(const uint8_t *src, size_t size) const {
+      if (!compression || cube_faces != 1 || !texture_cache::get().is_enabled()) return 0;
+      uint32_t params[6] = { compression, bc_encoder::version };
+      mipmaps.get_settings(params + 2);
+      return texture_cache::make_key(src, size, params, 6);
+    }
+
+    /// Start loading the image on the I/O threads.
+    ///
+    /// The file is decoded on a worker thread a piece at a time. GIF, JPEG and TGA rows
+    /// are copied to the texture at the end of each frame as they are decoded, so large
+    /// textures fill in while they load. Until the first rows arrive, get_gl_texture() returns zero.
+    /// Cube maps are loaded synchronously.
+    void load_async(int priority = url_loader::priority_visible) {
+      if (pending && pending->is_finished()) pending = 0;
+      if (cube_faces != 1 || gl_texture || pending || url.empty()) return;
+
+      ref<image> self = this;
+      pending = url_loader::get().request(url.c_str(), priority,
+        [this](url_request *req) {
+          decode_stream(req);
+        },
+        [self](url_request *) {
+          self->end_load();
+        }
+      );
+    }
+
+    /// Raise or lower the priority of an asynchronous load.
+    void set_load_priority(int priority) {
+      if (pending) url_loader::get().set_priority(pending, priority);
+    }
+
+    /// Cancel an asynchronous load.
+    ///
+    /// A decode that has started stops at the next chunk; is_loading() stays true until it has,
+    /// as the worker is still writing to the image until then.
+    void cancel_load() {
+      if (pending) {
+        pending->cancel();
+      }
+    }
+
+    /// Return true if an asynchronous load is in progress.
+    bool is_loading() const {
+      return pending && !pending->is_finished();
+    }
+
+    /// Make a decoder for a file from its first few bytes, or return null if there is none.
+    /// NIFTI volumes and KTX2 files are not streamed: KTX2 levels are stored smallest first.
+    static image_decoder *new_decoder(const uint8_t *src, size_t size) {
+      if (size >= 6 && !memcmp(src, "GIF8", 4)) {
+        return new gif_decoder();
+      } else if (size >= 6 && src[0] == 0xff && src[1] == 0xd8) {
+        return new jpeg_decoder();
+      } else if (size >= 6 && src[0] == 0 && src[1] == 0 && src[2] == 2) {
+        return new tga_decoder();
+      } else if (size >= 4 && src[0] == 'D' && src[1] == 'D' && src[2] == 'S' && src[3] == ' ') {
+        return new dds_decoder();
+      }
+      return 0;
+    }
+
+    /// Decode a file a piece at a time on a worker thread, passing finished rows to the main thread.
+    ///
+    /// The file is mapped, so the OS reads ahead while we decode the part we have.
+    void decode_stream(url_request *req) {
+      const uint8_t *src = req->get_data();
+      size_t size = req->get_size();
+
+      // no rows have been uploaded yet, so the cached texture can go straight in.
+      uint64_t key = get_cache_key(src, size);
+      if (load_cached(key)) return;
+
+      image_decoder *dec = new_decoder(src, size);
+      if (!dec) {
+        bytes.resize(0);
+        decode_part(src, size);
+        return;
+      }
+
+      if (!uploader) uploader = new row_uploader(this);
+      bytes.resize(0);
+      mip_levels = 1;
+      dec->begin(bytes, uploader);
+      for (size_t pos = 0; pos < size; ) {
+        // stop early if the load was cancelled.
+        if (req->get_state() != url_request::state_loading) break;
+        size_t chunk = size - pos < (size_t)stream_chunk_size ? size - pos : (size_t)stream_chunk_size;
+        if (!dec->feed(src + pos, chunk)) break;
+        pos += chunk;
+      }
+      bool complete = dec->end();
+
+      {
+        std::lock_guard<std::mutex> guard(uploader->mutex);
+        set_frames(*dec);
+        mip_levels = (uint8_t)dec->get_num_levels();
+        delete dec;
+      }
+
+      // the uploads are kept out while the bytes move.
+      make_mipmaps(&uploader->mutex);
+      if (compression) compress(compression, &uploader->mutex);
+
+      // don't cache part of an image: the file was broken, or the load was cancelled.
+      if (complete && req->get_state() == url_request::state_loading) {
+        save_cached(key);
+      }
+    }
+
+    /// The asynchronous load has finished: make the texture, or replace the rows uploaded so far.
+    void end_load() {
+      pending = 0;
+      if (gl_texture && bytes.size()) {
+        glActiveTexture(GL_TEXTURE0);
+        add_texture();
+        glTexParameteri(gl_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(gl_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      } else {
+        get_gl_texture();
+      }
+    }
+
+    /// Stack the frames of an animation up in the texture.
+    void set_frames(const image_decoder &dec) {
+      frames = dec.get_frames() ? dec.get_frames() : 1;
+      frame_delays.resize(0);
+      if (frames > 1) {
+        height = (uint16_t)(dec.get_height() * frames);
+        for (unsigned i = 0; i != frames; ++i) {
+          frame_delays.push_back(dec.get_frame_delay(i));
+        }
+      }
+    }
+
+    /// load one image (or cube face) from a url
     void load_part(const char *_url) {
-      dynarray<uint8_t> buffer;
-      app_utils::get_url(buffer, _url);
-      const unsigned char *src = &buffer[0];
-      const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+      // the decoders read directly from the mapped file.
+      ref<file_map> map = app_utils::map_url(_url);
+      decode_part(map->get_data(), (size_t)map->get_size());
+    }
+
+    /// decode one image (or cube face) from the contents of a file.
+    void decode_part(const uint8_t *src, size_t size) {
+      if (size == 0) {
+        printf("warning: empty texture file\n");
+        return;
+      }
+      uint64_t key = get_cache_key(src, size);
+      if (load_cached(key)) return;
+
+      const unsigned char *src_max = src + size;
+      mip_levels = 1;
+      if (size >= 6 && !memcmp(src, "GIF8", 4)) {
         gif_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
+        set_frames(dec);
+      } else if (size >= 6 && src[0] == 0xff && src[1] == 0xd8) {
         jpeg_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
+      } else if (size >= 6 && src[0] == 0 && src[1] == 0 && src[2] == 2) {
         tga_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
+      } else if (size >= 4 && src[0] == 'D' && src[1] == 'D' && src[2] == 'S' && src[3] == ' ') {
         dds_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 348 && (!memcmp(&buffer[344], "ni1", 4) || !memcmp(&buffer[344], "n+1", 4))) {
+        mip_levels = (uint8_t)dec.get_num_levels();
+      } else if (ktx_decoder::is_ktx2(src, size)) {
+        ktx_decoder dec;
+        dec.get_image(bytes, format, width, height, src, src_max);
+        mip_levels = (uint8_t)dec.get_num_levels();
+        if (dec.get_num_faces() == 6) {
+          gl_target = GL_TEXTURE_CUBE_MAP;
+          cube_faces = 6;
+        }
+      } else if (size >= 348 && (!memcmp(src + 344, "ni1", 4) || !memcmp(src + 344, "n+1", 4))) {
         nifti_decoder dec;
         gl_target = GL_TEXTURE_3D;
         dec.get_image(bytes, format, width, height, depth, frames, src, src_max);
@@ -361,11 +638,18 @@ namespace octet { namespace scene {
       }
 
       make_mipmaps();
-      //dxt_encode();
+      if (compression) compress(compression);
+      save_cached(key);
     }
 
     /// get the OpenGL texture handle for this image.
     GLuint get_gl_texture() {
+      if (pending) {
+        // still streaming: draw with the rows we have so far, or without a texture.
+        if (!pending->is_finished()) return gl_texture;
+        pending = 0;
+      }
+
       if (!gl_texture) {
         if (bytes.size() == 0 || width == 0 || height == 0) {
           load();
@@ -375,27 +659,8 @@ namespace octet { namespace scene {
         glGenTextures(1, &gl_texture);
         glActiveTexture(GL_TEXTURE0);
 
-        // todo: handle compressed textures
-        if (format == GL_RGB || format == GL_RGBA) {
+        if (mipmap_generator::get_num_comps(format) || bc_encoder::get_block_bytes(format)) {
           add_texture();
-        } else if (format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT3_EXT || format == COMPRESSED_RGBA_S3TC_DXT5_EXT) {
-          glBindTexture(gl_target, gl_texture);
-          unsigned w = width;
-          unsigned h = height;
-          uint8_t *src = &bytes[0];
-          unsigned level = 0;
-          unsigned shift = ( format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT ) ? 1 : 0;
-          while (w != 0 && h != 0) {
-            unsigned wmin = w < 4 ? 4 : w;
-            unsigned hmin = h < 4 ? 4 : h;
-            unsigned size = ( wmin * hmin ) >> shift;
-            glCompressedTexImage2D(gl_target, level++, format, w, h, 0, size, (void*)src);
-            //printf("%d\n", glGetError());
-            src += size;
-            w >>= 1;
-            h >>= 1;
-          }
-          //printf("%d %d\n", src - image_, size);
         }
 
         glTexParameteri(gl_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// image tests
+//
+// the texture cache and scratch files go in bin/.
+// no rows reach the texture in these tests, so no GL context is needed.
+//
+
+namespace octet { namespace scene {
+  /// Tests for image.
+  class image_test {
+    static const char *get_source() {
+      return "assets/invaderers/ship.gif";
+    }
+
+    static const char *get_truncated() {
+      return "bin/image_test_truncated.gif";
+    }
+
+    static image *new_image() {
+      image *img = new image();
+      img->set_compression(image::COMPRESSED_RGBA_S3TC_DXT5_EXT);
+      return img;
+    }
+
+    // true if a texture made from this file is in the cache.
+    static bool is_cached(const char *url) {
+      ref<file_map> map = app_utils::map_url(url);
+      ref<image> img = new_image();
+      ref<file_map> cached = texture_cache::get().load(img->get_cache_key(map->get_data(), (size_t)map->get_size()));
+      return cached != 0;
+    }
+
+    static void remove_cached(const char *url) {
+      ref<file_map> map = app_utils::map_url(url);
+      ref<image> img = new_image();
+      string name;
+      texture_cache::get().get_file_name(name, img->get_cache_key(map->get_data(), (size_t)map->get_size()));
+      remove(name.c_str());
+    }
+
+    // decode a file with decode_stream() as load_async() does, cancelling the request first if asked to.
+    static void load_stream(const char *url, bool cancel) {
+      ref<image> img = new_image();
+      std::atomic<bool> decoded(false);
+      ref<url_request> req = url_loader::get().request(url, url_loader::priority_visible,
+        [&img, &decoded, cancel](url_request *req) {
+          if (cancel) req->cancel();
+          img->decode_stream(req);
+          decoded.store(true, std::memory_order_release);
+        },
+        nullptr
+      );
+
+      // the row uploads queued by the decode do nothing once the image is compressed.
+      while (!decoded.load(std::memory_order_acquire) && !req->is_finished()) {
+        std::this_thread::yield();
+      }
+      while (!req->is_finished()) {
+        run_main_thread_jobs();
+        std::this_thread::yield();
+      }
+    }
+
+    static bool report(FILE *file, const char *name, bool ok) {
+      fprintf(file, "%-40s %s\n", name, ok ? "ok" : "FAILED");
+      return ok;
+    }
+
+  public:
+    /// Check that only complete images go in the texture cache. Returns false if any check fails.
+    static bool run(FILE *file = stdout) {
+      fprintf(file, "image\n");
+
+      string dir;
+      dir.format("%sbin/", app_utils::prefix());
+      texture_cache::get().set_dir(dir.c_str());
+
+      // the first frame of the file, cut off before the end of its first row.
+      ref<file_map> map = app_utils::map_url(get_source());
+      string truncated_path;
+      app_utils::get_path(truncated_path, get_truncated());
+      FILE *truncated = fopen(truncated_path.c_str(), "wb");
+      if (truncated) {
+        fwrite(map->get_data(), 1, (size_t)map->get_size() / 2, truncated);
+        fclose(truncated);
+      }
+
+      remove_cached(get_source());
+      remove_cached(get_truncated());
+
+      bool ok = true;
+      load_stream(get_source(), true);
+      ok = report(file, "cancelled load is not cached", !is_cached(get_source())) && ok;
+
+      load_stream(get_truncated(), false);
+      ok = report(file, "truncated file is not cached", truncated && !is_cached(get_truncated())) && ok;
+
+      // the cache works at all.
+      ref<image> img = new_image();
+      img->decode_part(map->get_data(), (size_t)map->get_size());
+      ok = report(file, "complete image is cached", is_cached(get_source())) && ok;
+
+      remove_cached(get_source());
+      remove_cached(get_truncated());
+      remove(truncated_path.c_str());
+      texture_cache::get().set_dir("");
+      return ok;
+    }
+  };
+} }
@@ -24,15 +24,152 @@ namespace octet { namespace scene {
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // -1 until we have asked the shader if it supports instancing
+    int8_t instancing;
+
+    // drawn after the opaque materials, farthest first. See set_blended()
+    bool blended;
+
+    // the parameters that change every draw come first in params so that we do not search for them.
+    enum {
+      slot_modelToProjection,
+      slot_modelToCamera,
+      slot_lighting,
+      slot_num_lights,
+      slot_instanced,
+      num_dynamic_slots,
+    };
+    bool dynamic_params;
+
+    // one bit for each of the first 64 params that has changed since we last sent it with glUniform*
+    uint64_t dirty_params;
+
+    #if OCTET_UNIFORM_BLOCKS
+      // colours etc. for shaders with an octet_material block
+      uniform_block material_block;
+
+      // the lighting and matrix blocks are shared by all materials
+      static uniform_block &get_shared_block(unsigned block) {
+        static uniform_block blocks[param::num_blocks];
+        return blocks[block];
+      }
+
+      uniform_block &get_block(unsigned block) {
+        return block == param::block_material ? material_block : get_shared_block(block);
+      }
+    #endif
+
+    // state that every constructor sets up
+    void init_flags() {
+      instancing = -1;
+      blended = false;
+      dynamic_params = false;
+      dirty_params = ~(uint64_t)0;
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
       param_buffer_info dynamic_pbi(buffer);
 
+      // same order as slot_*
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToProjection, GL_FLOAT_MAT4, 1, param::stage_vertex));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToCamera, GL_FLOAT_MAT4, 1, param::stage_vertex));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_lighting, GL_FLOAT_VEC4, ambient_size + max_lights * light_size, param::stage_fragment));
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
+      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_instanced, GL_BOOL, 1, param::stage_vertex));
+      dynamic_params = true;
+    }
+
+    param_uniform *get_dynamic_param(unsigned slot) {
+      return static_cast<param_uniform*>((param*)params[slot]);
+    }
+
+    void mark_dirty(unsigned index) {
+      if (index < 64) dirty_params |= (uint64_t)1 << index;
+    }
+
+    bool is_dirty(unsigned index) const {
+      return index >= 64 || ((dirty_params >> index) & 1) != 0;
+    }
+
+    // copy a value into the buffer, noting if it has changed.
+    void set_param(unsigned index, param_uniform *pu, const void *value, unsigned size) {
+      uint8_t *dest = buffer.data() + pu->get_offset();
+      if (memcmp(dest, value, size)) {
+        memcpy(dest, value, size);
+        mark_dirty(index);
+      }
+    }
+
+    // matrices and lighting go in the dynamic uniform buffer
+    void set_dynamic_params(const mat4t &toProjection, const mat4t &toCamera, bool instanced, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      if (!dynamic_params) return;
+      int32_t num_lights_value = num_lights;
+      int32_t instanced_value = instanced;
+      set_param(slot_modelToProjection, get_dynamic_param(slot_modelToProjection), toProjection.get(), sizeof(toProjection));
+      set_param(slot_modelToCamera, get_dynamic_param(slot_modelToCamera), toCamera.get(), sizeof(toCamera));
+      set_param(slot_lighting, get_dynamic_param(slot_lighting), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      set_param(slot_num_lights, get_dynamic_param(slot_num_lights), &num_lights_value, sizeof(int32_t));
+      set_param(slot_instanced, get_dynamic_param(slot_instanced), &instanced_value, sizeof(int32_t));
+    }
+
+    // send a parameter to its uniform block, or with glUniform* if it has changed.
+    // samplers also bind their texture, which is not part of the program.
+    void upload_param(unsigned index, param_uniform *pu) {
+      #if OCTET_UNIFORM_BLOCKS
+        unsigned block = pu->get_uniform_buffer_index();
+        if (block != param::block_none) {
+          get_block(block).set(pu->get_block_offset(), buffer.data() + pu->get_offset(), pu->get_block_size());
+          return;
+        }
+      #endif
+      if (is_dirty(index) || pu->is_sampler()) {
+        pu->render(buffer.data());
+      }
+    }
+
+    // set the program and send the uniforms that have changed to OpenGL
+    void render_params() {
+      custom_shader->render();
+
+      // if another material has used this program since, all its uniforms need setting again.
+      if (custom_shader->get_last_user() != this) {
+        dirty_params = ~(uint64_t)0;
+        custom_shader->set_last_user(this);
+      }
+
+      #if OCTET_UNIFORM_BLOCKS
+        for (unsigned i = 0; i != param::num_blocks; ++i) {
+          get_block(i).reserve(custom_shader->get_block_size(i));
+        }
+      #endif
+
+      for (unsigned i = 0; i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        if (pu) {
+          upload_param(i, pu);
+        }
+      }
+      dirty_params = 0;
+
+      #if OCTET_UNIFORM_BLOCKS
+        for (unsigned i = 0; i != param::num_blocks; ++i) {
+          if (custom_shader->get_block_size(i)) {
+            get_block(i).bind(i);
+          }
+        }
+      #endif
+    }
+
+    // find the index of a parameter in params
+    int get_param_index(const param *p) const {
+      for (unsigned i = 0; i != params.size(); ++i) {
+        if (params[i] == p) {
+          return (int)i;
+        }
+      }
+      return -1;
     }
 
     // create the attribute parameters
@@ -53,10 +190,13 @@ namespace octet { namespace scene {
 
     /// Default constructor makes a blank material.
     material() {
+      init_flags();
     }
 
     /// Alternative constructor.
     material(const vec4 &color, param_shader *shader = NULL) {
+      init_flags();
+
       // materials are constructed from parameters which build the final shader.
       // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
       params.reserve(16);
@@ -76,6 +216,7 @@ namespace octet { namespace scene {
 
     /// create a material from an existing image
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
+      init_flags();
       if (!smpl) smpl = new sampler();
 
       params.reserve(16);
@@ -94,6 +235,7 @@ namespace octet { namespace scene {
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      init_flags();
     }
 
     /// Serialize.
@@ -107,33 +249,64 @@ namespace octet { namespace scene {
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      set_dynamic_params(modelToProjection, modelToCamera, false, light_uniforms, num_light_uniforms, num_lights);
+      render_params();
+    }
 
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+    /// Set the uniforms for instanced drawing.
+    /// Each instance supplies its own model to world matrix in the instanceToWorld attribute.
+    void render_instanced(const mat4t &worldToProjection, const mat4t &worldToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      set_dynamic_params(worldToProjection, worldToCamera, true, light_uniforms, num_light_uniforms, num_lights);
+      render_params();
+    }
 
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+    /// Change only the matrices of a material that was the last one rendered with render().
+    /// This saves setting the program, colours and textures again when drawing many objects with one material.
+    void render_matrices(const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      if (!dynamic_params) return;
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
-      }
+      param_uniform *modelToProjection_param = get_dynamic_param(slot_modelToProjection);
+      set_param(slot_modelToProjection, modelToProjection_param, modelToProjection.get(), sizeof(modelToProjection));
+      upload_param(slot_modelToProjection, modelToProjection_param);
 
-      custom_shader->render();
+      param_uniform *modelToCamera_param = get_dynamic_param(slot_modelToCamera);
+      set_param(slot_modelToCamera, modelToCamera_param, modelToCamera.get(), sizeof(modelToCamera));
+      upload_param(slot_modelToCamera, modelToCamera_param);
 
-      {
-        // colours and textures go in the static uniform buffer
-        for (unsigned i = 0; i != params.size(); ++i) {
-          param_uniform *pu = params[i]->get_param_uniform();
-          if (pu) {
-            //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
-            pu->render(buffer.data());
-          }
+      dirty_params &= ~(((uint64_t)1 << slot_modelToProjection) | ((uint64_t)1 << slot_modelToCamera));
+
+      #if OCTET_UNIFORM_BLOCKS
+        if (custom_shader->get_block_size(param::block_draw)) {
+          get_shared_block(param::block_draw).upload();
         }
+      #endif
+    }
+
+    /// Can this material's shader draw many instances at once? (see render_instanced)
+    bool can_instance() {
+      if (instancing == -1) {
+        param_uniform *instanced_param = get_param_uniform(atom_instanced);
+        bool has_uniform = instanced_param && (instanced_param->get_uniform() != -1 || instanced_param->get_uniform_buffer_index() != param::block_none);
+        instancing = custom_shader && has_uniform && gl_features::get().has_instancing() &&
+          glGetAttribLocation(custom_shader->get_program(), "instanceToWorld") == attribute_instance_matrix;
       }
+      return instancing != 0;
+    }
+
+    /// Does this material blend with what is behind it?
+    bool is_blended() const {
+      return blended;
+    }
+
+    /// Blended materials are drawn after the opaque ones, farthest first.
+    /// The default shaders write an alpha of one, so call this for custom shaders that write alpha.
+    void set_blended(bool value) {
+      blended = value;
+    }
+
+    /// get the shader program for sorting draws.
+    GLuint get_program() const {
+      return custom_shader ? custom_shader->get_program() : 0;
     }
 
     /// Set the uniforms for this material on skinned meshes.
@@ -160,13 +333,15 @@ namespace octet { namespace scene {
 
     /// set the diffuse color parameter (if it exists)
     void set_diffuse(const vec4 &color) {
-      if (param *p = get_param_uniform(atom_diffuse)) {
-        p->get_param_uniform()->set_value(buffer.data(), &color, sizeof(color));
+      if (param_uniform *p = get_param_uniform(atom_diffuse)) {
+        set_uniform(p, &color, sizeof(color));
       }
     }
 
     void set_uniform(param_uniform *param, const void *data, size_t size) {
       memcpy(buffer.data() + param->get_offset(), data, size);
+      int index = get_param_index(param);
+      if (index != -1) mark_dirty((unsigned)index);
     }
 
     dynarray<ref<param> > &get_params() {
@@ -181,6 +356,7 @@ namespace octet { namespace scene {
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
       result->bind(pbind);
+      mark_dirty(params.size() - 1);
       return result;
     }
 
@@ -193,6 +369,7 @@ namespace octet { namespace scene {
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
       result->bind(pbind);
+      mark_dirty(params.size() - 1);
       return result;
     }
   };
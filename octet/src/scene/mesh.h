@@ -51,6 +51,13 @@ namespace octet { namespace scene {
 
     uint8_t num_slots;
 
+    // vertex array object holding the attribute pointers and index buffer binding.
+    // rebuilt by enable_attributes() when the format or buffers change.
+    GLuint vao;
+    GLuint vao_vertices;
+    GLuint vao_indices;
+    bool vao_dirty;
+
     // optional skin
     ref<skin> mesh_skin;
     
@@ -158,7 +165,7 @@ namespace octet { namespace scene {
     }
 
     /// clone a mesh. Note that this does not also clone the vertices and indices.
-    mesh(const mesh &rhs) {
+    mesh(const mesh &rhs) : resource() {
       vertices = rhs.vertices;
       indices = rhs.indices;
 
@@ -177,6 +184,10 @@ namespace octet { namespace scene {
       mode = rhs.mode;
 
       mesh_skin = rhs.mesh_skin;
+
+      vao = 0;
+      vao_vertices = vao_indices = 0;
+      vao_dirty = true;
     }
 
     /// Init function used for aggregated meshes.
@@ -198,6 +209,10 @@ namespace octet { namespace scene {
       index_type = GL_UNSIGNED_SHORT;
       mode = GL_TRIANGLES;
 
+      vao = 0;
+      vao_vertices = vao_indices = 0;
+      vao_dirty = true;
+
       mesh_skin = _skin;
 
       if (max_vertices || max_indices) {
@@ -221,10 +236,14 @@ namespace octet { namespace scene {
       v.visit(num_slots, atom_num_slots);
       v.visit(mesh_skin, atom_mesh_skin);
       v.visit(mesh_aabb, atom_aabb);
+      vao_dirty = true;
     }
 
     // Destructor
     ~mesh() {
+      #if OCTET_VERTEX_ARRAYS
+        if (vao) glDeleteVertexArrays(1, &vao);
+      #endif
     }
 
     /// Set the defuault mesh parameters, used for boxes, spheres etc.
@@ -238,6 +257,7 @@ namespace octet { namespace scene {
     /// reset the mesh to empty.
     void clear_attributes() {
       num_slots = 0;
+      vao_dirty = true;
     }
 
     /// Add an extra attribute to the mesh. eg. add_attribute(attribute_pos, 3, GL_FLOAT, 0)
@@ -245,6 +265,7 @@ namespace octet { namespace scene {
       assert(num_slots < max_slots);
       format[num_slots] = (offset << 9) + (attr << 5) + ((size-1) << 3) + (kind - GL_BYTE);
       if (norm) normalized |= 1 << num_slots;
+      vao_dirty = true;
       return num_slots++;
     }
 
@@ -431,6 +452,7 @@ namespace octet { namespace scene {
     void allocate(size_t vsize, size_t isize) {
       vertices->allocate(GL_ARRAY_BUFFER, vsize);
       indices->allocate(GL_ELEMENT_ARRAY_BUFFER, isize);
+      vao_dirty = true;
     }
 
     /// allocate and assign data to IBO and VBO
@@ -446,6 +468,7 @@ namespace octet { namespace scene {
       num_vertices = (uint32_t)num_vertices_;
       mode = mode_;
       index_type = index_type_;
+      vao_dirty = true;
     }
 
     /// dump the mesh to a file in ASCII. Used to debug mesh transforms.
@@ -474,7 +497,32 @@ namespace octet { namespace scene {
 
     /// When rendering a mesh, call this first to enable the attributes.
     /// assume the shader, uniforms and render params are already set up.
-    void enable_attributes() const {
+    /// With vertex array objects, this just binds the mesh's VAO, building it first if the format has changed.
+    void enable_attributes() {
+      #if OCTET_VERTEX_ARRAYS
+        if (gl_features::get().has_vertex_arrays()) {
+          GLuint ibo = get_index_type() && indices ? indices->get_buffer() : 0;
+          if (vao_dirty || vao_vertices != vertices->get_buffer() || vao_indices != ibo) {
+            // start again with a fresh VAO so that no old attributes stay enabled.
+            if (vao) glDeleteVertexArrays(1, &vao);
+            glGenVertexArrays(1, &vao);
+            glBindVertexArray(vao);
+            bind_attributes();
+            if (ibo) indices->bind();
+            vao_vertices = vertices->get_buffer();
+            vao_indices = ibo;
+            vao_dirty = false;
+          } else {
+            glBindVertexArray(vao);
+          }
+          return;
+        }
+      #endif
+      bind_attributes();
+    }
+
+    /// set the attribute pointers for each slot and enable them.
+    void bind_attributes() const {
       vertices->bind();
 
       unsigned n = normalized;
@@ -493,15 +541,37 @@ namespace octet { namespace scene {
     void draw() {
       //printf("de %04x %d %d\n", get_mode(), get_num_vertices(), get_index_type());
       if (get_index_type()) {
-        indices->bind();
+        // the VAO already has the index buffer.
+        if (!vao) {
+          indices->bind();
+        }
         glDrawElements(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index));
       } else {
         glDrawArrays(get_mode(), 0, get_num_vertices());
       }
     }
 
+    #if OCTET_INSTANCING
+      /// Draw many copies of the primitives.
+      /// Per-instance attributes, such as the instance matrix, must be enabled with a divisor of one.
+      void draw_instanced(unsigned num_instances) {
+        if (get_index_type()) {
+          glDrawElementsInstanced(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index), num_instances);
+        } else {
+          glDrawArraysInstanced(get_mode(), 0, get_num_vertices(), num_instances);
+        }
+      }
+    #endif
+
     /// When rendering a mesh, call this last to disable attributes.
     void disable_attributes() {
+      #if OCTET_VERTEX_ARRAYS
+        if (vao) {
+          // the attributes stay enabled in our VAO; go back to the default one.
+          glBindVertexArray(0);
+          return;
+        }
+      #endif
       for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
         unsigned attr = get_attr(slot);
         glDisableVertexAttribArray(attr);
@@ -634,6 +704,7 @@ namespace octet { namespace scene {
     /// set a new VBO object
     void set_vertices(gl_resource *value) {
       vertices = value;
+      vao_dirty = true;
     }
 
     /// assign a vector to the vertex buffer and set params
@@ -645,11 +716,13 @@ namespace octet { namespace scene {
       vertices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       stride = sizeof(elem_t);
       set_num_vertices(rhs.size());
+      vao_dirty = true;
     }
 
     /// set a new IBO object
     void set_indices(gl_resource *value) {
       indices = value;
+      vao_dirty = true;
     }
 
     /// assign a vector to the index buffer and set params
@@ -662,6 +735,7 @@ namespace octet { namespace scene {
       set_index_type(sizeof(elem_t) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
       set_num_indices(rhs.size());
       set_first_index(0);
+      vao_dirty = true;
     }
 
     /// Get all the edges in a hash map to avoid duplicates.
@@ -23,6 +23,21 @@ namespace octet { namespace scene {
       stage_max
     };
 
+    /// std140 uniform blocks that a shader may declare instead of plain uniforms.
+    enum block_type {
+      block_frame,     // octet_frame: lighting, the same for every draw in a frame
+      block_material,  // octet_material: colours etc.
+      block_draw,      // octet_draw: matrices
+      num_blocks,
+      block_none = 0xff
+    };
+
+    /// name of a uniform block in the shader; also its binding point.
+    static const char *get_block_name(unsigned block) {
+      static const char *names[] = { "octet_frame", "octet_material", "octet_draw" };
+      return block < num_blocks ? names[block] : "";
+    }
+
   private:
     atom_t name;
     stage_type stage_;
@@ -102,13 +117,14 @@ namespace octet { namespace scene {
   /// Uniforms are used to send parameters to OpenGL that do not change between triangles or fragments.
   ///
   /// For OpenGL ES2 we keep uniforms in a dynarray and use glUniform* to copy them to OpenGL.
-  /// For OpenGL ES3 we keep uniforms in a uniform buffer and use the buffer.
+  /// For OpenGL 3 we also copy uniforms that the shader puts in a uniform block to a uniform buffer.
   /// The parameter uniform records the location, name and type of the uniform as well as the repeat count for arrays.
   class param_uniform : public param {
     GLint uniform;           // uniform index
     uint16_t offset;         // offset in uniform buffer
     uint16_t repeat;         // how many in array?
-    uint8_t uniform_buffer;  // Which uniform buffer? 0 = dynamic, 1 = static.
+    uint8_t uniform_buffer;  // Which uniform block? (block_none for plain uniforms)
+    uint16_t block_offset;   // std140 offset in the uniform block
   public:
     RESOURCE_META(param_uniform)
 
@@ -120,7 +136,10 @@ namespace octet { namespace scene {
     param_uniform(param_buffer_info &pbi, const void *data, atom_t name, uint16_t _type, uint16_t _repeat, stage_type _stage=stage_fragment) :
       param(name, _type, _stage)
     {
+      uniform = -1;
       repeat = _repeat;
+      uniform_buffer = block_none;
+      block_offset = 0;
 
       // in uniform buffers, everything is in units of 16 bytes
       // matrices are repeats of vec4s
@@ -171,6 +190,34 @@ namespace octet { namespace scene {
     void bind(param_bind_info &pbi) {
       uniform = glGetUniformLocation(pbi.program, get_atom_name());
       //log("bind %d %s\n", uniform, get_atom_name());
+
+      uniform_buffer = block_none;
+      block_offset = 0;
+      #if OCTET_UNIFORM_BLOCKS
+        // uniforms in blocks have no location, find which block they are in instead.
+        if (uniform == -1 && gl_features::get().has_uniform_blocks()) {
+          const char *name = get_atom_name();
+          GLuint index = GL_INVALID_INDEX;
+          glGetUniformIndices(pbi.program, 1, &name, &index);
+          if (index != GL_INVALID_INDEX) {
+            GLint block = -1;
+            GLint block_offset_ = 0;
+            glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+            glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_OFFSET, &block_offset_);
+            char block_name[64];
+            block_name[0] = 0;
+            if (block != -1) {
+              glGetActiveUniformBlockName(pbi.program, block, sizeof(block_name), NULL, block_name);
+            }
+            for (unsigned i = 0; i != num_blocks; ++i) {
+              if (!strcmp(block_name, get_block_name(i))) {
+                uniform_buffer = i;
+                block_offset = (uint16_t)block_offset_;
+              }
+            }
+          }
+        }
+      #endif
     }
 
     /// get the uniform location
@@ -192,11 +239,37 @@ namespace octet { namespace scene {
       return buffer + offset;
     }
 
-    /// which uniform buffer does this parameter belong to?
+    /// which uniform block does this parameter belong to? (block_none if it is a plain uniform)
     uint8_t get_uniform_buffer_index() {
       return uniform_buffer;
     }
 
+    /// the offset of this parameter in its uniform block.
+    unsigned get_block_offset() const {
+      return block_offset;
+    }
+
+    /// the number of bytes to copy to the uniform block.
+    /// std140 packs scalars, vec2 and vec3 as they are, but array elements on 16 byte boundaries,
+    /// so only use vec4 and mat4 for arrays in blocks.
+    unsigned get_block_size() {
+      switch (get_gl_type()) {
+        case GL_FLOAT: case GL_INT: case GL_BOOL: case GL_UNSIGNED_INT: return 4;
+        case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+        case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+        case GL_FLOAT_MAT4: return repeat * 64;
+        default: return repeat * 16;
+      }
+    }
+
+    /// is this a texture sampler? These can not go in uniform blocks.
+    bool is_sampler() {
+      switch (get_gl_type()) {
+        case GL_SAMPLER_2D: case GL_SAMPLER_CUBE: case GL_SAMPLER_3D: case GL_SAMPLER_2D_SHADOW: return true;
+        default: return false;
+      }
+    }
+
     /// for OpenGL ES2, call glUniform* to copy the uniform to the GPU command buffer.
     /// for OpenGL ES3, we can use the uniform buffer directly and so don't need this.
     void render(const uint8_t *buffer) {
@@ -297,18 +370,100 @@ namespace octet { namespace scene {
     }
   };
 
+  #if OCTET_UNIFORM_BLOCKS
+    /// A uniform buffer object with a copy of its contents in memory.
+    ///
+    /// set() only marks the bytes that actually change and upload() sends just that range,
+    /// so values that are the same for every draw, like the lighting, go to OpenGL once.
+    class uniform_block {
+      dynarray<uint8_t> bytes;
+      GLuint buffer;
+      unsigned dirty_begin;
+      unsigned dirty_end;
+
+      uniform_block(const uniform_block &);
+      uniform_block &operator=(const uniform_block &);
+    public:
+      uniform_block() {
+        buffer = 0;
+        dirty_begin = ~0u;
+        dirty_end = 0;
+      }
+
+      ~uniform_block() {
+        if (buffer) glDeleteBuffers(1, &buffer);
+      }
+
+      /// make sure the block is at least this many bytes.
+      void reserve(unsigned size) {
+        unsigned old_size = bytes.size();
+        if (size <= old_size) return;
+        bytes.resize(size);
+        memset(bytes.data() + old_size, 0, size - old_size);
+        if (buffer) glDeleteBuffers(1, &buffer);
+        buffer = 0;
+      }
+
+      /// copy a value into the block.
+      void set(unsigned offset, const void *value, unsigned size) {
+        reserve(offset + size);
+        uint8_t *dest = bytes.data() + offset;
+        if (memcmp(dest, value, size)) {
+          memcpy(dest, value, size);
+          dirty_begin = std::min(dirty_begin, offset);
+          dirty_end = std::max(dirty_end, offset + size);
+        }
+      }
+
+      /// send changes to OpenGL.
+      void upload() {
+        if (!buffer) {
+          glGenBuffers(1, &buffer);
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+          glBufferData(GL_UNIFORM_BUFFER, bytes.size(), bytes.data(), GL_DYNAMIC_DRAW);
+        } else if (dirty_begin < dirty_end) {
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+          glBufferSubData(GL_UNIFORM_BUFFER, dirty_begin, dirty_end - dirty_begin, bytes.data() + dirty_begin);
+        }
+        dirty_begin = ~0u;
+        dirty_end = 0;
+      }
+
+      /// send changes to OpenGL and use this block for a binding point (see param::block_type).
+      void bind(unsigned binding) {
+        upload();
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+      }
+    };
+  #endif
+
   /// Shader that uses parameters.
+  ///
+  /// If either shader mentions OCTET_UNIFORM_BLOCKS and the context has uniform blocks (see gl_features),
+  /// we compile both as GLSL 1.40 with OCTET_UNIFORM_BLOCKS defined so that they can use the octet_frame,
+  /// octet_material and octet_draw std140 blocks. Otherwise uniforms are set one at a time with glUniform*.
   class param_shader : public shader {
     std::string vertex_shader;
     std::string fragment_shader;
 
+    // size in bytes of each uniform block, zero if the program does not use it.
+    unsigned block_sizes[param::num_blocks];
+
+    // the material that last set the uniforms of this program.
+    const void *last_user;
+
   public:
     RESOURCE_META(param_shader)
 
     param_shader() {
+      memset(block_sizes, 0, sizeof(block_sizes));
+      last_user = NULL;
     }
 
     param_shader(const char *vs_url, const char *fs_url) {
+      memset(block_sizes, 0, sizeof(block_sizes));
+      last_user = NULL;
+
       dynarray<uint8_t> vs;
       dynarray<uint8_t> fs;
       app_utils::get_url(vs, vs_url);
@@ -319,7 +474,31 @@ namespace octet { namespace scene {
     }
 
     void init(dynarray<ref<param> > &params) {
-      shader::init(vertex_shader.data(), fragment_shader.data());
+      #if OCTET_UNIFORM_BLOCKS
+        const char *blocks_define = "OCTET_UNIFORM_BLOCKS";
+        bool mentions_blocks = vertex_shader.find(blocks_define) != std::string::npos || fragment_shader.find(blocks_define) != std::string::npos;
+        memset(block_sizes, 0, sizeof(block_sizes));
+        if (mentions_blocks && gl_features::get().has_uniform_blocks()) {
+          std::string prologue = "#version 140\n#define OCTET_UNIFORM_BLOCKS 1\n";
+          shader::init((prologue + vertex_shader).c_str(), (prologue + fragment_shader).c_str());
+
+          for (unsigned i = 0; i != param::num_blocks; ++i) {
+            GLuint index = glGetUniformBlockIndex(get_program(), param::get_block_name(i));
+            if (index != GL_INVALID_INDEX) {
+              GLint size = 0;
+              glUniformBlockBinding(get_program(), index, i);
+              glGetActiveUniformBlockiv(get_program(), index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+              block_sizes[i] = (unsigned)size;
+            }
+          }
+        } else {
+          // the plain uniform version of the same source.
+          shader::init(vertex_shader.data(), fragment_shader.data());
+        }
+      #else
+        shader::init(vertex_shader.data(), fragment_shader.data());
+      #endif
+      last_user = NULL;
 
       param_bind_info pbi;
       pbi.program = get_program();
@@ -328,6 +507,21 @@ namespace octet { namespace scene {
         params[i]->bind(pbi);
       }
     }
+
+    /// size of a uniform block in bytes (see param::block_type); zero if the program does not use it.
+    unsigned get_block_size(unsigned block) const {
+      return block < param::num_blocks ? block_sizes[block] : 0;
+    }
+
+    /// the material that last set the uniforms of this program.
+    const void *get_last_user() const {
+      return last_user;
+    }
+
+    /// record which material has set the uniforms of this program.
+    void set_last_user(const void *value) {
+      last_user = value;
+    }
   };
 }}
 
@@ -0,0 +1,325 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Render queue: sort the draws of a frame to minimise state changes.
+//
+
+namespace octet { namespace scene {
+  /// Sorts the draws of a frame to minimise OpenGL state changes.
+  ///
+  /// Each draw gets a 64 bit key made of (from the top bits down) the pass, shader program, material, mesh and depth.
+  /// After sorting, each material sets its program, uniforms and textures once,
+  /// each mesh enables its attributes once and runs of the same mesh and material become
+  /// a single glDrawElementsInstanced call with the model to world matrices in a vertex buffer.
+  ///
+  /// Blended materials (see material::set_blended) go after the opaque draws of their pass and
+  /// are drawn farthest first, in the order they were added when they are at the same depth.
+  ///
+  /// On OpenGLES2 and OpenGL before 3.3, or when the material's shader does not read instanceToWorld,
+  /// runs are drawn one at a time.
+  ///
+  ///     queue.reset();
+  ///     queue.add(msh, mat, modelToWorld, distance);
+  ///     queue.render(cam, light_uniforms, num_light_uniforms, num_lights);
+  class render_queue {
+  public:
+    enum {
+      /// the smallest run of identical draws that we instance.
+      min_instances = 2,
+    };
+
+  private:
+    struct item {
+      uint64_t key;
+      mesh *msh;
+      material *mat;
+      const mat4t *modelToWorld;
+      int skin_offset; // first bone matrix in skin_matrices, or -1 if not skinned
+      int num_bones;
+
+      bool operator<(const item &rhs) const { return key < rhs.key; }
+    };
+
+    // a run of draws with the same mesh and material
+    struct batch {
+      unsigned first;
+      unsigned count;
+      int instance_offset; // -1 if not instanced
+    };
+
+    dynarray<item> items;
+    dynarray<batch> batches;
+
+    // small numbers for materials and meshes to put in the sort key
+    hash_map<const void *, unsigned> ids;
+
+    // bone to camera matrices of the skinned draws of this frame
+    dynarray<mat4t> skin_matrices;
+
+    // model to world matrices for the instanced batches of this frame
+    dynarray<mat4t> instance_matrices;
+    GLuint instance_buffer;
+
+    bool instancing;
+
+    // statistics for the last frame
+    unsigned num_draw_calls;
+    unsigned num_material_changes;
+    unsigned num_mesh_changes;
+
+    unsigned get_id(const void *ptr) {
+      // ids are only used for grouping, so starting again is harmless.
+      if (ids.size() == 0xffff) {
+        ids.clear();
+      }
+      unsigned &id = ids[ptr];
+      if (id == 0) id = ids.size();
+      return id;
+    }
+
+    // float bits sort in the same order as positive floats.
+    static uint32_t get_float_bits(float depth) {
+      if (!(depth > 0)) return 0;
+      union { float f; uint32_t u; } bits;
+      bits.f = depth;
+      return bits.u;
+    }
+
+    // opaque draws sort by program, material, mesh and then near to far (16 depth bits is about 1/128 precision).
+    // blended draws sort far to near and then by the order they were added.
+    uint64_t make_key(material *mat, mesh *msh, float depth, unsigned pass) {
+      uint64_t key = (uint64_t)(pass & 0xf) << 60;
+      if (mat->is_blended()) {
+        key |= (uint64_t)1 << 59;
+        key |= (uint64_t)(0xffffffff - get_float_bits(depth)) << 24;
+        key |= items.size() & 0xffffff;
+      } else {
+        uint64_t program = mat->get_program() & 0x7ff;
+        key |= program << 48;
+        key |= (uint64_t)get_id(mat) << 32;
+        key |= (uint64_t)get_id(msh) << 16;
+        key |= get_float_bits(depth) >> 15;
+      }
+      return key;
+    }
+
+    #if OCTET_INSTANCING
+      void enable_instance_matrices(int instance_offset) {
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+        for (unsigned i = 0; i != 4; ++i) {
+          GLuint attr = attribute_instance_matrix + i;
+          size_t offset = instance_offset * sizeof(mat4t) + i * sizeof(vec4);
+          glVertexAttribPointer(attr, 4, GL_FLOAT, GL_FALSE, sizeof(mat4t), (void*)offset);
+          glEnableVertexAttribArray(attr);
+          glVertexAttribDivisor(attr, 1);
+        }
+      }
+
+      void disable_instance_matrices() {
+        for (unsigned i = 0; i != 4; ++i) {
+          GLuint attr = attribute_instance_matrix + i;
+          glVertexAttribDivisor(attr, 0);
+          glDisableVertexAttribArray(attr);
+        }
+      }
+    #endif
+
+    // split the sorted items into runs and gather the matrices of the instanced runs.
+    void make_batches() {
+      batches.resize(0);
+      instance_matrices.resize(0);
+      for (unsigned i = 0; i != items.size(); ) {
+        mesh *msh = items[i].msh;
+        material *mat = items[i].mat;
+        unsigned j = i + 1;
+        // skinned draws have their own matrices and are always drawn one at a time.
+        while (items[i].skin_offset == -1 && j != items.size() && items[j].msh == msh && items[j].mat == mat && items[j].skin_offset == -1) {
+          ++j;
+        }
+
+        batch b;
+        b.first = i;
+        b.count = j - i;
+        b.instance_offset = -1;
+        #if OCTET_INSTANCING
+          if (instancing && b.count >= min_instances && gl_features::get().has_instancing() && mat->can_instance()) {
+            b.instance_offset = (int)instance_matrices.size();
+            for (unsigned k = i; k != j; ++k) {
+              instance_matrices.push_back(*items[k].modelToWorld);
+            }
+          }
+        #endif
+        batches.push_back(b);
+        i = j;
+      }
+    }
+
+  public:
+    render_queue() {
+      instance_buffer = 0;
+      instancing = true;
+      num_draw_calls = 0;
+      num_material_changes = 0;
+      num_mesh_changes = 0;
+    }
+
+    ~render_queue() {
+      if (instance_buffer) {
+        glDeleteBuffers(1, &instance_buffer);
+      }
+    }
+
+    /// Start a new frame.
+    void reset() {
+      items.resize(0);
+      skin_matrices.resize(0);
+    }
+
+    /// Add a draw. Lower passes draw first. Within a pass, opaque objects draw nearest first
+    /// and blended ones after them, farthest first.
+    /// The matrix must stay valid until render().
+    void add(mesh *msh, material *mat, const mat4t &modelToWorld, float depth, unsigned pass=0) {
+      item it;
+      it.key = make_key(mat, msh, depth, pass);
+      it.msh = msh;
+      it.mat = mat;
+      it.modelToWorld = &modelToWorld;
+      it.skin_offset = -1;
+      it.num_bones = 0;
+      items.push_back(it);
+    }
+
+    /// Add a draw of a skinned mesh with its bone to camera matrices (see skeleton::calc_transforms).
+    /// The matrices are copied, so the skeleton can be used again before render().
+    void add_skinned(mesh *msh, material *mat, const mat4t *transforms, int num_bones, float depth, unsigned pass=0) {
+      item it;
+      it.key = make_key(mat, msh, depth, pass);
+      it.msh = msh;
+      it.mat = mat;
+      it.modelToWorld = NULL;
+      it.skin_offset = (int)skin_matrices.size();
+      it.num_bones = num_bones;
+      for (int i = 0; i != num_bones; ++i) {
+        skin_matrices.push_back(transforms[i]);
+      }
+      items.push_back(it);
+    }
+
+    /// Sort and draw everything added since reset().
+    void render(const camera_instance &cam, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      num_draw_calls = 0;
+      num_material_changes = 0;
+      num_mesh_changes = 0;
+      if (items.size() == 0) return;
+
+      std::sort(items.data(), items.data() + items.size());
+      make_batches();
+
+      #if OCTET_INSTANCING
+        if (instance_matrices.size()) {
+          if (!instance_buffer) {
+            glGenBuffers(1, &instance_buffer);
+          }
+          // a new store every frame so that we do not wait for the last frame's draws.
+          glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+          glBufferData(GL_ARRAY_BUFFER, instance_matrices.size() * sizeof(mat4t), instance_matrices.data(), GL_STREAM_DRAW);
+        }
+      #endif
+
+      mat4t worldToWorld;
+      worldToWorld.loadIdentity();
+      mat4t worldToProjection;
+      mat4t worldToCamera;
+      cam.get_matrices(worldToProjection, worldToCamera, worldToWorld);
+
+      material *bound_mat = NULL;
+      bool bound_instanced = false;
+      mesh *bound_mesh = NULL;
+
+      for (unsigned bi = 0; bi != batches.size(); ++bi) {
+        const batch &b = batches[bi];
+        mesh *msh = items[b.first].msh;
+        material *mat = items[b.first].mat;
+
+        if (msh != bound_mesh) {
+          if (bound_mesh) bound_mesh->disable_attributes();
+          msh->enable_attributes();
+          bound_mesh = msh;
+          num_mesh_changes++;
+        }
+
+        if (items[b.first].skin_offset != -1) {
+          const item &it = items[b.first];
+          if (it.num_bones) mat->render_skinned(cam.get_cameraToProjection(), skin_matrices.data() + it.skin_offset, it.num_bones, light_uniforms, num_light_uniforms, num_lights);
+          // render_skinned does not leave the material set up for render_matrices.
+          bound_mat = NULL;
+          msh->draw();
+          num_draw_calls++;
+          continue;
+        }
+
+        #if OCTET_INSTANCING
+          if (b.instance_offset != -1) {
+            if (mat != bound_mat || !bound_instanced) {
+              mat->render_instanced(worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
+              bound_mat = mat;
+              bound_instanced = true;
+              num_material_changes++;
+            }
+            enable_instance_matrices(b.instance_offset);
+            msh->draw_instanced(b.count);
+            disable_instance_matrices();
+            num_draw_calls++;
+            continue;
+          }
+        #endif
+
+        for (unsigned i = b.first; i != b.first + b.count; ++i) {
+          mat4t modelToProjection;
+          mat4t modelToCamera;
+          cam.get_matrices(modelToProjection, modelToCamera, *items[i].modelToWorld);
+          if (mat != bound_mat || bound_instanced) {
+            mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+            bound_mat = mat;
+            bound_instanced = false;
+            num_material_changes++;
+          } else {
+            mat->render_matrices(modelToProjection, modelToCamera);
+          }
+          msh->draw();
+          num_draw_calls++;
+        }
+      }
+
+      if (bound_mesh) bound_mesh->disable_attributes();
+    }
+
+    /// Use instanced draws where the driver has them (the default).
+    void set_instancing(bool value) {
+      instancing = value;
+    }
+
+    /// number of draws added since reset()
+    unsigned get_num_items() const {
+      return items.size();
+    }
+
+    /// number of glDraw* calls made by the last render()
+    unsigned get_num_draw_calls() const {
+      return num_draw_calls;
+    }
+
+    /// number of times the last render() set up a material
+    unsigned get_num_material_changes() const {
+      return num_material_changes;
+    }
+
+    /// number of times the last render() enabled a mesh's attributes
+    unsigned get_num_mesh_changes() const {
+      return num_mesh_changes;
+    }
+  };
+}}
@@ -23,6 +23,8 @@
 #include "../scene/camera_instance.h"
 #include "../scene/light_instance.h"
 #include "../scene/mesh_instance.h"
+#include "../scene/aabb_tree.h"
+#include "../scene/render_queue.h"
 #include "../scene/animation_instance.h"
 #include "../scene/visual_scene.h"
 #include "../scene/displacement_map.h"
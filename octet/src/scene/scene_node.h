@@ -27,6 +27,40 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // derived from the parents (not for saving): see calcModelToWorld()
+    mat4t nodeToWorld;
+    bool world_enabled;
+
+    // nodeToWorld and world_enabled need recalculating.
+    // If a node is dirty, so are all of its children.
+    bool world_dirty;
+
+    // counts the recalculations, see get_world_version()
+    unsigned world_version;
+
+    // the parent's transform or enabled state has changed: recalculate on the next read.
+    void mark_dirty() {
+      world_dirty = true;
+      for (unsigned i = 0; i != children.size(); ++i) {
+        scene_node *child = children[i];
+        if (!child->world_dirty) child->mark_dirty();
+      }
+    }
+
+    // recalculate the parents first, so each matrix is multiplied once.
+    void update_world() {
+      if (parent) {
+        if (parent->world_dirty) parent->update_world();
+        nodeToWorld = nodeToParent * parent->nodeToWorld;
+        world_enabled = enabled && parent->world_enabled;
+      } else {
+        nodeToWorld = nodeToParent;
+        world_enabled = enabled;
+      }
+      world_dirty = false;
+      world_version++;
+    }
+
   public:
     RESOURCE_META(scene_node)
 
@@ -35,6 +69,8 @@ namespace octet { namespace scene {
       nodeToParent.loadIdentity();
       sid = atom_;
       enabled = true;
+      world_dirty = true;
+      world_version = 0;
       if (parent) {
         parent->add_child(this);
       }
@@ -45,6 +81,8 @@ namespace octet { namespace scene {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
       enabled = true;
+      world_dirty = true;
+      world_version = 0;
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -61,6 +99,7 @@ namespace octet { namespace scene {
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
         nodeToParent.init_transpose(value);
+        mark_dirty();
       }
     }
 
@@ -73,6 +112,7 @@ namespace octet { namespace scene {
       //log("visit scene_node nodeToParent\n");
       v.visit(nodeToParent, atom_nodeToParent);
       v.visit(sid, atom_sid);
+      mark_dirty();
     }
 
 
@@ -80,6 +120,7 @@ namespace octet { namespace scene {
     void add_child(scene_node *new_node) {
       new_node->parent = this;
       children.push_back(new_node);
+      new_node->mark_dirty();
     }
 
     /// Get the parent node of this node.
@@ -97,21 +138,23 @@ namespace octet { namespace scene {
       return children[index];
     }
 
-    // compute the scene_node to world matrix for an individual scene_node;
-    mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
-      }
-      return result;
+    /// Get the scene_node to world matrix.
+    /// This is kept until this node or one of its parents moves, so calling it often is cheap.
+    const mat4t &calcModelToWorld() {
+      if (world_dirty) update_world();
+      return nodeToWorld;
+    }
+
+    /// Changes whenever calcModelToWorld() or calcEnabled() may have changed,
+    /// so that other caches can tell when to update. Call one of them first.
+    unsigned get_world_version() const {
+      return world_version;
     }
 
-    // calculate whether this node is enabled (recursively)
+    /// Return true if this node and all its parents are enabled. Cached like calcModelToWorld().
     bool calcEnabled() {
-      for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
-      }
-      return true;
+      if (world_dirty) update_world();
+      return world_enabled;
     }
 
     /// transform a point from model space to world space
@@ -134,7 +177,10 @@ namespace octet { namespace scene {
     }
 
     /// access the node to parent transform matrix for writing.
+    /// The world matrices of this node and its children are recalculated when they are next read,
+    /// so write to the matrix straight away rather than keeping the reference.
     mat4t &access_nodeToParent() {
+      mark_dirty();
       return nodeToParent;
     }
 
@@ -165,27 +211,34 @@ namespace octet { namespace scene {
 
     /// set enabled state
     void set_enabled(bool value) {
-      enabled = value;
+      if (value != enabled) {
+        enabled = value;
+        mark_dirty();
+      }
     }
 
     /// reset the matrix
     void loadIdentity() {
       nodeToParent.loadIdentity();
+      mark_dirty();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
       nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
       nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      mark_dirty();
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
       nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Get the identifying sid
@@ -207,7 +260,7 @@ namespace octet { namespace scene {
         parent_stack.pop_back();
         nodes.push_back(node);
         parents.push_back(parent);
-        for (int i = 0; i != node->children.size(); ++i) {
+        for (unsigned i = 0; i != node->children.size(); ++i) {
           stack.push_back(node->children[i]);
           parent_stack.push_back(new_parent);
         }
@@ -63,12 +63,12 @@ namespace octet { namespace scene {
       }
 
       // todo: optionally drive animation directly to the skeleton.
-      for (int i = 0; i != nodes.size(); ++i) {
+      for (unsigned i = 0; i != nodes.size(); ++i) {
         nodeToParents[i] = nodes[i]->access_nodeToParent();
       }
 
       // compute matrix heirachy
-      for (int i = 0; i != nodeToParents.size(); ++i) {
+      for (unsigned i = 0; i != nodeToParents.size(); ++i) {
         int parent = parents[i];
         // skeleton -> parent -> parent -> world -> camera
         if (parent == -1) {
@@ -106,7 +106,7 @@ namespace octet { namespace scene {
 
     // convert an sid into an index. (should be cached!)
     int get_bone_index(atom_t sid) {
-      for (int i = 0; i != joints.size(); ++i) {
+      for (unsigned i = 0; i != joints.size(); ++i) {
         if (joints[i] == sid) return i;
       }
       return -1;
@@ -27,6 +27,27 @@ namespace octet { namespace scene {
     /// lights available
     dynarray<ref<light_instance> > light_instances;
 
+    // world space box of a mesh instance, as it is in instance_tree
+    struct instance_bounds {
+      int leaf;                // -1 if the instance is not in the tree
+      unsigned world_version;  // see scene_node::get_world_version()
+      scene_node *node;
+      aabb local;
+    };
+
+    // mesh instances by bounding box, to find the ones in view quickly
+    aabb_tree instance_tree;
+    dynarray<instance_bounds> instance_boxes;
+
+    // skinned meshes and meshes with no bounding box are always drawn.
+    dynarray<unsigned> unbounded_instances;
+
+    // indices of the mesh instances in view
+    dynarray<unsigned> visible_instances;
+
+    // draws of the visible instances: opaque ones sorted by shader, material and mesh, then blended ones far to near
+    render_queue queue;
+
     /// set this to draw bounding boxes
     bool render_aabbs;
     bool render_debug_lines;
@@ -111,14 +132,82 @@ namespace octet { namespace scene {
     }
 
     void render_mesh_aabbs() {
-      for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
-        mesh_instance *mi = mesh_instances[mesh_index];
+      for (unsigned vis = 0; vis != visible_instances.size(); ++vis) {
+        mesh_instance *mi = mesh_instances[visible_instances[vis]];
         aabb bb = mi->get_mesh()->get_aabb();
         bb = bb.get_transform(mi->get_node()->calcModelToWorld());
         draw_aabb(bb);
       }
     }
 
+    static bool same_box(const aabb &a, const aabb &b) {
+      vec3 ac = a.get_center(), bc = b.get_center();
+      vec3 ah = a.get_half_extent(), bh = b.get_half_extent();
+      return ac.x() == bc.x() && ac.y() == bc.y() && ac.z() == bc.z() && ah.x() == bh.x() && ah.y() == bh.y() && ah.z() == bh.z();
+    }
+
+    // Bring instance_tree up to date with the mesh instances that have been added, moved or changed mesh.
+    // Nodes that have not moved cost a version check.
+    void update_instance_tree() {
+      if (instance_boxes.size() > mesh_instances.size()) {
+        // the scene has been reset.
+        instance_tree.reset();
+        instance_boxes.resize(0);
+      }
+      for (unsigned i = instance_boxes.size(); i != mesh_instances.size(); ++i) {
+        instance_bounds ib = { -1, 0, 0, aabb() };
+        instance_boxes.push_back(ib);
+      }
+
+      unbounded_instances.resize(0);
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        instance_bounds &ib = instance_boxes[i];
+        mesh *msh = mi ? mi->get_mesh() : 0;
+        scene_node *node = mi ? mi->get_node() : 0;
+        if (!msh || !node) continue;
+
+        // skinned meshes move away from their bind pose boxes.
+        aabb local = msh->get_aabb();
+        vec3 half = local.get_half_extent();
+        if ((mi->get_skeleton() && msh->get_skin()) || (half.x() == 0 && half.y() == 0 && half.z() == 0)) {
+          if (ib.leaf != -1) {
+            instance_tree.remove(ib.leaf);
+            ib.leaf = -1;
+          }
+          unbounded_instances.push_back(i);
+          continue;
+        }
+
+        const mat4t &modelToWorld = node->calcModelToWorld();
+        unsigned version = node->get_world_version();
+        if (ib.leaf == -1 || ib.node != node || ib.world_version != version || !same_box(ib.local, local)) {
+          aabb bb = local.get_transform(modelToWorld);
+          if (ib.leaf == -1) {
+            ib.leaf = instance_tree.insert(bb, i);
+          } else {
+            instance_tree.move(ib.leaf, bb);
+          }
+          ib.node = node;
+          ib.world_version = version;
+          ib.local = local;
+        }
+      }
+    }
+
+    // find the mesh instances that the camera can see.
+    void find_visible_instances(camera_instance &cam) {
+      update_instance_tree();
+
+      vec4 planes[6];
+      cam.get_frustum_planes(planes);
+      visible_instances.resize(0);
+      instance_tree.cull(visible_instances, planes, 6);
+      for (unsigned i = 0; i != unbounded_instances.size(); ++i) {
+        visible_instances.push_back(unbounded_instances[i]);
+      }
+    }
+
     void render_debug_line_buffer() {
       glBindBuffer(GL_ARRAY_BUFFER, 0);
       glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 12, (void*)debug_line_buffer.data() );
@@ -190,12 +279,16 @@ namespace octet { namespace scene {
       calc_lighting(worldToCamera);
 
       cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
-      mat4t cameraToProjection = cam.get_cameraToProjection();
+
+      find_visible_instances(cam);
 
       draw_debug_data(cam);
 
-      for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
-        mesh_instance *mi = mesh_instances[mesh_index];
+      queue.reset();
+      bool any_selected = false;
+
+      for (unsigned vis = 0; vis != visible_instances.size(); ++vis) {
+        mesh_instance *mi = mesh_instances[visible_instances[vis]];
 
         scene_node *node = mi->get_node();
         unsigned flags = mi->get_flags();
@@ -210,15 +303,15 @@ namespace octet { namespace scene {
         skeleton *skel = mi->get_skeleton();
         material *mat = mi->get_material();
 
-        mat4t modelToWorld = node->calcModelToWorld();
+        const mat4t &modelToWorld = node->calcModelToWorld();
         mat4t modelToCamera;
         mat4t modelToProjection;
         cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
         //printf("%d %f\n", mesh_index, modelToWorld.w().y());
+        float distance = -modelToCamera.w().z();
 
         // selecting LOD meshes by distance
         if (flags & mesh_instance::flag_lod) {
-          float distance = -modelToCamera.w().z();
           //printf("%f %f %f\n", distance, mi->get_min_draw_distance(), mi->get_max_draw_distance());
           if (
             distance < mi->get_min_draw_distance() ||
@@ -228,11 +321,12 @@ namespace octet { namespace scene {
           }
         }
 
+        any_selected |= (flags & mesh_instance::flag_selected) != 0;
+
         if (!skel || !skn) {
-          /// normal rendering for single matrix objects
-          /// build a projection matrix: model -> world -> camera_instance -> projection
-          /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          /// normal rendering for single matrix objects goes in the render queue
+          /// which sorts by shader, material and mesh and instances repeated meshes.
+          queue.add(msh, mat, modelToWorld, distance);
         } else {
           /// multi-matrix rendering
           mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
@@ -241,23 +335,34 @@ namespace octet { namespace scene {
             GLint mvuv = 0;
             //glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &mvuv);
             printf("warning: too many bones (%d/%d)\n", num_bones, mvuv/4);
-          } else {
-            mat->render_skinned(cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
+            num_bones = 0;
           }
-        }
 
-        /*if (true) {
-          static bool dumped;
-          if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
-        }*/
-        msh->enable_attributes();
-        msh->draw();
-        msh->disable_attributes();
+          /*if (true) {
+            static bool dumped;
+            if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
+          }*/
+          /// skinned draws go in the queue too, so that blended ones are drawn in depth order with the rest.
+          queue.add_skinned(msh, mat, transforms, num_bones, distance);
+        }
+      }
 
-        if (mi->get_flags() & mesh_instance::flag_selected) {
-          aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(mi->get_node()->calcModelToWorld());
-          draw_aabb(bb);
+      queue.render(cam, light_uniforms, num_light_uniforms, num_lights);
+
+      if (any_selected) {
+        // selected instances get their bounding box drawn in world space
+        mat4t worldToWorld;
+        worldToWorld.loadIdentity();
+        mat4t worldToProjection;
+        cam.get_matrices(worldToProjection, worldToCamera, worldToWorld);
+        debug_material->render(worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
+        for (unsigned vis = 0; vis != visible_instances.size(); ++vis) {
+          mesh_instance *mi = mesh_instances[visible_instances[vis]];
+          if (mi->get_flags() & mesh_instance::flag_selected) {
+            aabb bb = mi->get_mesh()->get_aabb();
+            bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+            draw_aabb(bb);
+          }
         }
       }
       frame_number++;
@@ -275,7 +380,7 @@ namespace octet { namespace scene {
       render_debug_lines = false;
       debug_material = new material(vec4(1, 0, 0, 1));
       debug_line_buffer.resize(256);
-      assert(is_power_of_two(debug_line_buffer.size()));
+      assert(is_power_of_two((unsigned)debug_line_buffer.size()));
       memset(&debug_line_buffer[0], 0, debug_line_buffer.size() * sizeof(debug_line_buffer[0]));
       debug_in_ptr = 0;
 
@@ -482,6 +587,16 @@ namespace octet { namespace scene {
       return (int)mesh_instances.size();
     }
 
+    /// how many mesh instances were in view at the last render?
+    int get_num_visible_mesh_instances() {
+      return (int)visible_instances.size();
+    }
+
+    /// the render queue, for draw call statistics and to turn instancing off.
+    render_queue &get_render_queue() {
+      return queue;
+    }
+
     /// how many camera_instances do we have?
     int get_num_camera_instances() {
       return (int)camera_instances.size();
@@ -536,19 +651,22 @@ namespace octet { namespace scene {
           btCollisionObject *co = array[i];
           scene_node *node = (scene_node *)co->getUserPointer();
           if (node) {
-            mat4t &mat = node->access_nodeToParent();
+            // only moving objects dirty their world matrices.
+            mat4t mat;
             co->getWorldTransform().getOpenGLMatrix(mat.get());
-            //printf("%d %f\n", i, mat.w().y());
+            if (memcmp(&mat, &node->get_nodeToParent(), sizeof(mat))) {
+              node->access_nodeToParent() = mat;
+            }
           }
         }
       #endif
 
-      for (int idx = 0; idx != animation_instances.size(); ++idx) {
+      for (unsigned idx = 0; idx != animation_instances.size(); ++idx) {
         animation_instance *inst = animation_instances[idx];
         inst->update(delta_time);
       }
 
-      for (int idx = 0; idx != mesh_instances.size(); ++idx) {
+      for (unsigned idx = 0; idx != mesh_instances.size(); ++idx) {
         mesh_instance *inst = mesh_instances[idx];
         inst->update(delta_time);
       }
@@ -582,7 +700,7 @@ namespace octet { namespace scene {
 
     /// find a mesh instance for a node
     mesh_instance *get_first_mesh_instance(scene_node *node) {
-      for (int i = 0; i != mesh_instances.size(); ++i) {
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
         mesh_instance *mi = mesh_instances[i];
         if (mi && mi->get_node() == node) {
           return mi;
@@ -595,7 +713,7 @@ namespace octet { namespace scene {
     aabb get_world_aabb() {
       aabb world_aabb;
       bool first = true;
-      for (int i = 0; i != mesh_instances.size(); ++i) {
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
         mesh_instance *mi = mesh_instances[i];
         if (mi && mi->get_node()) {
           mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
@@ -617,35 +735,42 @@ namespace octet { namespace scene {
       rational depth;
     };
 
-    /// brute force & ignorance ray cast.
+    /// ray cast: the bounding box tree finds the instances, then their triangles are tested.
     /// return the mesh instance and location of hits.
-    /// todo: build a kd tree for mesh instance bbs & mesh triangles
+    /// todo: build a kd tree for mesh triangles
     void cast_ray(cast_result &result, const ray &the_ray) {
       result.mi = 0;
       result.depth = rational(0, 0);
 
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          mesh *mesh = mi->get_mesh();
-          aabb bb = mesh->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (the_ray.intersects(bb)) {
-            mat4t worldToNode = nodeToWorld.inverse3x4();
-            //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
-            ray model_ray = the_ray.get_transform(worldToNode);
-            int indices[3] = {0};
-            vec4 bary_numer(0, 0, 0, 0);
-            float bary_denom;
-            bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
-            if (hit) {
-              rational depth(bary_numer.w() / bary_denom);
-              result.depth = min(depth, result.depth);
-            }
-            //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
-          }
+      update_instance_tree();
+      instance_tree.cast_ray(the_ray, [&](unsigned i) { cast_ray_instance(result, the_ray, i); });
+      for (unsigned i = 0; i != unbounded_instances.size(); ++i) {
+        cast_ray_instance(result, the_ray, unbounded_instances[i]);
+      }
+    }
+
+    /// ray cast against one mesh instance.
+    void cast_ray_instance(cast_result &result, const ray &the_ray, unsigned i) {
+      mesh_instance *mi = mesh_instances[i];
+      if (!mi || !mi->get_node()) return;
+
+      mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
+      mesh *mesh = mi->get_mesh();
+      aabb bb = mesh->get_aabb();
+      bb = bb.get_transform(nodeToWorld);
+      if (the_ray.intersects(bb)) {
+        mat4t worldToNode = nodeToWorld.inverse3x4();
+        //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
+        ray model_ray = the_ray.get_transform(worldToNode);
+        int indices[3] = {0};
+        vec4 bary_numer(0, 0, 0, 0);
+        float bary_denom;
+        bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
+        if (hit) {
+          rational depth(bary_numer.w() / bary_denom);
+          result.depth = min(depth, result.depth);
         }
+        //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
       }
     }
 
@@ -29,6 +29,10 @@ namespace octet { namespace shaders {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      // slots 10-13 are beyond the eight attributes that OpenGLES2 promises.
+      if (gl_features::get().has_instancing()) {
+        glBindAttribLocation(program, attribute_instance_matrix, "instanceToWorld");
+      }
       glLinkProgram(program);
 
       program_ = program;